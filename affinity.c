@@ -0,0 +1,232 @@
+/*	$OpenBSD$ */
+/*
+ * Copyright (c) 2026 Marc Espie.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE OPENBSD PROJECT AND CONTRIBUTORS
+ * ``AS IS'' AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ * LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR
+ * A PARTICULAR PURPOSE ARE DISCLAIMED.  IN NO EVENT SHALL THE OPENBSD
+ * PROJECT OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+ * SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT
+ * LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+ * DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+ * THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+ * OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+
+#if defined(HAS_AFFINITY) && !defined(_GNU_SOURCE)
+#define _GNU_SOURCE	/* for the cpu_set_t interface */
+#endif
+#include <sys/types.h>
+#include <ctype.h>
+#include <dirent.h>
+#include <limits.h>
+#include <sched.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "config.h"
+#include "defines.h"
+#include "affinity.h"
+#include "var.h"
+#include "memory.h"
+#include "error.h"
+
+#ifdef HAS_AFFINITY
+#define NODE_DIR	"/sys/devices/system/node"
+
+static bool pinned = false;
+static cpu_set_t own;		/* what make itself runs on */
+static cpu_set_t *slot_set;	/* indexed by slot-1 */
+static int nslots;
+
+static int read_nodes(cpu_set_t **);
+static bool parse_cpulist(const char *, cpu_set_t *);
+static int nth_cpu(const cpu_set_t *, int);
+
+/* the kernel's format: 0-3,8,10-11 */
+static bool
+parse_cpulist(const char *s, cpu_set_t *set)
+{
+	char *e;
+	long a, b;
+
+	CPU_ZERO(set);
+	while (isdigit((unsigned char)*s)) {
+		a = b = strtol(s, &e, 10);
+		if (*e == '-')
+			b = strtol(e+1, &e, 10);
+		for (; a <= b && a < CPU_SETSIZE; a++)
+			CPU_SET(a, set);
+		s = e;
+		if (*s == ',')
+			s++;
+	}
+	return *s == '\0' || *s == '\n';
+}
+
+/* the NUMA nodes, restricted to the CPUs we may use */
+static int
+read_nodes(cpu_set_t **nodes)
+{
+	DIR *d;
+	struct dirent *e;
+	FILE *f;
+	char name[PATH_MAX], line[4096];
+	int n = 0, max = 0;
+	cpu_set_t set;
+
+	*nodes = NULL;
+	if ((d = opendir(NODE_DIR)) == NULL)
+		return 0;
+	while ((e = readdir(d)) != NULL) {
+		if (strncmp(e->d_name, "node", 4) != 0 ||
+		    !isdigit((unsigned char)e->d_name[4]))
+			continue;
+		(void)snprintf(name, sizeof name, "%s/%s/cpulist", NODE_DIR,
+		    e->d_name);
+		if ((f = fopen(name, "r")) == NULL)
+			continue;
+		if (fgets(line, sizeof line, f) != NULL &&
+		    parse_cpulist(line, &set)) {
+			CPU_AND(&set, &set, &own);
+			if (CPU_COUNT(&set) != 0) {
+				if (n == max) {
+					max = max == 0 ? 4 : max * 2;
+					*nodes = ereallocarray(*nodes, max,
+					    sizeof(cpu_set_t));
+				}
+				(*nodes)[n++] = set;
+			}
+		}
+		fclose(f);
+	}
+	closedir(d);
+	return n;
+}
+
+/* the cpu number of the ith cpu in set */
+static int
+nth_cpu(const cpu_set_t *set, int i)
+{
+	int cpu;
+
+	for (cpu = 0; cpu < CPU_SETSIZE; cpu++)
+		if (CPU_ISSET(cpu, set) && i-- == 0)
+			return cpu;
+	return -1;
+}
+
+void
+Affinity_Init(int slots)
+{
+	const char *s = Var_Value("AFFINITY");
+	cpu_set_t *nodes;
+	bool by_node, packed;
+	int nnodes, ncpus, i, k, cpu;
+
+	if (s == NULL || slot_set != NULL)
+		return;
+	by_node = strncmp(s, "node", 4) == 0;
+	if (!by_node && strncmp(s, "cpu", 3) != 0) {
+		Error("AFFINITY: unknown policy %s", s);
+		return;
+	}
+	packed = strstr(s, "packed") != NULL;
+	if (sched_getaffinity(0, sizeof own, &own) == -1)
+		return;
+	nnodes = read_nodes(&nodes);
+	if (nnodes == 0) {
+		/* no NUMA information: a single node */
+		nodes = emalloc(sizeof(cpu_set_t));
+		nodes[0] = own;
+		nnodes = 1;
+	}
+	ncpus = CPU_COUNT(&own);
+	nslots = slots;
+	slot_set = ereallocarray(NULL, slots, sizeof(cpu_set_t));
+	for (i = 0; i < slots; i++) {
+		CPU_ZERO(&slot_set[i]);
+		if (by_node) {
+			k = packed ? i * nnodes / slots : i % nnodes;
+			slot_set[i] = nodes[k];
+			continue;
+		}
+		if (packed) {
+			/* the cpus in node order */
+			for (k = 0, cpu = i % ncpus; k < nnodes; k++) {
+				if (cpu < CPU_COUNT(&nodes[k]))
+					break;
+				cpu -= CPU_COUNT(&nodes[k]);
+			}
+			cpu = k == nnodes ? -1 : nth_cpu(&nodes[k], cpu);
+		} else {
+			/* one from each node in turn */
+			k = i % nnodes;
+			cpu = nth_cpu(&nodes[k],
+			    i / nnodes % CPU_COUNT(&nodes[k]));
+		}
+		if (cpu == -1)
+			slot_set[i] = own;
+		else
+			CPU_SET(cpu, &slot_set[i]);
+	}
+	free(nodes);
+}
+
+void
+Affinity_Enter(int slot)
+{
+	char buf[12];
+
+	if (slot_set == NULL || slot < 1 || slot > nslots)
+		return;
+	/* the calling thread only: children inherit it */
+	if (sched_setaffinity(0, sizeof(cpu_set_t), &slot_set[slot-1]) == -1)
+		return;
+	pinned = true;
+	(void)snprintf(buf, sizeof buf, "%d", slot);
+	esetenv("MAKE_JOB_SLOT", buf);
+	(void)snprintf(buf, sizeof buf, "%d", CPU_COUNT(&slot_set[slot-1]));
+	esetenv("MAKE_JOB_CPUS", buf);
+}
+
+void
+Affinity_Leave(void)
+{
+	if (!pinned)
+		return;
+	(void)sched_setaffinity(0, sizeof own, &own);
+	unsetenv("MAKE_JOB_SLOT");
+	unsetenv("MAKE_JOB_CPUS");
+	pinned = false;
+}
+#else
+void
+Affinity_Init(int slots UNUSED)
+{
+}
+
+void
+Affinity_Enter(int slot UNUSED)
+{
+}
+
+void
+Affinity_Leave(void)
+{
+}
+#endif
@@ -0,0 +1,50 @@
+#ifndef AFFINITY_H
+#define AFFINITY_H
+/*	$OpenBSD$ */
+
+/*
+ * Copyright (c) 2026 Marc Espie.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE OPENBSD PROJECT AND CONTRIBUTORS
+ * ``AS IS'' AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ * LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR
+ * A PARTICULAR PURPOSE ARE DISCLAIMED.  IN NO EVENT SHALL THE OPENBSD
+ * PROJECT OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+ * SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT
+ * LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+ * DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+ * THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+ * OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+/* CPU placement of jobs: AFFINITY pins each job slot to a set of CPUs,
+ * either a whole NUMA node (node) or a single CPU (cpu), handing them
+ * out round-robin, or filling one node after the other with packed.
+ * Jobs find their slot number in MAKE_JOB_SLOT, and how many CPUs they
+ * may use in MAKE_JOB_CPUS.
+ * This needs HAS_AFFINITY, and is ignored otherwise.
+ */
+
+/* Affinity_Init(slots);
+ *	compute the CPU sets for job slots 1 to slots. */
+extern void Affinity_Init(int);
+
+/* Affinity_Enter(slot);
+ *	processes started from now on belong to that slot. */
+extern void Affinity_Enter(int);
+
+/* Affinity_Leave();
+ *	back to make's own placement. */
+extern void Affinity_Leave(void);
+
+#endif
@@ -67,9 +67,15 @@
  * headers are read and hashed and the archive closed again. All hashed
  * archives are kept in a hash (archives) which is searched each time
  * an archive member is referenced.
- *
+ *	Each header is read at its own offset, so that going from one
+ * header to the next doesn't read the members themselves.  If
+ * MAKEDIRCACHE names a directory, the list of members gets saved there
+ * too, keyed by device and inode, and validated by size and mtime:
+ * later makes don't even have to walk the headers.
  */
 
+#include <sys/mman.h>
+#include <sys/stat.h>
 #include <ar.h>
 #include <assert.h>
 #include <ctype.h>
@@ -80,6 +86,7 @@
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <time.h>
 #include <unistd.h>
 #include <ohash.h>
 #include "config.h"
@@ -91,6 +98,8 @@
 #include "var.h"
 #include "targ.h"
 #include "memory.h"
+#include "str.h"
+#include "hash.h"
 #include "gnode.h"
 #include "timestamp.h"
 #include "lst.h"
@@ -109,10 +118,14 @@
 #endif
 
 static struct ohash archives;	/* Archives we've already examined.  */
+static const char *archcache;	/* MAKEDIRCACHE */
+static LIST touched;		/* Archives with members to touch.  */
+static pid_t touch_pid;		/* ... written back by that process */
 
 typedef struct Arch_ {
 	struct ohash members;	/* All the members of this archive, as
 				 * struct arch_member entries.  */
+	bool touched;		/* some members wait for Arch_Touch */
 	char name[1];		/* Archive name. */
 } Arch;
 
@@ -127,6 +140,7 @@ struct arch_member {
 	struct timespec mtime;		/* Member modification date.  */
 	char date[AR_DATE_SIZE+1];	/* Same, before conversion to numeric
 					 * value.  */
+	bool touched;			/* date must be written back */
 	char name[1];			/* Member name.  */
 };
 
@@ -139,16 +153,32 @@ static struct ohash_info arch_info = {
 	offsetof(Arch, name), NULL, hash_calloc, hash_free, element_alloc
 };
 
+/* file layout: this header, then the members, each one as its ar_date
+ * field followed by its NUL-terminated name */
+#define ARCHCACHE_MAGIC	"mkarch1"
+struct archcache_header {
+	char magic[8];
+	uint64_t dev;
+	uint64_t ino;
+	int64_t size;
+	int64_t sec;		/* archive mtime */
+	int64_t nsec;
+};
 
 
-static struct arch_member *new_arch_member(struct ar_hdr *, const char *);
+static struct arch_member *new_arch_member(const char *, const char *);
 static struct timespec mtime_of_member(struct arch_member *);
 static long field2long(const char *, size_t);
+static bool walk_archive(Arch *, int, off_t, bool);
+static Arch *find_archive(const char *, bool);
+static struct arch_member *find_member(Arch *, const char *);
 static Arch *read_archive(const char *, const char *);
+static char *archcache_name(const struct stat *);
+static bool load_archcache(Arch *, const struct stat *);
+static void save_archcache(Arch *, const struct stat *);
 
 static struct timespec ArchMTimeMember(const char *, const char *, bool);
 static FILE *ArchFindMember(const char *, const char *, struct ar_hdr *, const char *);
-static void ArchTouch(const char *, const char *);
 #if defined(__svr4__) || defined(__SVR4) || \
     (defined(__OpenBSD__) && defined(__ELF__))
 #define SVR4ARCHIVES
@@ -164,19 +194,21 @@ struct SVR4namelist {
 #ifdef SVR4ARCHIVES
 static const char *svr4list = "Archive list";
 
-static char *ArchSVR4Entry(struct SVR4namelist *, const char *, size_t, FILE *);
+static char *ArchSVR4Entry(struct SVR4namelist *, const char *, size_t, FILE *,
+    int, off_t);
 #endif
 
 static struct arch_member *
-new_arch_member(struct ar_hdr *hdr, const char *name)
+new_arch_member(const char *date, const char *name)
 {
 	const char *end = NULL;
 	struct arch_member *n;
 
 	n = ohash_create_entry(&members_info, name, &end);
 	/* XXX ar entries are NOT null terminated.	*/
-	memcpy(n->date, &(hdr->ar_date), AR_DATE_SIZE);
+	memcpy(n->date, date, AR_DATE_SIZE);
 	n->date[AR_DATE_SIZE] = '\0';
+	n->touched = false;
 	/* Don't compute mtime before it is needed. */
 	ts_set_out_of_date(n->mtime);
 	return n;
@@ -371,34 +403,22 @@ field2long(const char *field, size_t length)
 	return strtol(enough, NULL, 10);
 }
 
-static Arch *
-read_archive(const char *archive, const char *earchive)
+/* Walk the headers with pread(2): stdio would fill a whole buffer
+ * after each seek, and mapping the archive faults in member pages
+ * around each header.
+ * With touch, we don't record members, we write back the dates of
+ * the touched ones.
+ * Returns false if the archive is bogus.  */
+static bool
+walk_archive(Arch *ar, int fd, off_t len, bool touch)
 {
-	FILE *arch;       /* Stream to archive */
-	char magic[SARMAG];
-	Arch *ar;
+	off_t pos = SARMAG, hdrpos;
 	struct SVR4namelist list;
+	bool ok = false;
 
 	list.fnametab = NULL;
 
-	/* When we encounter an archive for the first time, we read its
-	 * whole contents, to place it in the cache.  */
-	arch = fopen(archive, "r");
-	if (arch == NULL)
-		return NULL;
-
-	/* Make sure this is an archive we can handle.  */
-	if ((fread(magic, SARMAG, 1, arch) != 1) ||
-	    (strncmp(magic, ARMAG, SARMAG) != 0)) {
-		fclose(arch);
-		return NULL;
-	}
-
-	ar = ohash_create_entry(&arch_info, archive, &earchive);
-	ohash_init(&ar->members, 8, &members_info);
-
 	for (;;) {
-		size_t n;
 		struct ar_hdr arHeader;	/* Archive-member header */
 		off_t size;		/* Size of archive member */
 		char buffer[PATH_MAX];
@@ -406,97 +426,265 @@ read_archive(const char *archive, const char *earchive)
 		char *cp;
 
 		memberName = buffer;
-		n = fread(&arHeader, 1, sizeof(struct ar_hdr), arch);
 
 		/*  Whole archive read ok.  */
-		if (n == 0 && feof(arch)) {
-			free(list.fnametab);
-			fclose(arch);
-			return ar;
+		if (pos >= len) {
+			ok = true;
+			break;
 		}
-		if (n < sizeof(struct ar_hdr))
+		if (pread(fd, &arHeader, sizeof(arHeader), pos) !=
+		    sizeof(arHeader))
 			break;
+		hdrpos = pos;
+		pos += sizeof(struct ar_hdr);
 
-		if (memcmp(arHeader.ar_fmag, ARFMAG, sizeof(arHeader.ar_fmag))
-		    != 0) {
+		if (memcmp(arHeader.ar_fmag, ARFMAG,
+		    sizeof(arHeader.ar_fmag)) != 0)
 			/* header is bogus.  */
 			break;
-		} else {
-			/* We need to advance the stream's pointer to the start
-			 * of the next header.  Records are padded with
-			 * newlines to an even-byte boundary, so we need to
-			 * extract the size of the record and round it up
-			 * during the seek.  */
-			size = (off_t) field2long(arHeader.ar_size,
-			    sizeof(arHeader.ar_size));
-
-			(void)memcpy(memberName, arHeader.ar_name,
-			    AR_NAME_SIZE);
-			/* Find real end of name (strip extranous ' ')  */
-			for (cp = memberName + AR_NAME_SIZE - 1; *cp == ' ';)
-				cp--;
-			cp[1] = '\0';
+		/* Records are padded with newlines to an even-byte
+		 * boundary.  */
+		size = (off_t) field2long(arHeader.ar_size,
+		    sizeof(arHeader.ar_size));
+		if (size < 0)
+			break;
+
+		(void)memcpy(memberName, arHeader.ar_name, AR_NAME_SIZE);
+		/* Find real end of name (strip extranous ' ')  */
+		for (cp = memberName + AR_NAME_SIZE - 1; *cp == ' ';)
+			cp--;
+		cp[1] = '\0';
 
 #ifdef SVR4ARCHIVES
-			/* SVR4 names are slash terminated.  Also svr4 extended
-			 * AR format.
-			 */
-			if (memberName[0] == '/') {
-				/* SVR4 magic mode.  */
-				memberName = ArchSVR4Entry(&list, memberName,
-				    size, arch);
-				if (memberName == NULL)
-					/* Invalid data */
-					break;
-				else if (memberName == svr4list)
-					/* List of files entry */
-					continue;
-				/* Got the entry.  */
-				/* XXX this assumes further processing, such as
-				 * AR_EFMT1, also applies to SVR4ARCHIVES.  */
-			}
-			else {
-				if (cp[0] == '/')
-					cp[0] = '\0';
+		/* SVR4 names are slash terminated.  Also svr4 extended
+		 * AR format.
+		 */
+		if (memberName[0] == '/') {
+			/* SVR4 magic mode.  */
+			memberName = ArchSVR4Entry(&list, memberName,
+			    size, NULL, fd, pos);
+			if (memberName == NULL)
+				/* Invalid data */
+				break;
+			else if (memberName == svr4list) {
+				/* List of files entry */
+				pos += size;
+				continue;
 			}
+			/* Got the entry.  */
+			/* XXX this assumes further processing, such as
+			 * AR_EFMT1, also applies to SVR4ARCHIVES.  */
+		}
+		else {
+			if (cp[0] == '/')
+				cp[0] = '\0';
+		}
 #endif
 
 #ifdef AR_EFMT1
-			/* BSD 4.4 extended AR format: #1/<namelen>, with name
-			 * as the first <namelen> bytes of the file.  */
-			if (memcmp(memberName, AR_EFMT1, sizeof(AR_EFMT1) - 1)
-			    == 0 && ISDIGIT(memberName[sizeof(AR_EFMT1) - 1])) {
-
-				int elen = atoi(memberName +
-				    sizeof(AR_EFMT1)-1);
-
-				if (elen <= 0 || elen >= PATH_MAX)
-					break;
-				memberName = buffer;
-				if (fread(memberName, elen, 1, arch) != 1)
-					break;
-				memberName[elen] = '\0';
-				if (fseek(arch, -elen, SEEK_CUR) != 0)
-					break;
-				if (DEBUG(ARCH) || DEBUG(MAKE))
-					printf("ArchStat: Extended format entry for %s\n",
-					    memberName);
-			}
+		/* BSD 4.4 extended AR format: #1/<namelen>, with name
+		 * as the first <namelen> bytes of the file.  */
+		if (memcmp(memberName, AR_EFMT1, sizeof(AR_EFMT1) - 1)
+		    == 0 && ISDIGIT(memberName[sizeof(AR_EFMT1) - 1])) {
+
+			int elen = atoi(memberName +
+			    sizeof(AR_EFMT1)-1);
+
+			if (elen <= 0 || elen >= PATH_MAX)
+				break;
+			memberName = buffer;
+			if (pread(fd, memberName, elen, pos) != elen)
+				break;
+			memberName[elen] = '\0';
+			if (DEBUG(ARCH) || DEBUG(MAKE))
+				printf("ArchStat: Extended format entry for %s\n",
+				    memberName);
+		}
 #endif
 
+		if (touch) {
+			struct arch_member *mem;
+
+			/* all copies of the member, ArchFindMember only
+			 * touched the first one */
+			mem = ohash_find(&ar->members,
+			    hash_qlookup(&ar->members, memberName));
+			if (mem != NULL && mem->touched &&
+			    pwrite(fd, mem->date, AR_DATE_SIZE,
+			    hdrpos + offsetof(struct ar_hdr, ar_date)) !=
+			    AR_DATE_SIZE)
+				break;
+		} else
 			ohash_insert(&ar->members,
-			    ohash_qlookup(&ar->members, memberName),
-				new_arch_member(&arHeader, memberName));
-		}
-		if (fseek(arch, (size + 1) & ~1, SEEK_CUR) != 0)
+			    hash_qlookup(&ar->members, memberName),
+				new_arch_member(arHeader.ar_date, memberName));
+		if (((size + 1) & ~1) > len - pos) {
+			/* truncated last member, as good as the end */
+			ok = true;
 			break;
+		}
+		pos += (size + 1) & ~1;
 	}
 
-	fclose(arch);
-	ohash_delete(&ar->members);
 	free(list.fnametab);
-	free(ar);
-	return NULL;
+	return ok;
+}
+
+static Arch *
+read_archive(const char *archive, const char *earchive)
+{
+	struct stat st;
+	Arch *ar;
+	char magic[SARMAG];
+	bool ok;
+	int fd;
+
+	/* When we encounter an archive for the first time, we read all
+	 * its headers, to place it in the cache.  */
+	fd = open(archive, O_RDONLY | O_CLOEXEC);
+	if (fd == -1)
+		return NULL;
+	if (fstat(fd, &st) == -1 || !S_ISREG(st.st_mode) ||
+	    st.st_size < SARMAG) {
+		close(fd);
+		return NULL;
+	}
+
+	ar = ohash_create_entry(&arch_info, archive, &earchive);
+	ohash_init(&ar->members, 8, &members_info);
+	ar->touched = false;
+
+	if (archcache != NULL && load_archcache(ar, &st)) {
+		close(fd);
+		return ar;
+	}
+
+	/* Make sure this is an archive we can handle.  */
+	ok = pread(fd, magic, SARMAG, 0) == SARMAG &&
+	    memcmp(magic, ARMAG, SARMAG) == 0 &&
+	    walk_archive(ar, fd, st.st_size, false);
+	close(fd);
+	if (!ok) {
+		ohash_delete(&ar->members);
+		free(ar);
+		return NULL;
+	}
+	if (archcache != NULL)
+		save_archcache(ar, &st);
+	return ar;
+}
+
+static char *
+archcache_name(const struct stat *st)
+{
+	char *name;
+
+	if (asprintf(&name, "%s/a%llx.%llx", archcache,
+	    (unsigned long long)st->st_dev,
+	    (unsigned long long)st->st_ino) == -1)
+		return NULL;
+	return name;
+}
+
+static bool
+load_archcache(Arch *ar, const struct stat *st)
+{
+	struct archcache_header *h;
+	struct stat cst;
+	char *name, *s, *e, *end;
+	void *m;
+	int fd;
+
+	if ((name = archcache_name(st)) == NULL)
+		return false;
+	fd = open(name, O_RDONLY | O_CLOEXEC);
+	free(name);
+	if (fd == -1)
+		return false;
+	if (fstat(fd, &cst) == -1 || cst.st_size < (off_t)sizeof(*h)) {
+		close(fd);
+		return false;
+	}
+	m = mmap(NULL, cst.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+	close(fd);
+	if (m == MAP_FAILED)
+		return false;
+	h = m;
+	s = (char *)m + sizeof(*h);
+	end = (char *)m + cst.st_size;
+	if (memcmp(h->magic, ARCHCACHE_MAGIC, sizeof(h->magic)) != 0 ||
+	    h->dev != (uint64_t)st->st_dev || h->ino != (uint64_t)st->st_ino ||
+	    h->size != st->st_size ||
+	    h->sec != st->st_mtime || h->nsec != st->st_mtimensec ||
+	    (end != s && end[-1] != '\0')) {
+		munmap(m, cst.st_size);
+		return false;
+	}
+	/* each member is its date, then its name */
+	for (; s != end; s = e + 1) {
+		if (end - s <= (ptrdiff_t)AR_DATE_SIZE)
+			break;
+		e = strchr(s + AR_DATE_SIZE, '\0');
+		ohash_insert(&ar->members,
+		    hash_qlookup(&ar->members, s + AR_DATE_SIZE),
+		    new_arch_member(s, s + AR_DATE_SIZE));
+	}
+	munmap(m, cst.st_size);
+	if (s != end) {
+		ohash_delete(&ar->members);
+		ohash_init(&ar->members, 8, &members_info);
+		return false;
+	}
+	if (DEBUG(ARCH))
+		printf("Archive %s from %s\n", ar->name, archcache);
+	return true;
+}
+
+static void
+save_archcache(Arch *ar, const struct stat *st)
+{
+	struct archcache_header h;
+	struct arch_member *mem;
+	unsigned int i;
+	char *name, *tmp;
+	FILE *f;
+	int fd;
+
+	/* same rule as the directory cache: changes during the same second
+	 * might not show in the mtime */
+	if (st->st_mtime >= time(NULL) - 1)
+		return;
+	if ((name = archcache_name(st)) == NULL)
+		return;
+	tmp = Str_concat(name, ".XXXXXXXXXX", 0);
+	if ((fd = mkstemp(tmp)) == -1 || (f = fdopen(fd, "w")) == NULL) {
+		if (fd != -1) {
+			close(fd);
+			(void)unlink(tmp);
+		}
+		free(tmp);
+		free(name);
+		return;
+	}
+	memset(&h, 0, sizeof h);
+	memcpy(h.magic, ARCHCACHE_MAGIC, sizeof(h.magic));
+	h.dev = st->st_dev;
+	h.ino = st->st_ino;
+	h.size = st->st_size;
+	h.sec = st->st_mtime;
+	h.nsec = st->st_mtimensec;
+	fwrite(&h, sizeof h, 1, f);
+	for (mem = ohash_first(&ar->members, &i); mem != NULL;
+	    mem = ohash_next(&ar->members, &i)) {
+		fwrite(mem->date, AR_DATE_SIZE, 1, f);
+		fwrite(mem->name, strlen(mem->name) + 1, 1, f);
+	}
+	if (fclose(f) == 0)
+		(void)rename(tmp, name);
+	else
+		(void)unlink(tmp);
+	free(tmp);
+	free(name);
 }
 
 /*-
@@ -524,70 +712,83 @@ ArchMTimeMember(
 {
 	FILE *arch;     	/* Stream to archive */
 	Arch *ar;		/* Archive descriptor */
-	unsigned int slot;	/* Place of archive in the archives hash */
-	const char *end = NULL;
-	const char *cp;
+	struct arch_member *he;
 	struct timespec result;
 
 	ts_set_out_of_date(result);
-	/* Because of space constraints and similar things, files are archived
-	 * using their final path components, not the entire thing, so we need
-	 * to point 'member' to the final component, if there is one, to make
-	 * the comparisons easier...  */
-	cp = strrchr(member, '/');
-	if (cp != NULL)
-		member = cp + 1;
 
-	/* Try to find archive in cache.  */
-	slot = ohash_qlookupi(&archives, archive, &end);
-	ar = ohash_find(&archives, slot);
+	ar = find_archive(archive, hash);
+	/* If not found, and we don't want it.  */
+	if (ar == NULL && !hash) {
+		/* Quick path:  no need to hash the whole archive, just
+		 * use ArchFindMember to get the member's header and
+		 * close the stream again.  */
+		struct ar_hdr arHeader;
 
-	/* If not found, get it now.  */
-	if (ar == NULL) {
-		if (!hash) {
-			/* Quick path:  no need to hash the whole archive, just
-			 * use ArchFindMember to get the member's header and
-			 * close the stream again.  */
-			struct ar_hdr arHeader;
-
-			arch = ArchFindMember(archive, member, &arHeader, "r");
-
-			if (arch != NULL) {
-				fclose(arch);
-				ts_set_from_time_t(
-				    (time_t)strtol(arHeader.ar_date, NULL, 10),
-				    result);
-			}
-			return result;
+		arch = ArchFindMember(archive, member, &arHeader, "r");
+
+		if (arch != NULL) {
+			fclose(arch);
+			ts_set_from_time_t(
+			    (time_t)strtol(arHeader.ar_date, NULL, 10),
+			    result);
 		}
-		ar = read_archive(archive, end);
-		if (ar != NULL)
-			ohash_insert(&archives, slot, ar);
+		return result;
 	}
 
 	/* If archive was found, get entry we seek.  */
 	if (ar != NULL) {
-		struct arch_member *he;
-		end = NULL;
-
-		he = ohash_find(&ar->members, ohash_qlookupi(&ar->members,
-		    member, &end));
+		he = find_member(ar, member);
 		if (he != NULL)
 			return mtime_of_member(he);
-		else {
-			if ((size_t)(end - member) > AR_NAME_SIZE) {
-				/* Try truncated name.	*/
-				end = member + AR_NAME_SIZE;
-				he = ohash_find(&ar->members,
-				    ohash_qlookupi(&ar->members, member, &end));
-				if (he != NULL)
-					return mtime_of_member(he);
-			}
-		}
 	}
 	return result;
 }
 
+/* Find archive in cache.  If not found and hash, get it now.  */
+static Arch *
+find_archive(const char *archive, bool hash)
+{
+	Arch *ar;
+	unsigned int slot;
+	const char *end = NULL;
+
+	slot = hash_qlookupi(&archives, archive, &end);
+	ar = ohash_find(&archives, slot);
+	if (ar == NULL && hash) {
+		ar = read_archive(archive, end);
+		if (ar != NULL)
+			ohash_insert(&archives, slot, ar);
+	}
+	return ar;
+}
+
+static struct arch_member *
+find_member(Arch *ar, const char *member)
+{
+	struct arch_member *he;
+	const char *end = NULL;
+	const char *cp;
+
+	/* Because of space constraints and similar things, files are archived
+	 * using their final path components, not the entire thing, so we need
+	 * to point 'member' to the final component, if there is one, to make
+	 * the comparisons easier...  */
+	cp = strrchr(member, '/');
+	if (cp != NULL)
+		member = cp + 1;
+
+	he = ohash_find(&ar->members, hash_qlookupi(&ar->members,
+	    member, &end));
+	if (he == NULL && (size_t)(end - member) > AR_NAME_SIZE) {
+		/* Try truncated name.	*/
+		end = member + AR_NAME_SIZE;
+		he = ohash_find(&ar->members,
+		    hash_qlookupi(&ar->members, member, &end));
+	}
+	return he;
+}
+
 #ifdef SVR4ARCHIVES
 /*-
  *-----------------------------------------------------------------------
@@ -603,12 +804,14 @@ ArchMTimeMember(
  *	extended name
  *
  * Side-effect:
- *	For a list of names, store the list in l.
+ *	For a list of names, store the list in l.  The list is read
+ *	from arch if it's not NULL, from fd at offset pos otherwise.
  *-----------------------------------------------------------------------
  */
 
 static char *
-ArchSVR4Entry(struct SVR4namelist *l, const char *name, size_t size, FILE *arch)
+ArchSVR4Entry(struct SVR4namelist *l, const char *name, size_t size, FILE *arch,
+    int fd, off_t pos)
 {
 #define ARLONGNAMES1 "/"
 #define ARLONGNAMES2 "ARFILENAMES"
@@ -631,7 +834,8 @@ ArchSVR4Entry(struct SVR4namelist *l, const char *name, size_t size, FILE *arch)
 		l->fnametab = emalloc(size);
 		l->fnamesize = size;
 
-		if (fread(l->fnametab, size, 1, arch) != 1) {
+		if (arch != NULL ? fread(l->fnametab, size, 1, arch) != 1 :
+		    pread(fd, l->fnametab, size, pos) != (ssize_t)size) {
 			if (DEBUG(ARCH))
 				printf("Reading an SVR4 name table failed\n");
 			return NULL;
@@ -776,7 +980,7 @@ ArchFindMember(
 		if (memberName[0] == '/') {
 			/* svr4 magic mode.  */
 			memberName = ArchSVR4Entry(&list, arHeaderPtr->ar_name,
-			    size, arch);
+			    size, arch, -1, 0);
 			if (memberName == NULL)
 				/* Invalid data */
 				break;
@@ -831,19 +1035,29 @@ ArchFindMember(
 	return NULL;
 }
 
-static void
-ArchTouch(const char *archive, const char *member)
+void
+Arch_FlushTouches(void)
 {
-	FILE *arch;
-	struct ar_hdr arHeader;
-
-	arch = ArchFindMember(archive, member, &arHeader, "r+");
-	if (arch != NULL) {
-		snprintf(arHeader.ar_date, sizeof(arHeader.ar_date),
-		    "%-12ld", (long) time(NULL));
-		if (fseek(arch, -sizeof(struct ar_hdr), SEEK_CUR) == 0)
-			(void)fwrite(&arHeader, sizeof(struct ar_hdr), 1, arch);
-		fclose(arch);
+	Arch *ar;
+	struct arch_member *mem;
+	struct stat st;
+	unsigned int i;
+	int fd;
+
+	/* forked children don't get a say */
+	if (getpid() != touch_pid)
+		return;
+	while ((ar = Lst_DeQueue(&touched)) != NULL) {
+		fd = open(ar->name, O_RDWR | O_CLOEXEC);
+		if (fd != -1) {
+			if (fstat(fd, &st) == 0)
+				(void)walk_archive(ar, fd, st.st_size, true);
+			close(fd);
+		}
+		for (mem = ohash_first(&ar->members, &i); mem != NULL;
+		    mem = ohash_next(&ar->members, &i))
+			mem->touched = false;
+		ar->touched = false;
 	}
 }
 
@@ -852,11 +1066,29 @@ ArchTouch(const char *archive, const char *member)
  *	The modification time of the entire archive is also changed.
  *	For a library, this could necessitate the re-ranlib'ing of the
  *	whole thing.
+ *	The in-memory date changes right away, but the archive is only
+ *	written by Arch_FlushTouches, so that touching many members of an
+ *	archive costs a single pass over it.
  */
 void
 Arch_Touch(GNode *gn)
 {
-	ArchTouch(Var(ARCHIVE_INDEX, gn), Var(MEMBER_INDEX, gn));
+	Arch *ar;
+	struct arch_member *mem;
+
+	ar = find_archive(Var(ARCHIVE_INDEX, gn), true);
+	if (ar == NULL)
+		return;
+	mem = find_member(ar, Var(MEMBER_INDEX, gn));
+	if (mem == NULL)
+		return;
+	snprintf(mem->date, sizeof(mem->date), "%-12ld", (long) time(NULL));
+	ts_set_out_of_date(mem->mtime);
+	mem->touched = true;
+	if (!ar->touched) {
+		ar->touched = true;
+		Lst_AtEnd(&touched, ar);
+	}
 }
 
 struct timespec
@@ -911,4 +1143,10 @@ void
 Arch_Init(void)
 {
 	ohash_init(&archives, 4, &arch_info);
+	Static_Lst_Init(&touched);
+	touch_pid = getpid();
+	atexit(Arch_FlushTouches);
+	archcache = getenv("MAKEDIRCACHE");
+	if (archcache != NULL && *archcache == '\0')
+		archcache = NULL;
 }
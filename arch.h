@@ -47,6 +47,10 @@ extern bool Arch_ParseArchive(const char **, Lst, SymTable *);
  *	Alter the modification time of the archive member described by node
  *	to the current time.  */
 extern void Arch_Touch(GNode *);
+/* Arch_FlushTouches();
+ *	Write back the dates of all touched members, one pass over each
+ *	archive.  Done along with Dir_FlushTouches, and on exit.  */
+extern void Arch_FlushTouches(void);
 /* stamp = Arch_MTime(node);
  *	Find the modification time of a member of an archive *in the
  *	archive*, and returns it.
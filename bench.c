@@ -0,0 +1,394 @@
+/*	$OpenBSD$ */
+/*
+ * Copyright (c) 2026 Marc Espie.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE OPENBSD PROJECT AND CONTRIBUTORS
+ * ``AS IS'' AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ * LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR
+ * A PARTICULAR PURPOSE ARE DISCLAIMED.  IN NO EVENT SHALL THE OPENBSD
+ * PROJECT OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+ * SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT
+ * LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+ * DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+ * THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+ * OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+/* Benchmarks: generate makefiles of typical shapes in a scratch
+ * directory, then time make on them, both under -n from scratch and
+ * once everything is built, and report the best run along with the
+ * maximum resident size.
+ *
+ * usage: makebench [-k] [-r runs] [-s scale] make [shape ...]
+ */
+
+#include <sys/resource.h>
+#include <sys/stat.h>
+#include <sys/time.h>
+#include <sys/wait.h>
+#include <err.h>
+#include <fcntl.h>
+#include <limits.h>
+#include <stdarg.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+static void gen_chain(FILE *, unsigned int);
+static void gen_fanin(FILE *, unsigned int);
+static void gen_words(FILE *, unsigned int);
+static void gen_for(FILE *, unsigned int);
+static void gen_suffixes(FILE *, unsigned int);
+static void gen_depends(FILE *, unsigned int);
+static void gen_path(FILE *, unsigned int);
+
+static struct shape {
+	const char *name;
+	void (*generate)(FILE *, unsigned int);
+	unsigned int size;	/* for scale 1 */
+} shapes[] = {
+	{ "chain", gen_chain, 2000 },		/* t0 <- t1 <- ... */
+	{ "fanin", gen_fanin, 10000 },		/* one link, lots of objects */
+	{ "words", gen_words, 20000 },		/* huge variables, modifiers */
+	{ "for", gen_for, 10000 },		/* big .for loops */
+	{ "suffixes", gen_suffixes, 3000 },	/* .w -> .x -> .y -> .z */
+	{ "depends", gen_depends, 2000 },	/* lots of included .d files */
+	{ "path", gen_path, 20000 },		/* huge .PATH directory */
+};
+
+#define NSHAPES	(sizeof(shapes) / sizeof(shapes[0]))
+
+struct result {
+	double real;
+	double cpu;
+	long maxrss;
+	int status;
+};
+
+static void
+create(const char *fmt, ...)
+{
+	char name[PATH_MAX];
+	va_list ap;
+	int fd;
+
+	va_start(ap, fmt);
+	(void)vsnprintf(name, sizeof name, fmt, ap);
+	va_end(ap);
+	fd = open(name, O_WRONLY|O_CREAT|O_TRUNC, 0666);
+	if (fd == -1)
+		err(1, "%s", name);
+	close(fd);
+}
+
+static void
+subdir(const char *name)
+{
+	if (mkdir(name, 0777) == -1)
+		err(1, "mkdir %s", name);
+}
+
+static void
+gen_chain(FILE *f, unsigned int n)
+{
+	unsigned int i;
+
+	fprintf(f, "all: t0\n");
+	for (i = 0; i < n; i++)
+		fprintf(f, "t%u: t%u\n\t@touch ${.TARGET}\n", i, i+1);
+	fprintf(f, "t%u:\n\t@touch ${.TARGET}\n", n);
+}
+
+static void
+gen_fanin(FILE *f, unsigned int n)
+{
+	unsigned int i;
+
+	fprintf(f, "OBJS =");
+	for (i = 0; i < n; i++)
+		fprintf(f, " o%u.o", i);
+	fprintf(f, "\nprog: ${OBJS}\n\t@: ${.ALLSRC:T}; touch ${.TARGET}\n");
+	for (i = 0; i < n; i++) {
+		fprintf(f, "o%u.o: s%u.c\n\t@touch ${.TARGET}\n", i, i);
+		create("s%u.c", i);
+	}
+}
+
+static void
+gen_words(FILE *f, unsigned int n)
+{
+	unsigned int i;
+
+	fprintf(f, "W =");
+	for (i = 0; i < n; i++)
+		fprintf(f, " dir%u/w%u.c", i % 10, i);
+	fprintf(f, "\n");
+	for (i = 0; i < 50; i++) {
+		fprintf(f, "X%u := ${W:M*%u*:T:R:S/w/x/}\n", i, i);
+		fprintf(f, ".if !empty(W:Mdir%u/w%u*)\n"
+		    "Y%u := ${W:N*%u.c:C/dir([0-9])/d\\1/g:E}\n.endif\n",
+		    i % 10, i, i, i);
+	}
+	fprintf(f, "all: a b\na:\n\t@touch ${.TARGET}\n"
+	    "\t@: ${W:S/.c/.o/:H:M*1}\nb: a\n\t@touch ${.TARGET}\n"
+	    "\t@: ${X1:M*999*} ${Y2:M[ab]} ${W:M*7*:Q:M*777*}\n");
+}
+
+static void
+gen_for(FILE *f, unsigned int n)
+{
+	unsigned int i;
+
+	fprintf(f, "L =");
+	for (i = 0; i < n; i++)
+		fprintf(f, " %u", i);
+	fprintf(f, "\n.for i in ${L}\nV${i} = ${i}\nall: t${i}\n"
+	    "t${i}:\n\t@touch ${.TARGET}\n.endfor\n"
+	    ".for a b in ${L}\nP${a} = ${b} ${V${a}}\n.endfor\n");
+}
+
+static void
+gen_suffixes(FILE *f, unsigned int n)
+{
+	unsigned int i;
+
+	fprintf(f, ".SUFFIXES: .w .x .y .z\n"
+	    ".w.x:\n\t@touch ${.TARGET}\n"
+	    ".x.y:\n\t@touch ${.TARGET}\n"
+	    ".y.z:\n\t@touch ${.TARGET}\n"
+	    "all:");
+	for (i = 0; i < n; i++) {
+		fprintf(f, " f%u.z", i);
+		create("f%u.w", i);
+	}
+	fprintf(f, "\n");
+}
+
+static void
+gen_depends(FILE *f, unsigned int n)
+{
+	unsigned int i, j;
+	char name[PATH_MAX];
+	FILE *d;
+
+	subdir("d");
+	subdir("h");
+	for (i = 0; i < 200; i++)
+		create("h/h%u.h", i);
+	fprintf(f, "all:");
+	for (i = 0; i < n; i++)
+		fprintf(f, " o%u.o", i);
+	fprintf(f, "\n");
+	for (i = 0; i < n; i++) {
+		fprintf(f, ".include \"d/o%u.d\"\no%u.o: s%u.c\n"
+		    "\t@touch ${.TARGET}\n", i, i, i);
+		create("s%u.c", i);
+		(void)snprintf(name, sizeof name, "d/o%u.d", i);
+		if ((d = fopen(name, "w")) == NULL)
+			err(1, "%s", name);
+		fprintf(d, "o%u.o: s%u.c", i, i);
+		for (j = 0; j < 20; j++)
+			fprintf(d, " \\\n  h/h%u.h", (i * 7 + j * 13) % 200);
+		fprintf(d, "\n");
+		fclose(d);
+	}
+}
+
+static void
+gen_path(FILE *f, unsigned int n)
+{
+	unsigned int i;
+
+	subdir("src");
+	for (i = 0; i < n; i++)
+		create("src/f%u.c", i);
+	fprintf(f, ".PATH: src\nall:");
+	for (i = 0; i < n; i += 4)
+		fprintf(f, " f%u.o", i);
+	fprintf(f, "\n");
+	for (i = 0; i < n; i += 4)
+		fprintf(f, "f%u.o: f%u.c\n\t@touch ${.TARGET}\n", i, i);
+}
+
+static double
+now(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+/* run make in the current directory, with a single optional flag */
+static void
+run(const char *make, const char *flag, struct result *r)
+{
+	struct rusage ru;
+	double start;
+	pid_t pid;
+	int fd;
+
+	start = now();
+	switch (pid = fork()) {
+	case -1:
+		err(1, "fork");
+	case 0:
+		fd = open("/dev/null", O_WRONLY);
+		if (fd != -1) {
+			dup2(fd, STDOUT_FILENO);
+			dup2(fd, STDERR_FILENO);
+		}
+		execl(make, "make", "-r", flag, (char *)NULL);
+		_exit(127);
+	default:
+		if (wait4(pid, &r->status, 0, &ru) == -1)
+			err(1, "wait4");
+	}
+	r->real = now() - start;
+	r->cpu = ru.ru_utime.tv_sec + ru.ru_utime.tv_usec / 1e6 +
+	    ru.ru_stime.tv_sec + ru.ru_stime.tv_usec / 1e6;
+	r->maxrss = ru.ru_maxrss;
+}
+
+static void
+measure(const char *shape, const char *mode, const char *make,
+    const char *flag, unsigned int runs)
+{
+	struct result best = { 0 }, r;
+	unsigned int i;
+
+	for (i = 0; i < runs; i++) {
+		run(make, flag, &r);
+		if (r.status != 0) {
+			printf("%-10s %-6s failed, status %d\n", shape, mode,
+			    WIFEXITED(r.status) ? WEXITSTATUS(r.status) : -1);
+			return;
+		}
+		if (i == 0 || r.real < best.real)
+			best = r;
+	}
+	printf("%-10s %-6s %8.3fs %8.3fs %8ldKB\n", shape, mode, best.real,
+	    best.cpu, best.maxrss);
+	fflush(stdout);
+}
+
+static void
+bench(struct shape *s, const char *make, unsigned int scale,
+    unsigned int runs)
+{
+	struct result r;
+	FILE *f;
+
+	subdir(s->name);
+	if (chdir(s->name) == -1)
+		err(1, "chdir %s", s->name);
+	if ((f = fopen("Makefile", "w")) == NULL)
+		err(1, "Makefile");
+	s->generate(f, s->size * scale);
+	if (fclose(f) != 0)
+		err(1, "Makefile");
+
+	measure(s->name, "-n", make, "-n", runs);
+	/* build everything, then see how long it takes to do nothing */
+	run(make, NULL, &r);
+	if (r.status != 0)
+		printf("%-10s %-6s failed\n", s->name, "build");
+	else
+		measure(s->name, "null", make, NULL, runs);
+	if (chdir("..") == -1)
+		err(1, "chdir ..");
+}
+
+static void
+usage(void)
+{
+	fprintf(stderr,
+	    "usage: makebench [-k] [-r runs] [-s scale] make [shape ...]\n");
+	exit(2);
+}
+
+int
+main(int argc, char *argv[])
+{
+	char make[PATH_MAX];
+	char dir[PATH_MAX];
+	const char *tmp, *errstr;
+	unsigned int runs = 3, scale = 1;
+	bool keep = false;
+	size_t i;
+	int ch, j;
+
+	while ((ch = getopt(argc, argv, "kr:s:")) != -1) {
+		switch (ch) {
+		case 'k':
+			keep = true;
+			break;
+		case 'r':
+			runs = strtonum(optarg, 1, 100, &errstr);
+			if (errstr != NULL)
+				errx(2, "runs is %s: %s", errstr, optarg);
+			break;
+		case 's':
+			scale = strtonum(optarg, 1, 100, &errstr);
+			if (errstr != NULL)
+				errx(2, "scale is %s: %s", errstr, optarg);
+			break;
+		default:
+			usage();
+		}
+	}
+	argc -= optind;
+	argv += optind;
+	if (argc < 1)
+		usage();
+	if (realpath(argv[0], make) == NULL)
+		err(1, "%s", argv[0]);
+
+	if ((tmp = getenv("TMPDIR")) == NULL || *tmp == '\0')
+		tmp = "/tmp";
+	(void)snprintf(dir, sizeof dir, "%s/makebench.XXXXXXXXXX", tmp);
+	if (mkdtemp(dir) == NULL)
+		err(1, "mkdtemp %s", dir);
+	if (chdir(dir) == -1)
+		err(1, "chdir %s", dir);
+
+	printf("%-10s %-6s %9s %9s %10s\n", "shape", "mode", "real",
+	    "user+sys", "maxrss");
+	for (i = 0; i < NSHAPES; i++) {
+		if (argc > 1) {
+			for (j = 1; j < argc; j++)
+				if (strcmp(argv[j], shapes[i].name) == 0)
+					break;
+			if (j == argc)
+				continue;
+		}
+		bench(&shapes[i], make, scale, runs);
+	}
+
+	if (keep)
+		printf("results in %s\n", dir);
+	else if (chdir("/") == 0) {
+		pid_t pid = fork();
+
+		if (pid == 0) {
+			execl("/bin/rm", "rm", "-rf", dir, (char *)NULL);
+			_exit(127);
+		}
+		if (pid != -1)
+			waitpid(pid, NULL, 0);
+	}
+	return 0;
+}
@@ -119,7 +119,13 @@ BufExpand(Buffer bp, size_t nb)
 		}
 		assert(size >= occupied);
 	} while (size - occupied < nb+1+BUF_MARGIN);
-	bp->buffer = erealloc(bp->buffer, size);
+	if (bp->buffer == bp->local) {
+		char *n = emalloc(size);
+
+		memcpy(n, bp->buffer, occupied);
+		bp->buffer = n;
+	} else
+		bp->buffer = erealloc(bp->buffer, size);
 	bp->inPtr = bp->buffer +occupied;
 	bp->endPtr = bp->buffer + size;
 }
@@ -176,4 +182,27 @@ Buf_Init(Buffer bp, size_t size)
 		size = BUF_DEF_SIZE;
 	bp->inPtr = bp->endPtr = bp->buffer = emalloc(size);
 	bp->endPtr += size;
+	bp->local = NULL;
+}
+
+void
+Buf_InitLocal(Buffer bp, char *space, size_t size)
+{
+#ifdef STATS_BUF
+	STAT_TOTAL_BUFS++;
+#endif
+	bp->inPtr = bp->buffer = bp->local = space;
+	bp->endPtr = space + size;
+}
+
+void
+Buf_Learn(Buffer bp, size_t *hint)
+{
+	/* some headroom, so that slightly larger contents still fit */
+	size_t n = Buf_Size(bp) + Buf_Size(bp) / 2 + 1;
+
+	if (n > *hint)
+		*hint = n;
+	else
+		*hint -= (*hint - n) / 8;
 }
@@ -82,6 +82,7 @@ typedef struct Buffer_ {
     char    *buffer;	/* The buffer itself. */
     char    *inPtr;	/* Place to write to. */
     char    *endPtr;	/* End of allocated space. */
+    char    *local;	/* Space provided by the caller, not ours to free. */
 } BUFFER;
 
 /* Internal support for Buf_AddChar.  */
@@ -106,12 +107,24 @@ extern void Buf_AddChars(Buffer, size_t, const char *);
  *	Initializes a buffer, to hold approximately init chars.
  *	Set init to 0 if you have no idea.  */
 extern void Buf_Init(Buffer, size_t);
+/* Buf_InitLocal(buf, space, size);
+ *	Initializes a buffer that starts out in space, usually an array
+ *	on the stack, and only goes to the heap if it outgrows it.
+ *	Buf_Retrieve may then return space itself, so the contents
+ *	don't outlive it.  */
+extern void Buf_InitLocal(Buffer, char *, size_t);
 /* Buf_Reinit(buf, init);
  *	Initializes/reset a static buffer */
 extern void Buf_Reinit(Buffer, size_t);
+/* Buf_Learn(buf, &hint);
+ *	Remember how large buf got in hint, a size_t belonging to the
+ *	call site, to pass to its next Buf_Init.  Follows increases right
+ *	away, and decreases slowly.  */
+extern void Buf_Learn(Buffer, size_t *);
 /* Buf_Destroy(buf);
  * 	Nukes a buffer and all its resources.	*/
-#define Buf_Destroy(bp) ((void)free((bp)->buffer))
+#define Buf_Destroy(bp) \
+	((void)((bp)->buffer != (bp)->local ? free((bp)->buffer) : (void)0))
 /* str = Buf_Retrieve(buf);
  *	Retrieves data from a buffer, as a NULL terminated string.  */
 #define Buf_Retrieve(bp)	(*(bp)->inPtr = '\0', (bp)->buffer)
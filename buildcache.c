@@ -0,0 +1,311 @@
+/*	$OpenBSD$ */
+/*
+ * Copyright (c) 2026 Marc Espie.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE OPENBSD PROJECT AND CONTRIBUTORS
+ * ``AS IS'' AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ * LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR
+ * A PARTICULAR PURPOSE ARE DISCLAIMED.  IN NO EVENT SHALL THE OPENBSD
+ * PROJECT OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+ * SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT
+ * LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+ * DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+ * THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+ * OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <sha2.h>
+#include <stddef.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <ohash.h>
+#include "config.h"
+#include "defines.h"
+#include "buildcache.h"
+#include "digest.h"
+#include "gnode.h"
+#include "lst.h"
+#include "var.h"
+#include "str.h"
+#include "memory.h"
+#include "hash.h"
+#include "targ.h"
+#include "extern.h"
+
+/* An entry is one file per output, key.0, key.1... in the order of the
+ * target group, followed by an empty key file that says they're all
+ * there: other makes may be filling the same entry right now.
+ */
+
+struct pending_key {
+	char key[SHA256_DIGEST_STRING_LENGTH];	/* "" if not cacheable */
+	char name[1];
+};
+
+static struct ohash_info pending_info = {
+	offsetof(struct pending_key, name), NULL,
+	hash_calloc, hash_free, element_alloc
+};
+
+static struct ohash pending;
+static char *cache_dir = NULL;
+
+static bool cacheable(GNode *);
+static bool compute_key(GNode *, char *);
+static const char *output_path(GNode *);
+static GNode *next_output(GNode *, GNode *);
+static char *entry_name(const char *, int);
+static bool copy_file(const char *, const char *);
+
+void
+BuildCache_Init(void)
+{
+	const char *s;
+
+	s = Var_Value("BUILD_CACHE");
+	if (s == NULL || *s == '\0')
+		return;
+	if (mkdir(s, 0777) == -1 && errno != EEXIST)
+		return;
+	cache_dir = estrdup(s);
+	ohash_init(&pending, 8, &pending_info);
+}
+
+static bool
+cacheable(GNode *gn)
+{
+	if (noExecute || touchFlag)
+		return false;
+	if (gn->type & (OP_PHONY | OP_DUMMY | OP_MAKE | OP_EXPENSIVE))
+		return false;
+	return gn->special == SPECIAL_NONE && !Lst_IsEmpty(&gn->commands);
+}
+
+/* the commands, expanded as job_run_next would, the prerequisites, the
+ * environment, and the outputs, since their names may not show up in
+ * the commands.  Nothing runs: commands that need a shell to expand
+ * don't get cached */
+static bool
+compute_key(GNode *gn, char *key)
+{
+	SHA256_CTX ctx;
+	LstNode ln;
+	GNode *o;
+	char d[SHA256_DIGEST_STRING_LENGTH];
+	const char *list, *e, *w, *v;
+	char *s;
+	bool skipped;
+
+	SHA256Init(&ctx);
+	for (o = gn; o != NULL; o = next_output(gn, o))
+		SHA256Update(&ctx, (const u_int8_t *)o->name,
+		    strlen(o->name) + 1);
+	for (ln = Lst_First(&gn->commands); ln != NULL; ln = Lst_Adv(ln)) {
+		struct command *cmd = Lst_Datum(ln);
+
+		s = Var_SubstNoExec(cmd->string, &gn->localvars, &skipped);
+		SHA256Update(&ctx, (const u_int8_t *)s, strlen(s) + 1);
+		free(s);
+		if (skipped)
+			return false;
+	}
+	for (ln = Lst_First(&gn->children); ln != NULL; ln = Lst_Adv(ln)) {
+		GNode *c = Lst_Datum(ln);
+
+		if ((c->type & OP_USE) || c->special != SPECIAL_NONE)
+			continue;
+		if (c->type & (OP_PHONY | OP_DUMMY))
+			return false;
+		if (!Digest_File(c->path != NULL ? c->path : c->name, d))
+			return false;
+		SHA256Update(&ctx, (const u_int8_t *)c->name,
+		    strlen(c->name) + 1);
+		SHA256Update(&ctx, (const u_int8_t *)d, strlen(d));
+	}
+	if ((list = Var_Value("BUILD_CACHE_ENV")) != NULL)
+		for (e = list; (w = iterate_words(&e)) != NULL;) {
+			s = Str_dupi(w, e);
+			SHA256Update(&ctx, (const u_int8_t *)s, strlen(s) + 1);
+			if ((v = getenv(s)) == NULL)
+				v = "";
+			SHA256Update(&ctx, (const u_int8_t *)v, strlen(v) + 1);
+			free(s);
+		}
+	SHA256End(&ctx, key);
+	return true;
+}
+
+static const char *
+output_path(GNode *gn)
+{
+	return gn->path != NULL ? gn->path : gn->name;
+}
+
+/* gn, then the rest of its target group */
+static GNode *
+next_output(GNode *gn, GNode *o)
+{
+	if (gn->groupling == NULL)
+		return NULL;
+	o = o->groupling;
+	return o == gn ? NULL : o;
+}
+
+static char *
+entry_name(const char *key, int i)
+{
+	char *s;
+
+	if (i == -1)
+		return Str_concat(cache_dir, key, '/');
+	if (asprintf(&s, "%s/%s.%d", cache_dir, key, i) == -1)
+		return NULL;
+	return s;
+}
+
+/* by way of a temporary file, so that readers see all of it or nothing */
+static bool
+copy_file(const char *from, const char *to)
+{
+	char buf[BUFSIZ];
+	struct stat st;
+	char *tmp;
+	ssize_t r, w, i;
+	int in, out;
+	bool ok = false;
+
+	if ((in = open(from, O_RDONLY | O_CLOEXEC)) == -1)
+		return false;
+	tmp = Str_concat(to, ".XXXXXXXXXX", 0);
+	if (fstat(in, &st) == -1 || (out = mkstemp(tmp)) == -1) {
+		close(in);
+		free(tmp);
+		return false;
+	}
+	for (;;) {
+		r = read(in, buf, sizeof buf);
+		if (r == -1 && errno == EINTR)
+			continue;
+		if (r <= 0) {
+			ok = r == 0;
+			break;
+		}
+		for (i = 0; i < r; i += w) {
+			w = write(out, buf + i, r - i);
+			if (w == -1) {
+				if (errno == EINTR) {
+					w = 0;
+					continue;
+				}
+				break;
+			}
+		}
+		if (i < r)
+			break;
+	}
+	close(in);
+	if (fchmod(out, st.st_mode & 07777) == -1)
+		ok = false;
+	if (close(out) == -1)
+		ok = false;
+	if (ok && rename(tmp, to) == -1)
+		ok = false;
+	if (!ok)
+		(void)unlink(tmp);
+	free(tmp);
+	return ok;
+}
+
+bool
+BuildCache_Fetch(GNode *gn)
+{
+	struct pending_key *p;
+	unsigned int slot;
+	const char *end = NULL;
+	struct stat st;
+	GNode *o;
+	char *s;
+	int i;
+	bool ok;
+
+	if (cache_dir == NULL || !cacheable(gn))
+		return false;
+	slot = hash_qlookupi(&pending, gn->name, &end);
+	p = ohash_find(&pending, slot);
+	if (p == NULL) {
+		p = ohash_create_entry(&pending_info, gn->name, &end);
+		ohash_insert(&pending, slot, p);
+	}
+	if (!compute_key(gn, p->key)) {
+		p->key[0] = '\0';
+		return false;
+	}
+	s = entry_name(p->key, -1);
+	ok = stat(s, &st) == 0;
+	free(s);
+	if (!ok)
+		return false;
+	for (i = 0, o = gn; o != NULL && ok; o = next_output(gn, o), i++) {
+		if ((s = entry_name(p->key, i)) == NULL)
+			return false;
+		ok = copy_file(s, output_path(o));
+		free(s);
+	}
+	if (!ok)
+		return false;
+	if (!Targ_Silent(gn))
+		printf("%s restored from %s\n", gn->name, cache_dir);
+	/* nothing to store */
+	p->key[0] = '\0';
+	return true;
+}
+
+void
+BuildCache_Store(GNode *gn)
+{
+	struct pending_key *p;
+	unsigned int slot;
+	const char *end = NULL;
+	GNode *o;
+	char *s;
+	int i, fd;
+
+	if (cache_dir == NULL)
+		return;
+	slot = hash_qlookupi(&pending, gn->name, &end);
+	p = ohash_find(&pending, slot);
+	if (p == NULL || p->key[0] == '\0')
+		return;
+	for (i = 0, o = gn; o != NULL; o = next_output(gn, o), i++) {
+		if ((s = entry_name(p->key, i)) == NULL)
+			return;
+		if (!copy_file(output_path(o), s)) {
+			free(s);
+			return;
+		}
+		free(s);
+	}
+	s = entry_name(p->key, -1);
+	if ((fd = open(s, O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0666))
+	    != -1)
+		close(fd);
+	free(s);
+	p->key[0] = '\0';
+}
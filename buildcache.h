@@ -0,0 +1,53 @@
+#ifndef BUILDCACHE_H
+#define BUILDCACHE_H
+/*	$OpenBSD$ */
+
+/*
+ * Copyright (c) 2026 Marc Espie.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE OPENBSD PROJECT AND CONTRIBUTORS
+ * ``AS IS'' AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ * LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR
+ * A PARTICULAR PURPOSE ARE DISCLAIMED.  IN NO EVENT SHALL THE OPENBSD
+ * PROJECT OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+ * SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT
+ * LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+ * DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+ * THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+ * OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+/* Build cache: with BUILD_CACHE naming a directory, possibly shared
+ * between machines, the files a target produces are kept there, under a
+ * digest of its expanded commands, of the contents of its prerequisites
+ * and of the environment variables named in BUILD_CACHE_ENV.
+ * Next time the same target would be built from the same inputs, its
+ * files are copied back instead of running the commands.
+ * Phony targets, recursive makes, expensive targets, and targets that
+ * depend on phony targets are never cached.
+ */
+
+/* BuildCache_Init();
+ *	look at BUILD_CACHE. */
+extern void BuildCache_Init(void);
+
+/* hit = BuildCache_Fetch(gn);
+ *	gn is about to be built: restore its files if we have them, and
+ *	otherwise remember its key for BuildCache_Store. */
+extern bool BuildCache_Fetch(GNode *);
+
+/* BuildCache_Store(gn);
+ *	gn was built successfully: keep its files. */
+extern void BuildCache_Store(GNode *);
+
+#endif
@@ -25,9 +25,15 @@
  */
 
 #include <sys/types.h>
+#include <sys/stat.h>
 #include <sys/wait.h>
+#include <dirent.h>
 #include <errno.h>
+#include <fcntl.h>
+#include <sha2.h>
 #include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
 #include <unistd.h>
 #include "config.h"
 #include "defines.h"
@@ -36,22 +42,211 @@
 #include "memory.h"
 #include "pathnames.h"
 #include "job.h"
+#include "dir.h"
+#include "snapshot.h"
+#include "var.h"
+#include "str.h"
+#include "stats.h"
 
-char *
-Cmd_Exec(const char *cmd, char **err)
+/* With SHELL_CACHE set, the output of successful commands is kept in the
+ * directory named by MAKESHELLCACHE, which sub-makes inherit.  Unless
+ * the user gave one, it's created by the first make that needs it, and
+ * removed when that make exits, so results don't outlive the build.
+ * The key is a digest of the command, of the environment variables named
+ * in SHELL_CACHE_ENV, and of the modification times of the files named
+ * in SHELL_CACHE_FILES.  */
+#define SHELL_CACHE_ENV		"MAKESHELLCACHE"
+
+static char *cache_dir = NULL;
+static bool cache_owner = false;
+static pid_t cache_pid;
+
+static bool shell_cache_enabled(void);
+static void remove_cache_dir(void);
+static void hash_words(SHA256_CTX *, const char *, bool);
+static char *cache_entry(const char *);
+static char *cache_lookup(const char *);
+static void cache_store(const char *, const char *);
+
+static bool
+shell_cache_enabled(void)
+{
+	const char *s;
+	char tmpl[] = "/tmp/make-shellcache.XXXXXXXXXX";
+
+	if (cache_dir != NULL)
+		return true;
+	s = getenv(SHELL_CACHE_ENV);
+	if (s != NULL && *s != '\0') {
+		cache_dir = estrdup(s);
+		return true;
+	}
+	if (Var_Value("SHELL_CACHE") == NULL)
+		return false;
+	if (mkdtemp(tmpl) == NULL)
+		return false;
+	cache_dir = estrdup(tmpl);
+	cache_owner = true;
+	cache_pid = getpid();
+	Var_Setenv(SHELL_CACHE_ENV, cache_dir);
+	atexit(remove_cache_dir);
+	return true;
+}
+
+static void
+remove_cache_dir(void)
+{
+	DIR *d;
+	struct dirent *e;
+	char *name;
+
+	/* forked children that exit() have no business here */
+	if (!cache_owner || getpid() != cache_pid)
+		return;
+	d = opendir(cache_dir);
+	if (d != NULL) {
+		while ((e = readdir(d)) != NULL) {
+			if (e->d_name[0] == '.')
+				continue;
+			name = Str_concat(cache_dir, e->d_name, '/');
+			(void)unlink(name);
+			free(name);
+		}
+		closedir(d);
+	}
+	(void)rmdir(cache_dir);
+}
+
+/* names are taken literally: either environment variables, or files */
+static void
+hash_words(SHA256_CTX *ctx, const char *list, bool files)
 {
+	const char *e, *w;
+	char *name;
+	const char *v;
+	struct stat st;
+	char buf[64];
+
+	if (list == NULL)
+		return;
+	for (e = list; (w = iterate_words(&e)) != NULL;) {
+		name = Str_dupi(w, e);
+		SHA256Update(ctx, (const u_int8_t *)name, strlen(name) + 1);
+		if (files) {
+			if (stat(name, &st) == 0)
+				(void)snprintf(buf, sizeof buf, "%lld.%ld %lld",
+				    (long long)st.st_mtime,
+				    (long)st.st_mtimensec,
+				    (long long)st.st_size);
+			else
+				strlcpy(buf, "-", sizeof buf);
+			v = buf;
+		} else if ((v = getenv(name)) == NULL)
+			v = "";
+		SHA256Update(ctx, (const u_int8_t *)v, strlen(v) + 1);
+		free(name);
+	}
+}
+
+/* path of the cache entry for cmd */
+static char *
+cache_entry(const char *cmd)
+{
+	SHA256_CTX ctx;
+	char d[SHA256_DIGEST_STRING_LENGTH];
+	char *cwd;
+
+	SHA256Init(&ctx);
+	SHA256Update(&ctx, (const u_int8_t *)cmd, strlen(cmd) + 1);
+	/* sub-makes share the cache, from other directories */
+	if ((cwd = dogetcwd()) != NULL) {
+		SHA256Update(&ctx, (const u_int8_t *)cwd, strlen(cwd) + 1);
+		free(cwd);
+	}
+	hash_words(&ctx, Var_Value("SHELL_CACHE_ENV"), false);
+	hash_words(&ctx, Var_Value("SHELL_CACHE_FILES"), true);
+	SHA256End(&ctx, d);
+	return Str_concat(cache_dir, d, '/');
+}
+
+static char *
+cache_lookup(const char *entry)
+{
+	BUFFER buf;
+	char grab[BUFSIZ];
+	ssize_t cc;
+	int fd;
+
+	fd = open(entry, O_RDONLY | O_CLOEXEC);
+	if (fd == -1)
+		return NULL;
+	Buf_Init(&buf, MAKE_BSIZE);
+	while ((cc = read(fd, grab, sizeof grab)) > 0 ||
+	    (cc == -1 && errno == EINTR))
+		if (cc > 0)
+			Buf_AddChars(&buf, cc, grab);
+	close(fd);
+	if (cc == -1) {
+		Buf_Destroy(&buf);
+		return NULL;
+	}
+	return Buf_Retrieve(&buf);
+}
+
+static void
+cache_store(const char *entry, const char *result)
+{
+	char *tmp;
+	size_t len = strlen(result);
+	int fd;
+
+	/* other makes may be looking at the same entry right now */
+	tmp = Str_concat(entry, ".XXXXXXXXXX", 0);
+	if ((fd = mkstemp(tmp)) == -1) {
+		free(tmp);
+		return;
+	}
+	if (write(fd, result, len) == (ssize_t)len && close(fd) == 0)
+		(void)rename(tmp, entry);
+	else {
+		close(fd);
+		(void)unlink(tmp);
+	}
+	free(tmp);
+}
+
+/* a command running in the background, see Cmd_Start */
+struct pending_cmd {
+	pid_t	cpid;		/* Child PID */
+	int	fd;		/* Reading side of the pipe */
+	char	*entry;		/* Where the result may be cached. */
+	char	*result;	/* Already known result, from the cache */
+	char	*err;		/* Failure to start the command */
+};
+
+struct pending_cmd *
+Cmd_Start(const char *cmd)
+{
+	struct pending_cmd *p;
 	char	*args[4];	/* Args for invoking the shell */
 	int 	fds[2]; 	/* Pipe streams */
-	pid_t 	cpid;		/* Child PID */
-	char	*result;	/* Result */
-	int 	status; 	/* Command exit status */
-	BUFFER	buf;		/* Buffer to store the result. */
-	char	*cp;		/* Pointer into result. */
-	ssize_t	cc;		/* Characters read from pipe. */
-	size_t	length;		/* Total length of result. */
 
+	p = emalloc(sizeof(struct pending_cmd));
+	p->cpid = -1;
+	p->fd = -1;
+	p->entry = NULL;
+	p->result = NULL;
+	p->err = NULL;
+
+	/* there's no telling what the output depends on */
+	Snapshot_Volatile();
+	Var_Volatile();
 
-	*err = NULL;
+	if (shell_cache_enabled()) {
+		p->entry = cache_entry(cmd);
+		if ((p->result = cache_lookup(p->entry)) != NULL)
+			return p;
+	}
 
 	/* Set up arguments for the shell. */
 	args[0] = "sh";
@@ -61,12 +256,13 @@ Cmd_Exec(const char *cmd, char **err)
 
 	/* Open a pipe for retrieving shell's output. */
 	if (pipe(fds) == -1) {
-		*err = "Couldn't create pipe for \"%s\"";
-		goto bad;
+		p->err = "Couldn't create pipe for \"%s\"";
+		return p;
 	}
 
 	/* Fork */
-	switch (cpid = fork()) {
+	COUNT(FORK);
+	switch (p->cpid = fork()) {
 	case 0:
 		reset_signal_mask();
 		/* Close input side of pipe */
@@ -87,29 +283,55 @@ Cmd_Exec(const char *cmd, char **err)
 		/*NOTREACHED*/
 
 	case -1:
-		*err = "Couldn't exec \"%s\"";
-		goto bad;
+		(void)close(fds[0]);
+		(void)close(fds[1]);
+		p->err = "Couldn't exec \"%s\"";
+		return p;
 
 	default:
 		/* No need for the writing half. */
 		(void)close(fds[1]);
+		/* and later commands have no business with the reading half */
+		(void)fcntl(fds[0], F_SETFD, FD_CLOEXEC);
+		p->fd = fds[0];
+		return p;
+	}
+}
 
+char *
+Cmd_Finish(struct pending_cmd *p, char **err)
+{
+	char	*result;	/* Result */
+	int 	status = 0; 	/* Command exit status */
+	BUFFER	buf;		/* Buffer to store the result. */
+	char	*cp;		/* Pointer into result. */
+	ssize_t	cc;		/* Characters read from pipe. */
+	size_t	length;		/* Total length of result. */
+
+	*err = p->err;
+	if (p->result != NULL)
+		result = p->result;
+	else if (p->fd == -1)
+		result = estrdup("");
+	else {
 		Buf_Init(&buf, MAKE_BSIZE);
 
 		do {
 			char   grab[BUFSIZ];
 
-			cc = read(fds[0], grab, sizeof(grab));
+			cc = read(p->fd, grab, sizeof(grab));
 			if (cc > 0)
 				Buf_AddChars(&buf, cc, grab);
 		} while (cc > 0 || (cc == -1 && errno == EINTR));
 
 		/* Close the input side of the pipe.  */
-		(void)close(fds[0]);
+		(void)close(p->fd);
 
 		/* Wait for the child to exit.  */
-		while (waitpid(cpid, &status, 0) == -1 && errno == EINTR)
+		while (waitpid(p->cpid, &status, 0) == -1 && errno == EINTR)
 			continue;
+		/* it may have created files */
+		Dir_Changed();
 
 		if (cc == -1)
 			*err = "Couldn't read shell's output for \"%s\"";
@@ -132,10 +354,17 @@ Cmd_Exec(const char *cmd, char **err)
 				*cp = ' ';
 			cp--;
 		}
-		break;
+		if (p->entry != NULL && *err == NULL)
+			cache_store(p->entry, result);
 	}
+	free(p->entry);
+	free(p);
 	return result;
-    bad:
-	return estrdup("");
+}
+
+char *
+Cmd_Exec(const char *cmd, char **err)
+{
+	return Cmd_Finish(Cmd_Start(cmd), err);
 }
 
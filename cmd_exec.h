@@ -34,4 +34,14 @@
  *	The output result should always be freed by the caller.  */
 extern char *Cmd_Exec(const char *, char **);
 
+/* p = Cmd_Start(cmd);
+ *	start the command in cmd in the background, so that other work
+ *	may proceed while it runs.
+ * output = Cmd_Finish(p, &err);
+ *	wait for that command and return its output, as Cmd_Exec would.
+ *	Every started command must be finished, before any job is reaped.  */
+struct pending_cmd;
+extern struct pending_cmd *Cmd_Start(const char *);
+extern char *Cmd_Finish(struct pending_cmd *, char **);
+
 #endif
@@ -58,6 +58,9 @@
 #include "main.h"
 #include "gnode.h"
 #include "lst.h"
+#include "memory.h"
+#include "hash.h"
+#include "snapshot.h"
 
 
 /* The parsing of conditional expressions is based on this grammar:
@@ -163,6 +166,63 @@ static struct {
 	Location origin;
 } condStack[MAXIF];		/* Stack of conditionals */
 
+/* Conditionals in loops and in files included over and over get
+ * evaluated many times, so we keep the shape of each line we parsed:
+ * terms and the &&, || and ! that link them.  Evaluating it again only
+ * means evaluating the terms we need.
+ * Each term keeps its extent in the line: if it comes out different
+ * (some expansion changed how it parses), we just parse the line again.
+ */
+struct cond_node {
+	Token kind;		/* And, Or, Not, or None for a term */
+	unsigned int a, b;	/* operands, or extent of the term */
+};
+
+struct compiled_cond {
+	struct If *ifp;		/* default function depends on it */
+	struct cond_node *nodes;
+	unsigned int root;
+	char line[1];
+};
+
+static struct ohash_info compiled_info = {
+	offsetof(struct compiled_cond, line), NULL,
+	hash_calloc, hash_free, element_alloc
+};
+
+static struct ohash compiled;
+static bool compiled_setup = false;
+
+static unsigned int add_node(Token, unsigned int, unsigned int);
+static struct compiled_cond *lookup_compiled(const char *, struct If *);
+static void save_compiled(const char *, struct If *);
+static Token eval_compiled(struct compiled_cond *, unsigned int);
+
+static bool recording;		/* Build nodes while parsing */
+static bool record_failed;	/* The parse can't be replayed */
+static const char *condLine;	/* Start of the line being recorded */
+static struct cond_node *nodes;
+static unsigned int nnodes, maxnodes;
+static unsigned int lastNode;	/* Root of what we just parsed */
+
+/* exists() asks the same questions over and over: remember the answers
+ * until directories or search paths change.
+ */
+struct exists_answer {
+	unsigned int generation;	/* Dir_Generation() */
+	unsigned int paths;		/* Dir_PathsGeneration() */
+	char *path;			/* what Dir_FindFile found, or NULL */
+	char name[1];
+};
+
+static struct ohash_info exists_info = {
+	offsetof(struct exists_answer, name), NULL,
+	hash_calloc, hash_free, element_alloc
+};
+
+static struct ohash exists_cache;
+static bool exists_setup = false;
+
 static int condTop = MAXIF;	/* Top-most conditional */
 static int skipIfLevel=0;	/* Depth of skipped conditionals */
 static bool skipLine = false;	/* Whether the parse module is skipping lines */
@@ -177,6 +237,89 @@ find_cond(const char *p)
 	}
 }
 
+static unsigned int
+add_node(Token kind, unsigned int a, unsigned int b)
+{
+	if (nnodes == maxnodes) {
+		maxnodes = maxnodes == 0 ? 16 : maxnodes * 2;
+		nodes = ereallocarray(nodes, maxnodes, sizeof(struct cond_node));
+	}
+	nodes[nnodes].kind = kind;
+	nodes[nnodes].a = a;
+	nodes[nnodes].b = b;
+	return nnodes++;
+}
+
+static struct compiled_cond *
+lookup_compiled(const char *line, struct If *ifp)
+{
+	const char *end = NULL;
+	struct compiled_cond *c;
+
+	if (!compiled_setup)
+		return NULL;
+	c = ohash_find(&compiled, hash_qlookupi(&compiled, line, &end));
+	if (c != NULL && c->ifp == ifp)
+		return c;
+	return NULL;
+}
+
+static void
+save_compiled(const char *line, struct If *ifp)
+{
+	const char *end = NULL;
+	struct compiled_cond *c;
+	unsigned int slot;
+
+	if (!compiled_setup) {
+		ohash_init(&compiled, 6, &compiled_info);
+		compiled_setup = true;
+	}
+	slot = hash_qlookupi(&compiled, line, &end);
+	c = ohash_find(&compiled, slot);
+	if (c == NULL) {
+		c = ohash_create_entry(&compiled_info, line, &end);
+		ohash_insert(&compiled, slot, c);
+	} else
+		free(c->nodes);
+	c->ifp = ifp;
+	c->nodes = ereallocarray(NULL, nnodes, sizeof(struct cond_node));
+	memcpy(c->nodes, nodes, nnodes * sizeof(struct cond_node));
+	c->root = lastNode;
+}
+
+/* Same results as CondE, or None if a term doesn't parse the same */
+static Token
+eval_compiled(struct compiled_cond *c, unsigned int i)
+{
+	struct cond_node *n = &c->nodes[i];
+	Token t;
+
+	switch (n->kind) {
+	case Not:
+		t = eval_compiled(c, n->a);
+		if (t == True)
+			return False;
+		else if (t == False)
+			return True;
+		return t;
+	case And:
+		t = eval_compiled(c, n->a);
+		return t == True ? eval_compiled(c, n->b) : t;
+	case Or:
+		t = eval_compiled(c, n->a);
+		return t == False ? eval_compiled(c, n->b) : t;
+	default:
+		condExpr = c->line + n->a;
+		condPushBack = None;
+		t = CondToken(true);
+		/* errors end the parse anyway */
+		if (t != Err && condExpr != c->line + n->b)
+			return None;
+		return t;
+	}
+}
+
 
 /*-
  *-----------------------------------------------------------------------
@@ -291,20 +434,38 @@ CondDoMake(struct Name *arg)
 static bool
 CondDoExists(struct Name *arg)
 {
-	bool result;
-	char *path;
+	struct exists_answer *a;
+	unsigned int slot;
+	const char *end = arg->e;
 
 	if (arg->s == arg->e)
 		Parse_Error(PARSE_FATAL, "Empty file name in .if exists()");
 
-	path = Dir_FindFilei(arg->s, arg->e, defaultPath);
-	if (path != NULL) {
-		result = true;
-		free(path);
-	} else {
-		result = false;
+	if (!exists_setup) {
+		ohash_init(&exists_cache, 6, &exists_info);
+		exists_setup = true;
+	}
+	slot = hash_qlookupi(&exists_cache, arg->s, &end);
+	a = ohash_find(&exists_cache, slot);
+	if (a == NULL) {
+		a = ohash_create_entry(&exists_info, arg->s, &end);
+		a->path = NULL;
+		a->generation = Dir_Generation() - 1;
+		ohash_insert(&exists_cache, slot, a);
 	}
-	return result;
+	if (a->generation != Dir_Generation() ||
+	    a->paths != Dir_PathsGeneration()) {
+		free(a->path);
+		a->path = Dir_FindFilei(arg->s, arg->e, defaultPath);
+		/* finding a file may add its directory to the path */
+		a->generation = Dir_Generation();
+		a->paths = Dir_PathsGeneration();
+	}
+	if (a->path != NULL)
+		Snapshot_Probe(a->path, NULL, true);
+	else
+		Snapshot_Probe(arg->s, arg->e, false);
+	return a->path != NULL;
 }
 
 /*-
@@ -426,8 +587,9 @@ CondHandleVarSpec(bool doEval)
 	if (*condExpr && !ISSPACE(*condExpr) &&
 		strchr("!=><", *condExpr) == NULL) {
 		BUFFER buf;
+		char space[MAKE_BSIZE];
 
-		Buf_Init(&buf, 0);
+		Buf_InitLocal(&buf, space, sizeof(space));
 
 		Buf_AddString(&buf, lhs);
 
@@ -451,6 +613,7 @@ CondHandleString(bool doEval)
 	char *lhs;
 	const char *begin;
 	BUFFER buf;
+	char space[MAKE_BSIZE];
 
 	/* find the extent of the string */
 	begin = ++condExpr;
@@ -458,7 +621,7 @@ CondHandleString(bool doEval)
 		condExpr++;
 	}
 
-	Buf_Init(&buf, 0);
+	Buf_InitLocal(&buf, space, sizeof(space));
 	Buf_Addi(&buf, begin, condExpr);
 	if (*condExpr == '"')
 		condExpr++;
@@ -515,6 +678,7 @@ do_compare:
 		const char *cp;
 		int qt;
 		BUFFER buf;
+		char space[MAKE_BSIZE];
 
 do_string_compare:
 		if ((*op != '!' && *op != '=') || op[1] != '=') {
@@ -523,7 +687,7 @@ do_string_compare:
 			goto error;
 		}
 
-		Buf_Init(&buf, 0);
+		Buf_InitLocal(&buf, space, sizeof(space));
 		qt = *rhs == '"' ? 1 : 0;
 
 		for (cp = &rhs[qt]; ((qt && *cp != '"') ||
@@ -554,7 +718,7 @@ do_string_compare:
 			t = strcmp(lhs, string) ? False : True;
 		else
 			t = strcmp(lhs, string) ? True : False;
-		free(string);
+		Buf_Destroy(&buf);
 		if (rhs == condExpr) {
 			if (!qt && *cp == ')')
 				condExpr = cp;
@@ -745,6 +909,8 @@ CondHandleDefault(bool doEval)
 static Token
 CondToken(bool doEval)
 {
+	const char *start;
+	Token t;
 
 	if (condPushBack != None) {
 		Token t;
@@ -779,16 +945,29 @@ CondToken(bool doEval)
 	case '\n':
 	case '\0':
 		return EndOfFile;
+	default:
+		break;
+	}
+
+	start = condExpr;
+	switch (*condExpr) {
 	case '"':
-		return CondHandleString(doEval);
+		t = CondHandleString(doEval);
+		break;
 	case '$':
-		return CondHandleVarSpec(doEval);
+		t = CondHandleVarSpec(doEval);
+		break;
 	case '0': case '1': case '2': case '3': case '4':
 	case '5': case '6': case '7': case '8': case '9':
-		return CondHandleNumber(doEval);
+		t = CondHandleNumber(doEval);
+		break;
 	default:
-		return CondHandleDefault(doEval);
+		t = CondHandleDefault(doEval);
+		break;
 	}
+	if (recording)
+		lastNode = add_node(None, start - condLine, condExpr - condLine);
+	return t;
 }
 
 /*-
@@ -830,7 +1009,11 @@ CondT(bool doEval)
 			t = False;
 		else if (t == False)
 			t = True;
+		if (recording)
+			lastNode = add_node(Not, lastNode, 0);
 	}
+	if (t != True && t != False)
+		record_failed = true;
 	return t;
 }
 
@@ -851,9 +1034,11 @@ static Token
 CondF(bool doEval)
 {
 	Token l, o;
+	unsigned int left;
 
 	l = CondT(doEval);
 	if (l != Err) {
+		left = lastNode;
 		o = CondToken(doEval);
 
 		if (o == And) {
@@ -867,6 +1052,8 @@ CondF(bool doEval)
 			    l = CondF(doEval);
 		    else
 			    (void)CondF(false);
+		    if (recording)
+			    lastNode = add_node(And, left, lastNode);
 		} else
 			/* F -> T.	*/
 			condPushBack = o;
@@ -891,9 +1078,11 @@ static Token
 CondE(bool doEval)
 {
 	Token l, o;
+	unsigned int left;
 
 	l = CondF(doEval);
 	if (l != Err) {
+		left = lastNode;
 		o = CondToken(doEval);
 
 		if (o == Or) {
@@ -908,6 +1097,8 @@ CondE(bool doEval)
 				l = CondE(doEval);
 			else
 				(void)CondE(false);
+			if (recording)
+				lastNode = add_node(Or, left, lastNode);
 		} else
 			/* E -> F.	*/
 			condPushBack = o;
@@ -917,7 +1108,7 @@ CondE(bool doEval)
 
 /* Evaluate conditional in line.
  * returns COND_SKIP, COND_PARSE, COND_INVALID, COND_ISFOR, COND_ISINCLUDE,
- * COND_ISUNDEF.
+ * COND_ISDEPINCLUDE, COND_ISUNDEF.
  * A conditional line looks like this:
  *	<cond-type> <expr>
  *	where <cond-type> is any of if, ifmake, ifnmake, ifdef,
@@ -944,7 +1135,7 @@ Cond_Eval(const char *line)
 	if (*end == '.' || *end == ':')
 		return COND_INVALID;
 	len = end - line;
-	k = ohash_interval(line, &end);
+	k = hash_interval(line, &end);
 	switch(k % MAGICSLOTS2) {
 	case K_COND_IF % MAGICSLOTS2:
 		if (k == K_COND_IF && len == strlen(COND_IF) &&
@@ -1084,6 +1275,12 @@ Cond_Eval(const char *line)
 			return COND_ISINCLUDE;
 		else
 			return COND_INVALID;
+	case K_COND_DEPINCLUDE % MAGICSLOTS2:
+		if (k == K_COND_DEPINCLUDE && len == strlen(COND_DEPINCLUDE) &&
+		    strncmp(line, COND_DEPINCLUDE, len) == 0)
+			return COND_ISDEPINCLUDE;
+		else
+			return COND_INVALID;
 	default:
 		/* Not a valid conditional type. No error...  */
 		return COND_INVALID;
@@ -1120,6 +1317,9 @@ Cond_Eval(const char *line)
 	}
 
 	if (ifp->defProc) {
+		struct compiled_cond *c;
+		Token t = None;
+
 		/* Initialize file-global variables for parsing.  */
 		condDefProc = ifp->defProc;
 		condInvert = ifp->doNot;
@@ -1129,23 +1329,35 @@ Cond_Eval(const char *line)
 		while (*line == ' ' || *line == '\t')
 			line++;
 
-		condExpr = line;
+		c = lookup_compiled(line, ifp);
+		if (c != NULL) {
+			t = eval_compiled(c, c->root);
+			if (t == Err)
+				goto err;
+		}
+		if (t == True || t == False) {
+			value = t == True;
+			goto done;
+		}
+
+		condExpr = condLine = line;
 		condPushBack = None;
+		recording = true;
+		record_failed = false;
+		nnodes = 0;
 
-		switch (CondE(true)) {
+		t = CondE(true);
+		recording = false;
+		switch (t) {
 		case True:
-			if (CondToken(true) == EndOfFile) {
-				value = true;
-				break;
-			}
-			goto err;
-			/* FALLTHROUGH */
 		case False:
-			if (CondToken(true) == EndOfFile) {
-				value = false;
-				break;
-			}
-			/* FALLTHROUGH */
+			/* only a line that parsed to the end is worth keeping */
+			if (CondToken(true) != EndOfFile)
+				goto err;
+			value = t == True;
+			if (!record_failed)
+				save_compiled(line, ifp);
+			break;
 		case Err:
 err:
 			Parse_Error(level, "Malformed conditional (%s)", line);
@@ -1154,6 +1366,7 @@ err:
 			break;
 		}
 	}
+done:
 
 	condStack[condTop].value = value;
 	Parse_FillLocation(&condStack[condTop].origin);
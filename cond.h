@@ -39,6 +39,7 @@
 #define COND_ISUNDEF	4
 #define COND_ISINCLUDE	5
 #define COND_ISPOISON	6
+#define COND_ISDEPINCLUDE	7
 
 /* whattodo = Cond_Eval(line);
  *	Parses a conditional expression (without the leading dot),
@@ -18,3 +18,4 @@
 #define COND_INCLUDE	"include"
 #define COND_UNDEF	"undef"
 #define COND_POISON	"poison"
+#define COND_DEPINCLUDE	"depinclude"
@@ -57,6 +57,9 @@ typedef struct Job_ Job;
 struct Suff_;
 typedef struct Suff_ Suff;
 
+struct Snapshot_;
+typedef struct Snapshot_ Snapshot;
+
 /* some useful defines for gcc */
 
 #ifdef __GNUC__
@@ -99,6 +102,12 @@ extern int debug;
 #define DEBUG_HELDJOBS		0x20000
 #define DEBUG_DOUBLE		0x40000
 #define DEBUG_TARGGROUP		0x80000
+#define DEBUG_TRACE		0x100000
+#define DEBUG_VARPROF		0x200000
+#define DEBUG_HASH		0x400000
+#define DEBUG_MEMORY		0x800000
+#define DEBUG_PARSEPROF		0x1000000
+#define DEBUG_IDLE		0x2000000
 
 #define CONCAT(a,b)	a##b
 
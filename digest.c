@@ -0,0 +1,300 @@
+/*	$OpenBSD$ */
+/*
+ * Copyright (c) 2026 Marc Espie.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE OPENBSD PROJECT AND CONTRIBUTORS
+ * ``AS IS'' AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ * LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR
+ * A PARTICULAR PURPOSE ARE DISCLAIMED.  IN NO EVENT SHALL THE OPENBSD
+ * PROJECT OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+ * SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT
+ * LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+ * DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+ * THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+ * OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <limits.h>
+#include <sha2.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <ohash.h>
+#include "config.h"
+#include "defines.h"
+#include "digest.h"
+#include "gnode.h"
+#include "lst.h"
+#include "var.h"
+#include "str.h"
+#include "memory.h"
+#include "hash.h"
+
+/* The cache file has two kinds of lines:
+ *	F digest mtime-sec mtime-nsec size inode path
+ *	T digest target
+ * for files, and for the digest of the prerequisites of each target
+ * when it was last built.
+ */
+
+struct file_digest {
+	char digest[SHA256_DIGEST_STRING_LENGTH];
+	long long sec;
+	long nsec;
+	long long size;
+	unsigned long long ino;
+	char name[1];
+};
+
+struct target_digest {
+	char inputs[SHA256_DIGEST_STRING_LENGTH];	/* "" if unknown */
+	char pending[SHA256_DIGEST_STRING_LENGTH];	/* while building */
+	char name[1];
+};
+
+static struct ohash_info file_info = {
+	offsetof(struct file_digest, name), NULL,
+	hash_calloc, hash_free, element_alloc
+};
+
+static struct ohash_info target_info = {
+	offsetof(struct target_digest, name), NULL,
+	hash_calloc, hash_free, element_alloc
+};
+
+static struct ohash files, targets;
+static char *cache_file = NULL;
+static pid_t cache_pid;
+static bool dirty = false;
+
+static void *lookup(struct ohash *, struct ohash_info *, const char *);
+static bool digest_of_inputs(GNode *, char *);
+static void read_cache(FILE *);
+static void Digest_End(void);
+
+static void *
+lookup(struct ohash *h, struct ohash_info *info, const char *name)
+{
+	unsigned int slot;
+	const char *end = NULL;
+	void *e;
+
+	slot = hash_qlookupi(h, name, &end);
+	e = ohash_find(h, slot);
+	if (e == NULL) {
+		e = ohash_create_entry(info, name, &end);
+		memset(e, 0, info->key_offset);
+		ohash_insert(h, slot, e);
+	}
+	return e;
+}
+
+bool
+Digest_File(const char *path, char *digest)
+{
+	struct stat st;
+	struct file_digest *f;
+
+	if (stat(path, &st) == -1)
+		return false;
+	f = lookup(&files, &file_info, path);
+	if (f->digest[0] == '\0' || f->sec != st.st_mtime ||
+	    f->nsec != st.st_mtimensec || f->size != st.st_size ||
+	    f->ino != st.st_ino) {
+		if (SHA256File(path, f->digest) == NULL) {
+			f->digest[0] = '\0';
+			return false;
+		}
+		f->sec = st.st_mtime;
+		f->nsec = st.st_mtimensec;
+		f->size = st.st_size;
+		f->ino = st.st_ino;
+		dirty = true;
+	}
+	strlcpy(digest, f->digest, SHA256_DIGEST_STRING_LENGTH);
+	return true;
+}
+
+/* all prerequisites that are files, in order */
+static bool
+digest_of_inputs(GNode *gn, char *digest)
+{
+	SHA256_CTX ctx;
+	LstNode ln;
+	char d[SHA256_DIGEST_STRING_LENGTH];
+
+	SHA256Init(&ctx);
+	for (ln = Lst_First(&gn->children); ln != NULL; ln = Lst_Adv(ln)) {
+		GNode *c = Lst_Datum(ln);
+
+		if ((c->type & OP_USE) || c->special != SPECIAL_NONE)
+			continue;
+		/* no contents to look at, make will decide */
+		if (c->type & (OP_PHONY | OP_DUMMY))
+			return false;
+		if (!Digest_File(c->path != NULL ? c->path : c->name, d))
+			return false;
+		SHA256Update(&ctx, (const u_int8_t *)c->name,
+		    strlen(c->name) + 1);
+		SHA256Update(&ctx, (const u_int8_t *)d, strlen(d));
+	}
+	SHA256End(&ctx, digest);
+	return true;
+}
+
+static void
+read_cache(FILE *stream)
+{
+	char *line, *copy;
+	size_t len;
+	char d[SHA256_DIGEST_STRING_LENGTH];
+	long long sec, size;
+	long nsec;
+	unsigned long long ino;
+	int n;
+
+	while ((line = fgetln(stream, &len)) != NULL) {
+		copy = emalloc(len+1);
+		memcpy(copy, line, len);
+		if (len > 0 && copy[len-1] == '\n')
+			len--;
+		copy[len] = '\0';
+		if (sscanf(copy, "F %64s %lld %ld %lld %llu %n", d, &sec, &nsec,
+		    &size, &ino, &n) == 5 && copy[n] != '\0') {
+			struct file_digest *f;
+
+			f = lookup(&files, &file_info, copy + n);
+			strlcpy(f->digest, d, sizeof f->digest);
+			f->sec = sec;
+			f->nsec = nsec;
+			f->size = size;
+			f->ino = ino;
+		} else if (sscanf(copy, "T %64s %n", d, &n) == 1 &&
+		    copy[n] != '\0') {
+			struct target_digest *t;
+
+			t = lookup(&targets, &target_info, copy + n);
+			strlcpy(t->inputs, d, sizeof t->inputs);
+		}
+		free(copy);
+	}
+}
+
+void
+Digest_Init(void)
+{
+	const char *s;
+	FILE *f;
+
+	/* Digest_File works without a cache file, just not across runs */
+	ohash_init(&files, 8, &file_info);
+	ohash_init(&targets, 8, &target_info);
+	s = Var_Value("HASH_CACHE");
+	if (s == NULL || *s == '\0')
+		return;
+	cache_file = estrdup(s);
+	cache_pid = getpid();
+	f = fopen(cache_file, "r");
+	if (f != NULL) {
+		read_cache(f);
+		fclose(f);
+	}
+	atexit(Digest_End);
+}
+
+bool
+Digest_Unchanged(GNode *gn)
+{
+	struct target_digest *t;
+	char d[SHA256_DIGEST_STRING_LENGTH];
+
+	if (cache_file == NULL)
+		return false;
+	t = lookup(&targets, &target_info, gn->name);
+	if (t->inputs[0] == '\0')
+		return false;
+	return digest_of_inputs(gn, d) && strcmp(d, t->inputs) == 0;
+}
+
+void
+Digest_Start(GNode *gn)
+{
+	struct target_digest *t;
+
+	if (cache_file == NULL)
+		return;
+	t = lookup(&targets, &target_info, gn->name);
+	if (!digest_of_inputs(gn, t->pending))
+		t->pending[0] = '\0';
+	/* whatever the target was built from, it may not be after this:
+	 * if the build fails, going back to the old inputs mustn't look
+	 * like there's nothing to do */
+	if (t->inputs[0] != '\0') {
+		t->inputs[0] = '\0';
+		dirty = true;
+	}
+}
+
+void
+Digest_Done(GNode *gn)
+{
+	struct target_digest *t;
+
+	if (cache_file == NULL)
+		return;
+	t = lookup(&targets, &target_info, gn->name);
+	if (strcmp(t->inputs, t->pending) != 0) {
+		strlcpy(t->inputs, t->pending, sizeof t->inputs);
+		dirty = true;
+	}
+}
+
+static void
+Digest_End(void)
+{
+	struct file_digest *f;
+	struct target_digest *t;
+	unsigned int i;
+	char *tmp;
+	FILE *stream;
+
+	/* forked children that exit() don't get a say */
+	if (getpid() != cache_pid || !dirty)
+		return;
+	tmp = Str_concat(cache_file, ".tmp", 0);
+	stream = fopen(tmp, "w");
+	if (stream == NULL) {
+		free(tmp);
+		return;
+	}
+	for (f = ohash_first(&files, &i); f != NULL;
+	    f = ohash_next(&files, &i))
+		if (f->digest[0] != '\0')
+			fprintf(stream, "F %s %lld %ld %lld %llu %s\n",
+			    f->digest, f->sec, f->nsec, f->size, f->ino,
+			    f->name);
+	for (t = ohash_first(&targets, &i); t != NULL;
+	    t = ohash_next(&targets, &i))
+		if (t->inputs[0] != '\0')
+			fprintf(stream, "T %s %s\n", t->inputs, t->name);
+	if (fclose(stream) == 0)
+		(void)rename(tmp, cache_file);
+	else
+		(void)unlink(tmp);
+	free(tmp);
+}
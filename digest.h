@@ -0,0 +1,62 @@
+#ifndef DIGEST_H
+#define DIGEST_H
+/*	$OpenBSD$ */
+
+/*
+ * Copyright (c) 2026 Marc Espie.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE OPENBSD PROJECT AND CONTRIBUTORS
+ * ``AS IS'' AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ * LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR
+ * A PARTICULAR PURPOSE ARE DISCLAIMED.  IN NO EVENT SHALL THE OPENBSD
+ * PROJECT OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+ * SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT
+ * LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+ * DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+ * THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+ * OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+/* Content digests: with HASH_CACHE set, a target whose prerequisites are
+ * newer but have exactly the same contents as when it was last built
+ * isn't out of date.
+ * SHA256 digests of files are kept in the HASH_CACHE file along with
+ * their mtime, size and inode, so files only get hashed again when
+ * those change.
+ */
+
+/* Digest_Init();
+ *	read the cache file, if HASH_CACHE is set.  It will be written
+ *	back at exit. */
+extern void Digest_Init(void);
+
+/* ok = Digest_File(path, digest);
+ *	SHA256 digest of the contents of path, as a string, which only
+ *	gets computed again if the file changed. */
+extern bool Digest_File(const char *, char *);
+
+/* same = Digest_Unchanged(gn);
+ *	true if gn's prerequisites have the same contents as when it
+ *	was last built. */
+extern bool Digest_Unchanged(GNode *);
+
+/* Digest_Start(gn);
+ *	gn is about to be built: note what its prerequisites look like,
+ *	and forget what it was built from until Digest_Done. */
+extern void Digest_Start(GNode *);
+
+/* Digest_Done(gn);
+ *	gn was built successfully from what Digest_Start saw. */
+extern void Digest_Done(GNode *);
+
+#endif
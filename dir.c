@@ -61,20 +61,29 @@
  * SUCH DAMAGE.
  */
 
+#include <sys/mman.h>
+#include <sys/resource.h>
 #include <sys/stat.h>
 #include <dirent.h>
+#include <errno.h>
+#include <fcntl.h>
 #include <limits.h>
+#include <pthread.h>
+#include <signal.h>
 #include <stddef.h>
 #include <stdint.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <time.h>
+#include <unistd.h>
 #include <ohash.h>
 #include "config.h"
 #include "defines.h"
 #include "dir.h"
 #include "lst.h"
 #include "memory.h"
+#include "hash.h"
 #include "buf.h"
 #include "gnode.h"
 #include "arch.h"
@@ -82,6 +91,10 @@
 #include "error.h"
 #include "str.h"
 #include "timestamp.h"
+#include "trace.h"
+#include "stats.h"
+#include "statcache.h"
+#include "snapshot.h"
 
 
 /*	A search path consists of a Lst of PathEntry structures. A Path
@@ -149,7 +162,22 @@
  *	essentially a stat() without the copyout() call, and that the same
  *	filesystem overhead would have to be incurred in Dir_MTime, it made
  *	sense to replace the access() with a stat() and record the mtime
- *	in a cache for when Dir_MTime was actually called.  */
+ *	in a cache for when Dir_MTime was actually called.
+ *
+ *	File descriptors are no longer that scarce, so we now keep the
+ *	first few directories we read open, within a budget, and stat(2)
+ *	files relative to them.  This saves the kernel walking long paths
+ *	like /usr/obj/very/long/path over and over again.
+ *
+ *	If MAKEDIRCACHE names a directory, the contents of directories we
+ *	read get saved there, keyed by device and inode, and validated by
+ *	the directory mtime.  Later makes mmap the saved file set and use
+ *	it in place instead of reading the directory again.
+ *
+ *	We also do 3): after commands have run, each directory gets its
+ *	mtime checked again before the next lookup, and gets re-read if it
+ *	changed.  A directory that changes more than DIR_REHASH_MAX times
+ *	is only checked through stat from then on.  */
 
 
 /* several data structures exist to handle caching of directory stuff.
@@ -170,6 +198,19 @@
 struct PathEntry {
 	int refCount;		/* ref-counted, can participate to
 				 * several paths */
+	int fd;			/* open directory, or -1 */
+	void *map;		/* files come from the MAKEDIRCACHE file */
+	size_t maplen;
+	char *arena;		/* or from one block we read them into */
+	struct timespec mtime;	/* of the directory, when we read it */
+	unsigned int checked;	/* dir_generation we last checked */
+	int rehashes;		/* times we had to read it again */
+	bool use_stat;		/* changes too often, don't trust files */
+	bool matches_init;	/* matches is there */
+	bool subdirs_known;	/* subdirs is there */
+	struct PathEntry **subdirs;	/* for ** patterns */
+	unsigned int nsubdirs;
+	struct ohash matches;	/* wildcard patterns we already matched */
 	struct ohash files;	/* hash of name of files in the directory */
 	char name[1];		/* directory name */
 };
@@ -182,11 +223,60 @@ static struct ohash_info dir_info = {
 
 static struct ohash   knownDirectories;	/* cache all open directories */
 
+#define DIRFD_MAX	256	/* never keep more directories open */
+static int dirfd_budget;	/* how many more we may keep open */
+
+static const char *dircache;	/* MAKEDIRCACHE */
+
+#define DIR_REHASH_MAX	4
+static unsigned int dir_generation;	/* bumped when commands ran */
+
+/* file layout: this header, then the file names, each followed by NUL */
+#define DIRCACHE_MAGIC	"mkdirc1"
+struct dircache_header {
+	char magic[8];
+	uint64_t dev;
+	uint64_t ino;
+	int64_t sec;		/* directory mtime */
+	int64_t nsec;
+};
+
+
+/* What reading a directory yields, before it becomes a PathEntry.
+ * Several directories can be read at once from threads, see Dir_ReadDirs.
+ */
+struct dirscan {
+	int fd;
+	bool known;		/* st is valid */
+	bool scanned;		/* names are there */
+	struct stat st;
+	char *arena;		/* all names, each followed by NUL */
+	char *end;
+};
+
+#define DIRBUF_SIZE	(64 * 1024)	/* for getdents */
+#define ARENA_SIZE	4096		/* initial size */
+
+/* Dir_MatchFilesi remembers what each pattern matched in a directory,
+ * until the directory gets read again.  The names point into files.
+ */
+struct match_cache {
+	const char **names;
+	unsigned int n;
+	char pattern[1];
+};
+
+static struct ohash_info match_info = {
+	offsetof(struct match_cache, pattern), NULL, hash_calloc, hash_free,
+	element_alloc
+};
 
 /* file names kept in a path entry */
 static struct ohash_info file_info = {
 	0, NULL, hash_calloc, hash_free, element_alloc
 };
+/* all of them show up as one line in the -dH report */
+static const char dir_contents[] = "directory contents";
 
 
 /* Global structure used to cache mtimes.  XXX We don't cache an mtime
@@ -200,13 +290,96 @@ struct file_stamp {
 };
 
 static struct ohash mtimes;
+static struct pool stamp_pool;		/* all of them go at once */
 
 
 static struct ohash_info stamp_info = {
+	offsetof(struct file_stamp, name), &stamp_pool, hash_calloc, hash_free,
+	pool_element_alloc
+};
+
+/* make -t: files waiting for Dir_FlushTouches, with the time they get */
+static struct ohash touched;
+static struct ohash_info touch_info = {
 	offsetof(struct file_stamp, name), NULL, hash_calloc, hash_free,
 	element_alloc
 };
+static pid_t touch_pid;
+
+
+
+/* Inverted index for long search paths: each file name maps to the
+ * first directory on the path that has it, so that a miss costs one probe
+ * instead of one per directory.  Paths with the same directories share an
+ * index, since suff.c gives each suffix its own copy of defaultPath.
+ * Any change to any path makes us look at its directories again, and
+ * freeing a directory throws every index away.
+ */
+#define PATH_INDEX_MIN	4	/* shorter paths are cheap enough to walk */
+
+struct index_entry {
+	struct PathEntry *p;		/* first directory with... */
+	char name[1];			/* ...that file */
+};
+
+static struct ohash_info index_info = {
+	offsetof(struct index_entry, name), NULL, hash_calloc, hash_free,
+	element_alloc
+};
+
+struct path_index {
+	struct path_index *next;
+	struct ohash names;		/* struct index_entry */
+	struct pool pool;		/* where those come from */
+	bool built;
+	bool usable;			/* none of the dirs uses stat */
+	unsigned int checked;		/* dir_generation we last checked */
+	unsigned int rehashes;		/* summed over dirs, to notice
+					 * when one got re-read */
+	unsigned int n;
+	struct PathEntry *dirs[1];	/* those directories, in order */
+};
+
+/* which index a given Lst uses, keyed by the Lst address */
+struct path_cache {
+	struct path_index *index;	/* NULL if too short */
+	unsigned int generation;	/* paths_generation it's valid for */
+	Lst path;
+};
+
+static struct ohash_info cache_info = {
+	offsetof(struct path_cache, path), NULL, hash_calloc, hash_free,
+	element_alloc
+};
+
+static struct path_index *indexes;
+static struct ohash path_caches;
+static unsigned int paths_generation;	/* bumped when any path changes */
+
 
+/* Files we know don't exist: suff.c and exists() ask about the same
+ * missing files over and over.  Good until commands run, i.e., until
+ * dir_generation changes.
+ */
+static struct ohash missing;
+static struct pool missing_pool;
+static unsigned int missing_generation;
+
+static struct ohash_info missing_info = {
+	0, &missing_pool, hash_calloc, hash_free, pool_element_alloc
+};
+
+/* Files Dir_ProbeFiles found, until known_stat asks about them. */
+struct found_stat {
+	struct stat st;
+	char name[1];
+};
+static struct ohash found;
+
+static struct ohash_info found_info = {
+	offsetof(struct found_stat, name), NULL, hash_calloc, hash_free,
+	element_alloc
+};
 
 
 static LIST   theDefaultPath;		/* main search path */
@@ -215,8 +388,6 @@ struct PathEntry *dot; 			/* contents of current directory */
 
 
 
-/* add_file(path, name): add a file name to a path hash structure. */
-static void add_file(struct PathEntry *, const char *);
 /* n = find_file_hashi(p, name, end, hv): retrieve name in a path hash
  * 	structure. */
 static char *find_file_hashi(struct PathEntry *, const char *, const char *,
@@ -230,6 +401,63 @@ static struct file_stamp *find_stampi(const char *, const char *);
 static void record_stamp(const char *, struct timespec);
 
 static bool read_directory(struct PathEntry *);
+/* ok = scan_names(s): read all names from s->fd into one arena. */
+static bool scan_names(struct dirscan *);
+/* ok = setup_directory(p, s): fill p with what was read into s. */
+static bool setup_directory(struct PathEntry *, struct dirscan *);
+/* hash_names(p, names, end): hash the names in place, one after the
+ *	other, each followed by NUL. */
+static void hash_names(struct PathEntry *, char *, char *);
+/* m = find_matches(p, word, eword): names in p that match word. */
+static struct match_cache *find_matches(struct PathEntry *, const char *,
+    const char *);
+/* find_subdirs(p): fill p->subdirs. */
+static void find_subdirs(struct PathEntry *);
+/* clear_files(p): forget the file names we know about. */
+static void clear_files(struct PathEntry *);
+/* revalidate(p): read p again if it changed since. */
+static void revalidate(struct PathEntry *);
+/* ok = dir_has_file(p, name, end, hv): is name in p, as far as we know. */
+static bool dir_has_file(struct PathEntry *, const char *, const char *,
+    uint32_t);
+/* name = dircache_name(&st): cache file for that directory. */
+static char *dircache_name(const struct stat *);
+/* ok = load_dircache(p, &st): fill p from the cache, if it's current. */
+static bool load_dircache(struct PathEntry *, const struct stat *);
+/* save_dircache(p, &st): save p's file names, if it's safe. */
+static void save_dircache(struct PathEntry *, const struct stat *);
+
+/* r = path_stat(p, file, &stb): stat(2) file found in directory p,
+ *	relative to the directory fd if p has one. */
+static int path_stat(struct PathEntry *, const char *, struct stat *);
+/* p = directory_of(file): cached directory file lives in, if any. */
+static struct PathEntry *directory_of(const char *);
+/* r = dir_stat(file, &stb): stat(2) file, through its directory if
+ *	we know it. */
+static int dir_stat(const char *, struct stat *);
+/* r = known_stat(p, file, &stb): like path_stat, but file may already
+ *	be known not to exist. */
+static int known_stat(struct PathEntry *, const char *, struct stat *);
+/* check_missing(): forget missing files if commands ran since. */
+static void check_missing(void);
+/* add_missing(file): record that file doesn't exist. */
+static void add_missing(const char *);
+/* found = background_mtime(name, &mtime): answer from Dir_StartPrefetch,
+ * waiting for it if needed. */
+static bool background_mtime(const char *, struct timespec *);
+/* idx = find_index(path): the index shared by paths with those dirs. */
+static struct path_index *find_index(Lst);
+/* build_index(idx): fill idx from its directories. */
+static void build_index(struct path_index *);
+/* ok = check_index(idx): make idx current, true if we may use it. */
+static bool check_index(struct path_index *);
+/* forget_indexes(): a directory went away, drop all indexes. */
+static void forget_indexes(void);
+/* ok = path_index_find(path, name, end, hv, &p): use the index to find
+ *	the first directory on path with name.  false if path has no
+ *	usable index. */
+static bool path_index_find(Lst, const char *, const char *, uint32_t,
+    struct PathEntry **);
 /* p = DirReaddiri(name, end): read an actual directory, caching results
  * 	as we go.  */
 static struct PathEntry *create_PathEntry(const char *, const char *);
@@ -247,7 +475,7 @@ record_stamp(const char *file, struct timespec t)
 	const char *end = NULL;
 	struct file_stamp *n;
 
-	slot = ohash_qlookupi(&mtimes, file, &end);
+	slot = hash_qlookupi(&mtimes, file, &end);
 	n = ohash_find(&mtimes, slot);
 	if (n)
 		n->mtime = t;
@@ -261,65 +489,453 @@ record_stamp(const char *file, struct timespec t)
 static struct file_stamp *
 find_stampi(const char *file, const char *efile)
 {
-	return ohash_find(&mtimes, ohash_qlookupi(&mtimes, file, &efile));
+	return ohash_find(&mtimes, hash_qlookupi(&mtimes, file, &efile));
 }
 
 /***
  *** PathEntry handling
  ***/
 
-static void
-add_file(struct PathEntry *p, const char *file)
+static char *
+find_file_hashi(struct PathEntry *p, const char *file, const char *efile,
+    uint32_t hv)
 {
-	unsigned int	slot;
-	const char	*end = NULL;
-	char		*n;
 	struct ohash 	*h = &p->files;
 
-	slot = ohash_qlookupi(h, file, &end);
-	n = ohash_find(h, slot);
-	if (n == NULL) {
-		n = ohash_create_entry(&file_info, file, &end);
-		ohash_insert(h, slot, n);
-	}
+	return ohash_find(h, ohash_lookup_interval(h, file, efile, hv));
 }
 
 static char *
-find_file_hashi(struct PathEntry *p, const char *file, const char *efile,
-    uint32_t hv)
+dircache_name(const struct stat *st)
 {
-	struct ohash 	*h = &p->files;
+	char *name;
 
-	return ohash_find(h, ohash_lookup_interval(h, file, efile, hv));
+	if (asprintf(&name, "%s/%llx.%llx", dircache,
+	    (unsigned long long)st->st_dev,
+	    (unsigned long long)st->st_ino) == -1)
+		return NULL;
+	return name;
+}
+
+static bool
+load_dircache(struct PathEntry *p, const struct stat *st)
+{
+	struct dircache_header *h;
+	struct stat cst;
+	char *name, *s, *end;
+	void *m;
+	int fd;
+
+	if ((name = dircache_name(st)) == NULL)
+		return false;
+	fd = open(name, O_RDONLY | O_CLOEXEC);
+	free(name);
+	if (fd == -1)
+		return false;
+	if (fstat(fd, &cst) == -1 || cst.st_size < (off_t)sizeof(*h)) {
+		close(fd);
+		return false;
+	}
+	m = mmap(NULL, cst.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+	close(fd);
+	if (m == MAP_FAILED)
+		return false;
+	h = m;
+	s = (char *)m + sizeof(*h);
+	end = (char *)m + cst.st_size;
+	if (memcmp(h->magic, DIRCACHE_MAGIC, sizeof(h->magic)) != 0 ||
+	    h->dev != (uint64_t)st->st_dev || h->ino != (uint64_t)st->st_ino ||
+	    h->sec != st->st_mtime || h->nsec != st->st_mtimensec ||
+	    (end != s && end[-1] != '\0')) {
+		munmap(m, cst.st_size);
+		return false;
+	}
+	/* the names are used in place */
+	hash_names(p, s, end);
+	p->map = m;
+	p->maplen = cst.st_size;
+	return true;
+}
+
+static void
+save_dircache(struct PathEntry *p, const struct stat *st)
+{
+	struct dircache_header h;
+	unsigned int i;
+	char *name, *tmp, *e;
+	FILE *f;
+	int fd;
+
+	/* files created during the same second as the last change wouldn't
+	 * change the mtime we check against */
+	if (st->st_mtime >= time(NULL) - 1)
+		return;
+	if ((name = dircache_name(st)) == NULL)
+		return;
+	tmp = Str_concat(name, ".XXXXXXXXXX", 0);
+	if ((fd = mkstemp(tmp)) == -1 || (f = fdopen(fd, "w")) == NULL) {
+		if (fd != -1) {
+			close(fd);
+			(void)unlink(tmp);
+		}
+		free(tmp);
+		free(name);
+		return;
+	}
+	memset(&h, 0, sizeof h);
+	memcpy(h.magic, DIRCACHE_MAGIC, sizeof(h.magic));
+	h.dev = st->st_dev;
+	h.ino = st->st_ino;
+	h.sec = st->st_mtime;
+	h.nsec = st->st_mtimensec;
+	fwrite(&h, sizeof h, 1, f);
+	for (e = ohash_first(&p->files, &i); e != NULL;
+	    e = ohash_next(&p->files, &i))
+		fwrite(e, strlen(e) + 1, 1, f);
+	if (fclose(f) == 0)
+		(void)rename(tmp, name);
+	else
+		(void)unlink(tmp);
+	free(tmp);
+	free(name);
+}
+
+static void
+hash_names(struct PathEntry *p, char *s, char *end)
+{
+	unsigned int n = 0, size = 4;
+	char *q;
+
+	for (q = s; q != end; q = strchr(q, '\0') + 1)
+		n++;
+	/* ohash grows past 3/4 full */
+	while ((3U << size) < 4 * n)
+		size++;
+	ohash_init(&p->files, size, &file_info);
+	for (q = s; q != end; q = strchr(q, '\0') + 1) {
+		unsigned int slot = hash_qlookup(&p->files, q);
+
+		if (ohash_find(&p->files, slot) == NULL)
+			ohash_insert(&p->files, slot, q);
+	}
+}
+
+static bool
+scan_names(struct dirscan *s)
+{
+	char *buf, *q;
+	size_t len = 0, size = ARENA_SIZE;
+	int r;
+
+	buf = emalloc(DIRBUF_SIZE);
+	s->arena = emalloc(size);
+	while ((r = getdents(s->fd, buf, DIRBUF_SIZE)) > 0) {
+		for (q = buf; q < buf + r; q += ((struct dirent *)q)->d_reclen) {
+			struct dirent *dp = (struct dirent *)q;
+			size_t l;
+
+			if (dp->d_fileno == 0)
+				continue;
+			if (dp->d_name[0] == '.' &&
+			    (dp->d_name[1] == '\0' ||
+			    (dp->d_name[1] == '.' && dp->d_name[2] == '\0')))
+				continue;
+			l = strlen(dp->d_name) + 1;
+			if (len + l > size) {
+				do {
+					size *= 2;
+				} while (len + l > size);
+				s->arena = erealloc(s->arena, size);
+			}
+			memcpy(s->arena + len, dp->d_name, l);
+			len += l;
+		}
+	}
+	free(buf);
+	if (r == -1) {
+		free(s->arena);
+		return false;
+	}
+	s->end = s->arena + len;
+	s->scanned = true;
+	return true;
 }
 
 static bool
 read_directory(struct PathEntry *p)
 {
-	DIR *d;
-	struct dirent *dp;
+	struct dirscan s;
 
 	if (DEBUG(DIR)) {
 		printf("Caching %s...", p->name);
 		fflush(stdout);
 	}
 
-	if ((d = opendir(p->name)) == NULL)
+	s.fd = open(p->name, O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+	if (s.fd == -1)
 		return false;
+	s.known = fstat(s.fd, &s.st) == 0;
+	s.scanned = false;
+	return setup_directory(p, &s);
+}
 
-	ohash_init(&p->files, 4, &file_info);
+static bool
+setup_directory(struct PathEntry *p, struct dirscan *s)
+{
+	p->map = NULL;
+	p->arena = NULL;
+	p->fd = -1;
+	p->checked = dir_generation;
+	p->matches_init = false;
+	p->subdirs_known = false;
+	p->subdirs = NULL;
+	p->nsubdirs = 0;
+	if (s->known)
+		ts_set_from_stat(s->st, p->mtime);
+
+	if (!s->scanned && s->known && dircache != NULL &&
+	    load_dircache(p, &s->st)) {
+		if (DEBUG(DIR))
+			printf("done (from %s)\n", dircache);
+	} else {
+		if (!s->scanned && !scan_names(s)) {
+			close(s->fd);
+			return false;
+		}
+		hash_names(p, s->arena, s->end);
+		p->arena = s->arena;
+		if (s->known && dircache != NULL)
+			save_dircache(p, &s->st);
+		if (DEBUG(DIR))
+			printf("done\n");
+	}
+	if (dirfd_budget > 0) {
+		p->fd = s->fd;
+		dirfd_budget--;
+	} else
+		close(s->fd);
+	return true;
+}
 
-	while ((dp = readdir(d)) != NULL) {
-		if (dp->d_name[0] == '.' &&
-		    (dp->d_name[1] == '\0' ||
-		    (dp->d_name[1] == '.' && dp->d_name[2] == '\0')))
-			continue;
-		add_file(p, dp->d_name);
+static int
+path_stat(struct PathEntry *p, const char *file, struct stat *stb)
+{
+	if (p->fd == -1 || p == dot)
+		return stat(file, stb);
+	return fstatat(p->fd, file + strlen(p->name) + 1, stb, 0);
+}
+
+static struct PathEntry *
+directory_of(const char *file)
+{
+	const char *base = strrchr(file, '/');
+
+	if (base == NULL || base == file)
+		return NULL;
+	return ohash_find(&knownDirectories,
+	    hash_qlookupi(&knownDirectories, file, &base));
+}
+
+static int
+dir_stat(const char *file, struct stat *stb)
+{
+	return known_stat(directory_of(file), file, stb);
+}
+
+static void
+check_missing(void)
+{
+	struct found_stat *f;
+	unsigned int i;
+
+	if (missing_generation != dir_generation) {
+		ohash_delete(&missing);
+		pool_free_all(&missing_pool);
+		ohash_init(&missing, 4, &missing_info);
+		for (f = ohash_first(&found, &i); f != NULL;
+		    f = ohash_next(&found, &i))
+			free(f);
+		ohash_delete(&found);
+		ohash_init(&found, 4, &found_info);
+		missing_generation = dir_generation;
+	}
+}
+
+static void
+add_missing(const char *file)
+{
+	unsigned int slot;
+	const char *end = NULL;
+
+	slot = hash_qlookupi(&missing, file, &end);
+	if (ohash_find(&missing, slot) == NULL)
+		ohash_insert(&missing, slot,
+		    ohash_create_entry(&missing_info, file, &end));
+}
+
+static int
+known_stat(struct PathEntry *p, const char *file, struct stat *stb)
+{
+	unsigned int slot;
+	const char *end = NULL;
+	int r;
+
+	check_missing();
+	slot = hash_qlookupi(&missing, file, &end);
+	if (ohash_find(&missing, slot) != NULL) {
+		COUNT(DIR_HIT);
+		errno = ENOENT;
+		return -1;
+	}
+	if (ohash_entries(&found) != 0) {
+		struct found_stat *f;
+
+		f = ohash_remove(&found, hash_qlookup(&found, file));
+		if (f != NULL) {
+			COUNT(DIR_HIT);
+			*stb = f->st;
+			free(f);
+			return 0;
+		}
+	}
+	COUNT(DIR_MISS);
+	COUNT(STAT);
+	r = p == NULL ? stat(file, stb) : path_stat(p, file, stb);
+	if (r == -1 && (errno == ENOENT || errno == ENOTDIR))
+		ohash_insert(&missing, slot,
+		    ohash_create_entry(&missing_info, file, &end));
+	return r;
+}
+
+static void
+clear_files(struct PathEntry *p)
+{
+	if (p->matches_init) {
+		struct match_cache *m;
+		unsigned int i;
+
+		for (m = ohash_first(&p->matches, &i); m != NULL;
+		    m = ohash_next(&p->matches, &i)) {
+			free(m->names);
+			free(m);
+		}
+		ohash_delete(&p->matches);
+		p->matches_init = false;
+	}
+	free(p->subdirs);
+	p->subdirs = NULL;
+	p->nsubdirs = 0;
+	p->subdirs_known = false;
+	if (p->map != NULL) {
+		ohash_delete(&p->files);
+		munmap(p->map, p->maplen);
+		p->map = NULL;
+	} else if (p->arena != NULL) {
+		ohash_delete(&p->files);
+		free(p->arena);
+		p->arena = NULL;
+	} else
+		free_hash(&p->files);
+}
+
+static void
+revalidate(struct PathEntry *p)
+{
+	struct stat st;
+	struct timespec mtime;
+
+	p->checked = dir_generation;
+	if (p->use_stat)
+		return;
+	COUNT(STAT);
+	if ((p->fd != -1 ? fstat(p->fd, &st) : stat(p->name, &st)) == -1)
+		ts_set_out_of_date(mtime);
+	else
+		ts_set_from_stat(st, mtime);
+	if (timespeccmp(&mtime, &p->mtime, ==))
+		return;
+	if (++p->rehashes > DIR_REHASH_MAX) {
+		if (DEBUG(DIR))
+			printf("%s changes too often, using stat\n", p->name);
+		p->use_stat = true;
+		return;
 	}
-	(void)closedir(d);
 	if (DEBUG(DIR))
-		printf("done\n");
-	return true;
+		printf("%s changed, ", p->name);
+	clear_files(p);
+	if (p->fd != -1) {
+		close(p->fd);
+		dirfd_budget++;
+	}
+	if (!read_directory(p)) {
+		/* it went away */
+		ohash_init(&p->files, 4, &file_info);
+		p->fd = -1;
+		p->mtime = mtime;
+	}
+}
+
+static bool
+dir_has_file(struct PathEntry *p, const char *file, const char *efile,
+    uint32_t hv)
+{
+	struct stat stb;
+	struct timespec mtime;
+	char *name;
+	int r;
+
+	if (p->checked != dir_generation)
+		revalidate(p);
+	if (!p->use_stat) {
+		COUNT(DIR_HIT);
+		return find_file_hashi(p, file, efile, hv) != NULL;
+	}
+
+	name = p == dot ? Str_dupi(file, efile) :
+	    Str_concati(p->name, strchr(p->name, '\0'), file, efile, '/');
+	r = known_stat(p, name, &stb);
+	if (r == 0) {
+		/* Dir_MTime will want it */
+		ts_set_from_stat(stb, mtime);
+		record_stamp(name, mtime);
+	}
+	free(name);
+	return r == 0;
+}
+
+void
+Dir_Changed(void)
+{
+	dir_generation++;
+	StatCache_Changed();
+}
+
+unsigned int
+Dir_Generation(void)
+{
+	return dir_generation;
+}
+
+unsigned int
+Dir_PathsGeneration(void)
+{
+	return paths_generation;
+}
+
+unsigned int
+PathEntry_version(struct PathEntry *p)
+{
+	if (p->checked != dir_generation)
+		revalidate(p);
+	return p->use_stat ? 0 : p->rehashes + 1;
+}
+
+void
+Dir_ForgetTimes(void)
+{
+	ohash_delete(&mtimes);
+	pool_free_all(&stamp_pool);
+	ohash_init(&mtimes, 8, &stamp_info);
 }
 
 /* Read a directory, either from the disk, or from the cache.  */
@@ -329,17 +945,20 @@ create_PathEntry(const char *name, const char *ename)
 	struct PathEntry *p;
 	unsigned int slot;
 
-	slot = ohash_qlookupi(&knownDirectories, name, &ename);
+	slot = hash_qlookupi(&knownDirectories, name, &ename);
 	p = ohash_find(&knownDirectories, slot);
 
 	if (p == NULL) {
 		p = ohash_create_entry(&dir_info, name, &ename);
 		p->refCount = 0;
+		p->rehashes = 0;
+		p->use_stat = false;
 		if (!read_directory(p)) {
 			free(p);
 			return NULL;
 		}
 		ohash_insert(&knownDirectories, slot, p);
+		hash_register(&p->files, dir_contents);
 	}
 	p->refCount++;
 	return p;
@@ -356,11 +975,27 @@ void
 Dir_Init(void)
 {
 	char *dotname = ".";
+	struct rlimit rl;
+
+	/* leave most fds for jobs */
+	dirfd_budget = 0;
+	if (getrlimit(RLIMIT_NOFILE, &rl) == 0)
+		dirfd_budget = rl.rlim_cur / 4 < DIRFD_MAX ?
+		    rl.rlim_cur / 4 : DIRFD_MAX;
+
+	dircache = getenv("MAKEDIRCACHE");
+	if (dircache != NULL && *dircache == '\0')
+		dircache = NULL;
 
 	Static_Lst_Init(defaultPath);
 	ohash_init(&knownDirectories, 4, &dir_info);
-	ohash_init(&mtimes, 4, &stamp_info);
-
+	ohash_init(&mtimes, 8, &stamp_info);
+	hash_register(&knownDirectories, "directories");
+	hash_register(&mtimes, "file times");
+	ohash_init(&path_caches, 4, &cache_info);
+	ohash_init(&missing, 4, &missing_info);
+	ohash_init(&found, 4, &found_info);
+	ohash_init(&touched, 4, &touch_info);
 
 	dot = create_PathEntry(dotname, dotname+1);
 
@@ -378,13 +1013,28 @@ Dir_Init(void)
  *	will do for now.
  *-----------------------------------------------------------------------
  */
-void
-Dir_MatchFilesi(const char *word, const char *eword, struct PathEntry *p,
-    Lst expansions)
+static struct match_cache *
+find_matches(struct PathEntry *p, const char *word, const char *eword)
 {
-	unsigned int search; 	/* Index into the directory's table */
-	const char *entry; 	/* Current entry in the table */
-
+	struct match_cache *m;
+	unsigned int slot, search, max = 0;
+	const char *entry;
+	struct Glob *g;
+
+	if (!p->matches_init) {
+		ohash_init(&p->matches, 3, &match_info);
+		p->matches_init = true;
+	}
+	slot = hash_qlookupi(&p->matches, word, &eword);
+	m = ohash_find(&p->matches, slot);
+	if (m != NULL)
+		return m;
+
+	/* the same pattern against every file */
+	g = Str_CompileGlobi(word, eword);
+	m = ohash_create_entry(&match_info, word, &eword);
+	m->names = NULL;
+	m->n = 0;
 	for (entry = ohash_first(&p->files, &search); entry != NULL;
 	     entry = ohash_next(&p->files, &search)) {
 		/* See if the file matches the given pattern. We follow the UNIX
@@ -393,11 +1043,235 @@ Dir_MatchFilesi(const char *word, const char *eword, struct PathEntry *p,
 		 * so they won't match `.*'.  */
 		if (*word != '.' && *entry == '.')
 			continue;
-		if (Str_Matchi(entry, strchr(entry, '\0'), word, eword))
-			Lst_AtEnd(expansions,
-			    p == dot  ? estrdup(entry) :
-			    Str_concat(p->name, entry, '/'));
+		if (!Str_GlobMatch(g, entry))
+			continue;
+		if (m->n == max) {
+			max = max == 0 ? 8 : 2 * max;
+			m->names = ereallocarray(m->names, max,
+			    sizeof(*m->names));
+		}
+		m->names[m->n++] = entry;
 	}
+	Str_FreeGlob(g);
+	ohash_insert(&p->matches, slot, m);
+	return m;
+}
+
+void
+Dir_MatchFilesi(const char *word, const char *eword, struct PathEntry *p,
+    Lst expansions)
+{
+	struct match_cache *m;
+	unsigned int i;
+
+	if (p->checked != dir_generation)
+		revalidate(p);
+	m = find_matches(p, word, eword);
+	for (i = 0; i < m->n; i++)
+		Lst_AtEnd(expansions,
+		    p == dot  ? estrdup(m->names[i]) :
+		    Str_concat(p->name, m->names[i], '/'));
+}
+
+static void
+find_subdirs(struct PathEntry *p)
+{
+	struct stat st;
+	struct PathEntry *sub;
+	unsigned int search, max = 0;
+	const char *entry;
+	char *name;
+	int r;
+
+	p->subdirs_known = true;
+	for (entry = ohash_first(&p->files, &search); entry != NULL;
+	     entry = ohash_next(&p->files, &search)) {
+		/* like the shell, don't descend into hidden directories */
+		if (*entry == '.')
+			continue;
+		name = p == dot ? estrdup(entry) :
+		    Str_concat(p->name, entry, '/');
+		/* and don't follow symlinks, so no loops */
+		COUNT(STAT);
+		if (p->fd != -1 && p != dot)
+			r = fstatat(p->fd, entry, &st, AT_SYMLINK_NOFOLLOW);
+		else
+			r = lstat(name, &st);
+		if (r == 0 && S_ISDIR(st.st_mode) &&
+		    (sub = create_PathEntry(name, strchr(name, '\0'))) != NULL) {
+			if (p->nsubdirs == max) {
+				max = max == 0 ? 8 : 2 * max;
+				p->subdirs = ereallocarray(p->subdirs, max,
+				    sizeof(*p->subdirs));
+			}
+			p->subdirs[p->nsubdirs++] = sub;
+		}
+		free(name);
+	}
+}
+
+void
+Dir_MatchFilesRecursivei(const char *word, const char *eword,
+    struct PathEntry *p, Lst expansions)
+{
+	unsigned int i;
+
+	Dir_MatchFilesi(word, eword, p, expansions);
+	if (!p->subdirs_known)
+		find_subdirs(p);
+	for (i = 0; i < p->nsubdirs; i++)
+		Dir_MatchFilesRecursivei(word, eword, p->subdirs[i],
+		    expansions);
+}
+
+/***
+ *** search path index
+ ***/
+
+static struct path_index *
+find_index(Lst path)
+{
+	struct path_index *idx;
+	LstNode ln;
+	unsigned int n = 0;
+
+	for (ln = Lst_First(path); ln != NULL; ln = Lst_Adv(ln))
+		n++;
+	if (n < PATH_INDEX_MIN)
+		return NULL;
+	for (idx = indexes; idx != NULL; idx = idx->next) {
+		if (idx->n != n)
+			continue;
+		for (ln = Lst_First(path), n = 0; ln != NULL;
+		    ln = Lst_Adv(ln), n++)
+			if (idx->dirs[n] != Lst_Datum(ln))
+				break;
+		if (ln == NULL)
+			return idx;
+		n = idx->n;
+	}
+	idx = emalloc(sizeof(*idx) + (n-1) * sizeof(struct PathEntry *));
+	idx->n = n;
+	for (ln = Lst_First(path), n = 0; ln != NULL; ln = Lst_Adv(ln))
+		idx->dirs[n++] = Lst_Datum(ln);
+	idx->built = false;
+	idx->pool.chunks = NULL;
+	idx->pool.ptr = idx->pool.end = NULL;
+	idx->next = indexes;
+	indexes = idx;
+	return idx;
+}
+
+static void
+build_index(struct path_index *idx)
+{
+	struct index_entry *e;
+	unsigned int i, j, slot;
+	const char *file, *end;
+
+	if (idx->built) {
+		ohash_delete(&idx->names);
+		pool_free_all(&idx->pool);
+		idx->built = false;
+	}
+	if (!idx->usable)
+		return;
+	ohash_init(&idx->names, 10, &index_info);
+	for (i = 0; i < idx->n; i++) {
+		struct PathEntry *p = idx->dirs[i];
+
+		for (file = ohash_first(&p->files, &j); file != NULL;
+		    file = ohash_next(&p->files, &j)) {
+			end = NULL;
+			slot = hash_qlookupi(&idx->names, file, &end);
+			if (ohash_find(&idx->names, slot) != NULL)
+				continue;
+			e = pool_alloc(&idx->pool,
+			    offsetof(struct index_entry, name) + (end - file) + 1);
+			memcpy(e->name, file, end - file);
+			e->name[end - file] = '\0';
+			e->p = p;
+			ohash_insert(&idx->names, slot, e);
+		}
+	}
+	idx->built = true;
+}
+
+static bool
+check_index(struct path_index *idx)
+{
+	unsigned int i, rehashes = 0;
+	bool usable = true;
+
+	if (idx->built && idx->checked == dir_generation)
+		return idx->usable;
+	for (i = 0; i < idx->n; i++) {
+		struct PathEntry *p = idx->dirs[i];
+
+		if (p->checked != dir_generation)
+			revalidate(p);
+		if (p->use_stat)
+			usable = false;
+		rehashes += p->rehashes;
+	}
+	idx->checked = dir_generation;
+	if (!idx->built || rehashes != idx->rehashes ||
+	    usable != idx->usable) {
+		idx->rehashes = rehashes;
+		idx->usable = usable;
+		build_index(idx);
+	}
+	return idx->usable;
+}
+
+static void
+forget_indexes(void)
+{
+	struct path_index *idx;
+	struct path_cache *c;
+	unsigned int i;
+
+	while ((idx = indexes) != NULL) {
+		indexes = idx->next;
+		if (idx->built) {
+			ohash_delete(&idx->names);
+			pool_free_all(&idx->pool);
+		}
+		free(idx);
+	}
+	for (c = ohash_first(&path_caches, &i); c != NULL;
+	    c = ohash_next(&path_caches, &i))
+		free(c);
+	ohash_delete(&path_caches);
+	ohash_init(&path_caches, 4, &cache_info);
+}
+
+static bool
+path_index_find(Lst path, const char *name, const char *ename, uint32_t hv,
+    struct PathEntry **pp)
+{
+	struct path_cache *c;
+	struct index_entry *e;
+	unsigned int slot;
+
+	slot = hash_lookup_memory(&path_caches, &path, sizeof(path));
+	c = ohash_find(&path_caches, slot);
+	if (c == NULL) {
+		c = emalloc(sizeof(*c));
+		c->path = path;
+		c->generation = paths_generation - 1;
+		ohash_insert(&path_caches, slot, c);
+	}
+	if (c->generation != paths_generation) {
+		c->index = find_index(path);
+		c->generation = paths_generation;
+	}
+	if (c->index == NULL || !check_index(c->index))
+		return false;
+	e = ohash_find(&c->index->names,
+	    ohash_lookup_interval(&c->index->names, name, ename, hv));
+	*pp = e == NULL ? NULL : e->p;
+	return true;
 }
 
 /*-
@@ -426,6 +1300,7 @@ Dir_FindFileComplexi(const char *name, const char *ename, Lst path,
 			/* Entry for mtimes table */
 	uint32_t hv;	/* hash value for last component in file name */
 	char *q;	/* Str_dupi(name, ename) */
+	struct timespec mtime;
 
 	/* Find the final component of the name and note whether name has a
 	 * slash in it */
@@ -438,7 +1313,7 @@ Dir_FindFileComplexi(const char *name, const char *ename, Lst path,
 		basename = name;
 	}
 
-	hv = ohash_interval(basename, &ename);
+	hv = hash_interval(basename, &ename);
 
 	if (DEBUG(DIR))
 		printf("Searching for %s...", name);
@@ -447,12 +1322,26 @@ Dir_FindFileComplexi(const char *name, const char *ename, Lst path,
 	 * and we always return exactly what the caller specified. */
 	if (checkCurdirFirst &&
 	    (!hasSlash || (basename - name == 2 && *name == '.')) &&
-	    find_file_hashi(dot, basename, ename, hv) != NULL) {
+	    dir_has_file(dot, basename, ename, hv)) {
 		if (DEBUG(DIR))
 			printf("in '.'\n");
 		return Str_dupi(name, ename);
 	}
 
+	/* Without a slash, the index knows the answer right away */
+	if (!hasSlash && path_index_find(path, basename, ename, hv, &p)) {
+		if (p == NULL) {
+			if (DEBUG(DIR))
+				printf("failed (indexed).\n");
+			return NULL;
+		}
+		file = Str_concati(p->name, strchr(p->name, '\0'), basename,
+		    ename, '/');
+		if (DEBUG(DIR))
+			printf("returning %s (indexed)\n", file);
+		return file;
+	}
+
 	/* Then, we look through all the directories on path, seeking one
 	 * containing the final component of name and whose final
 	 * component(s) match name's initial component(s).
@@ -462,7 +1351,7 @@ Dir_FindFileComplexi(const char *name, const char *ename, Lst path,
 		p = Lst_Datum(ln);
 		if (DEBUG(DIR))
 			printf("%s...", p->name);
-		if (find_file_hashi(p, basename, ename, hv) != NULL) {
+		if (dir_has_file(p, basename, ename, hv)) {
 			if (DEBUG(DIR))
 				printf("here...");
 			if (hasSlash) {
@@ -546,7 +1435,7 @@ Dir_FindFileComplexi(const char *name, const char *ename, Lst path,
 			if (DEBUG(DIR))
 				printf("checking %s...", file);
 
-			if (stat(file, &stb) == 0) {
+			if (known_stat(p, file, &stb) == 0) {
 				struct timespec mtime;
 
 				ts_set_from_stat(stb, mtime);
@@ -608,14 +1497,18 @@ Dir_FindFileComplexi(const char *name, const char *ename, Lst path,
 		if (DEBUG(DIR))
 			printf("got it (in mtime cache)\n");
 		return q;
-	} else if (stat(q, &stb) == 0) {
-		struct timespec mtime;
-
+	} else if (StatCache_Lookup(q, &mtime)) {
+		if (DEBUG(DIR))
+			printf("got it (in shared cache)\n");
+		record_stamp(q, mtime);
+		return q;
+	} else if (dir_stat(q, &stb) == 0) {
 		ts_set_from_stat(stb, mtime);
 		if (DEBUG(DIR))
 			printf("Caching %s for %s\n", time_to_string(&mtime), 
 			    q);
 		record_stamp(q, mtime);
+		StatCache_Enter(q, &mtime);
 		return q;
 	} else {
 	    if (DEBUG(DIR))
@@ -637,6 +1530,7 @@ Dir_AddDiri(Lst path, const char *name, const char *ename)
 		Lst_AtEnd(path, p);
 	else if (!Lst_AddNew(path, p))
 		return;
+	paths_generation++;
 }
 
 void *
@@ -644,6 +1538,7 @@ Dir_CopyDir(void *p)
 {
 	struct PathEntry *q = p;
 	q->refCount++;
+	paths_generation++;
 	return p;
 }
 
@@ -652,10 +1547,17 @@ Dir_Destroy(void *pp)
 {
 	struct PathEntry *p = pp;
 
+	paths_generation++;
 	if (--p->refCount == 0) {
+		forget_indexes();
 		ohash_remove(&knownDirectories,
-		    ohash_qlookup(&knownDirectories, p->name));
-		free_hash(&p->files);
+		    hash_qlookup(&knownDirectories, p->name));
+		if (p->fd != -1) {
+			close(p->fd);
+			dirfd_budget++;
+		}
+		clear_files(p);
+		hash_unregister(&p->files);
 		free(p);
 	}
 }
@@ -681,6 +1583,7 @@ Dir_Concat(Lst path1, Lst path2)
 		if (Lst_AddNew(path1, p))
 			p->refCount++;
 	}
+	paths_generation++;
 }
 
 static void
@@ -701,7 +1604,7 @@ Dir_MTime(GNode *gn)
 {
 	char *fullName;
 	struct stat stb;
-	struct file_stamp *entry;
+	struct file_stamp *entry, *pending;
 	unsigned int slot;
 	struct timespec	  mtime;
 
@@ -711,6 +1614,7 @@ Dir_MTime(GNode *gn)
 	if (gn->type & OP_ARCHV)
 		return Arch_MTime(gn);
 
+	trace_begin("mtime", gn->name);
 	if (gn->path == NULL) {
 		fullName = Dir_FindFile(gn->name, defaultPath);
 		if (fullName == NULL)
@@ -718,9 +1622,15 @@ Dir_MTime(GNode *gn)
 	} else
 		fullName = gn->path;
 
-	slot = ohash_qlookup(&mtimes, fullName);
+	pending = ohash_find(&touched, hash_qlookup(&touched, fullName));
+	slot = hash_qlookup(&mtimes, fullName);
 	entry = ohash_find(&mtimes, slot);
-	if (entry != NULL) {
+	if (pending != NULL) {
+		if (DEBUG(DIR))
+			printf("Using touched time %s for %s\n",
+			    time_to_string(&pending->mtime), fullName);
+		mtime = pending->mtime;
+	} else if (entry != NULL) {
 		/* Only do this once -- the second time folks are checking to
 		 * see if the file was actually updated, so we need to
 		 * actually go to the file system.	*/
@@ -728,14 +1638,28 @@ Dir_MTime(GNode *gn)
 			printf("Using cached time %s for %s\n",
 			    time_to_string(&entry->mtime), fullName);
 		mtime = entry->mtime;
-		free(entry);
+		COUNT(DIR_HIT);
+		/* the entry itself goes with stamp_pool */
 		ohash_remove(&mtimes, slot);
-	} else if (stat(fullName, &stb) == 0)
+	} else if (background_mtime(fullName, &mtime)) {
+		if (DEBUG(DIR))
+			printf("Using prefetched time %s for %s\n",
+			    time_to_string(&mtime), fullName);
+		COUNT(DIR_HIT);
+	} else if (gn->built_status != REBUILT &&
+	    StatCache_Lookup(fullName, &mtime)) {
+		if (DEBUG(DIR))
+			printf("Using shared time %s for %s\n",
+			    time_to_string(&mtime), fullName);
+		COUNT(DIR_HIT);
+	} else if (dir_stat(fullName, &stb) == 0) {
 		ts_set_from_stat(stb, mtime);
-	else {
+		StatCache_Enter(fullName, &mtime);
+	} else {
 		if (gn->type & OP_MEMBER) {
 			if (fullName != gn->path)
 				free(fullName);
+			trace_end();
 			return Arch_MemMTime(gn);
 		} else
 			ts_set_out_of_date(mtime);
@@ -744,6 +1668,810 @@ Dir_MTime(GNode *gn)
 		gn->path = fullName;
 
 	gn->mtime = mtime;
+	trace_end();
 	return gn->mtime;
 }
 
+/* On slow file systems, a null build spends most of its time waiting for
+ * stat(2), one node at a time.  Before building anything, we can resolve
+ * paths up front and stat them from a few threads, so that Dir_MTime
+ * finds every answer in the mtimes cache.  The threads only ever see
+ * the todo array.
+ */
+#define PREFETCH_THREADS	8
+#define PREFETCH_MIN		64	/* not worth it for small builds */
+
+struct prefetch {
+	char *name;
+	struct PathEntry *dir;	/* where to look it up from */
+	struct timespec mtime;
+	int error;		/* touching it failed */
+	int rank;		/* in the background, most urgent first */
+	long priority;
+	bool done;		/* under todo_lock */
+	bool used;		/* Dir_MTime already took it */
+};
+
+static struct prefetch *todo;
+static unsigned int todo_n, todo_next;
+static pthread_mutex_t todo_lock = PTHREAD_MUTEX_INITIALIZER;
+
+/* Dir_StartPrefetch: the workers keep going while we start building,
+ * and Dir_MTime waits for the answer it needs.  This only looks at the
+ * names, since the directories may change under us. */
+static pthread_cond_t todo_done = PTHREAD_COND_INITIALIZER;
+static pthread_t background[PREFETCH_THREADS];
+static unsigned int nbackground;
+static bool in_background = false;
+struct prefetch_index {
+	unsigned int i;
+	char name[1];
+};
+static struct ohash_info prefetch_info = {
+	offsetof(struct prefetch_index, name), NULL, hash_calloc, hash_free,
+	element_alloc
+};
+static struct ohash prefetching;	/* name -> todo entry */
+
+static void collect_prefetch(GNode **, unsigned int);
+static int cmp_urgent(const void *, const void *);
+
+static void *
+prefetch_worker(void *arg UNUSED)
+{
+	struct stat stb;
+	unsigned int i;
+
+	for (;;) {
+		pthread_mutex_lock(&todo_lock);
+		i = todo_next++;
+		pthread_mutex_unlock(&todo_lock);
+		if (i >= todo_n)
+			break;
+		if ((todo[i].dir == NULL ? stat(todo[i].name, &stb) :
+		    path_stat(todo[i].dir, todo[i].name, &stb)) == 0)
+			ts_set_from_stat(stb, todo[i].mtime);
+		else
+			ts_set_out_of_date(todo[i].mtime);
+		if (in_background) {
+			pthread_mutex_lock(&todo_lock);
+			todo[i].done = true;
+			pthread_cond_broadcast(&todo_done);
+			pthread_mutex_unlock(&todo_lock);
+		}
+	}
+	return NULL;
+}
+
+/* group lookups by directory */
+static int
+cmp_prefetch(const void *a, const void *b)
+{
+	const struct prefetch *p1 = a;
+	const struct prefetch *p2 = b;
+
+	if (p1->dir != p2->dir)
+		return p1->dir < p2->dir ? -1 : 1;
+	return strcmp(p1->name, p2->name);
+}
+
+void
+Dir_RunWorkers(void *(*worker)(void *))
+{
+	pthread_t tid[PREFETCH_THREADS-1];
+	sigset_t all, old;
+	unsigned int i, started;
+
+	/* signals are for the main thread */
+	sigfillset(&all);
+	pthread_sigmask(SIG_SETMASK, &all, &old);
+	for (started = 0; started < PREFETCH_THREADS-1; started++)
+		if (pthread_create(&tid[started], NULL, worker, NULL) != 0)
+			break;
+	pthread_sigmask(SIG_SETMASK, &old, NULL);
+	(void)worker(NULL);
+	for (i = 0; i < started; i++)
+		pthread_join(tid[i], NULL);
+}
+
+bool
+Dir_SaveLookups(Snapshot *s)
+{
+	struct PathEntry *p;
+	const char *name;
+	struct stat st;
+	struct timespec mtime;
+	unsigned int i;
+
+	snap_put_int(s, ohash_entries(&knownDirectories));
+	for (p = ohash_first(&knownDirectories, &i); p != NULL;
+	    p = ohash_next(&knownDirectories, &i)) {
+		/* it must still look the way it did when we read it */
+		if (p->use_stat || stat(p->name, &st) == -1)
+			return false;
+		ts_set_from_stat(st, mtime);
+		if (!timespeccmp(&mtime, &p->mtime, ==))
+			return false;
+		snap_put_string(s, p->name);
+		snap_put_int(s, mtime.tv_sec);
+		snap_put_int(s, mtime.tv_nsec);
+	}
+	/* older lookups were forgotten */
+	if (missing_generation != dir_generation)
+		return false;
+	snap_put_int(s, ohash_entries(&missing));
+	for (name = ohash_first(&missing, &i); name != NULL;
+	    name = ohash_next(&missing, &i))
+		snap_put_string(s, name);
+	return true;
+}
+
+bool
+Dir_CheckLookups(Snapshot *s)
+{
+	const char *name;
+	struct stat st;
+	struct timespec mtime;
+	unsigned long n, sec, nsec;
+
+	for (n = snap_get_int(s); n > 0; n--) {
+		name = snap_get_string(s);
+		sec = snap_get_int(s);
+		nsec = snap_get_int(s);
+		if (name == NULL || stat(name, &st) == -1)
+			return false;
+		ts_set_from_stat(st, mtime);
+		if ((unsigned long)mtime.tv_sec != sec ||
+		    (unsigned long)mtime.tv_nsec != nsec)
+			return false;
+	}
+	for (n = snap_get_int(s); n > 0; n--) {
+		name = snap_get_string(s);
+		if (name == NULL || stat(name, &st) == 0)
+			return false;
+	}
+	return true;
+}
+
+static int
+cmp_urgent(const void *a, const void *b)
+{
+	const struct prefetch *p1 = a;
+	const struct prefetch *p2 = b;
+
+	if (p1->rank != p2->rank)
+		return p1->rank > p2->rank ? -1 : 1;
+	if (p1->priority != p2->priority)
+		return p1->priority > p2->priority ? -1 : 1;
+	return strcmp(p1->name, p2->name);
+}
+
+static void
+collect_prefetch(GNode **nodes, unsigned int n)
+{
+	unsigned int i;
+
+	todo = ereallocarray(NULL, n, sizeof(struct prefetch));
+	todo_n = 0;
+	for (i = 0; i < n; i++) {
+		GNode *gn = nodes[i];
+		char *name;
+
+		if (gn->type & (OP_PHONY | OP_USE | OP_ARCHV | OP_MEMBER))
+			continue;
+		/* same lookup as Dir_MTime */
+		if (gn->path != NULL)
+			name = estrdup(gn->path);
+		else {
+			name = Dir_FindFile(gn->name, defaultPath);
+			if (name == NULL)
+				name = estrdup(gn->name);
+		}
+		if (find_stampi(name, NULL) != NULL) {
+			free(name);
+			continue;
+		}
+		todo[todo_n].dir = directory_of(name);
+		todo[todo_n].rank = gn->rank;
+		todo[todo_n].priority = gn->priority;
+		todo[todo_n].done = false;
+		todo[todo_n].used = false;
+		todo[todo_n++].name = name;
+	}
+}
+
+void
+Dir_PrefetchMTimes(GNode **nodes, unsigned int n)
+{
+	unsigned int i;
+
+	collect_prefetch(nodes, n);
+	if (todo_n >= PREFETCH_MIN) {
+		trace_begin("mtime", "prefetch");
+		qsort(todo, todo_n, sizeof(struct prefetch), cmp_prefetch);
+		todo_next = 0;
+		Dir_RunWorkers(prefetch_worker);
+		/* counted here, the workers don't touch shared state */
+		COUNT_N(STAT, todo_n);
+		for (i = 0; i < todo_n; i++)
+			record_stamp(todo[i].name, todo[i].mtime);
+		trace_end();
+	}
+	for (i = 0; i < todo_n; i++)
+		free(todo[i].name);
+	free(todo);
+	todo = NULL;
+	todo_n = 0;
+}
+
+void
+Dir_StartPrefetch(GNode **nodes, unsigned int n)
+{
+	struct prefetch_index *e;
+	sigset_t all, old;
+	unsigned int i, slot;
+	const char *end;
+
+	collect_prefetch(nodes, n);
+	if (todo_n < PREFETCH_MIN) {
+		Dir_EndPrefetch();
+		return;
+	}
+	qsort(todo, todo_n, sizeof(struct prefetch), cmp_urgent);
+	ohash_init(&prefetching, 8, &prefetch_info);
+	for (i = 0; i < todo_n; i++) {
+		todo[i].dir = NULL;
+		end = NULL;
+		slot = hash_qlookupi(&prefetching, todo[i].name, &end);
+		if (ohash_find(&prefetching, slot) != NULL)
+			continue;
+		e = ohash_create_entry(&prefetch_info, todo[i].name, &end);
+		e->i = i;
+		ohash_insert(&prefetching, slot, e);
+	}
+	todo_next = 0;
+	in_background = true;
+	/* signals are for the main thread */
+	sigfillset(&all);
+	pthread_sigmask(SIG_SETMASK, &all, &old);
+	for (nbackground = 0; nbackground < PREFETCH_THREADS; nbackground++)
+		if (pthread_create(&background[nbackground], NULL,
+		    prefetch_worker, NULL) != 0)
+			break;
+	pthread_sigmask(SIG_SETMASK, &old, NULL);
+	if (nbackground == 0)
+		(void)prefetch_worker(NULL);
+}
+
+static bool
+background_mtime(const char *name, struct timespec *mtime)
+{
+	struct prefetch_index *e;
+	struct prefetch *p;
+
+	if (!in_background)
+		return false;
+	e = ohash_find(&prefetching, hash_qlookup(&prefetching, name));
+	if (e == NULL)
+		return false;
+	p = &todo[e->i];
+	if (p->used)
+		return false;
+	pthread_mutex_lock(&todo_lock);
+	while (!p->done)
+		pthread_cond_wait(&todo_done, &todo_lock);
+	pthread_mutex_unlock(&todo_lock);
+	p->used = true;
+	*mtime = p->mtime;
+	return true;
+}
+
+void
+Dir_CancelPrefetch(void)
+{
+	if (!in_background)
+		return;
+	pthread_mutex_lock(&todo_lock);
+	if (todo_next < todo_n)
+		todo_next = todo_n;
+	pthread_mutex_unlock(&todo_lock);
+}
+
+void
+Dir_EndPrefetch(void)
+{
+	struct prefetch_index *e;
+	unsigned int i;
+
+	if (in_background) {
+		for (i = 0; i < nbackground; i++)
+			pthread_join(background[i], NULL);
+		in_background = false;
+		/* after Dir_CancelPrefetch, some never got looked at */
+		for (i = 0; i < todo_n; i++) {
+			if (!todo[i].done)
+				continue;
+			COUNT(STAT);
+			if (!todo[i].used)
+				record_stamp(todo[i].name, todo[i].mtime);
+		}
+		for (e = ohash_first(&prefetching, &i); e != NULL;
+		    e = ohash_next(&prefetching, &i))
+			free(e);
+		ohash_delete(&prefetching);
+	}
+	for (i = 0; i < todo_n; i++)
+		free(todo[i].name);
+	free(todo);
+	todo = NULL;
+	todo_n = 0;
+}
+
+/* With a slash in the name, Dir_FindFile may try every directory on the
+ * path with stat(2), then the name itself.  Dir_ProbeFiles goes through
+ * the same steps for lots of lookups at once: each round, the threads do
+ * the next stat(2) of every lookup that isn't over yet.  What isn't there
+ * goes to the missing cache, what is there to the found cache, which
+ * known_stat empties as Dir_FindFile gets to it.
+ */
+struct probe_group {
+	unsigned int i;		/* current name in the group */
+	LstNode ln;		/* next directory to try */
+	int state;
+#define PROBE_NAME	0	/* names[i] is next */
+#define PROBE_DIRS	1	/* trying directories from ln */
+#define PROBE_LAST	2	/* the name itself is next */
+#define PROBE_TRIED	3	/* the name itself wasn't there */
+#define PROBE_DONE	4
+	bool checkedDot;
+};
+
+#define PROBE_CHUNK	16
+
+struct probe {
+	char *file;
+	struct PathEntry *dir;
+	struct probe_group *g;
+	struct stat st;
+	int r;
+	int error;
+};
+
+static char **probe_names;
+static Lst *probe_paths;
+static struct probe *probes;
+static unsigned int probes_n, probes_next;
+
+static bool probe_first(const char *, Lst, struct probe_group *);
+static char *next_probe(struct probe_group *, struct PathEntry **);
+static void add_found(const char *, const struct stat *);
+
+static void *
+probe_worker(void *arg UNUSED)
+{
+	unsigned int i, last;
+
+	for (;;) {
+		/* small chunks, so that the lock doesn't cost more than
+		 * stat(2) itself on local file systems */
+		pthread_mutex_lock(&todo_lock);
+		i = probes_next;
+		probes_next += PROBE_CHUNK;
+		pthread_mutex_unlock(&todo_lock);
+		if (i >= probes_n)
+			break;
+		last = i + PROBE_CHUNK < probes_n ? i + PROBE_CHUNK : probes_n;
+		for (; i < last; i++) {
+			probes[i].r = probes[i].dir == NULL ?
+			    stat(probes[i].file, &probes[i].st) :
+			    path_stat(probes[i].dir, probes[i].file,
+			    &probes[i].st);
+			probes[i].error = errno;
+		}
+	}
+	return NULL;
+}
+
+static void
+add_found(const char *file, const struct stat *st)
+{
+	struct found_stat *f;
+	unsigned int slot;
+	const char *end = NULL;
+
+	slot = hash_qlookupi(&found, file, &end);
+	if (ohash_find(&found, slot) != NULL)
+		return;
+	f = ohash_create_entry(&found_info, file, &end);
+	f->st = *st;
+	ohash_insert(&found, slot, f);
+}
+
+/* what Dir_FindFileComplexi sees before it stats anything: true if
+ * that's the end of it */
+static bool
+probe_first(const char *name, Lst path, struct probe_group *g)
+{
+	struct PathEntry *p;
+	const char *basename, *ename, *p2;
+	char *p1;
+	LstNode ln;
+	uint32_t hv;
+
+	basename = strrchr(name, '/');
+	if (basename == NULL)
+		return true;	/* no stat(2) for those */
+	basename++;
+	ename = NULL;
+	hv = hash_interval(basename, &ename);
+	if (basename - name == 2 && *name == '.' &&
+	    dir_has_file(dot, basename, ename, hv))
+		return true;
+	for (ln = Lst_First(path); ln != NULL; ln = Lst_Adv(ln)) {
+		p = Lst_Datum(ln);
+		if (dir_has_file(p, basename, ename, hv)) {
+			p1 = p->name + strlen(p->name) - 1;
+			p2 = basename - 2;
+			while (p2 >= name && p1 >= p->name && *p1 == *p2) {
+				p1--;
+				p2--;
+			}
+			if (p2 >= name || (p1 >= p->name && *p1 != '/'))
+				continue;
+			return true;
+		} else {
+			for (p1 = p->name, p2 = name; *p1 && *p1 == *p2;
+			    p1++, p2++)
+				continue;
+			if (*p1 == '\0' && p2 == basename - 1) {
+				/* not there: on to the next name */
+				g->i++;
+				g->state = PROBE_NAME;
+				return false;
+			}
+		}
+	}
+	g->checkedDot = false;
+	if (*name == '/')
+		g->state = PROBE_LAST;
+	else {
+		g->state = PROBE_DIRS;
+		g->ln = Lst_First(path);
+	}
+	return false;
+}
+
+/* the next file g's lookups would stat, if any */
+static char *
+next_probe(struct probe_group *g, struct PathEntry **dir)
+{
+	const char *name;
+	struct PathEntry *p;
+	struct timespec mtime;
+	char *file;
+
+	for (;;) {
+		name = probe_names[g->i];
+		switch (g->state) {
+		case PROBE_NAME:
+			if (name == NULL ||
+			    probe_first(name, probe_paths[g->i], g)) {
+				g->state = PROBE_DONE;
+				return NULL;
+			}
+			break;
+		case PROBE_DIRS:
+			if (g->ln == NULL) {
+				if (g->checkedDot) {
+					g->i++;
+					g->state = PROBE_NAME;
+				} else
+					g->state = PROBE_LAST;
+				break;
+			}
+			p = Lst_Datum(g->ln);
+			g->ln = Lst_Adv(g->ln);
+			if (p == dot) {
+				file = estrdup(name);
+				g->checkedDot = true;
+			} else
+				file = Str_concat(p->name, name, '/');
+			if (ohash_find(&missing,
+			    hash_qlookup(&missing, file)) != NULL) {
+				free(file);
+				break;
+			}
+			*dir = p;
+			return file;
+		case PROBE_LAST:
+			if (find_stampi(name, NULL) != NULL ||
+			    StatCache_Lookup(name, &mtime)) {
+				g->state = PROBE_DONE;
+				return NULL;
+			}
+			g->state = PROBE_TRIED;
+			if (ohash_find(&missing,
+			    hash_qlookup(&missing, name)) != NULL)
+				break;
+			*dir = directory_of(name);
+			return estrdup(name);
+		case PROBE_TRIED:
+			g->i++;
+			g->state = PROBE_NAME;
+			break;
+		default:
+			return NULL;
+		}
+	}
+}
+
+void
+Dir_ProbeFiles(char **names, Lst *paths, unsigned int n)
+{
+	struct probe_group *groups;
+	unsigned int i, ngroups = 0;
+
+	check_missing();
+	probe_names = names;
+	probe_paths = paths;
+	groups = ereallocarray(NULL, n == 0 ? 1 : n, sizeof *groups);
+	for (i = 0; i < n; i++)
+		if (i == 0 || names[i-1] == NULL) {
+			groups[ngroups].i = i;
+			groups[ngroups++].state = PROBE_NAME;
+		}
+	probes = ereallocarray(NULL, ngroups == 0 ? 1 : ngroups,
+	    sizeof(struct probe));
+	trace_begin("dir", "probe");
+	for (;;) {
+		probes_n = 0;
+		for (i = 0; i < ngroups; i++) {
+			struct PathEntry *dir = NULL;
+			char *file = next_probe(&groups[i], &dir);
+
+			if (file == NULL)
+				continue;
+			probes[probes_n].file = file;
+			probes[probes_n].dir = dir;
+			probes[probes_n++].g = &groups[i];
+		}
+		if (probes_n == 0)
+			break;
+		probes_next = 0;
+		if (probes_n >= PREFETCH_MIN)
+			Dir_RunWorkers(probe_worker);
+		else
+			(void)probe_worker(NULL);
+		COUNT_N(STAT, probes_n);
+		for (i = 0; i < probes_n; i++) {
+			if (probes[i].r == 0) {
+				add_found(probes[i].file, &probes[i].st);
+				probes[i].g->state = PROBE_DONE;
+			} else if (probes[i].error == ENOENT ||
+			    probes[i].error == ENOTDIR)
+				add_missing(probes[i].file);
+			free(probes[i].file);
+		}
+	}
+	trace_end();
+	free(probes);
+	probes = NULL;
+	free(groups);
+}
+
+/* A .PATH line with lots of directories: read them all from threads,
+ * then turn them into PathEntries in order.  The following Dir_AddDiri
+ * calls will find them in knownDirectories.
+ */
+#define READDIRS_MIN		4
+
+struct readdir_todo {
+	char *name;
+	struct dirscan scan;
+	bool ok;
+};
+
+static struct readdir_todo *dirs_todo;
+static unsigned int dirs_n, dirs_next;
+
+static void *
+readdir_worker(void *arg UNUSED)
+{
+	struct readdir_todo *t;
+	unsigned int i;
+
+	for (;;) {
+		pthread_mutex_lock(&todo_lock);
+		i = dirs_next++;
+		pthread_mutex_unlock(&todo_lock);
+		if (i >= dirs_n)
+			break;
+		t = &dirs_todo[i];
+		t->ok = false;
+		t->scan.scanned = false;
+		t->scan.fd = open(t->name, O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+		if (t->scan.fd == -1)
+			continue;
+		t->scan.known = fstat(t->scan.fd, &t->scan.st) == 0;
+		/* MAKEDIRCACHE beats reading the directory */
+		if (t->scan.known && dircache != NULL)
+			t->ok = true;
+		else if (scan_names(&t->scan))
+			t->ok = true;
+		else
+			close(t->scan.fd);
+	}
+	return NULL;
+}
+
+void
+Dir_ReadDirs(const char *line)
+{
+	const char *pos, *word, *end;
+	struct PathEntry *p;
+	unsigned int i, slot, n = 0;
+
+	for (pos = line; iterate_words(&pos) != NULL;)
+		n++;
+	if (n < READDIRS_MIN)
+		return;
+
+	dirs_todo = ereallocarray(NULL, n, sizeof(struct readdir_todo));
+	dirs_n = 0;
+	for (pos = line; (word = iterate_words(&pos)) != NULL;) {
+		slot = hash_qlookupi(&knownDirectories, word, &pos);
+		if (ohash_find(&knownDirectories, slot) == NULL)
+			dirs_todo[dirs_n++].name = Str_dupi(word, pos);
+	}
+	if (dirs_n >= READDIRS_MIN) {
+		trace_begin("dir", "readdirs");
+		dirs_next = 0;
+		Dir_RunWorkers(readdir_worker);
+		trace_end();
+	} else
+		for (i = 0; i < dirs_n; i++)
+			dirs_todo[i].ok = false;
+
+	for (i = 0; i < dirs_n; i++) {
+		struct readdir_todo *t = &dirs_todo[i];
+
+		end = NULL;
+		slot = hash_qlookupi(&knownDirectories, t->name, &end);
+		if (t->ok && ohash_find(&knownDirectories, slot) != NULL) {
+			/* same name twice */
+			close(t->scan.fd);
+			if (t->scan.scanned)
+				free(t->scan.arena);
+		} else if (t->ok) {
+			if (DEBUG(DIR)) {
+				printf("Caching %s...", t->name);
+				fflush(stdout);
+			}
+			p = ohash_create_entry(&dir_info, t->name, &end);
+			p->refCount = 0;
+			p->rehashes = 0;
+			p->use_stat = false;
+			if (setup_directory(p, &t->scan)) {
+				ohash_insert(&knownDirectories, slot, p);
+				hash_register(&p->files, dir_contents);
+			} else
+				free(p);
+		}
+		free(t->name);
+	}
+	free(dirs_todo);
+	dirs_todo = NULL;
+}
+
+void
+Dir_Touch(const char *file)
+{
+	static struct timespec now;
+	struct file_stamp *n;
+	unsigned int slot;
+	const char *end = NULL;
+
+	if (touch_pid == 0) {
+		touch_pid = getpid();
+		atexit(Dir_FlushTouches);
+	}
+	/* the whole batch gets the same time */
+	if (ohash_entries(&touched) == 0)
+		clock_gettime(CLOCK_REALTIME, &now);
+	slot = hash_qlookupi(&touched, file, &end);
+	if (ohash_find(&touched, slot) != NULL)
+		return;
+	n = ohash_create_entry(&touch_info, file, &end);
+	n->mtime = now;
+	ohash_insert(&touched, slot, n);
+}
+
+static void *
+touch_worker(void *arg UNUSED)
+{
+	struct timespec ts[2];
+	const char *name;
+	unsigned int i;
+	int dfd, fd;
+
+	for (;;) {
+		pthread_mutex_lock(&todo_lock);
+		i = todo_next++;
+		pthread_mutex_unlock(&todo_lock);
+		if (i >= todo_n)
+			break;
+		/* same shortcut as path_stat */
+		if (todo[i].dir == NULL || todo[i].dir->fd == -1 ||
+		    todo[i].dir == dot) {
+			dfd = AT_FDCWD;
+			name = todo[i].name;
+		} else {
+			dfd = todo[i].dir->fd;
+			name = todo[i].name + strlen(todo[i].dir->name) + 1;
+		}
+		ts[0] = ts[1] = todo[i].mtime;
+		todo[i].error = 0;
+		if (utimensat(dfd, name, ts, 0) == 0)
+			continue;
+		/* we may only be able to set the current time */
+		if (errno == EPERM && utimensat(dfd, name, NULL, 0) == 0)
+			continue;
+		/* the file isn't there: create it */
+		fd = openat(dfd, name, O_RDWR | O_CREAT, 0666);
+		if (fd == -1)
+			todo[i].error = errno;
+		else {
+			if (futimens(fd, ts) == -1)
+				(void)futimens(fd, NULL);
+			close(fd);
+		}
+	}
+	return NULL;
+}
+
+void
+Dir_FlushTouches(void)
+{
+	struct file_stamp *n;
+	unsigned int i;
+
+	/* forked children that exit() have no business here */
+	if (ohash_entries(&touched) == 0 || getpid() != touch_pid)
+		return;
+	/* the todo array is not ours yet */
+	Dir_EndPrefetch();
+	todo = ereallocarray(NULL, ohash_entries(&touched),
+	    sizeof(struct prefetch));
+	todo_n = 0;
+	for (n = ohash_first(&touched, &i); n != NULL;
+	    n = ohash_next(&touched, &i)) {
+		todo[todo_n].name = n->name;
+		todo[todo_n].dir = directory_of(n->name);
+		todo[todo_n++].mtime = n->mtime;
+	}
+	trace_begin("touch", "batch");
+	todo_next = 0;
+	if (todo_n >= PREFETCH_MIN) {
+		qsort(todo, todo_n, sizeof(struct prefetch), cmp_prefetch);
+		Dir_RunWorkers(touch_worker);
+	} else
+		(void)touch_worker(NULL);
+	for (i = 0; i < todo_n; i++) {
+		if (todo[i].error != 0)
+			fprintf(stderr, "*** couldn't touch %s: %s\n",
+			    todo[i].name, strerror(todo[i].error));
+		else
+			record_stamp(todo[i].name, todo[i].mtime);
+	}
+	trace_end();
+	free(todo);
+	todo = NULL;
+	todo_n = 0;
+	for (n = ohash_first(&touched, &i); n != NULL;
+	    n = ohash_next(&touched, &i))
+		free(n);
+	ohash_delete(&touched);
+	ohash_init(&touched, 4, &touch_info);
+	/* some files may have been created */
+	Dir_Changed();
+}
@@ -115,6 +115,90 @@ extern char *Dir_FindFileComplexi(const char *, const char *, Lst, bool);
  */
 extern struct timespec Dir_MTime(GNode *);
 
+/* Dir_Changed();
+ *	Commands ran, cached directories may have changed.
+ */
+extern void Dir_Changed(void);
+
+/* Dir_ForgetTimes();
+ *	Throw away cached modification times, before looking at the
+ *	same nodes again.
+ */
+extern void Dir_ForgetTimes(void);
+
+/* Dir_PrefetchMTimes(nodes, n);
+ *	Look up the modification times of all those nodes in parallel,
+ *	so that the first Dir_MTime call for each is answered from the
+ *	cache.
+ */
+extern void Dir_PrefetchMTimes(GNode **, unsigned int);
+
+/* Dir_StartPrefetch(nodes, n);
+ *	Same as Dir_PrefetchMTimes, but return right away: the threads
+ *	look at the nodes with the highest priority first, and Dir_MTime
+ *	waits for them as needed.
+ */
+extern void Dir_StartPrefetch(GNode **, unsigned int);
+
+/* Dir_CancelPrefetch();
+ *	Tell the threads started by Dir_StartPrefetch to stop, once they're
+ *	done with the nodes at hand.  Dir_EndPrefetch still has to be
+ *	called.
+ */
+extern void Dir_CancelPrefetch(void);
+
+/* Dir_EndPrefetch();
+ *	Wait for the threads started by Dir_StartPrefetch, and put what
+ *	they found that nobody asked for yet in the cache.
+ */
+extern void Dir_EndPrefetch(void);
+
+/* Dir_ProbeFiles(names, paths, n);
+ *	names is a run of groups, each ended by a NULL; paths has the
+ *	matching entries.  In a group, Dir_FindFile(names[i], paths[i])
+ *	is coming for each name in turn until one is found: do the
+ *	stat(2) calls those need for names with a slash from threads,
+ *	and remember what they found.
+ */
+extern void Dir_ProbeFiles(char **, Lst *, unsigned int);
+
+/* Dir_RunWorkers(fn);
+ *	Run fn from several threads, including this one, with signals
+ *	blocked in the new threads.  fn must leave make's own data
+ *	alone, and use its own locks.
+ */
+extern void Dir_RunWorkers(void *(*)(void *));
+
+/* Dir_ReadDirs(line);
+ *	Read all directories named on line (as from a .PATH line) at
+ *	once, so that adding them to paths is just a lookup.
+ */
+extern void Dir_ReadDirs(const char *);
+
+/* Dir_Touch(file);
+ *	make -t: give file the current time, eventually.  Dir_MTime
+ *	answers with that time right away.
+ */
+extern void Dir_Touch(const char *);
+
+/* Dir_FlushTouches();
+ *	Apply all pending Dir_Touch, from threads if there are many.
+ *	Also done before running commands, and on exit.
+ */
+extern void Dir_FlushTouches(void);
+
+/* ok = Dir_SaveLookups(s);
+ *	Save the directories we read, and the files we found missing,
+ *	so that a later run can tell whether looking again would give
+ *	the same answers.  False if they already changed.
+ */
+extern bool Dir_SaveLookups(Snapshot *);
+
+/* same = Dir_CheckLookups(s);
+ *	Check the directories and files saved by Dir_SaveLookups.
+ */
+extern bool Dir_CheckLookups(Snapshot *);
+
 
 
 
@@ -125,6 +209,11 @@ extern struct timespec Dir_MTime(GNode *);
 /* List of directories to search when looking for targets. */
 extern Lst	defaultPath;
 
+/* Changes whenever any search path did, so that callers can remember
+ * what Dir_FindFile answered in the meantime, along with Dir_Generation().
+ */
+extern unsigned int Dir_PathsGeneration(void);
+
 
 /* communication between dir.c and direxpand.c */
 struct PathEntry;
@@ -132,5 +221,13 @@ extern struct PathEntry *dot;
 /* Handles wildcard expansion on a given directory. */
 extern  void Dir_MatchFilesi(const char *, const char *, struct PathEntry *,
     Lst);
+/* Same, in the directory and all its subdirectories, for **. */
+extern void Dir_MatchFilesRecursivei(const char *, const char *,
+    struct PathEntry *, Lst);
 extern char *PathEntry_name(struct PathEntry *);
+/* Changes whenever cached directories may have changed. */
+extern unsigned int Dir_Generation(void);
+/* Changes whenever the contents of that directory did, 0 if we don't
+ * cache them. */
+extern unsigned int PathEntry_version(struct PathEntry *);
 #endif /* DIR_H */
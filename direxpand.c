@@ -59,9 +59,12 @@
  * SUCH DAMAGE.
  */
 
+#include <stddef.h>
+#include <stdint.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <ohash.h>
 #include "config.h"
 #include "defines.h"
 #include "lst.h"
@@ -70,9 +73,47 @@
 #include "error.h"
 #include "memory.h"
 #include "str.h"
+#include "hash.h"
+
+/* Expansions kept by Dir_ExpandShared: the same wildcard source may
+ * appear in lots of dependency lines.
+ * An expansion stays good as long as the path holds the same
+ * directories, and none of the directories we looked into changed.  */
+struct dir_version {
+	struct PathEntry *p;
+	unsigned int version;
+};
+
+struct expansion {
+	Lst path;
+	unsigned int generation;	/* Dir_Generation() when checked */
+	bool reliable;			/* false for ** and missing dirs */
+	void **dirs;			/* what path held, after expanding */
+	unsigned int ndirs;
+	struct dir_version *seen;	/* all directories we looked into */
+	unsigned int nseen, maxseen;
+	char **words;
+	unsigned int n;
+	char name[1];			/* the pattern */
+};
+
+static struct ohash_info expansion_info = {
+	offsetof(struct expansion, name), NULL, hash_calloc, hash_free,
+	element_alloc
+};
+
+static struct ohash expansions_cache;
+static bool expansions_init = false;
+static struct expansion *recording;	/* the one being filled */
+
+static void record_dir(struct PathEntry *);
+static bool expansion_valid(struct expansion *, Lst);
+static void fill_expansion(struct expansion *, Lst);
 
 /* Handles simple wildcard expansion on a path. */
 static void PathMatchFilesi(const char *, const char *, Lst, Lst);
+/* Handles recursive ** patterns. */
+static bool DirExpandRecursivei(const char *, const char *, Lst, Lst);
 /* Handles wildcards expansion except for curly braces. */
 static void DirExpandWildi(const char *, const char *, Lst, Lst);
 #define DirExpandWild(s, l1, l2) DirExpandWildi(s, strchr(s, '\0'), l1, l2)
@@ -94,8 +135,66 @@ PathMatchFilesi(const char *word, const char *eword, Lst path, Lst expansions)
 {
 	LstNode	ln;		/* Current node */
 
-	for (ln = Lst_First(path); ln != NULL; ln = Lst_Adv(ln))
+	for (ln = Lst_First(path); ln != NULL; ln = Lst_Adv(ln)) {
+		record_dir(Lst_Datum(ln));
 		Dir_MatchFilesi(word, eword, Lst_Datum(ln), expansions);
+	}
+}
+
+/*-
+ *-----------------------------------------------------------------------
+ * DirExpandRecursivei:
+ *	Expand a ** component: it matches any number of directories,
+ *	except hidden ones, so the last component is looked for in the
+ *	directory before it and every directory below.
+ *	Only the last component may come after **, and the directory
+ *	before it may not have wildcards.
+ *	Returns false if word isn't like that.
+ *-----------------------------------------------------------------------
+ */
+static bool
+DirExpandRecursivei(const char *word, const char *eword, Lst path,
+    Lst expansions)
+{
+	const char *cp, *dir, *pattern;
+	char *dirpath, *dp;
+	struct PathEntry *p;
+	LIST temp;
+
+	for (cp = word; cp + 2 < eword; cp++)
+		if (cp[0] == '*' && cp[1] == '*' && cp[2] == '/' &&
+		    (cp == word || cp[-1] == '/'))
+			break;
+	if (cp + 2 >= eword)
+		return false;
+	pattern = cp + 3;
+	if (memchr(pattern, '/', eword - pattern) != NULL)
+		return false;
+	/* we don't keep track of every subdirectory */
+	if (recording != NULL)
+		recording->reliable = false;
+
+	if (cp == word) {
+		Dir_MatchFilesRecursivei(pattern, eword, dot, expansions);
+		return true;
+	}
+	/* the leading directory can't have wildcards... */
+	for (dir = word; dir != cp; dir++)
+		if (*dir == '*' || *dir == '?' || *dir == '[')
+			return false;
+	/* ...and we find it like DirExpandWildi does */
+	dirpath = Dir_FindFilei(word, cp, path);
+	if (dirpath == NULL)
+		return true;
+	dp = strchr(dirpath, '\0');
+	while (dp > dirpath + 1 && dp[-1] == '/')
+		dp--;
+	Lst_Init(&temp);
+	Dir_AddDiri(&temp, dirpath, dp);
+	if ((p = Lst_DeQueue(&temp)) != NULL)
+		Dir_MatchFilesRecursivei(pattern, eword, p, expansions);
+	free(dirpath);
+	return true;
 }
 
 /*-
@@ -115,9 +214,13 @@ DirExpandWildi(const char *word, const char *eword, Lst path, Lst expansions)
 	const char *cp;
 	const char *slash; /* keep track of first slash before wildcard */
 
+	if (DirExpandRecursivei(word, eword, path, expansions))
+		return;
+
 	slash = memchr(word, '/', eword - word);
 	if (slash == NULL) {
 		/* First the files in dot.  */
+		record_dir(dot);
 		Dir_MatchFilesi(word, eword, dot, expansions);
 
 		/* Then the files in every other directory on the path.  */
@@ -158,7 +261,9 @@ DirExpandWildi(const char *word, const char *eword, Lst path, Lst expansions)
 					PathMatchFilesi(slash+1, eword, &temp,
 					    expansions);
 					Lst_Destroy(&temp, NOFREE);
-				}
+				} else if (recording != NULL)
+					/* it could show up anywhere */
+					recording->reliable = false;
 			} else
 				/* Start the search from the local directory. */
 				PathMatchFilesi(word, eword, path, expansions);
@@ -294,6 +399,120 @@ Dir_Expandi(const char *word, const char *eword, Lst path, Lst expansions)
 	}
 }
 
+static void
+record_dir(struct PathEntry *p)
+{
+	if (recording == NULL)
+		return;
+	if (recording->nseen == recording->maxseen) {
+		recording->maxseen = recording->maxseen * 2 + 4;
+		recording->seen = ereallocarray(recording->seen,
+		    recording->maxseen, sizeof(struct dir_version));
+	}
+	recording->seen[recording->nseen].p = p;
+	recording->seen[recording->nseen++].version = PathEntry_version(p);
+}
+
+static bool
+expansion_valid(struct expansion *e, Lst path)
+{
+	LstNode ln;
+	unsigned int i;
+
+	if (!e->reliable || e->path != path)
+		return false;
+	/* first the path, so that all seen directories are still there */
+	for (i = 0, ln = Lst_First(path); ln != NULL; ln = Lst_Adv(ln), i++)
+		if (i == e->ndirs || e->dirs[i] != Lst_Datum(ln))
+			return false;
+	if (i != e->ndirs)
+		return false;
+	/* then, if commands ran, look at the directories again */
+	if (e->generation != Dir_Generation()) {
+		for (i = 0; i < e->nseen; i++)
+			if (e->seen[i].version == 0 ||
+			    PathEntry_version(e->seen[i].p) !=
+			    e->seen[i].version)
+				return false;
+		e->generation = Dir_Generation();
+	}
+	return true;
+}
+
+static void
+fill_expansion(struct expansion *e, Lst path)
+{
+	LIST exp;
+	LstNode ln;
+	unsigned int i;
+	char *s;
+
+	/* the path is part of it, even if it's not searched */
+	e->reliable = true;
+	e->nseen = 0;
+	recording = e;
+	for (ln = Lst_First(path); ln != NULL; ln = Lst_Adv(ln))
+		record_dir(Lst_Datum(ln));
+	record_dir(dot);
+	Lst_Init(&exp);
+	Dir_Expand(e->name, path, &exp);
+	recording = NULL;
+
+	/* expanding may add directories to the path */
+	e->path = path;
+	e->generation = Dir_Generation();
+	for (e->ndirs = 0, ln = Lst_First(path); ln != NULL;
+	    ln = Lst_Adv(ln))
+		e->ndirs++;
+	e->dirs = ereallocarray(NULL, e->ndirs, sizeof(void *));
+	for (i = 0, ln = Lst_First(path); ln != NULL; ln = Lst_Adv(ln))
+		e->dirs[i++] = Lst_Datum(ln);
+
+	for (e->n = 0, ln = Lst_First(&exp); ln != NULL; ln = Lst_Adv(ln))
+		e->n++;
+	e->words = ereallocarray(NULL, e->n, sizeof(char *));
+	for (i = 0; (s = Lst_DeQueue(&exp)) != NULL;)
+		e->words[i++] = s;
+}
+
+char **
+Dir_ExpandShared(const char *word, Lst path, unsigned int *n)
+{
+	struct expansion *e;
+	const char *eword = NULL;
+	unsigned int slot, i;
+
+	if (!expansions_init) {
+		ohash_init(&expansions_cache, 6, &expansion_info);
+		expansions_init = true;
+	}
+	slot = hash_qlookupi(&expansions_cache, word, &eword);
+	e = ohash_find(&expansions_cache, slot);
+	if (e == NULL) {
+		e = ohash_create_entry(&expansion_info, word, &eword);
+		e->seen = NULL;
+		e->maxseen = 0;
+		ohash_insert(&expansions_cache, slot, e);
+	} else if (expansion_valid(e, path)) {
+		if (DEBUG(DIR)) {
+			printf("expanding \"%s\"...(cached) ", word);
+			for (i = 0; i < e->n; i++)
+				DirPrintWord(e->words[i]);
+			fputc('\n', stdout);
+		}
+		*n = e->n;
+		return e->words;
+	} else {
+		for (i = 0; i < e->n; i++)
+			free(e->words[i]);
+		free(e->words);
+		free(e->dirs);
+	}
+	fill_expansion(e, path);
+	*n = e->n;
+	return e->words;
+}
+
 static void
 DirPrintWord(void *word)
 {
@@ -50,4 +50,12 @@ extern bool Dir_HasWildcardsi(const char *, const char *);
 extern void Dir_Expandi(const char *, const char *, Lst, Lst);
 #define Dir_Expand(n, l1, l2) Dir_Expandi(n, strchr(n, '\0'), l1, l2)
 
+/* words = Dir_ExpandShared(pattern, path, &n);
+ *	Like Dir_Expand, except the expansion is kept: the same pattern
+ *	along the same path only gets expanded again once directories or
+ *	the path change.  The n words are shared, don't modify them.
+ *	They stay valid until the next call.
+ */
+extern char **Dir_ExpandShared(const char *, Lst, unsigned int *);
+
 #endif
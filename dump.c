@@ -40,6 +40,8 @@
 #include "lst.h"
 #include "timestamp.h"
 #include "dir.h"
+#include "garray.h"
+#include "error.h"
 
 /* since qsort doesn't have user data, this needs to be a global... */
 static ptrdiff_t cmp_offset;
@@ -99,11 +101,13 @@ TargPrintOnlySrc(GNode *gn)
     	}
 }
 
-static void
-TargPrintNode(GNode *gn, bool full)
+/* real targets, as opposed to sources and special targets that only
+ * set properties */
+static bool
+is_dumped(GNode *gn)
 {
 	if (OP_NOP(gn->type))
-		return;
+		return false;
 	switch(gn->special) {
 	case SPECIAL_SUFFIXES:
 	case SPECIAL_PHONY:
@@ -111,10 +115,17 @@ TargPrintNode(GNode *gn, bool full)
 	case SPECIAL_NOTHING:
 	case SPECIAL_MAIN:
 	case SPECIAL_IGNORE:
-		return;
+		return false;
 	default:
-		break;
+		return true;
 	}
+}
+
+static void
+TargPrintNode(GNode *gn, bool full)
+{
+	if (!is_dumped(gn))
+		return;
 	if (full) {
 		printf("# %d unmade prerequisites\n", gn->children_left);
 		if (! (gn->type & OP_USE)) {
@@ -200,6 +211,178 @@ targ_dump(bool full)
 	free(t);
 }
 
+/* string s, quoted for json or graphviz */
+static void
+print_quoted(const char *s)
+{
+	putchar('"');
+	for (; *s != '\0'; s++)
+		switch (*s) {
+		case '"':
+		case '\\':
+			putchar('\\');
+			putchar(*s);
+			break;
+		case '\n':
+			fputs("\\n", stdout);
+			break;
+		case '\t':
+			fputs("\\t", stdout);
+			break;
+		default:
+			if ((unsigned char)*s < ' ')
+				printf("\\u%04x", (unsigned char)*s);
+			else
+				putchar(*s);
+		}
+	putchar('"');
+}
+
+static void
+json_list(const char *field, Lst l, bool cmds)
+{
+	LstNode ln;
+	const char *sep = "";
+
+	printf(",\"%s\":[", field);
+	for (ln = Lst_First(l); ln != NULL; ln = Lst_Adv(ln)) {
+		fputs(sep, stdout);
+		if (cmds)
+			print_quoted(((struct command *)Lst_Datum(ln))->string);
+		else
+			print_quoted(((GNode *)Lst_Datum(ln))->name);
+		sep = ",";
+	}
+	putchar(']');
+}
+
+static void
+json_node(GNode *gn)
+{
+	printf("{\"name\":");
+	print_quoted(gn->name);
+	switch (gn->type & OP_OPMASK) {
+	case OP_DEPENDS:
+		printf(",\"op\":\":\""); break;
+	case OP_FORCE:
+		printf(",\"op\":\"!\""); break;
+	case OP_DOUBLEDEP:
+		printf(",\"op\":\"::\""); break;
+	}
+	if (gn->path != NULL) {
+		printf(",\"path\":");
+		print_quoted(gn->path);
+	}
+	if (gn->type & OP_PHONY)
+		printf(",\"phony\":true");
+	json_list("children", &gn->children, false);
+	json_list("commands", &gn->commands, true);
+	printf("}\n");
+}
+
+static void
+dot_node(GNode *gn)
+{
+	LstNode ln;
+
+	if (Lst_IsEmpty(&gn->children)) {
+		putchar('\t');
+		print_quoted(gn->name);
+		printf(";\n");
+	}
+	for (ln = Lst_First(&gn->children); ln != NULL; ln = Lst_Adv(ln)) {
+		putchar('\t');
+		print_quoted(gn->name);
+		printf(" -> ");
+		print_quoted(((GNode *)Lst_Datum(ln))->name);
+		printf(";\n");
+	}
+}
+
+static void
+print_graph_node(GNode *gn, int format)
+{
+	LstNode ln;
+
+	if (!is_dumped(gn))
+		return;
+	switch (format) {
+	case DUMP_TEXT:
+		/* prints the cohorts as well */
+		TargPrintNode(gn, false);
+		return;
+	case DUMP_JSON:
+		json_node(gn);
+		break;
+	case DUMP_DOT:
+		dot_node(gn);
+		break;
+	}
+	for (ln = Lst_First(&gn->cohorts); ln != NULL; ln = Lst_Adv(ln))
+		print_graph_node(Lst_Datum(ln), format);
+}
+
+/* depth-first from the roots, each node printed once */
+static void
+dump_subgraph(Lst roots, int format)
+{
+	struct growableArray stack;
+	char *seen;
+	LstNode ln, ln2;
+	GNode *gn;
+
+	seen = emalloc(Targ_Count());
+	memset(seen, 0, Targ_Count());
+	Array_Init(&stack, 64);
+	for (ln = Lst_Last(roots); ln != NULL; ln = Lst_Rev(ln)) {
+		gn = Targ_FindNode(Lst_Datum(ln), TARG_NOCREATE);
+		if (gn == NULL)
+			Error("no target %s to dump", (char *)Lst_Datum(ln));
+		else
+			Array_Push(&stack, gn);
+	}
+	while ((gn = Array_Pop(&stack)) != NULL) {
+		if (seen[gn->id])
+			continue;
+		seen[gn->id] = 1;
+		print_graph_node(gn, format);
+		for (ln = Lst_Last(&gn->children); ln != NULL; ln = Lst_Rev(ln))
+			if (!seen[((GNode *)Lst_Datum(ln))->id])
+				Array_Push(&stack, Lst_Datum(ln));
+		/* cohorts got printed along with gn, even though parents
+		 * also list them as children */
+		for (ln = Lst_First(&gn->cohorts); ln != NULL; ln = Lst_Adv(ln)) {
+			GNode *cohort = Lst_Datum(ln);
+
+			seen[cohort->id] = 1;
+			for (ln2 = Lst_Last(&cohort->children); ln2 != NULL;
+			    ln2 = Lst_Rev(ln2))
+				Array_Push(&stack, Lst_Datum(ln2));
+		}
+	}
+	free(stack.a);
+	free(seen);
+}
+
+void
+dump_graph(int format, Lst roots)
+{
+	struct ohash *h = targets_hash();
+	unsigned int i;
+	GNode *gn;
+
+	if (format == DUMP_DOT)
+		printf("digraph make {\n");
+	if (Lst_IsEmpty(roots)) {
+		for (gn = ohash_first(h, &i); gn != NULL;
+		    gn = ohash_next(h, &i))
+			print_graph_node(gn, format);
+	} else
+		dump_subgraph(roots, format);
+	if (format == DUMP_DOT)
+		printf("}\n");
+}
+
 static bool dumped_once = false;
 
 void
@@ -32,6 +32,16 @@ extern void dump_data(void);
 /* and of graph debugging options */
 extern void post_mortem(void);
 
+/* dump_graph(format, roots);
+ *	implementation of -P: print the target graph straight from the
+ *	targets table, without sorting or copying anything.  If roots
+ *	isn't empty, only print those targets and what they depend on.
+ */
+#define DUMP_TEXT	1	/* same as -p */
+#define DUMP_JSON	2	/* one json object per target */
+#define DUMP_DOT	3	/* graphviz */
+extern void dump_graph(int, Lst);
+
 struct ohash;
 /* utility functions for both var and targ */
 
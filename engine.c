@@ -60,7 +60,9 @@
  */
 
 #include <sys/types.h>
+#include <sys/stat.h>
 #include <sys/time.h>
+#include <sys/resource.h>
 #include <sys/wait.h>
 #include <assert.h>
 #include <ctype.h>
@@ -68,11 +70,14 @@
 #include <fcntl.h>
 #include <limits.h>
 #include <signal.h>
+#include <spawn.h>
 #include <stdint.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <time.h>
 #include <unistd.h>
+#include <ohash.h>
 #include "config.h"
 #include "defines.h"
 #include "dir.h"
@@ -87,17 +92,35 @@
 #include "make.h"
 #include "pathnames.h"
 #include "error.h"
+#include "trace.h"
+#include "digest.h"
+#include "signature.h"
 #include "str.h"
 #include "memory.h"
+#include "hash.h"
 #include "buf.h"
 #include "job.h"
 #include "lowparse.h"
+#include "stats.h"
+#include "affinity.h"
 
 static void MakeTimeStamp(void *, void *);
-static int rewrite_time(const char *);
+extern char **environ;
+
 static void setup_meta(void);
+static void setup_limits(void);
+static void setup_echo(void);
+static char *short_echo(Job *, const char *);
 static void setup_engine(void);
+static void limit_memory(void);
+static bool oom_retry(Job *);
 static char **recheck_command_for_shell(char **);
+static const char *split_cd(const char *, char **);
+static char **direct_argv(const char *, char ***);
+static void set_pwd(const char *);
+static void forget_paths(void);
+static void check_path_target(const char *);
+static const char *find_in_path(const char *);
 static void list_parents(GNode *, FILE *);
 
 /* XXX due to a bug in make's logic, targets looking like *.a or -l*
@@ -214,33 +237,12 @@ node_failure(GNode *gn)
 	}
 }
 
-/* touch files the hard way, by writing stuff to them */
-static int
-rewrite_time(const char *name)
-{
-	int fd;
-	char c;
-
-	fd = open(name, O_RDWR | O_CREAT, 0666);
-	if (fd < 0)
-		return -1;
-	/*
-	 * Read and write a byte to the file to change
-	 * the modification time.
-	 */
-	if (read(fd, &c, 1) == 1) {
-		(void)lseek(fd, 0, SEEK_SET);
-		(void)write(fd, &c, 1);
-	}
-
-	(void)close(fd);
-	return 0;
-}
-
 void
 Job_Touch(GNode *gn)
 {
 	handle_all_signals();
+	/* as far as the rest of the graph is concerned */
+	gn->built_status = REBUILT;
 	if (gn->type & (OP_USE|OP_OPTIONAL|OP_PHONY)) {
 		/*
 		 * .JOIN, .USE, and .OPTIONAL targets are "virtual" targets
@@ -259,19 +261,11 @@ Job_Touch(GNode *gn)
 		return;
 	}
 
-	if (gn->type & OP_ARCHV) {
+	if (gn->type & OP_ARCHV)
 		Arch_Touch(gn);
-	} else {
-		const char *file = gn->path != NULL ? gn->path : gn->name;
-
-		if (set_times(file) == -1){
-			if (rewrite_time(file) == -1) {
-				(void)fprintf(stderr,
-				    "*** couldn't touch %s: %s", file,
-				    strerror(errno));
-		    	}
-		}
-	}
+	else
+		/* batched, but Make_Update sees the new time */
+		Dir_Touch(gn->path != NULL ? gn->path : gn->name);
 }
 
 void
@@ -305,7 +299,7 @@ Make_HandleUse(GNode	*cgn,	/* The .USE node */
 	    ln = Lst_Adv(ln)) {
 		gn = Lst_Datum(ln);
 
-		if (Lst_AddNew(&pgn->children, gn)) {
+		if (Targ_AddChild(pgn, gn)) {
 			Lst_AtEnd(&gn->parents, pgn);
 			pgn->children_left++;
 		}
@@ -329,36 +323,22 @@ Make_HandleUse(GNode	*cgn,	/* The .USE node */
 		pgn->children_left--;
 }
 
-void
-Make_DoAllVar(GNode *gn)
+/* $> and $? are only computed when something asks for them: link
+ * targets can have thousands of children and never use $?.  */
+static char *
+build_sources(GNode *gn, bool oodate_only)
 {
-	GNode *child;
-	LstNode ln;
-	BUFFER allsrc, oodate;
-	char *target;
-	bool do_oodate;
-	int oodate_count, allsrc_count = 0;
-
-	oodate_count = 0;
-	allsrc_count = 0;
-
-	Var(OODATE_INDEX, gn) = "";
-	Var(ALLSRC_INDEX, gn) = "";
-
-	for (ln = Lst_First(&gn->children); ln != NULL; ln = Lst_Adv(ln)) {
-		child = Lst_Datum(ln);
+	GNode *child, **v;
+	unsigned int i, n;
+	BUFFER buf;
+	char *target, *first = NULL;
+	int count = 0;
+
+	v = Targ_Children(gn, &n);
+	for (i = 0; i < n; i++) {
+		child = v[i];
 		if ((child->type & (OP_USE|OP_INVISIBLE)) != 0)
 			continue;
-		if (OP_NOP(child->type) ||
-		    (target = Var(TARGET_INDEX, child)) == NULL) {
-			/*
-			 * this node is only source; use the specific pathname
-			 * for it
-			 */
-			target = child->path != NULL ? child->path :
-			    child->name;
-		}
-
 		/*
 		 * It goes in the OODATE variable if the parent is younger than
 		 * the child or if the child has been modified more recently
@@ -370,48 +350,58 @@ Make_DoAllVar(GNode *gn)
 		 * kid and anything that relies on the OODATE variable will be
 		 * hosed.
 		 */
-		do_oodate = false;
-		if (is_strictly_before(gn->mtime, child->mtime) ||
-		   (!is_strictly_before(child->mtime, starttime) &&
-		   child->built_status == REBUILT))
-		   	do_oodate = true;
-		if (do_oodate) {
-			oodate_count++;
-			if (oodate_count == 1)
-				Var(OODATE_INDEX, gn) = target;
-			else {
-				if (oodate_count == 2) {
-					Buf_Init(&oodate, 0);
-					Buf_AddString(&oodate,
-					    Var(OODATE_INDEX, gn));
-				}
-				Buf_AddSpace(&oodate);
-				Buf_AddString(&oodate, target);
-			}
+		if (oodate_only &&
+		    !is_strictly_before(gn->mtime, child->mtime) &&
+		    (is_strictly_before(child->mtime, starttime) ||
+		    child->built_status != REBUILT))
+			continue;
+		if (OP_NOP(child->type) ||
+		    (target = Var(TARGET_INDEX, child)) == NULL) {
+			/*
+			 * this node is only source; use the specific pathname
+			 * for it
+			 */
+			target = child->path != NULL ? child->path :
+			    child->name;
 		}
-		allsrc_count++;
-		if (allsrc_count == 1)
-			Var(ALLSRC_INDEX, gn) = target;
+
+		count++;
+		if (count == 1)
+			first = target;
 		else {
-			if (allsrc_count == 2) {
-				Buf_Init(&allsrc, 0);
-				Buf_AddString(&allsrc,
-				    Var(ALLSRC_INDEX, gn));
+			if (count == 2) {
+				Buf_Init(&buf, 0);
+				Buf_AddString(&buf, first);
 			}
-			Buf_AddSpace(&allsrc);
-			Buf_AddString(&allsrc, target);
+			Buf_AddSpace(&buf);
+			Buf_AddString(&buf, target);
 		}
 	}
 
-	if (allsrc_count > 1)
-		Var(ALLSRC_INDEX, gn) = Buf_Retrieve(&allsrc);
-	if (oodate_count > 1)
-		Var(OODATE_INDEX, gn) = Buf_Retrieve(&oodate);
+	if (count == 0)
+		return "";
+	else if (count == 1)
+		return first;
+	else
+		return Buf_Retrieve(&buf);
+}
+
+void
+Make_DoAllVar(GNode *gn)
+{
+	Var(OODATE_INDEX, gn) = var_Lazy;
+	Var(ALLSRC_INDEX, gn) = var_Lazy;
 
 	if (gn->impliedsrc)
 		Var(IMPSRC_INDEX, gn) = Var(TARGET_INDEX, gn->impliedsrc);
 }
 
+char *
+Make_ComputeVar(GNode *gn, int idx)
+{
+	return build_sources(gn, idx == OODATE_INDEX);
+}
+
 /* Wrapper to call Make_TimeStamp from a forEach loop.	*/
 static void
 MakeTimeStamp(void *parent, void *child)
@@ -489,9 +479,22 @@ Make_OODate(GNode *gn)
 				printf(":: operator and no sources...");
 		}
 		oodate = true;
+		/* same contents, the dates don't matter */
+		if (!is_out_of_date(gn->mtime) && gn != gn->youngest &&
+		    Digest_Unchanged(gn)) {
+			if (DEBUG(MAKE))
+				printf("but same contents...");
+			oodate = false;
+		}
 	} else {
 		oodate = false;
 	}
+	/* same dates, or same contents, but not the same recipe */
+	if (!oodate && !(gn->type & OP_USE) && Signature_Changed(gn)) {
+		if (DEBUG(MAKE))
+			printf("commands changed...");
+		oodate = true;
+	}
 
 	/*
 	 * If the target isn't out-of-date, the parents need to know its
@@ -512,6 +515,20 @@ Make_OODate(GNode *gn)
  * directly by us.  */
 static char	    meta[256];
 
+/* JOB_MEMORY_LIMIT caps the data size of each command, which makes it
+ * fail instead of bringing the machine down.  OOM_RETRY deals with the
+ * other case: a command killed outright, that we didn't kill, is most
+ * likely a victim of the kernel running out of memory, so it's worth
+ * running again, with nothing else going on.  */
+static rlim_t job_memory = 0;	/* in bytes, 0 for no limit */
+static int oom_retries = 0;
+
+/* ECHO_SHORT abbreviates echoed commands: a number is how much of the
+ * command to show, anything else shows the tool and the target, like
+ * CC foo.o.  Errors still display the full command.  */
+static bool echo_short = false;
+static size_t echo_width = 0;	/* 0 for tool and target */
+
 void
 setup_meta(void)
 {
@@ -547,11 +564,73 @@ recheck_command_for_shell(char **av)
 	return av;
 }
 
-static void
-run_command(const char *cmd, bool errCheck)
+/* rest = split_cd(cmd, &dir);
+ *	recursive makes look like "cd dir && ${MAKE} target": if cmd has
+ *	that shape, with a plain directory name, returns what follows the
+ *	&&, and the directory to change to first.
+ */
+static const char *
+split_cd(const char *cmd, char **dirp)
+{
+	const char *p, *start;
+
+	if (strncmp(cmd, "cd", 2) != 0 || !ISSPACE(cmd[2]))
+		return NULL;
+	for (p = cmd + 2; ISSPACE(*p); p++)
+		continue;
+	if (*p == '-')
+		return NULL;
+	for (start = p; !ISSPACE(*p) && !meta[(unsigned char)*p] &&
+	    *p != '\'' && *p != '"'; p++)
+		continue;
+	if (p == start || !ISSPACE(*p))
+		return NULL;
+	*dirp = Str_dupi(start, p);
+	while (ISSPACE(*p))
+		p++;
+	if (p[0] != '&' || p[1] != '&') {
+		free(*dirp);
+		return NULL;
+	}
+	for (p += 2; ISSPACE(*p); p++)
+		continue;
+	return p;
+}
+
+/* todo = direct_argv(cmd, &av);
+ *	argument vector to execute cmd without a shell, or NULL.
+ *	av must be freed.
+ */
+static char **
+direct_argv(const char *cmd, char ***avp)
 {
 	const char *p;
-	char *shargv[4];
+	int argc;
+
+	/* Search for meta characters in the command. If there are no meta
+	 * characters, there's no need to execute a shell to execute the
+	 * command.  */
+	for (p = cmd; !meta[(unsigned char)*p]; p++)
+		continue;
+	if (*p != '\0')
+		return NULL;
+	/* No meta-characters, so probably no need to exec a shell.
+	 * Break the command into words to form an argument vector
+	 * we can execute.  */
+	*avp = brk_string(cmd, &argc);
+	return recheck_command_for_shell(*avp);
+}
+
+/* todo = command_argv(cmd, errCheck, shargv, &av, &dir);
+ *	build the argument vector to execute cmd, either shargv for the
+ *	shell, or straight from brk_string(), in which case dir may be
+ *	set to where it should run.  av and dir must be freed.
+ */
+static char **
+command_argv(const char *cmd, bool errCheck, char **shargv, char ***avp,
+    char **dirp)
+{
+	const char *rest;
 	char **todo;
 
 	shargv[0] = _PATH_BSHELL;
@@ -560,26 +639,443 @@ run_command(const char *cmd, bool errCheck)
 	shargv[2] = (char *)cmd;
 	shargv[3] = NULL;
 
-	todo = shargv;
+	*avp = NULL;
+	*dirp = NULL;
 
+	if ((rest = split_cd(cmd, dirp)) != NULL) {
+		if ((todo = direct_argv(rest, avp)) != NULL) {
+			COUNT(NOSHELL);
+			return todo;
+		}
+		free(*avp);
+		*avp = NULL;
+		free(*dirp);
+		*dirp = NULL;
+	}
+	if ((todo = direct_argv(cmd, avp)) != NULL) {
+		COUNT(NOSHELL);
+		return todo;
+	}
+	return shargv;
+}
 
-	/* Search for meta characters in the command. If there are no meta
-	 * characters, there's no need to execute a shell to execute the
-	 * command.  */
-	for (p = cmd; !meta[(unsigned char)*p]; p++)
+/* pid = spawn_command(job, cmd, errCheck, ofd);
+ *	start cmd without copying our address space, which can be large
+ *	after reading lots of makefiles.  Returns -1 on any failure, so
+ *	that the caller can fall back to fork, and report errors the usual
+ *	way.
+ */
+static pid_t
+spawn_command(Job *job, const char *cmd, bool errCheck, int ofd)
+{
+	char *shargv[4];
+	char **todo, **av;
+	char *dir;
+	const char *path;
+	posix_spawn_file_actions_t fa;
+	sigset_t mask;
+	pid_t pid;
+	int r;
+
+	todo = command_argv(cmd, errCheck, shargv, &av, &dir);
+	/* no portable way to chdir or to set limits: run_command and
+	 * limit_memory do it after fork */
+	if (dir != NULL ||
+	    (job_memory != 0 && job->executor == &local_executor) ||
+	    posix_spawn_file_actions_init(&fa) != 0) {
+		free(dir);
+		free(av);
+		return -1;
+	}
+	r = 0;
+	if (ofd != -1) {
+		r = posix_spawn_file_actions_adddup2(&fa, ofd, STDOUT_FILENO);
+		if (r == 0)
+			r = posix_spawn_file_actions_adddup2(&fa, ofd, 
+			    STDERR_FILENO);
+	}
+	if (r == 0) {
+		/* children start with the original signal mask. We may
+		 * get a signal in the meantime, but the handlers just
+		 * take note. */
+		sigprocmask(SIG_BLOCK, NULL, &mask);
+		reset_signal_mask();
+		/* posix_spawnp, as for execvp in run_command */
+		if ((path = find_in_path(todo[0])) == NULL)
+			path = todo[0];
+		r = posix_spawnp(&pid, path, &fa, NULL, todo, environ);
+		sigprocmask(SIG_SETMASK, &mask, NULL);
+	}
+	posix_spawn_file_actions_destroy(&fa);
+	free(av);
+	if (r != 0)
+		return -1;
+	COUNT(FORK);
+	return pid;
+}
+
+static const char *
+kill_command(Job *job, int signo)
+{
+	pid_t pid = job->pid;
+	if (getpgid(pid) != getpgrp()) {
+		if (killpg(pid, signo) == 0)
+			return "group got signal";
+		pid = -pid;
+	} else {
+		if (kill(pid, signo) == 0)
+			return "process got signal";
+	}
+	if (errno == ESRCH)
+		job->flags |= JOB_LOST;
+	return strerror(errno);
+}
+
+const struct executor local_executor = {
+	"local", spawn_command, kill_command
+};
+
+/* builtins: very simple commands we can run without forking.
+ * Each returns an exit code, or -1 if it doesn't handle that specific
+ * form of the command, in which case we run the real thing.
+ */
+static int
+builtin_true(Job *job UNUSED, char **av UNUSED)
+{
+	return 0;
+}
+
+static int
+builtin_false(Job *job UNUSED, char **av UNUSED)
+{
+	return 1;
+}
+
+static int
+builtin_echo(Job *job, char **av)
+{
+	BUFFER buf;
+	char space[MAKE_BSIZE];
+	char **p;
+
+	if (av[1] != NULL && strcmp(av[1], "-n") == 0)
+		return -1;
+	Buf_InitLocal(&buf, space, sizeof(space));
+	for (p = av+1; *p != NULL; p++) {
+		if (p != av+1)
+			Buf_AddSpace(&buf);
+		Buf_AddString(&buf, *p);
+	}
+	job_message(job, stdout, Buf_Retrieve(&buf));
+	Buf_Destroy(&buf);
+	return 0;
+}
+
+static void
+builtin_error(Job *job, const char *cmd, const char *file)
+{
+	char *s;
+
+	if (asprintf(&s, "%s: %s: %s", cmd, file, strerror(errno)) == -1)
+		return;
+	job_message(job, stderr, s);
+	free(s);
+}
+
+static int
+mkdir_parents(char *path)
+{
+	struct stat st;
+	char *slash;
+
+	for (slash = path; (slash = strchr(slash+1, '/')) != NULL;) {
+		*slash = '\0';
+		if (mkdir(path, 0777) == -1 && errno != EEXIST) {
+			*slash = '/';
+			return -1;
+		}
+		*slash = '/';
+	}
+	if (mkdir(path, 0777) == -1) {
+		if (errno != EEXIST || stat(path, &st) == -1 ||
+		    !S_ISDIR(st.st_mode)) {
+			errno = errno == EEXIST ? ENOTDIR : errno;
+			return -1;
+		}
+	}
+	return 0;
+}
+
+static int
+builtin_mkdir(Job *job, char **av)
+{
+	bool parents = false;
+	int code = 0;
+
+	if (av[1] != NULL && strcmp(av[1], "-p") == 0) {
+		parents = true;
+		av++;
+	}
+	if (av[1] == NULL || av[1][0] == '-')
+		return -1;
+	for (av++; *av != NULL; av++)
+		if ((parents ? mkdir_parents(*av) : mkdir(*av, 0777)) == -1) {
+			builtin_error(job, "mkdir", *av);
+			code = 1;
+		}
+	return code;
+}
+
+static int
+builtin_rm(Job *job, char **av)
+{
+	struct stat st;
+	char **p;
+	int code = 0;
+
+	/* only rm -f file... */
+	if (av[1] == NULL || strcmp(av[1], "-f") != 0)
+		return -1;
+	for (p = av+2; *p != NULL; p++)
+		if (**p == '-' || (lstat(*p, &st) == 0 && S_ISDIR(st.st_mode)))
+			return -1;
+	for (p = av+2; *p != NULL; p++)
+		if (unlink(*p) == -1 && errno != ENOENT) {
+			builtin_error(job, "rm", *p);
+			code = 1;
+		}
+	return code;
+}
+
+static int
+builtin_touch(Job *job, char **av)
+{
+	char **p;
+	int fd, code = 0;
+
+	if (av[1] == NULL)
+		return -1;
+	for (p = av+1; *p != NULL; p++)
+		if (**p == '-')
+			return -1;
+	for (p = av+1; *p != NULL; p++) {
+		if (utimensat(AT_FDCWD, *p, NULL, 0) == 0)
+			continue;
+		if (errno == ENOENT) {
+			fd = open(*p, O_WRONLY | O_CREAT, 0666);
+			if (fd != -1) {
+				close(fd);
+				continue;
+			}
+		}
+		builtin_error(job, "touch", *p);
+		code = 1;
+	}
+	return code;
+}
+
+static struct builtin {
+	const char *name;
+	int (*run)(Job *, char **);
+} builtins[] = {
+	{ ":", builtin_true },
+	{ "true", builtin_true },
+	{ "false", builtin_false },
+	{ "echo", builtin_echo },
+	{ "mkdir", builtin_mkdir },
+	{ "rm", builtin_rm },
+	{ "touch", builtin_touch },
+};
+
+/* ran = run_builtin(job, cmd, &code);
+ *	run simple cmd without forking, if we know how.
+ */
+static bool
+run_builtin(Job *job, const char *cmd, int *code)
+{
+	const char *p, *name, *end;
+	char **av;
+	int argc;
+	unsigned int i;
+	bool escaped;
+
+	/* ':' is nothing special to the shell, except as the : builtin */
+	for (p = cmd; !meta[(unsigned char)*p] || *p == ':'; p++)
 		continue;
-	if (*p == '\0') {
-		char *bp;
-		char **av;
-		int argc;
-		/* No meta-characters, so probably no need to exec a shell.
-		 * Break the command into words to form an argument vector
-		 * we can execute.  */
-		av = brk_string(cmd, &argc, &bp);
-		av = recheck_command_for_shell(av);
-		if (av != NULL)
-			todo = av;
+	if (*p != '\0')
+		return false;
+	/* most commands aren't builtins: look at the first word in place
+	 * before building a vector */
+	end = cmd;
+	name = iterate_args(&end, &escaped);
+	if (name == NULL || escaped)
+		return false;
+	for (i = 0; i != sizeof(builtins)/sizeof(builtins[0]); i++)
+		if (strncmp(name, builtins[i].name, end - name) == 0 &&
+		    builtins[i].name[end - name] == '\0')
+			break;
+	if (i == sizeof(builtins)/sizeof(builtins[0]))
+		return false;
+	av = brk_string(cmd, &argc);
+	*code = builtins[i].run(job, av);
+	free(av);
+	if (*code == -1)
+		return false;
+	COUNT(BUILTIN);
+	return true;
+}
+
+/* what the shell's cd would leave in PWD, which sub-makes use if it
+ * matches the directory they find themselves in */
+static void
+set_pwd(const char *dir)
+{
+	const char *pwd = getenv("PWD");
+	char *s;
+
+	if (dir[0] == '/')
+		setenv("PWD", dir, 1);
+	else if (pwd != NULL && pwd[0] == '/') {
+		s = Str_concat(pwd, dir, '/');
+		setenv("PWD", s, 1);
+		free(s);
+	} else
+		unsetenv("PWD");
+}
+
+/* execvp walks PATH for each command: remember where commands were
+ * found, for as long as PATH stays the same, and until a target gets
+ * built in one of its directories.  Commands that aren't there yet may
+ * get built, so misses are not remembered, and the child falls back to
+ * a full execvp if the file went away.  */
+struct exec_path {
+	char *path;
+	char name[1];
+};
+
+static struct ohash_info exec_path_info = {
+	offsetof(struct exec_path, name), NULL,
+	hash_calloc, hash_free, element_alloc
+};
+
+static struct ohash exec_paths;
+static char *exec_paths_for = NULL;	/* the PATH they come from */
+
+static void
+forget_paths(void)
+{
+	struct exec_path *e;
+	unsigned int i;
+
+	for (e = ohash_first(&exec_paths, &i); e != NULL;
+	    e = ohash_next(&exec_paths, &i)) {
+		free(e->path);
+		free(e);
+	}
+	hash_unregister(&exec_paths);
+	ohash_delete(&exec_paths);
+}
+
+/* name just got built: if that's in a PATH directory, it may hide a
+ * command we found further on */
+static void
+check_path_target(const char *name)
+{
+	const char *dir, *edir, *p, *end, *e;
+	char *full = NULL;
+
+	if (exec_paths_for == NULL || ohash_entries(&exec_paths) == 0)
+		return;
+	if (name[0] != '/') {
+		if ((dir = Var_Value(".OBJDIR")) == NULL)
+			return;
+		name = full = Str_concat(dir, name, '/');
 	}
+	dir = name;
+	edir = strrchr(name, '/');
+	if (edir == dir)
+		edir++;
+	for (p = exec_paths_for;; p = end+1) {
+		end = strchr(p, ':');
+		if (end == NULL)
+			end = strchr(p, '\0');
+		for (e = end; e - p > 1 && e[-1] == '/'; e--)
+			continue;
+		if (e - p == edir - dir && strncmp(p, dir, e - p) == 0) {
+			forget_paths();
+			free(exec_paths_for);
+			exec_paths_for = NULL;
+			break;
+		}
+		if (*end == '\0')
+			break;
+	}
+	free(full);
+}
+
+/* returns the full path to name, or NULL to leave it to execvp */
+static const char *
+find_in_path(const char *name)
+{
+	struct exec_path *e;
+	const char *path, *p, *end, *ename = NULL;
+	char *file;
+	struct stat st;
+	unsigned int slot;
+
+	if (strchr(name, '/') != NULL)
+		return NULL;
+	if ((path = getenv("PATH")) == NULL)
+		path = _PATH_DEFPATH;
+	if (exec_paths_for == NULL || strcmp(path, exec_paths_for) != 0) {
+		if (exec_paths_for != NULL)
+			forget_paths();
+		ohash_init(&exec_paths, 6, &exec_path_info);
+		hash_register(&exec_paths, "command paths");
+		free(exec_paths_for);
+		exec_paths_for = estrdup(path);
+	}
+	slot = hash_qlookup(&exec_paths, name);
+	if ((e = ohash_find(&exec_paths, slot)) != NULL)
+		return e->path;
+	for (p = path;; p = end+1) {
+		end = strchr(p, ':');
+		if (end == NULL)
+			end = strchr(p, '\0');
+		/* relative directories depend on where the command runs */
+		if (*p != '/')
+			return NULL;
+		file = Str_concati(p, end, name, strchr(name, '\0'), '/');
+		if (stat(file, &st) == 0 && S_ISREG(st.st_mode) &&
+		    access(file, X_OK) == 0) {
+			e = ohash_create_entry(&exec_path_info, name, &ename);
+			e->path = file;
+			ohash_insert(&exec_paths, slot, e);
+			return file;
+		}
+		free(file);
+		if (*end == '\0')
+			return NULL;
+	}
+}
+
+/* in the child: todo and dir come from command_argv(), path from
+ * find_in_path() */
+static void
+run_command(char **todo, const char *path, const char *dir)
+{
+	if (dir != NULL) {
+		if (chdir(dir) == -1) {
+			fprintf(stderr, "cd: %s: %s\n", dir, strerror(errno));
+			_exit(1);
+		}
+		set_pwd(dir);
+	}
+	/* execvp even with the full path: it doesn't walk PATH, but it
+	 * still runs scripts without #! through sh */
+	if (path != NULL)
+		execvp(path, todo);
+	/* something changed under us */
 	execvp(todo[0], todo);
 
 	if (errno == ENOENT)
@@ -597,7 +1093,12 @@ job_attach_node(Job *job, GNode *node)
 	job->next_cmd = Lst_First(&node->commands);
 	job->exit_type = JOB_EXIT_OKAY;
 	job->location = NULL;
+	job->command = NULL;
 	job->flags = 0;
+	job->retries = 0;
+	job->executor = &local_executor;
+	clock_gettime(CLOCK_MONOTONIC, &job->start);
+	memset(&job->usage, 0, sizeof(job->usage));
 }
 
 void
@@ -616,6 +1117,8 @@ handle_job_status(Job *job, int status)
 
 	debug_job_printf("Process %ld (%s) exited with status %d.\n",
 	    (long)job->pid, job->node->name, status);
+	trace_span(job->slot, &job->cmd_start, job->node->name, job->cmd);
+	check_path_target(job->node->name);
 
 	/* classify status */
 	if (WIFEXITED(status)) {
@@ -644,6 +1147,15 @@ handle_job_status(Job *job, int status)
 			printf("*** Signal %d", job->code);
 	}
 
+	if (oom_retry(job)) {
+		if (silent)
+			printf("*** Signal %d", job->code);
+		printf(" in target '%s', running it again alone\n",
+		    job->node->name);
+		free(job->cmd);
+		return;
+	}
+
 	/* if there is a problem, what's going on ? */
 	if (job->exit_type != JOB_EXIT_OKAY) {
 		if (!silent)
@@ -695,6 +1207,83 @@ run_gnode(GNode *gn)
 }
 
 
+static void
+setup_limits(void)
+{
+	const char *s;
+	const char *errstr;
+	long long mb;
+
+	if ((s = Var_Value("JOB_MEMORY_LIMIT")) != NULL) {
+		mb = strtonum(s, 1, LLONG_MAX >> 20, &errstr);
+		if (errstr != NULL)
+			Punt("JOB_MEMORY_LIMIT is %s: %s", errstr, s);
+		job_memory = mb << 20;
+	}
+	if ((s = Var_Value("OOM_RETRY")) != NULL) {
+		oom_retries = strtonum(s, 1, INT_MAX, &errstr);
+		if (errstr != NULL)
+			oom_retries = 1;
+	}
+}
+
+static void
+setup_echo(void)
+{
+	const char *s;
+	const char *errstr;
+
+	if ((s = Var_Value("ECHO_SHORT")) == NULL || *s == '\0')
+		return;
+	echo_short = true;
+	echo_width = strtonum(s, 1, INT_MAX, &errstr);
+	if (errstr != NULL)
+		echo_width = 0;
+}
+
+/* returns the abbreviated echo for cmd, or NULL to show cmd as is */
+static char *
+short_echo(Job *job, const char *cmd)
+{
+	BUFFER buf;
+	const char *p, *tool, *end;
+
+	if (!echo_short || noExecute)
+		return NULL;
+	if (echo_width != 0) {
+		if (strlen(cmd) <= echo_width)
+			return NULL;
+		Buf_Init(&buf, echo_width + 4);
+		Buf_AddChars(&buf, echo_width, cmd);
+		Buf_AddString(&buf, "...");
+		return Buf_Retrieve(&buf);
+	}
+	/* skip environment settings, then the path to the tool */
+	for (p = cmd;;) {
+		for (end = p; *end != '\0' && !ISSPACE(*end); end++)
+			if (*end == '=')
+				break;
+		if (*end != '=')
+			break;
+		while (*end != '\0' && !ISSPACE(*end))
+			end++;
+		while (ISSPACE(*end))
+			end++;
+		p = end;
+	}
+	for (tool = p; p != end; p++)
+		if (*p == '/')
+			tool = p+1;
+	if (tool == end)
+		return NULL;
+	Buf_Init(&buf, 0);
+	for (p = tool; p != end; p++)
+		Buf_AddChar(&buf, toupper((unsigned char)*p));
+	Buf_AddSpace(&buf);
+	Buf_AddString(&buf, job->node->name);
+	return Buf_Retrieve(&buf);
+}
+
 static void
 setup_engine(void)
 {
@@ -702,10 +1291,37 @@ setup_engine(void)
 
 	if (!already_setup) {
 		setup_meta();
+		setup_limits();
+		setup_echo();
 		already_setup = 1;
 	}
 }
 
+/* in the child: the hard limit stays, so we can't fail */
+static void
+limit_memory(void)
+{
+	struct rlimit rl;
+
+	if (getrlimit(RLIMIT_DATA, &rl) == -1)
+		return;
+	if (rl.rlim_max == RLIM_INFINITY || job_memory < rl.rlim_max)
+		rl.rlim_cur = job_memory;
+	(void)setrlimit(RLIMIT_DATA, &rl);
+}
+
+static bool
+oom_retry(Job *job)
+{
+	if (job->exit_type != JOB_SIGNALED || job->code != SIGKILL)
+		return false;
+	if (job->retries >= oom_retries || check_dying_signal())
+		return false;
+	job->retries++;
+	job->flags |= JOB_RETRY;
+	return true;
+}
+
 static bool
 do_run_command(Job *job, const char *pre)
 {
@@ -713,6 +1329,13 @@ do_run_command(Job *job, const char *pre)
 	bool doExecute;	/* Execute the command */
 	bool errCheck;	/* Check errors */
 	pid_t cpid; 	/* Child pid */
+	int ofd;	/* Output pipe */
+	int code;	/* Builtin exit code */
+	char *shown;	/* ECHO_SHORT version */
+	char *shargv[4];
+	char **todo, **av;
+	char *dir;
+	const char *path;
 
 	const char *cmd = job->cmd;
 	silent = Targ_Silent(job->node);
@@ -744,8 +1367,15 @@ do_run_command(Job *job, const char *pre)
 	while (ISSPACE(*cmd))
 		cmd++;
 	/* Print the command before fork if make -n or !silent*/
-	if ( noExecute || !silent)
-		printf("%s\n", cmd);
+	if ( noExecute || !silent) {
+		shown = short_echo(job, cmd);
+		job_message(job, stdout, shown != NULL ? shown : cmd);
+		/* so that errors show the full command */
+		if (shown != NULL) {
+			free(shown);
+			silent = true;
+		}
+	}
 	
 	if (silent)
 		job->flags |= JOB_SILENT;
@@ -763,33 +1393,198 @@ do_run_command(Job *job, const char *pre)
 	if (*cmd == '#')
 		return false;
 
-	/* Fork and execute the single command. If the fork fails, we abort.  */
-	switch (cpid = fork()) {
-	case -1:
-		Punt("Could not fork");
-		/*NOTREACHED*/
-	case 0:
-		reset_signal_mask();
-		/* put a random delay unless we're the only job running
-		 * and there's nothing left to do.
-		 */
-		if (random_delay)
-			if (!(runningJobs == NULL && nothing_left_to_build()))
-				usleep(arc4random_uniform(random_delay));
-		run_command(cmd, errCheck);
-		/*NOTREACHED*/
-	default:
-		job->pid = cpid;
-		job->next = runningJobs;
-		runningJobs = job;
+	trace_now(&job->cmd_start);
+	/* commands may look at what make -t did so far */
+	Dir_FlushTouches();
+	Arch_FlushTouches();
+	if (run_builtin(job, cmd, &code)) {
 		if (errCheck)
 			job->flags |= JOB_ERRCHECK;
 		else
 			job->flags &= ~JOB_ERRCHECK;
-		debug_job_printf("Running %ld (%s) %s\n", (long)job->pid, 
-		    job->node->name, (noExecute || !silent) ? "" : cmd);
-		return true;
+		job->pid = getpid();
+		debug_job_printf("Builtin (%s) %s\n", job->node->name, cmd);
+		/* same reporting as a real command */
+		if (code != 0)
+			job_flush_output(job);
+		handle_job_status(job, W_EXITCODE(code, 0));
+		if (!(job->flags & JOB_KEEPERROR))
+			job->cmd = NULL;
+		return false;
+	}
+
+	ofd = job_output_pipe(job);
+	Affinity_Enter(job->slot);
+	/* random delays need code running in the child.  Remote jobs
+	 * go without */
+	if (random_delay && job->executor == &local_executor)
+		cpid = -1;
+	else
+		cpid = job->executor->start(job, cmd, errCheck, ofd);
+
+	/* Fork and execute the single command. If the fork fails, we abort.
+	 * What to exec is figured out beforehand, so that PATH lookups
+	 * benefit the next commands.  */
+	if (cpid == -1) {
+		todo = command_argv(cmd, errCheck, shargv, &av, &dir);
+		path = find_in_path(todo[0]);
+		COUNT(FORK);
+		switch (cpid = fork()) {
+		case -1:
+			Punt("Could not fork");
+			/*NOTREACHED*/
+		case 0:
+			reset_signal_mask();
+			if (ofd != -1) {
+				if (dup2(ofd, STDOUT_FILENO) == -1 ||
+				    dup2(ofd, STDERR_FILENO) == -1)
+					_exit(1);
+				close(ofd);
+			}
+			/* put a random delay unless we're the only job 
+			 * running and there's nothing left to do.
+			 */
+			if (random_delay)
+				if (!(runningJobs == NULL && 
+				    nothing_left_to_build()))
+					usleep(arc4random_uniform(
+					    random_delay));
+			if (job_memory != 0 &&
+			    job->executor == &local_executor)
+				limit_memory();
+			run_command(todo, path, dir);
+			/*NOTREACHED*/
+		default:
+			break;
+		}
+		free(av);
+		free(dir);
+	}
+	Affinity_Leave();
+	if (ofd != -1)
+		close(ofd);
+	job->pid = cpid;
+	job->next = runningJobs;
+	if (runningJobs != NULL)
+		runningJobs->pprev = &job->next;
+	job->pprev = &runningJobs;
+	runningJobs = job;
+	watch_running_job(job);
+	if (errCheck)
+		job->flags |= JOB_ERRCHECK;
+	else
+		job->flags &= ~JOB_ERRCHECK;
+	debug_job_printf("Running %ld (%s) %s\n", (long)job->pid, 
+	    job->node->name, (noExecute || !silent) ? "" : cmd);
+	return true;
+}
+
+/* single shell mode: build one script out of all the commands of the
+ * target, so that we start one shell instead of one per command.
+ * Each command is echoed by the script itself, so that it shows up
+ * at the right place, and errors in '-' commands are ignored through
+ * || true.
+ */
+static bool
+use_single_shell(Job *job)
+{
+	GNode *gn = job->node;
+
+	/* -n must run '+' commands only */
+	if (noExecute || touchFlag || (gn->type & OP_MAKE))
+		return false;
+	if (!singleShell && !(gn->type & OP_SINGLESHELL))
+		return false;
+	/* nothing to gain */
+	return job->next_cmd == Lst_First(&gn->commands) &&
+	    Lst_Adv(job->next_cmd) != NULL;
+}
+
+void
+add_quoted(Buffer buf, const char *s)
+{
+	Buf_AddChar(buf, '\'');
+	for (; *s != '\0'; s++)
+		if (*s == '\'')
+			Buf_AddString(buf, "'\\''");
+		else
+			Buf_AddChar(buf, *s);
+	Buf_AddChar(buf, '\'');
+}
+
+static void
+build_single_shell(Job *job)
+{
+	GNode *gn = job->node;
+	BUFFER buf;
+	bool silent, errCheck, doExecute = false;
+	char *expanded, *script, *shown;
+	const char *cmd;
+
+	Buf_Init(&buf, 0);
+	job->location = &((struct command *)Lst_Datum(job->next_cmd))->location;
+	for (; job->next_cmd != NULL; job->next_cmd = Lst_Adv(job->next_cmd)) {
+		struct command *command = Lst_Datum(job->next_cmd);
+
+		handle_all_signals();
+		Parse_SetLocation(&command->location);
+		expanded = Var_SubstCompiled(command->string,
+		    &command->compiled, &gn->localvars, false);
+		if (fatal_errors)
+			Punt(NULL);
+		silent = Targ_Silent(gn);
+		errCheck = !Targ_Ignore(gn);
+		for (cmd = expanded;; cmd++) {
+			if (*cmd == '@')
+				silent = DEBUG(LOUD) ? false : true;
+			else if (*cmd == '-')
+				errCheck = false;
+			else if (*cmd == '+')
+				doExecute = true;
+			else
+				break;
+		}
+		while (ISSPACE(*cmd))
+			cmd++;
+		if (*cmd == '\0') {
+			Parse_Error(PARSE_WARNING, 
+			    "'%s' expands to '' while building %s", 
+			    command->string, gn->name);
+			free(expanded);
+			continue;
+		}
+		if (!silent) {
+			shown = short_echo(job, cmd);
+			Buf_AddString(&buf, "printf '%s\\n' ");
+			add_quoted(&buf, shown != NULL ? shown : cmd);
+			Buf_AddChar(&buf, '\n');
+			free(shown);
+		}
+		Buf_AddString(&buf, "{\n");
+		Buf_AddString(&buf, cmd);
+		Buf_AddString(&buf, errCheck ? "\n}\n" : "\n} || true\n");
+		free(expanded);
 	}
+	/* let do_run_command know about '+' and not print the whole
+	 * script.  '+' comes first for the expensive heuristics. */
+	script = Buf_Retrieve(&buf);
+	job->cmd = Str_concat(doExecute ? "+@" : "@", script, 0);
+	Buf_Destroy(&buf);
+}
+
+void
+job_prepare_node(GNode *gn)
+{
+	struct command *command;
+
+	if (gn->first_cmd != NULL || Lst_IsEmpty(&gn->commands))
+		return;
+	command = Lst_Datum(Lst_First(&gn->commands));
+	Parse_SetLocation(&command->location);
+	gn->first_cmd = Var_SubstCompiled(command->string,
+	    &command->compiled, &gn->localvars, false);
+	if (fatal_errors)
+		Punt(NULL);
 }
 
 bool
@@ -799,21 +1594,42 @@ job_run_next(Job *job)
 	GNode *gn = job->node;
 
 	setup_engine();
+	if (use_single_shell(job)) {
+		free(gn->first_cmd);
+		gn->first_cmd = NULL;
+		job->command = NULL;
+		build_single_shell(job);
+		Parse_SetLocation(job->location);
+		if (do_run_command(job, job->cmd)) {
+			/* errors shouldn't display the whole script */
+			job->flags &= ~JOB_SILENT;
+			return false;
+		}
+		free(job->cmd);
+	}
 	while (job->next_cmd != NULL) {
 		struct command *command = Lst_Datum(job->next_cmd);
 
 		handle_all_signals();
 		job->location = &command->location;
+		job->command = command;
 		Parse_SetLocation(job->location);
-		job->cmd = Var_Subst(command->string, &gn->localvars, false);
+		if (gn->first_cmd != NULL) {
+			job->cmd = gn->first_cmd;
+			gn->first_cmd = NULL;
+		} else
+			job->cmd = Var_SubstCompiled(command->string,
+			    &command->compiled, &gn->localvars, false);
 		job->next_cmd = Lst_Adv(job->next_cmd);
 		if (fatal_errors)
 			Punt(NULL);
 		started = do_run_command(job, command->string);
 		if (started)
 			return false;
-		else
-			free(job->cmd);
+		/* a builtin failed */
+		if (job->exit_type != JOB_EXIT_OKAY)
+			return true;
+		free(job->cmd);
 	}
 	job->exit_type = JOB_EXIT_OKAY;
 	return true;
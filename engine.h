@@ -52,7 +52,7 @@ extern void node_failure(GNode *);
 
 /* Job_Touch(node);
  *	touch the path corresponding to a node or update the corresponding
- *	archive object.
+ *	archive object, and mark it as rebuilt.
  */
 extern void Job_Touch(GNode *);
 
@@ -72,15 +72,47 @@ extern void Make_HandleUse(GNode *, GNode *);
 extern bool Make_OODate(GNode *);
 
 /* Make_DoAllVar(node);
- *	fill all dynamic variables for a node.
+ *	fill all dynamic variables for a node.  $> and $? are left as
+ *	var_Lazy, to be computed by Make_ComputeVar if they're used.
  */
 extern void Make_DoAllVar(GNode *);
 
+/* value = Make_ComputeVar(node, idx);
+ *	compute the value of $> (ALLSRC_INDEX) or $? (OODATE_INDEX).
+ */
+extern char *Make_ComputeVar(GNode *, int);
+
 /* status = run_gnode(gn):
  *	fully run all commands of a node for compat mode.
  */
 extern int run_gnode(GNode *);
 
+/* what building a target cost, according to wait4(2) */
+struct usage {
+	long wall;		/* milliseconds */
+	long cpu;		/* user and system, milliseconds */
+	long maxrss;		/* largest command, in kilobytes */
+	long io;		/* blocks read and written */
+	long csw;		/* context switches, voluntary or not */
+};
+
+/* Executors: who runs the commands of a job.  start returns the pid of
+ * a local process that stands for cmd, or -1 to fork and run cmd right
+ * here.  job.c waits on that pid as usual, and passes signals through
+ * kill, so executors that run commands elsewhere go through a local
+ * proxy, such as ssh.
+ */
+struct executor {
+	const char *name;
+	/* pid = start(job, cmd, errCheck, ofd); */
+	pid_t (*start)(Job *, const char *, bool, int);
+	/* error = kill(job, signo); */
+	const char *(*kill)(Job *, int);
+};
+
+/* fork and exec, or posix_spawn */
+extern const struct executor local_executor;
+
 /*-
  * Job Table definitions.
  *
@@ -101,6 +133,7 @@ extern int run_gnode(GNode *);
  */
 struct Job_ {
 	struct Job_ 	*next;		/* singly linked list */
+	struct Job_	**pprev;	/* what points to us in runningJobs */
 	pid_t		pid;		/* Current command process id */
 	Location	*location;
 	int 		code;		/* exit status or signal code */
@@ -114,9 +147,25 @@ struct Job_ {
 #define JOB_LOST		0x004	/* sent signal to non-existing pid ? */
 #define JOB_ERRCHECK		0x008	/* command wants errcheck */
 #define JOB_KEEPERROR		0x010	/* should place job on error list */
+#define JOB_RETRY		0x020	/* OOM_RETRY: start over */
+#define JOB_ALONE		0x040	/* ...with nothing else running */
+#define JOB_CACHED		0x080	/* restored from BUILD_CACHE */
 	LstNode		next_cmd;	/* Next command to run */
 	char		*cmd;		/* Last command run */
+	struct command	*command;	/* ...where it comes from, NULL for
+					 * a single shell script */
 	GNode		*node;	    	/* Target of this job */
+	int		out_fd;		/* Output pipe, for -O */
+	Buffer		output;		/* Output not shown yet, for -O */
+	size_t		queued;		/* ...its start, waiting in the batch */
+	struct timespec	start;		/* when we started on node */
+	struct usage	usage;		/* what its commands cost (no wall) */
+	struct timespec	cmd_start;	/* when the last command started */
+	int		slot;		/* position in the job pool, for -dC */
+	int		retries;	/* OOM_RETRY so far */
+	long		sim_end;	/* -R: when it's done, in ms */
+	const struct executor *executor;
+	int		host;		/* for the remote executor */
 };
 
 /* Continuation-style running commands for the parallel engine */
@@ -126,6 +175,12 @@ struct Job_ {
  */
 extern void job_attach_node(Job *, GNode *);
 
+/* job_prepare_node(node):
+ *	expand the first command of an out-of-date node before it gets
+ *	a job, so that it starts right away once it does.
+ */
+extern void job_prepare_node(GNode *);
+
 /* finished = job_run_next(job):
  *	run next command for a job attached to a node.
  *	return true when job is finished.
@@ -138,4 +193,9 @@ extern bool job_run_next(Job *);
  */
 extern void handle_job_status(Job *, int);
 
+/* add_quoted(buf, s):
+ *	add s to buf, quoted for the shell.
+ */
+extern void add_quoted(Buffer, const char *);
+
 #endif
@@ -1,6 +1,8 @@
 #include "config.h"
 #include "defines.h"
+#include "arch.h"
 #include "compat.h"
+#include "dir.h"
 #include "make.h"
 
 struct engine {
@@ -23,6 +25,8 @@ void
 engine_run_list(Lst l, bool *has_errors, bool *out_of_date)
 {
 	engine->run_list(l, has_errors, out_of_date);
+	Dir_FlushTouches();
+	Arch_FlushTouches();
 }
 
 void
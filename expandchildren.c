@@ -55,10 +55,13 @@
 #include "lst.h"
 #include "gnode.h"
 #include "suff.h"
+#include "memory.h"
+#include "garray.h"
 
 static void ExpandChildren(LstNode, GNode *);
 static void ExpandVarChildren(LstNode, GNode *, GNode *);
 static void ExpandWildChildren(LstNode, GNode *, GNode *);
+static void add_children(LstNode, GNode *, struct growableArray *);
 
 void
 LinkParent(GNode *cgn, GNode *pgn)
@@ -73,12 +76,33 @@ LinkParent(GNode *cgn, GNode *pgn)
 	}
 }
 
+/* Put the new nodes after the expanded child, in order, skipping the
+ * ones pgn already has.  */
+static void
+add_children(LstNode after, GNode *pgn, struct growableArray *a)
+{
+	unsigned int i;
+
+	for (i = 0; i < a->n; i++) {
+		GNode *gn = a->a[i];
+
+		if (DEBUG(SUFF))
+			printf("%s...", gn->name);
+		if (!Targ_HasChild(pgn, gn)) {
+			Lst_Append(&pgn->children, after, gn);
+			Targ_NoteChild(pgn, gn);
+			after = Lst_Adv(after);
+			LinkParent(gn, pgn);
+		}
+	}
+}
+
 static void
 ExpandVarChildren(LstNode after, GNode *cgn, GNode *pgn)
 {
 	GNode *gn;		/* New source 8) */
 	char *cp;		/* Expanded value */
-	LIST members;
+	struct growableArray members;
 
 
 	if (DEBUG(SUFF))
@@ -91,7 +115,7 @@ ExpandVarChildren(LstNode after, GNode *cgn, GNode *pgn)
 		return;
 	}
 
-	Lst_Init(&members);
+	Array_Init(&members, 16);
 
 	if (cgn->type & OP_ARCHV) {
 		/*
@@ -100,8 +124,12 @@ ExpandVarChildren(LstNode after, GNode *cgn, GNode *pgn)
 		 * variables in the parent's context.
 		 */
 		const char *sacrifice = (const char *)cp;
+		LIST l;
 
-		(void)Arch_ParseArchive(&sacrifice, &members, &pgn->localvars);
+		Lst_Init(&l);
+		(void)Arch_ParseArchive(&sacrifice, &l, &pgn->localvars);
+		AppendList2Array(&l, &members);
+		Lst_Destroy(&l, NOFREE);
 	} else {
 		/* Break the result into a vector of strings whose nodes
 		 * we can find, then add those nodes to the members list.
@@ -118,7 +146,7 @@ ExpandVarChildren(LstNode after, GNode *cgn, GNode *pgn)
 				 * node, add it, skip any further spaces.  */
 				gn = Targ_FindNodei(start, cp2, TARG_CREATE);
 				cp2++;
-				Lst_AtEnd(&members, gn);
+				Array_AtEnd(&members, gn);
 				while (ISSPACE(*cp2))
 					cp2++;
 				/* Adjust cp2 for increment at start of loop,
@@ -139,20 +167,13 @@ ExpandVarChildren(LstNode after, GNode *cgn, GNode *pgn)
 	    if (cp2 != start) {
 		    /* Stuff left over -- add it to the list too.  */
 		    gn = Targ_FindNodei(start, cp2, TARG_CREATE);
-		    Lst_AtEnd(&members, gn);
+		    Array_AtEnd(&members, gn);
 	    }
 	}
 	/* Add all elements of the members list to the parent node.  */
-	while ((gn = Lst_DeQueue(&members)) != NULL) {
-		if (DEBUG(SUFF))
-			printf("%s...", gn->name);
-		if (Lst_Member(&pgn->children, gn) == NULL) {
-			Lst_Append(&pgn->children, after, gn);
-			after = Lst_Adv(after);
-			LinkParent(gn, pgn);
-		}
-	}
+	add_children(after, pgn, &members);
 	/* Free the result.  */
+	free(members.a);
 	free(cp);
 	if (DEBUG(SUFF))
 		printf("\n");
@@ -161,10 +182,10 @@ ExpandVarChildren(LstNode after, GNode *cgn, GNode *pgn)
 static void
 ExpandWildChildren(LstNode after, GNode *cgn, GNode *pgn)
 {
-	char *cp;	/* Expanded value */
-
-	LIST exp;	/* List of expansions */
+	char **exp;	/* Expansions */
+	unsigned int i, n;
 	Lst path;	/* Search path along which to expand */
+	struct growableArray members;
 
 	if (DEBUG(SUFF))
 		printf("Wildcard expanding \"%s\"...", cgn->name);
@@ -174,25 +195,16 @@ ExpandWildChildren(LstNode after, GNode *cgn, GNode *pgn)
 	 * otherwise use the default path. */
 	path = find_best_path(cgn->name);
 
-	/* Expand the word along the chosen path. */
-	Lst_Init(&exp);
-	Dir_Expand(cgn->name, path, &exp);
+	/* Expand the word along the chosen path: other parents probably
+	 * have the same wildcard source. */
+	exp = Dir_ExpandShared(cgn->name, path, &n);
 
-	/* Fetch next expansion off the list and find its GNode.  */
-	while ((cp = Lst_DeQueue(&exp)) != NULL) {
-		GNode *gn;		/* New source 8) */
-		if (DEBUG(SUFF))
-			printf("%s...", cp);
-		gn = Targ_FindNode(cp, TARG_CREATE);
-
-		/* If gn isn't already a child of the parent, make it so and
-		 * up the parent's count of children to build.  */
-		if (Lst_Member(&pgn->children, gn) == NULL) {
-			Lst_Append(&pgn->children, after, gn);
-			after = Lst_Adv(after);
-			LinkParent(gn, pgn);
-		}
-	}
+	/* Find the GNode of each expansion, then add them.  */
+	Array_Init(&members, n == 0 ? 1 : n);
+	for (i = 0; i < n; i++)
+		Array_AtEnd(&members, Targ_FindNode(exp[i], TARG_CREATE));
+	add_children(after, pgn, &members);
+	free(members.a);
 
 	if (DEBUG(SUFF))
 		printf("\n");
@@ -232,6 +244,7 @@ ExpandChildren(LstNode ln, /* LstNode of child, so we can replace it */
 	 * keep it from being processed.  */
 	pgn->children_left--;
 	Lst_Remove(&pgn->children, ln);
+	Targ_ForgetChild(pgn, cgn);
 }
 
 void
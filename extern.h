@@ -44,6 +44,8 @@ extern bool	ignoreErrors;	/* True if should ignore all errors */
 extern bool	beSilent;	/* True if should print no commands */
 extern bool	noExecute;	/* True if should execute nothing */
 extern bool	allPrecious;	/* True if every target is precious */
+extern bool	singleShell;	/* True if every target runs its commands
+				 * in a single shell */
 extern bool	keepgoing;	/* True if should continue on unaffected
 				 * portions of the graph when have an error
 				 * in one portion */
@@ -100,6 +100,7 @@ struct For_ {
 	unsigned long	lineno; 	/* Line number at start of loop */
 	unsigned long	level;		/* Nesting level		*/
 	bool		freeold;
+	struct LoopTemplate *tpl;	/* Precompiled text, single var	*/
 };
 
 /* ForExec(value, handle);
@@ -251,6 +252,19 @@ ForExec(void *valuep, void *argp)
 	For *arg = argp;
 	BUFFER buf;
 
+	/* with only one variable, the text never changes: we don't need to
+	 * scan it again each time */
+	if (arg->tpl != NULL) {
+		if (DEBUG(FOR))
+			(void)fprintf(stderr, "--- %s = %s\n",
+			    Var_LoopVarName(Lst_Datum(Lst_First(&arg->vars))),
+			    value);
+		Buf_Init(&buf, arg->guess);
+		Var_SubstTemplate(&buf, arg->tpl, value);
+		Parse_FromString(Buf_Retrieve(&buf), arg->lineno);
+		return;
+	}
+
 	/* Parse_FromString pushes stuff back, so we need to go over vars in
 	   reverse.  */
 	if (arg->var == NULL) {
@@ -281,7 +295,14 @@ For_Run(For *arg)
 	arg->guess = Buf_Size(&arg->buf) + GUESS_EXPANSION;
 
 	arg->var = NULL;
+	if (arg->nvars == 1)
+		arg->tpl = Var_NewLoopTemplate(arg->text,
+		    Lst_Datum(Lst_First(&arg->vars)));
+	else
+		arg->tpl = NULL;
 	Lst_ForEach(&arg->lst, ForExec, arg);
+	if (arg->tpl != NULL)
+		Var_DeleteLoopTemplate(arg->tpl);
 	Buf_Destroy(&arg->buf);
 	Lst_Destroy(&arg->vars, (SimpleProc)Var_DeleteLoopVar);
 	Lst_Destroy(&arg->lst, (SimpleProc)free);
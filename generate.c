@@ -36,6 +36,7 @@
 #include "cond_int.h"
 #include "var_int.h"
 #include "node_int.h"
+#include "hash.h"
 
 #define M(x)	x, #x
 char *table_var[] = {
@@ -84,6 +85,7 @@ char *table_cond[] = {
 	M(COND_INCLUDE),
 	M(COND_UNDEF),
 	M(COND_POISON),
+	M(COND_DEPINCLUDE),
 	NULL
 };
 
@@ -109,7 +111,9 @@ char *table_nodes[] = {
 	M(NODE_PARALLEL),
 	M(NODE_PATH),
 	M(NODE_PHONY),
+	M(NODE_POOL),
 	M(NODE_PRECIOUS),
+	M(NODE_PRIORITY),
 	M(NODE_RECURSIVE),
 	M(NODE_SILENT),
 	M(NODE_SINGLESHELL),
@@ -133,16 +137,39 @@ char **table[] = {
 	table_nodes
 };
 
+/* do the names in t all fall into distinct slots? */
+static int
+fits(char **t, uint32_t slots)
+{
+	char **occupied;
+	const char *e;
+	uint32_t i, h;
+	int ok = 1;
+
+	occupied = calloc(slots, sizeof(char *));
+	if (!occupied)
+		exit(1);
+	for (i = 0; t[i] != NULL; i += 2) {
+		e = NULL;
+		h = hash_interval(t[i], &e) % slots;
+		if (occupied[h]) {
+			ok = 0;
+			break;
+		}
+		occupied[h] = t[i];
+	}
+	free(occupied);
+	return ok;
+}
+
 int
 main(int argc, char *argv[])
 {
 	uint32_t i;
 	uint32_t v;
-	uint32_t h;
 	uint32_t slots;
 	const char *errstr;
 	const char *e;
-	char **occupied;
 	char **t;
 	int tn;
 
@@ -157,28 +184,22 @@ main(int argc, char *argv[])
 	slots = strtonum(argv[2], 0, INT_MAX, &errstr);
 	if (errstr)
 		exit(1);
+	/* slots is where to start looking for the smallest number of slots
+	 * without collisions, so that the switch in the code stays dense */
 	if (slots) {
-		occupied = calloc(slots, sizeof(char *));
-		if (!occupied)
-			exit(1);
-	} else
-		occupied = NULL;
+		for (i = 0; t[i] != NULL; i += 2)
+			continue;
+		if (slots < i / 2)
+			slots = i / 2;
+		while (!fits(t, slots))
+			slots++;
+	}
 
-	printf("/* File created by generate %d %d, do not edit */\n",
-	    tn, slots);
+	printf("/* File created by generate %d %s, do not edit */\n",
+	    tn, argv[2]);
 	for (i = 0; t[i] != NULL; i++) {
 		e = NULL;
-		v = ohash_interval(t[i], &e);
-		if (slots) {
-			h = v % slots;
-			if (occupied[h]) {
-				fprintf(stderr,
-				    "Collision: %s / %s (%d)\n", occupied[h],
-				    t[i], h);
-				exit(1);
-			}
-			occupied[h] = t[i];
-		}
+		v = hash_interval(t[i], &e);
 		i++;
 		printf("#define K_%s %u\n", t[i], v);
 	}
@@ -63,6 +63,9 @@
  *	   and this target only (cf var.c [$@ $< $?, etc.])
  *	16) *commands*: the actual LIST of strings to pass to the shell
  *	   to create this target.
+ *	17) *priority*: length of the longest chain of ancestors still to
+ *	   build (cf make.c), used to start the critical path early.
+ *	   *rank*, from .PRIORITY, comes first.
  */
 
 /* constants for specials
@@ -100,14 +103,29 @@
 #define SPECIAL_ERROR		31U
 #define SPECIAL_CHEAP		32U
 #define SPECIAL_EXPENSIVE	33U
+#define SPECIAL_SINGLESHELL	34U
+#define SPECIAL_POOL		35U
+#define SPECIAL_PRIORITY	36U
 
 struct GNode_ {
+			/* the scheduling state comes first, so that make.c
+			 * walking the graph touches a single cache line
+			 * per node */
     unsigned int type;		/* node type (see the OP flags, below) */
-    unsigned int special_op;	/* special op to apply (only used in parse.c) */
-    unsigned char special;	/* type of special node or SPECIAL_NONE */
+    unsigned int id;		/* creation order, see Targ_Count */
     bool must_make;		/* true if this target needs building */
+    bool queued;		/* on the to_build queue (make.c) */
+    bool children_queued;	/* children went through add_targets_to_make,
+    				 * see Targ_NoteChild */
     bool child_rebuilt;		/* true if at least one child was rebuilt,
     			 	 * thus triggering timestamps changes */
+    bool ordered;		/* dropped from to_build until its .ORDER
+    				 * predecessors are built (make.c) */
+    bool prepared;		/* found out-of-date by LOOK_AHEAD, only
+    				 * needs a job slot (make.c) */
+    bool readahead;		/* handed to the READAHEAD reader */
+    bool probed;		/* implied sources looked for ahead of time
+    				 * (make.c) */
 
     char built_status;	
 #define UNKNOWN		0	/* Not examined yet */
@@ -123,19 +141,36 @@ struct GNode_ {
 				 * currently building, avoid race conditions
 				 * Only used in the parallel engine make.c */
 
-    char *path;		/* full pathname of the file */
-    int order;		/* wait weight (see .ORDER/predecessors/successors) */
-
     int children_left;	/* number of children left to build */
-
+    int order;		/* wait weight (see .ORDER/predecessors/successors) */
+    long priority;	/* scheduling priority, PRIORITY_UNKNOWN until
+    			 * computed by make.c */
+#define PRIORITY_UNKNOWN	-1
+    int hint;		/* from .PRIORITY, HINT_NONE if not given */
+#define HINT_NONE	INT_MIN
+    int rank;		/* hint that applies: own, or the best of the
+    			 * parents', computed along with priority */
+    long duration;	/* ms it took to build during this run, for the
+    			 * critical path report */
     struct timespec mtime;	/* Node's modification time */
     GNode *youngest;		/* Node's youngest child */
+    GNode **parentv;	/* children and parents as vectors, for walking */
+    GNode **childv;	/* the graph: see Targ_Children */
+    unsigned int nparentv;
+    unsigned int nchildv;
 
+    unsigned int special_op;	/* special op to apply (only used in parse.c) */
+    unsigned char special;	/* type of special node or SPECIAL_NONE */
+    char *path;		/* full pathname of the file */
     GNode *impliedsrc;	/* found by suff, to help with localvars */
     LIST cohorts;	/* Other nodes for the :: operator */
     LIST parents;	/* Nodes that depend on this one */
     LIST children;	/* Nodes on which this one depends */
+    struct ohash *child_index;	/* the same children, for quick membership
+    				 * tests, once there are many of them */
     LIST predecessors;
+    LstNode next_pred;	/* predecessors before that one got started,
+    			 * see has_predecessor_left_to_build */
     LIST successors; 	
 
     SymTable localvars;
@@ -146,19 +181,32 @@ struct GNode_ {
     GNode *groupling;	/* target lists, for HELDBACK: do not build two
     			 * at the same time */
     GNode *watched;	/* the node currently building for HELDBACK */
+    GNode *waiters;	/* HELDBACK nodes watching this one... */
+    GNode *next_waiter;	/* ...chained through there */
+    GNode *group;	/* groupling that stands for the whole list */
+    GNode *group_building;	/* for that one: member currently building */
+    struct pool_use *pools;	/* .POOL: resources it needs to build */
+    char *first_cmd;	/* first command, expanded ahead of time */
 
 			/* stuff for target name equivalence: */
     GNode *sibling;	/* equivalent targets (not complete yet) */
     char *basename;	/* pointer to name stripped of path */
     GNode *next;
+    struct equiv_keys *keys;	/* reduced names, see targequiv.c */
 
-    bool in_cycle;	/* cycle detection */
     char name[1];	/* The target's name */
 };
 
 struct command
 {
 	Location location;
+	struct SubstTemplate *compiled;	/* see Var_SubstCompiled */
+	unsigned char cost;	/* expensive heuristics (cf job.c) */
+#define COST_UNKNOWN	0
+#define COST_CHEAP	1
+#define COST_EXPENSIVE	2
+#define COST_EXPANDED	3	/* depends on variables, look every time */
+	unsigned long cost_gen;	/* cheap/expensive for that Var_Generation */
 	char string[1];
 };
 
@@ -220,6 +268,9 @@ struct command
 #define OP_RESOLVED	0x01000000  /* We looked harder already */
 #define OP_CHEAP	0x02000000  /* Assume job is not recursive */
 #define OP_EXPENSIVE	0x04000000  /* Recursive job, don't run in parallel */
+#define OP_SINGLESHELL	0x08000000  /* Run all commands in one shell */
+#define OP_EXPANDED	0x10000000  /* .USE and implicit sources applied,
+				     * don't do it again (-W) */
 
 /*
  * OP_NOP will return true if the node with the given type was not the
@@ -0,0 +1,198 @@
+/*	$OpenBSD$ */
+/*
+ * Copyright (c) 2026 Marc Espie.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE OPENBSD PROJECT AND CONTRIBUTORS
+ * ``AS IS'' AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ * LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR
+ * A PARTICULAR PURPOSE ARE DISCLAIMED.  IN NO EVENT SHALL THE OPENBSD
+ * PROJECT OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+ * SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT
+ * LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+ * DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+ * THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+ * OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+#include <ohash.h>
+#include "hash.h"
+#include "memory.h"
+
+/* All our tables hash their keys through here, so trying another
+ * function only takes changing hash_interval (and rebuilding the
+ * generated hashconsts.h files).
+ *
+ * This one eats 8 bytes at a time, and finishes with murmur3's mixer,
+ * since ohash picks slots and steps from the low bits.  Bytes are
+ * assembled explicitly, since generate may run on a host with another
+ * byte order.
+ */
+
+#define MUL	0x9e3779b97f4a7c15ULL
+
+#define LE64(p) \
+	((uint64_t)(unsigned char)(p)[0] | \
+	(uint64_t)(unsigned char)(p)[1] << 8 | \
+	(uint64_t)(unsigned char)(p)[2] << 16 | \
+	(uint64_t)(unsigned char)(p)[3] << 24 | \
+	(uint64_t)(unsigned char)(p)[4] << 32 | \
+	(uint64_t)(unsigned char)(p)[5] << 40 | \
+	(uint64_t)(unsigned char)(p)[6] << 48 | \
+	(uint64_t)(unsigned char)(p)[7] << 56)
+
+struct registered {
+	struct ohash *h;
+	const char *what;
+};
+
+static struct registered *tables = NULL;
+static unsigned int n_tables = 0, max_tables = 0;
+
+uint32_t
+hash_interval(const char *s, const char **e)
+{
+	uint64_t h, w;
+	size_t len;
+	int i;
+
+	if (*e == NULL)
+		*e = s + strlen(s);
+	len = *e - s;
+	h = MUL ^ len;
+	for (; len >= 8; s += 8, len -= 8) {
+		h = (h ^ LE64(s)) * MUL;
+		h ^= h >> 29;
+	}
+	if (len != 0) {
+		w = 0;
+		for (i = len; i-- > 0;)
+			w = w << 8 | (unsigned char)s[i];
+		h = (h ^ w) * MUL;
+	}
+	h ^= h >> 33;
+	h *= 0xff51afd7ed558ccdULL;
+	h ^= h >> 33;
+	h *= 0xc4ceb9fe1a85ec53ULL;
+	h ^= h >> 33;
+	return (uint32_t)h;
+}
+
+unsigned int
+hash_qlookupi(struct ohash *h, const char *s, const char **e)
+{
+	uint32_t hv;
+
+	hv = hash_interval(s, e);
+	return ohash_lookup_interval(h, s, *e, hv);
+}
+
+unsigned int
+hash_qlookup(struct ohash *h, const char *s)
+{
+	const char *e = NULL;
+
+	return hash_qlookupi(h, s, &e);
+}
+
+unsigned int
+hash_lookup_memory(struct ohash *h, const void *k, size_t size)
+{
+	const char *s = k, *e = s + size;
+
+	return ohash_lookup_memory(h, s, size, hash_interval(s, &e));
+}
+
+void
+hash_register(struct ohash *h, const char *what)
+{
+	if (n_tables == max_tables) {
+		max_tables = max_tables == 0 ? 16 : 2 * max_tables;
+		tables = ereallocarray(tables, max_tables, sizeof(*tables));
+	}
+	tables[n_tables].h = h;
+	tables[n_tables].what = what;
+	n_tables++;
+}
+
+void
+hash_unregister(struct ohash *h)
+{
+	unsigned int i;
+
+	for (i = 0; i < n_tables; i++)
+		if (tables[i].h == h) {
+			tables[i] = tables[--n_tables];
+			return;
+		}
+}
+
+/* how many slots a lookup for each entry goes through: this follows
+ * ohash_lookup_interval's double hashing.  Only for tables with string
+ * keys.  */
+static void
+probe_lengths(struct ohash *h, unsigned long *total, unsigned int *max)
+{
+	unsigned int pos, i, incr, n;
+	const char *e;
+	void *p;
+	uint32_t hv;
+
+	for (p = ohash_first(h, &pos); p != NULL; p = ohash_next(h, &pos)) {
+		e = NULL;
+		hv = hash_interval((char *)p + h->info.key_offset, &e);
+		i = hv % h->size;
+		incr = ((hv % (h->size-2)) & ~1) + 1;
+		for (n = 1; ohash_find(h, i) != p; n++) {
+			i += incr;
+			if (i >= h->size)
+				i -= h->size;
+		}
+		*total += n;
+		if (n > *max)
+			*max = n;
+	}
+}
+
+void
+hash_report(void)
+{
+	unsigned int i, j, count, max;
+	unsigned long entries, size, probes;
+
+	printf("#%-23s %6s %9s %9s %6s %5s\n", "table", "tables", "entries",
+	    "slots", "probes", "max");
+	for (i = 0; i < n_tables; i++) {
+		if (tables[i].what == NULL)
+			continue;
+		count = max = 0;
+		entries = size = probes = 0;
+		/* tables registered under the same name get added up */
+		for (j = i; j < n_tables; j++) {
+			if (tables[j].what != tables[i].what)
+				continue;
+			if (j != i)
+				tables[j].what = NULL;
+			count++;
+			entries += ohash_entries(tables[j].h);
+			size += tables[j].h->size;
+			probe_lengths(tables[j].h, &probes, &max);
+		}
+		printf("%-24s %6u %9lu %9lu %6.2f %5u\n", tables[i].what, count,
+		    entries, size, entries == 0 ? 0.0 : (double)probes / entries,
+		    max);
+	}
+}
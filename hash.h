@@ -0,0 +1,66 @@
+#ifndef HASH_H
+#define HASH_H
+/*	$OpenBSD$ */
+
+/*
+ * Copyright (c) 2026 Marc Espie.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE OPENBSD PROJECT AND CONTRIBUTORS
+ * ``AS IS'' AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ * LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR
+ * A PARTICULAR PURPOSE ARE DISCLAIMED.  IN NO EVENT SHALL THE OPENBSD
+ * PROJECT OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+ * SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT
+ * LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+ * DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+ * THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+ * OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+
+/* The hash function and lookups used by all our ohash tables,
+ * along with run-time statistics about them (-dH).
+ */
+
+struct ohash;
+
+/* hv = hash_interval(s, &e);
+ *	hash the string between s and e.  If e is NULL, the string ends
+ *	at the first NUL, and e gets set to that.  */
+extern uint32_t hash_interval(const char *, const char **);
+
+/* slot = hash_qlookupi(h, s, &e);
+ *	ohash_qlookupi(3), with our hash function.  */
+extern unsigned int hash_qlookupi(struct ohash *, const char *,
+    const char **);
+/* slot = hash_qlookup(h, s);
+ *	likewise, for a NUL-terminated string.  */
+extern unsigned int hash_qlookup(struct ohash *, const char *);
+/* slot = hash_lookup_memory(h, k, size);
+ *	ohash_lookup_memory(3), for keys that are not strings.  */
+extern unsigned int hash_lookup_memory(struct ohash *, const void *, size_t);
+
+/* hash_register(h, what);
+ *	show h in the -dH report.  Tables registered under the same what
+ *	string get added up.  */
+extern void hash_register(struct ohash *, const char *);
+/* hash_unregister(h);
+ *	before h goes away.  */
+extern void hash_unregister(struct ohash *);
+
+/* hash_report();
+ *	show how full each registered table is, and how many slots a
+ *	lookup goes through, on average and at worst.  */
+extern void hash_report(void);
+
+#endif
@@ -0,0 +1,311 @@
+/*	$OpenBSD$ */
+/*
+ * Copyright (c) 2026 Marc Espie.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE OPENBSD PROJECT AND CONTRIBUTORS
+ * ``AS IS'' AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ * LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR
+ * A PARTICULAR PURPOSE ARE DISCLAIMED.  IN NO EVENT SHALL THE OPENBSD
+ * PROJECT OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+ * SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT
+ * LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+ * DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+ * THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+ * OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include <limits.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <ohash.h>
+#include "config.h"
+#include "defines.h"
+#include "history.h"
+#include "gnode.h"
+#include "engine.h"
+#include "lst.h"
+#include "var.h"
+#include "str.h"
+#include "memory.h"
+#include "hash.h"
+
+/* The history file has one line per target:
+ *	cmdhash wall cpu maxrss io csw name
+ * cmdhash tells us whether the commands changed since, in which case
+ * the old duration is worthless.
+ * Older files only have wall and cpu.
+ */
+
+struct hist_entry {
+	uint32_t cmdhash;
+	struct usage u;
+	bool this_run;		/* built during this run, for the summary */
+	char name[1];
+};
+
+static struct ohash_info hist_info = {
+	offsetof(struct hist_entry, name), NULL,
+	hash_calloc, hash_free, element_alloc
+};
+
+static struct ohash history;
+static char *history_file = NULL;
+static pid_t history_pid;
+static bool dirty = false;
+static long total_wall = 0;	/* over all entries, for History_Mean */
+static unsigned int total_entries = 0;
+
+#define SUMMARY_DEFAULT	10
+
+static uint32_t command_hash(GNode *);
+static struct hist_entry *lookup(const char *, const char *, bool);
+static void read_history(FILE *);
+static void write_history(void);
+static void show_summary(void);
+static int cmp_wall(const void *, const void *);
+static int cmp_rss(const void *, const void *);
+static void show_top(const char *, struct hist_entry **, unsigned int,
+    unsigned int);
+static void History_End(void);
+
+static uint32_t
+command_hash(GNode *gn)
+{
+	LstNode ln;
+	uint32_t h = 0;
+
+	/* the unexpanded commands: changing a variable doesn't count */
+	for (ln = Lst_First(&gn->commands); ln != NULL; ln = Lst_Adv(ln)) {
+		struct command *cmd = Lst_Datum(ln);
+		const char *end = NULL;
+
+		h = h * 31 + ohash_interval(cmd->string, &end);
+	}
+	return h;
+}
+
+static struct hist_entry *
+lookup(const char *name, const char *ename, bool create)
+{
+	struct hist_entry *e;
+	unsigned int slot;
+
+	slot = hash_qlookupi(&history, name, &ename);
+	e = ohash_find(&history, slot);
+	if (e == NULL && create) {
+		e = ohash_create_entry(&hist_info, name, &ename);
+		memset(&e->u, 0, sizeof(e->u));
+		e->this_run = false;
+		ohash_insert(&history, slot, e);
+		total_entries++;
+	}
+	return e;
+}
+
+static void
+read_history(FILE *f)
+{
+	char *line, *copy, *name;
+	size_t len;
+	unsigned int h;
+	struct usage u;
+	int n;
+
+	while ((line = fgetln(f, &len)) != NULL) {
+		struct hist_entry *e;
+
+		copy = emalloc(len+1);
+		memcpy(copy, line, len);
+		if (len > 0 && copy[len-1] == '\n')
+			len--;
+		copy[len] = '\0';
+		memset(&u, 0, sizeof(u));
+		if (sscanf(copy, "%x %ld %ld %ld %ld %ld %n", &h, &u.wall,
+		    &u.cpu, &u.maxrss, &u.io, &u.csw, &n) != 6 &&
+		    sscanf(copy, "%x %ld %ld %n", &h, &u.wall, &u.cpu, &n) != 3)
+			n = -1;
+		if (n != -1 && u.wall >= 0 && u.cpu >= 0 && copy[n] != '\0') {
+			name = copy + n;
+			e = lookup(name, NULL, true);
+			total_wall -= e->u.wall;
+			e->cmdhash = h;
+			e->u = u;
+			total_wall += u.wall;
+		}
+		free(copy);
+	}
+}
+
+void
+History_Init(void)
+{
+	const char *s;
+	FILE *f;
+
+	s = Var_Value("BUILD_HISTORY");
+	if (s == NULL || *s == '\0')
+		return;
+	history_file = estrdup(s);
+	history_pid = getpid();
+	ohash_init(&history, 8, &hist_info);
+	f = fopen(history_file, "r");
+	if (f != NULL) {
+		read_history(f);
+		fclose(f);
+	}
+	atexit(History_End);
+}
+
+void
+History_Record(GNode *gn, const struct usage *u)
+{
+	struct hist_entry *e;
+
+	if (history_file == NULL)
+		return;
+	e = lookup(gn->name, NULL, true);
+	total_wall += u->wall - e->u.wall;
+	e->cmdhash = command_hash(gn);
+	e->u = *u;
+	e->this_run = true;
+	dirty = true;
+}
+
+long
+History_Duration(GNode *gn)
+{
+	struct hist_entry *e;
+
+	if (history_file == NULL)
+		return -1;
+	e = lookup(gn->name, NULL, false);
+	if (e == NULL || e->cmdhash != command_hash(gn))
+		return -1;
+	return e->u.wall;
+}
+
+long
+History_Mean(void)
+{
+	if (total_entries == 0)
+		return 0;
+	return total_wall / total_entries;
+}
+
+static void
+write_history(void)
+{
+	struct hist_entry *e;
+	unsigned int i;
+	char *tmp;
+	FILE *f;
+
+	tmp = Str_concat(history_file, ".tmp", 0);
+	f = fopen(tmp, "w");
+	if (f == NULL) {
+		free(tmp);
+		return;
+	}
+	for (e = ohash_first(&history, &i); e != NULL;
+	    e = ohash_next(&history, &i))
+		fprintf(f, "%08x %ld %ld %ld %ld %ld %s\n", e->cmdhash,
+		    e->u.wall, e->u.cpu, e->u.maxrss, e->u.io, e->u.csw,
+		    e->name);
+	if (fclose(f) == 0)
+		(void)rename(tmp, history_file);
+	else
+		(void)unlink(tmp);
+	free(tmp);
+}
+
+static int
+cmp_wall(const void *a, const void *b)
+{
+	const struct hist_entry *e1 = *(struct hist_entry * const *)a;
+	const struct hist_entry *e2 = *(struct hist_entry * const *)b;
+
+	if (e1->u.wall != e2->u.wall)
+		return e1->u.wall < e2->u.wall ? 1 : -1;
+	return strcmp(e1->name, e2->name);
+}
+
+static int
+cmp_rss(const void *a, const void *b)
+{
+	const struct hist_entry *e1 = *(struct hist_entry * const *)a;
+	const struct hist_entry *e2 = *(struct hist_entry * const *)b;
+
+	if (e1->u.maxrss != e2->u.maxrss)
+		return e1->u.maxrss < e2->u.maxrss ? 1 : -1;
+	return cmp_wall(a, b);
+}
+
+static void
+show_top(const char *title, struct hist_entry **t, unsigned int n,
+    unsigned int max)
+{
+	unsigned int i;
+
+	fprintf(stderr, "%s:\n", title);
+	fprintf(stderr, "%13s %13s %10s %8s %8s\n",
+	    "wall", "cpu", "maxrss", "io", "csw");
+	for (i = 0; i < n && i < max; i++)
+		fprintf(stderr, "%8ld.%03lds %8ld.%03lds %8ldKB %8ld %8ld  %s\n",
+		    t[i]->u.wall / 1000, t[i]->u.wall % 1000,
+		    t[i]->u.cpu / 1000, t[i]->u.cpu % 1000,
+		    t[i]->u.maxrss, t[i]->u.io, t[i]->u.csw, t[i]->name);
+}
+
+static void
+show_summary(void)
+{
+	struct hist_entry *e, **t;
+	unsigned int i, n = 0, max;
+	const char *s, *errstr;
+
+	s = Var_Value("BUILD_SUMMARY");
+	if (s == NULL)
+		return;
+	max = strtonum(s, 1, INT_MAX, &errstr);
+	if (errstr != NULL)
+		max = SUMMARY_DEFAULT;
+
+	t = ereallocarray(NULL, total_entries, sizeof(*t));
+	for (e = ohash_first(&history, &i); e != NULL;
+	    e = ohash_next(&history, &i))
+		if (e->this_run)
+			t[n++] = e;
+	if (n > 0) {
+		qsort(t, n, sizeof(*t), cmp_wall);
+		show_top("Slowest targets", t, n, max);
+		/* candidates for .EXPENSIVE */
+		qsort(t, n, sizeof(*t), cmp_rss);
+		if (t[0]->u.maxrss > 0)
+			show_top("Largest targets", t, n, max);
+	}
+	free(t);
+}
+
+static void
+History_End(void)
+{
+	/* forked children that exit() don't get a say */
+	if (getpid() != history_pid || !dirty)
+		return;
+	show_summary();
+	write_history();
+}
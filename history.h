@@ -0,0 +1,54 @@
+#ifndef HISTORY_H
+#define HISTORY_H
+/*	$OpenBSD$ */
+
+/*
+ * Copyright (c) 2026 Marc Espie.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE OPENBSD PROJECT AND CONTRIBUTORS
+ * ``AS IS'' AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ * LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR
+ * A PARTICULAR PURPOSE ARE DISCLAIMED.  IN NO EVENT SHALL THE OPENBSD
+ * PROJECT OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+ * SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT
+ * LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+ * DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+ * THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+ * OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+/* Build duration history: how long each target took to build last time,
+ * keyed by target name and a hash of its commands, kept in the file
+ * named by BUILD_HISTORY.
+ * All durations are in milliseconds.
+ */
+
+/* History_Init();
+ *	read the history file, if BUILD_HISTORY is set.  It will be
+ *	written back at exit. */
+extern void History_Init(void);
+
+/* History_Record(gn, &usage);
+ *	note that building gn just took that much. */
+struct usage;
+extern void History_Record(GNode *, const struct usage *);
+
+/* wall = History_Duration(gn);
+ *	how long gn took to build last time, or -1 if we don't know. */
+extern long History_Duration(GNode *);
+
+/* wall = History_Mean();
+ *	average duration over all known targets, 0 if none. */
+extern long History_Mean(void);
+
+#endif
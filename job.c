@@ -83,15 +83,22 @@
  */
 
 #include <sys/types.h>
+#include <sys/event.h>
+#include <sys/resource.h>
+#include <sys/select.h>
+#include <sys/time.h>
+#include <sys/uio.h>
 #include <sys/wait.h>
 #include <ctype.h>
 #include <errno.h>
 #include <fcntl.h>
+#include <limits.h>
 #include <signal.h>
 #include <stdarg.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <time.h>
 #include <unistd.h>
 #include "config.h"
 #include "defines.h"
@@ -107,6 +114,21 @@
 #include "memory.h"
 #include "buf.h"
 #include "enginechoice.h"
+#include "jobserver.h"
+#include "history.h"
+#include "digest.h"
+#include "trace.h"
+#include "dir.h"
+#include "stats.h"
+#include "status.h"
+#include "make.h"
+#include "schedule.h"
+#include "remote.h"
+#include "buildcache.h"
+#include "signature.h"
+#include "pool.h"
+#include "affinity.h"
+#include "arch.h"
 
 static int	aborting = 0;	    /* why is the make aborting? */
 #define ABORT_ERROR	1	    /* Because of an error */
@@ -117,12 +139,44 @@ static bool	no_new_jobs;	/* Mark recursive shit so we shouldn't start
 				 * something else at the same time
 				 */
 bool sequential;
+int output_sync = OUTPUT_SYNC_NONE;
+double max_load = 0;
 Job *runningJobs;		/* Jobs currently running a process */
 Job *errorJobs;			/* Jobs in error at end */
 Job *availableJobs;		/* Pool of available jobs */
 static Job *heldJobs;		/* Jobs not running yet because of expensive */
+static int held_jobs;		/* Length of heldJobs, for -dC */
+static Job *aloneJobs;		/* OOM_RETRY: waiting for the others */
+static int alone_jobs;		/* those, and the one running alone */
+static Job *localJobs;		/* REMOTE_HOSTS won't take them: waiting
+				 * for a local slot */
+static int local_waiting;	/* Length of localJobs */
+static int jobs_in_use;		/* Jobs attached to a node */
+static int local_slots;		/* -j, the rest is remote slots */
+static long min_free_pages;	/* MIN_FREE_MEMORY, in pages */
+static bool throttled;		/* we're not starting jobs because of load */
+static time_t last_start;	/* we started recent_starts jobs during */
+static int recent_starts;	/* second last_start */
 static pid_t mypid;		/* Used for printing debugging messages */
 static Job *extra_job;		/* Needed for .INTERRUPT */
+static Job *simulatedJobs;	/* -R: jobs on the virtual clock */
+
+/* -dI: how much job slot time went unused, and why.  Waits are charged
+ * to whatever kept make from starting jobs, the rest of the idle time
+ * to make itself.  All in slot-nanoseconds.  */
+static int job_slots;
+static struct timespec slots_start, slots_mark;
+static long long slots_busy, slots_idle, idle_for[IDLE_NUMBER];
+static int idle_why = IDLE_MAIN;
+static const char *idle_names[IDLE_NUMBER] = {
+	"waiting for prerequisites",
+	"sibling/target groups",
+	".ORDER or .WAIT",
+	"expensive jobs",
+	"jobserver tokens",
+	"load or memory",
+	"make itself",
+};
 
 static volatile sig_atomic_t got_fatal;
 
@@ -131,21 +185,50 @@ static volatile sig_atomic_t got_SIGINT, got_SIGHUP, got_SIGQUIT, got_SIGTERM,
 
 static sigset_t sigset, emptyset, origset;
 
+static int kq = -1;		/* kqueue for children, signals and tokens */
+#define KEVENTS	16
+
+/* -Oline: complete lines from several jobs are written together, with
+ * writev(2) straight from the job buffers, once make is done with the
+ * events at hand. */
+static Job **batch;		/* jobs with queued output */
+static int batch_len;
+#define BATCH_IOV	64	/* per writev */
+
 static void handle_fatal_signal(int);
+static void account_slots(void);
+static void idle_begin(void);
+static void idle_end(void);
+static void idle_report(void);
+static void simulate_job(Job *);
+static void simulate_next_job(void);
+static long elapsed(Job *);
 static void handle_siginfo(void);
 static void postprocess_job(Job *);
 static void determine_job_next_step(Job *);
 static void may_continue_job(Job *);
 static Job *reap_finished_job(pid_t);
+static void remove_running_job(Job *);
+static void process_reaped_job(Job *, pid_t, int, struct rusage *);
 static bool reap_jobs(void);
+static bool reap_one_job(Job *, pid_t);
+static bool wait_for_events(void);
+static void setup_kqueue(void);
+static bool under_pressure(void);
+static bool capture_output(Job *);
+static void read_job_output(Job *);
+static void flush_job_output(Job *, bool);
+static void flush_batch(void);
 static void may_continue_heldback_jobs(void);
+static int local_jobs(void);
+static void retry_alone(Job *);
 
-static bool expensive_job(Job *);
 static bool expensive_command(const char *);
+static bool expensive_template(struct command *, const char *);
+static unsigned char template_cost(struct command *);
 static void setup_signal(int);
 static void notice_signal(int);
 static void setup_all_signals(void);
-static const char *really_kill(Job *, int);
 static void debug_kill_printf(const char *, ...);
 static void debug_vprintf(const char *, va_list);
 static void may_remove_target(Job *);
@@ -156,23 +239,6 @@ static int dying_signal = 0;
 
 const char *	basedirectory = NULL;
 
-static const char *
-really_kill(Job *job, int signo)
-{
-	pid_t pid = job->pid;
-	if (getpgid(pid) != getpgrp()) {
-		if (killpg(pid, signo) == 0)
-			return "group got signal";
-		pid = -pid;
-	} else {
-		if (kill(pid, signo) == 0)
-			return "process got signal";
-	}
-	if (errno == ESRCH)
-		job->flags |= JOB_LOST;
-	return strerror(errno);
-}
-
 static void
 may_remove_target(Job *j)
 {
@@ -402,6 +468,84 @@ setup_all_signals(void)
 	got_fatal = 0;
 }
 
+/* charge the time since the last call to used and free slots, the
+ * free ones to idle_why */
+static void
+account_slots(void)
+{
+	struct timespec now, d;
+	long long t, idle;
+	int used = jobs_in_use > job_slots ? job_slots : jobs_in_use;
+
+	clock_gettime(CLOCK_MONOTONIC, &now);
+	timespecsub(&now, &slots_mark, &d);
+	slots_mark = now;
+	t = d.tv_sec * 1000000000LL + d.tv_nsec;
+	idle = t * (job_slots - used);
+	slots_busy += t * used;
+	slots_idle += idle;
+	idle_for[idle_why] += idle;
+}
+
+static void
+idle_begin(void)
+{
+	if (!DEBUG(IDLE))
+		return;
+	account_slots();
+	if (no_new_jobs || heldJobs != NULL)
+		idle_why = IDLE_EXPENSIVE;
+	else if (throttled)
+		idle_why = IDLE_LOAD;
+	else if (jobserver_wait_fd() != -1)
+		idle_why = IDLE_JOBSERVER;
+	else
+		idle_why = Make_IdleReason();
+}
+
+static void
+idle_end(void)
+{
+	if (DEBUG(IDLE)) {
+		account_slots();
+		idle_why = IDLE_MAIN;
+	}
+}
+
+static void
+idle_report(void)
+{
+	long long total;
+	int i;
+
+	/* forked children don't own the figures */
+	if (getpid() != mypid)
+		return;
+	account_slots();
+	total = slots_busy + slots_idle;
+	printf("# %d job slots over %lld.%03llds, %.1f%% used\n", job_slots,
+	    total / job_slots / 1000000000LL,
+	    total / job_slots / 1000000 % 1000,
+	    total == 0 ? 0.0 : 100.0 * slots_busy / total);
+	printf("#%10s %6s  %s\n", "slot-s", "%", "idle because of");
+	for (i = 0; i < IDLE_NUMBER; i++)
+		printf("%7lld.%03lld %6.1f  %s\n", idle_for[i] / 1000000000LL,
+		    idle_for[i] / 1000000 % 1000,
+		    total == 0 ? 0.0 : 100.0 * idle_for[i] / total,
+		    idle_names[i]);
+}
+
+/* how long we've been working on job's node, in ms */
+static long
+elapsed(Job *job)
+{
+	struct timespec now, d;
+
+	clock_gettime(CLOCK_MONOTONIC, &now);
+	timespecsub(&now, &job->start, &d);
+	return d.tv_sec * 1000 + d.tv_nsec / 1000000;
+}
+
 static void 
 handle_siginfo(void)
 {
@@ -426,10 +570,16 @@ handle_siginfo(void)
 		Buf_Truncate(&buf, length);
 
 	for (job = runningJobs; job != NULL ; job = job->next) {
+		long expected;
+
 		if (!first)
 			Buf_puts(&buf, ", ");
 		first = false;
 		Buf_puts(&buf, job->node->name);
+		expected = History_Duration(job->node);
+		if (expected >= 0)
+			Buf_printf(&buf, " (%lds of ~%lds)",
+			    elapsed(job) / 1000, (expected + 999) / 1000);
 	}
 	Buf_puts(&buf, first ? "nothing running\n" : "\n");
 
@@ -530,6 +680,16 @@ debug_kill_printf(const char *fmt, ...)
 static void
 postprocess_job(Job *job)
 {
+	if (DEBUG(IDLE))
+		account_slots();
+	Remote_Release(job);
+	jobs_in_use--;
+	Pool_Release(job->node);
+	trace_counter("running jobs", jobs_in_use);
+	status_count(STATUS_RUNNING, jobs_in_use);
+	Dir_Changed();
+	jobserver_release(local_jobs());
+	flush_job_output(job, true);
 	if (job->exit_type == JOB_EXIT_OKAY &&
 	    aborting != ABORT_ERROR &&
 	    aborting != ABORT_INTERRUPT) {
@@ -537,7 +697,23 @@ postprocess_job(Job *job)
 		 * non-zero status that we shouldn't ignore, we call
 		 * Make_Update to update the parents. */
 		job->node->built_status = REBUILT;
+		if (!simulate) {
+			job->usage.wall = elapsed(job);
+			/* a copy says nothing about how long it takes */
+			if (!(job->flags & JOB_CACHED))
+				History_Record(job->node, &job->usage);
+			Digest_Done(job->node);
+			Signature_Done(job->node);
+			if (!(job->flags & JOB_CACHED))
+				BuildCache_Store(job->node);
+		}
+		job->node->duration = job->usage.wall;
+		Schedule_Record(job->node, job->usage.wall);
+		status_job("done", job->node, 0);
 		engine_node_updated(job->node);
+	} else {
+		status_job("fail", job->node, job->code);
+		Make_Failed(job->node);
 	}
 	if (job->flags & JOB_KEEPERROR) {
 		job->next = errorJobs;
@@ -568,6 +744,8 @@ postprocess_job(Job *job)
  * While an expensive command is running, no_new_jobs
  * is set, so jobs that would fork new processes are accumulated in the
  * heldJobs list instead.
+ * With a jobserver, sub-makes take their tokens from the same pool, so
+ * there is no need to hold anything back.
  *
  * XXX This heuristics is also used on error exit: we display silent commands
  * that failed, unless those ARE expensive commands: expensive commands are
@@ -579,7 +757,9 @@ determine_expensive_job(Job *job)
 { 
 	if (expensive_job(job)) {
 		job->flags |= JOB_IS_EXPENSIVE;
-		no_new_jobs = true;
+		Schedule_Note(job->node, 'e');
+		if (!jobserver_active)
+			no_new_jobs = true;
 	} else
 		job->flags &= ~JOB_IS_EXPENSIVE;
 	if (DEBUG(EXPENSIVE))
@@ -588,16 +768,75 @@ determine_expensive_job(Job *job)
 		    job->flags & JOB_IS_EXPENSIVE ? "expensive" : "cheap");
 }
 
-static bool
+bool
 expensive_job(Job *job)
 {
 	if (job->node->type & OP_CHEAP)
 		return false;
 	if (job->node->type & (OP_EXPENSIVE | OP_MAKE))
 		return true;
+	if (job->command != NULL)
+		return expensive_template(job->command, job->cmd);
 	return expensive_command(job->cmd);
 }
 
+/* The heuristics look at the command's words.  Globals expand the same
+ * way for every target, and locals are file names: if the answer stays
+ * the same whether they stand for a separator, a path or a mere letter,
+ * it holds for every target, as long as globals don't change.  */
+static unsigned char
+template_cost(struct command *command)
+{
+	static const char stand_ins[] = " /_";
+	BUFFER buf;
+	char *s, *t, *p;
+	size_t i;
+	bool expensive = false;
+
+	if (strchr(command->string, '$') == NULL)
+		return expensive_command(command->string) ?
+		    COST_EXPENSIVE : COST_CHEAP;
+	Buf_Init(&buf, 0);
+	if (!Var_SubstGlobals(command->compiled, &buf, '\001')) {
+		Buf_Destroy(&buf);
+		return COST_EXPANDED;
+	}
+	s = Buf_Retrieve(&buf);
+	t = estrdup(s);
+	for (i = 0; i < sizeof(stand_ins) - 1; i++) {
+		for (p = s; *p != '\0'; p++)
+			t[p - s] = *p == '\001' ? stand_ins[i] : *p;
+		if (i == 0)
+			expensive = expensive_command(t);
+		else if (expensive_command(t) != expensive)
+			break;
+	}
+	free(s);
+	free(t);
+	if (i < sizeof(stand_ins) - 1)
+		return COST_EXPANDED;
+	return expensive ? COST_EXPENSIVE : COST_CHEAP;
+}
+
+static bool
+expensive_template(struct command *command, const char *expanded)
+{
+	if (command->cost == COST_UNKNOWN ||
+	    (command->cost != COST_EXPANDED &&
+	    command->cost_gen != Var_Generation())) {
+		command->cost = template_cost(command);
+		command->cost_gen = Var_Generation();
+	}
+	switch (command->cost) {
+	case COST_CHEAP:
+		return false;
+	case COST_EXPENSIVE:
+		return true;
+	default:
+		return expensive_command(expanded);
+	}
+}
+
 static bool
 expensive_command(const char *s)
 {
@@ -648,16 +887,169 @@ expensive_command(const char *s)
 	return false;
 }
 
+/* output synchronization (-O): the commands of a job write to a pipe,
+ * which we drain into job->output while they run.  We show that output
+ * as whole lines, or all at once when the job is done or fails.
+ * This needs kqueue to notice pipes filling up, and is pointless in
+ * sequential mode.
+ */
+static bool
+capture_output(Job *job)
+{
+	if (output_sync == OUTPUT_SYNC_NONE || sequential || kq == -1)
+		return false;
+	/* a sub-make will synchronize its own output */
+	if (output_sync == OUTPUT_SYNC_TARGET && expensive_job(job))
+		return false;
+	return true;
+}
+
+int
+job_output_pipe(Job *job)
+{
+	int fds[2];
+
+	if (!capture_output(job) || pipe(fds) == -1) {
+		/* stuff we already got must come first */
+		flush_job_output(job, true);
+		return -1;
+	}
+	(void)fcntl(fds[0], F_SETFD, FD_CLOEXEC);
+	(void)fcntl(fds[0], F_SETFL, O_NONBLOCK);
+	(void)fcntl(fds[1], F_SETFD, FD_CLOEXEC);
+	job->out_fd = fds[0];
+	return fds[1];
+}
+
+void
+job_message(Job *job, FILE *f, const char *s)
+{
+	if (capture_output(job)) {
+		Buf_AddString(job->output, s);
+		Buf_AddChar(job->output, '\n');
+		if (output_sync == OUTPUT_SYNC_LINE)
+			flush_job_output(job, false);
+	} else {
+		flush_job_output(job, true);
+		fprintf(f, "%s\n", s);
+	}
+}
+
+void
+job_flush_output(Job *job)
+{
+	flush_job_output(job, true);
+}
+
+static void
+read_job_output(Job *job)
+{
+	char buf[BUFSIZ];
+	ssize_t r;
+
+	if (job->out_fd == -1)
+		return;
+	for (;;) {
+		r = read(job->out_fd, buf, sizeof buf);
+		if (r > 0)
+			Buf_AddChars(job->output, r, buf);
+		else if (r == -1 && errno == EINTR)
+			continue;
+		else
+			break;
+	}
+	if (r == 0) {
+		close(job->out_fd);
+		job->out_fd = -1;
+	}
+	if (output_sync == OUTPUT_SYNC_LINE)
+		flush_job_output(job, false);
+}
+
+/* show what we have.  Unless all is set, keep the last incomplete line
+ * for later, and leave the complete ones in the batch, since more are
+ * likely to come.  Otherwise, something else is about to be displayed,
+ * so the whole batch must go first.
+ */
+static void
+flush_job_output(Job *job, bool all)
+{
+	size_t len = Buf_Size(job->output);
+	const char *s = job->output->buffer;
+
+	if (!all)
+		while (len > job->queued && s[len-1] != '\n')
+			len--;
+	if (len > job->queued) {
+		if (job->queued == 0)
+			batch[batch_len++] = job;
+		job->queued = len;
+	}
+	if (all)
+		flush_batch();
+}
+
+static void
+flush_batch(void)
+{
+	struct iovec iov[BATCH_IOV];
+	int i, j, n;
+	ssize_t w;
+	size_t left;
+	Job *job;
+
+	if (batch_len == 0)
+		return;
+	fflush(stdout);
+	for (i = 0; i < batch_len; i += n) {
+		n = batch_len - i;
+		if (n > BATCH_IOV)
+			n = BATCH_IOV;
+		for (j = 0; j != n; j++) {
+			iov[j].iov_base = batch[i+j]->output->buffer;
+			iov[j].iov_len = batch[i+j]->queued;
+		}
+		for (j = 0; j != n;) {
+			w = writev(STDOUT_FILENO, iov + j, n - j);
+			if (w == -1) {
+				if (errno == EINTR)
+					continue;
+				break;
+			}
+			for (; j != n && (size_t)w >= iov[j].iov_len; j++)
+				w -= iov[j].iov_len;
+			if (j != n) {
+				iov[j].iov_base = (char *)iov[j].iov_base + w;
+				iov[j].iov_len -= w;
+			}
+		}
+	}
+	for (i = 0; i != batch_len; i++) {
+		job = batch[i];
+		left = Buf_Size(job->output) - job->queued;
+		memmove(job->output->buffer, job->output->buffer + job->queued,
+		    left);
+		Buf_Truncate(job->output, left);
+		job->queued = 0;
+	}
+	batch_len = 0;
+}
+
 static void
 may_continue_job(Job *job)
 {
-	if (no_new_jobs) {
+	if (no_new_jobs && !(job->flags & JOB_ALONE)) {
 		if (DEBUG(EXPENSIVE))
 			fprintf(stderr, "[%ld] expensive -> hold %s\n",
 			    (long)mypid, job->node->name);
 		job->next = heldJobs;
 		heldJobs = job;
-	} else {
+		trace_instant("expensive", job->node->name, "hold");
+		trace_counter("held jobs", ++held_jobs);
+		status_count(STATUS_HELD_JOBS, held_jobs);
+	} else if (simulate)
+		simulate_job(job);
+	else {
 		bool finished = job_run_next(job);
 		if (finished)
 			postprocess_job(job);
@@ -666,9 +1058,49 @@ may_continue_job(Job *job)
 	}
 }
 
+/* a job killed by the OOM killer starts over, once nothing else runs,
+ * and nothing else starts until it's done */
+static void
+retry_alone(Job *job)
+{
+	job->flags &= ~JOB_RETRY;
+	if (!(job->flags & JOB_ALONE)) {
+		job->flags |= JOB_ALONE;
+		alone_jobs++;
+	}
+	job->next_cmd = Lst_First(&job->node->commands);
+	job->exit_type = JOB_EXIT_OKAY;
+	no_new_jobs = true;
+	job->next = aloneJobs;
+	aloneJobs = job;
+}
+
+/* jobs that run here: neither remote, nor waiting for their turn */
+static int
+local_jobs(void)
+{
+	return jobs_in_use - Remote_InUse() - local_waiting;
+}
+
 static void
 may_continue_heldback_jobs()
 {
+	if (aloneJobs != NULL) {
+		if (runningJobs == NULL) {
+			Job *job = aloneJobs;
+			aloneJobs = aloneJobs->next;
+			may_continue_job(job);
+		}
+		return;
+	}
+	while (localJobs != NULL && local_jobs() < local_slots &&
+	    jobserver_acquire(local_jobs())) {
+		Job *job = localJobs;
+		localJobs = localJobs->next;
+		local_waiting--;
+		status_job("start", job->node, 0);
+		may_continue_job(job);
+	}
 	while (!no_new_jobs) {
 		if (heldJobs != NULL) {
 			Job *job = heldJobs;
@@ -676,6 +1108,9 @@ may_continue_heldback_jobs()
 			if (DEBUG(EXPENSIVE))
 				fprintf(stderr, "[%ld] cheap -> release %s\n",
 				    (long)mypid, job->node->name);
+			trace_instant("expensive", job->node->name, "release");
+			trace_counter("held jobs", --held_jobs);
+			status_count(STATUS_HELD_JOBS, held_jobs);
 			may_continue_job(job);
 		} else
 			break;
@@ -697,18 +1132,80 @@ void
 Job_Make(GNode *gn)
 {
 	Job *job = availableJobs;       	
+	time_t now;
 
 	assert(job != NULL);
 	availableJobs = availableJobs->next;
+	if (DEBUG(IDLE))
+		account_slots();
+	jobs_in_use++;
+	trace_counter("running jobs", jobs_in_use);
+	status_count(STATUS_RUNNING, jobs_in_use);
+	if (time(&now) != last_start) {
+		last_start = now;
+		recent_starts = 0;
+	}
+	recent_starts++;
+	Digest_Start(gn);
 	job_attach_node(job, gn);
+	Pool_Take(gn);
+	if (!simulate && BuildCache_Fetch(gn)) {
+		job->flags |= JOB_CACHED;
+		status_job("start", gn, 0);
+		postprocess_job(job);
+		return;
+	}
+	/* can_start_job let us overflow to the remote hosts.  What can't
+	 * go there waits for a local slot */
+	if (local_jobs() > local_slots && !Remote_Take(job)) {
+		job->next = localJobs;
+		localJobs = job;
+		local_waiting++;
+		return;
+	}
+	status_job("start", gn, 0);
 	may_continue_job(job);
 }
 
+/* -R: instead of running commands, the job takes as long as the trace
+ * says, with the same effect on what else may run */
+static void
+simulate_job(Job *job)
+{
+	bool expensive;
+
+	job->next_cmd = NULL;
+	job->sim_end = Schedule_Start(job->node, &expensive);
+	job->usage.wall = Schedule_Duration(job->node);
+	if (expensive) {
+		job->flags |= JOB_IS_EXPENSIVE;
+		no_new_jobs = true;
+	}
+	job->next = simulatedJobs;
+	simulatedJobs = job;
+}
+
+/* and the virtual clock jumps to the end of the next job */
+static void
+simulate_next_job(void)
+{
+	Job **j, **first = &simulatedJobs, *job;
+
+	for (j = &simulatedJobs; *j != NULL; j = &(*j)->next)
+		if ((*j)->sim_end < (*first)->sim_end)
+			first = j;
+	job = *first;
+	*first = job->next;
+	Schedule_Advance(job->sim_end);
+	determine_job_next_step(job);
+	may_continue_heldback_jobs();
+}
+
 static void
 determine_job_next_step(Job *job)
 {
 	if (job->flags & JOB_IS_EXPENSIVE) {
-		no_new_jobs = false;
+		no_new_jobs = alone_jobs != 0;
 		if (DEBUG(EXPENSIVE))
 			fprintf(stderr, "[%ld] "
 			    "Returning from expensive target %s, "
@@ -716,9 +1213,15 @@ determine_job_next_step(Job *job)
 			    job->node->name);
 	}
 
-	if (job->exit_type != JOB_EXIT_OKAY || job->next_cmd == NULL)
+	if (job->flags & JOB_RETRY)
+		retry_alone(job);
+	else if (job->exit_type != JOB_EXIT_OKAY || job->next_cmd == NULL) {
+		if (job->flags & JOB_ALONE) {
+			job->flags &= ~JOB_ALONE;
+			no_new_jobs = --alone_jobs != 0;
+		}
 		postprocess_job(job);
-	else
+	} else
 		may_continue_job(job);
 }
 
@@ -732,18 +1235,55 @@ determine_job_next_step(Job *job)
 static Job *
 reap_finished_job(pid_t pid)
 {
-	Job **j, *job;
+	Job *job;
 
-	for (j = &runningJobs; *j != NULL; j = &((*j)->next))
-		if ((*j)->pid == pid) {
-			job = *j;
-			*j = job->next;
+	for (job = runningJobs; job != NULL; job = job->next)
+		if (job->pid == pid) {
+			remove_running_job(job);
 			return job;
 		}
 
 	return NULL;
 }
 
+static void
+remove_running_job(Job *job)
+{
+	*job->pprev = job->next;
+	if (job->next != NULL)
+		job->next->pprev = job->pprev;
+}
+
+static void
+process_reaped_job(Job *job, pid_t pid, int status, struct rusage *ru)
+{
+	if (job == NULL) {
+		Punt("Child (%ld) with status %d not in table?", 
+		    (long)pid, status);
+	} else {
+		/* get the last of its output, and show it before any error
+		 * message */
+		job->usage.cpu += ru->ru_utime.tv_sec * 1000 +
+		    ru->ru_utime.tv_usec / 1000 +
+		    ru->ru_stime.tv_sec * 1000 + ru->ru_stime.tv_usec / 1000;
+		if (ru->ru_maxrss > job->usage.maxrss)
+			job->usage.maxrss = ru->ru_maxrss;
+		job->usage.io += ru->ru_inblock + ru->ru_oublock;
+		job->usage.csw += ru->ru_nvcsw + ru->ru_nivcsw;
+		read_job_output(job);
+		if (job->out_fd != -1) {
+			close(job->out_fd);
+			job->out_fd = -1;
+		}
+		if (output_sync == OUTPUT_SYNC_LINE || status != 0 ||
+		    job->next_cmd == NULL)
+			flush_job_output(job, true);
+		handle_job_status(job, status);
+		determine_job_next_step(job);
+	}
+	may_continue_heldback_jobs();
+}
+
 /*
  * classic waitpid handler: retrieve as many dead children as possible.
  * returns true if succesful
@@ -753,23 +1293,14 @@ reap_jobs(void)
 {
  	pid_t pid;	/* pid of dead child */
  	int status;	/* Exit/termination status */
+	struct rusage ru;
 	bool reaped = false;
-	Job *job;
 
-	while ((pid = waitpid(WAIT_ANY, &status, WNOHANG)) > 0) {
+	while ((pid = wait4(WAIT_ANY, &status, WNOHANG, &ru)) > 0) {
 		if (WIFSTOPPED(status))
 			continue;
 		reaped = true;
-		job = reap_finished_job(pid);
-
-		if (job == NULL) {
-			Punt("Child (%ld) with status %d not in table?", 
-			    (long)pid, status);
-		} else {
-			handle_job_status(job, status);
-			determine_job_next_step(job);
-		}
-		may_continue_heldback_jobs();
+		process_reaped_job(reap_finished_job(pid), pid, status, &ru);
 	}
 	/* sanity check, should not happen */
 	if (pid == -1 && errno == ECHILD && runningJobs != NULL)
@@ -777,6 +1308,111 @@ reap_jobs(void)
 	return reaped;
 }
 
+/*
+ * kqueue told us pid exited: reap that job, unless reap_jobs() already
+ * got it, in which case it may even be running something else by now.
+ */
+static bool
+reap_one_job(Job *job, pid_t pid)
+{
+	int status;
+	struct rusage ru;
+
+	if (job->pid != pid || wait4(pid, &status, WNOHANG, &ru) != pid)
+		return false;
+	remove_running_job(job);
+	process_reaped_job(job, pid, status, &ru);
+	return true;
+}
+
+/*
+ * sleep on the kqueue, with signals blocked.
+ * returns true if something happened that needs make's attention
+ */
+static bool
+wait_for_events(void)
+{
+	struct kevent change[2], ev[KEVENTS];
+	int fd, n, i, nchanges = 0;
+	bool done = false;
+
+	fd = jobserver_wait_fd();
+	if (fd != -1)
+		EV_SET(&change[nchanges++], fd, EVFILT_READ,
+		    EV_ADD | EV_ONESHOT, 0, 0, NULL);
+	/* look again at the load in a second */
+	if (throttled)
+		EV_SET(&change[nchanges++], 0, EVFILT_TIMER,
+		    EV_ADD | EV_ONESHOT, 0, 1000, NULL);
+	n = kevent(kq, change, nchanges, ev, KEVENTS, NULL);
+	for (i = 0; i < n; i++) {
+		switch (ev[i].filter) {
+		case EVFILT_PROC:
+			if (reap_one_job(ev[i].udata, ev[i].ident))
+				done = true;
+			break;
+		case EVFILT_READ:
+			if (ev[i].udata != NULL) {
+				read_job_output(ev[i].udata);
+				break;
+			}
+			jobserver_stop_waiting();
+			done = true;
+			break;
+		case EVFILT_TIMER:
+			done = true;
+			break;
+		case EVFILT_SIGNAL:
+			/* let the handler run, handle_all_signals() will
+			 * see it */
+			sigprocmask(SIG_UNBLOCK, &sigset, NULL);
+			sigprocmask(SIG_BLOCK, &sigset, NULL);
+			break;
+		}
+	}
+	flush_batch();
+	return done;
+}
+
+void
+watch_running_job(Job *job)
+{
+	struct kevent kev;
+
+	if (kq == -1)
+		return;
+	EV_SET(&kev, job->pid, EVFILT_PROC, EV_ADD | EV_ONESHOT, NOTE_EXIT, 0,
+	    job);
+	/* ESRCH: it's already dead, and reap_jobs() will find it */
+	(void)kevent(kq, &kev, 1, NULL, 0, NULL);
+	/* the knote goes away when we close out_fd */
+	if (job->out_fd != -1) {
+		EV_SET(&kev, job->out_fd, EVFILT_READ, EV_ADD, 0, 0, job);
+		(void)kevent(kq, &kev, 1, NULL, 0, NULL);
+	}
+}
+
+static void
+setup_kqueue(void)
+{
+	static int sigs[] = { SIGINT, SIGHUP, SIGQUIT, SIGTERM, SIGINFO };
+	struct kevent kev[sizeof sigs / sizeof sigs[0]];
+	int i, n = 0;
+
+	kq = kqueue();
+	if (kq == -1)
+		return;
+	/* signals are blocked while we wait, but kqueue still sees them */
+	for (i = 0; i != sizeof sigs / sizeof sigs[0]; i++)
+		if (sigismember(&sigset, sigs[i]))
+			EV_SET(&kev[n++], sigs[i], EVFILT_SIGNAL, EV_ADD, 0, 0,
+			    NULL);
+	if (kevent(kq, kev, n, NULL, 0, NULL) == -1) {
+		close(kq);
+		kq = -1;
+	}
+}
+
 void 
 reset_signal_mask()
 {
@@ -786,6 +1422,13 @@ reset_signal_mask()
 void
 handle_running_jobs(void)
 {
+	int fd, r;
+	fd_set rfds;
+
+	if (simulate) {
+		simulate_next_job();
+		return;
+	}
 	/* reaping children in the presence of caught signals */
 
 	/* first, we make sure to hold on new signals, to synchronize
@@ -805,10 +1448,38 @@ handle_running_jobs(void)
 		handle_all_signals();
 		if (reap_jobs())
 			break;
+		/* don't sit on tokens we grabbed for nothing */
+		jobserver_release(local_jobs());
 		/* okay, so it's safe to suspend, we have nothing to do but
 		 * wait...
 		 */
-		sigsuspend(&emptyset);
+		Stats_IdleBegin();
+		idle_begin();
+		if (kq != -1) {
+			r = wait_for_events();
+			Stats_IdleEnd();
+			idle_end();
+			if (r)
+				break;
+			continue;
+		}
+		fd = jobserver_wait_fd();
+		if (fd == -1) {
+			sigsuspend(&emptyset);
+			Stats_IdleEnd();
+			idle_end();
+			continue;
+		}
+		/* ... for a child, or a token from the jobserver */
+		FD_ZERO(&rfds);
+		FD_SET(fd, &rfds);
+		r = pselect(fd+1, &rfds, NULL, NULL, NULL, &emptyset);
+		Stats_IdleEnd();
+		idle_end();
+		if (r > 0) {
+			jobserver_stop_waiting();
+			break;
+		}
 	}
 	reset_signal_mask();
 }
@@ -824,41 +1495,128 @@ void
 Job_Init(int maxJobs)
 {
 	Job *j;
-	int i;
+	BUFFER *b;
+	const char *s;
+	int i, n;
 
 	runningJobs = NULL;
+	simulatedJobs = NULL;
 	heldJobs = NULL;
+	aloneJobs = NULL;
+	alone_jobs = 0;
+	held_jobs = 0;
 	errorJobs = NULL;
 	availableJobs = NULL;
+	jobs_in_use = 0;
+	localJobs = NULL;
+	local_waiting = 0;
+	local_slots = maxJobs;
+	if (!simulate) {
+		Remote_Init();
+		maxJobs += Remote_Slots();
+	}
 	sequential = maxJobs == 1;
 
 	/* we allocate n+1 jobs, since we may need an extra job for
-	 * running .INTERRUPT.  */
-	j = ereallocarray(NULL, sizeof(Job), maxJobs+1);
-	for (i = 0; i != maxJobs; i++) {
+	 * running .INTERRUPT.  Jobs waiting in localJobs don't count
+	 * against maxJobs, so that the remote hosts stay busy: those
+	 * get one more job per remote slot.  */
+	n = maxJobs + (simulate ? 0 : Remote_Slots());
+	j = ereallocarray(NULL, sizeof(Job), n+1);
+	b = ereallocarray(NULL, sizeof(BUFFER), n+1);
+	batch = ereallocarray(NULL, sizeof(Job *), n+1);
+	batch_len = 0;
+	for (i = 0; i != n+1; i++) {
+		j[i].out_fd = -1;
+		j[i].queued = 0;
+		j[i].slot = i + 1;
+		j[i].output = &b[i];
+		Buf_Init(j[i].output, 0);
+	}
+	for (i = 0; i != n; i++) {
 		j[i].next = availableJobs;
 		availableJobs = &j[i];
 	}
-	extra_job = &j[maxJobs];
+	extra_job = &j[n];
 	mypid = getpid();
+	if (!simulate)
+		Affinity_Init(maxJobs);
+	job_slots = maxJobs;
+	if (DEBUG(IDLE)) {
+		clock_gettime(CLOCK_MONOTONIC, &slots_start);
+		slots_mark = slots_start;
+		atexit(idle_report);
+	}
 
 	aborting = 0;
 	setup_all_signals();
+	setup_kqueue();
+
+	min_free_pages = 0;
+	if ((s = Var_Value("MIN_FREE_MEMORY")) != NULL) {
+		const char *errstr;
+		long long mb = strtonum(s, 0, LLONG_MAX / 1048576, &errstr);
+
+		if (errstr != NULL)
+			Punt("MIN_FREE_MEMORY is %s: %s", errstr, s);
+		min_free_pages = mb * 1048576 / sysconf(_SC_PAGESIZE);
+	}
+}
+
+/* admission control: don't start new jobs while the machine is
+ * overloaded, unless we have nothing running.  Jobs we just started
+ * don't show up in the load average yet, so we count them as well,
+ * which lets make ramp up again slowly.
+ */
+static bool
+under_pressure(void)
+{
+	double load;
+	long avail;
+
+	if (jobs_in_use == 0)
+		return false;
+	if (max_load > 0 && getloadavg(&load, 1) == 1) {
+		if (time(NULL) == last_start)
+			load += recent_starts;
+		if (load >= max_load) {
+			debug_job_printf("Load %.2f, holding off\n", load);
+			return true;
+		}
+	}
+	if (min_free_pages > 0) {
+		avail = sysconf(_SC_AVPHYS_PAGES);
+		if (avail != -1 && avail < min_free_pages) {
+			debug_job_printf("%ld free pages, holding off\n",
+			    avail);
+			return true;
+		}
+	}
+	return false;
 }
 
 bool
 can_start_job(void)
 {
-	if (aborting || availableJobs == NULL)
+	if (aborting || availableJobs == NULL ||
+	    jobs_in_use - local_waiting >= job_slots)
 		return false;
-	else
+	if (simulate)
+		return true;
+	/* the local slots are busy, what's left is remote.  A job that
+	 * can't go there waits in Job_Make */
+	if (local_jobs() >= local_slots)
 		return true;
+	throttled = under_pressure();
+	if (throttled)
+		return false;
+	return jobserver_acquire(local_jobs());
 }
 
 bool
 Job_Empty(void)
 {
-	return runningJobs == NULL;
+	return runningJobs == NULL && simulatedJobs == NULL;
 }
 
 /*-
@@ -882,7 +1640,7 @@ handle_fatal_signal(int signo)
 	for (job = runningJobs; job != NULL; job = job->next) {
 		debug_kill_printf("passing to "
 		    "child %ld running %s: %s\n", (long)job->pid,
-		    job->node->name, really_kill(job, signo));
+		    job->node->name, job->executor->kill(job, signo));
 		may_remove_target(job);
 	}
 
@@ -896,6 +1654,10 @@ handle_fatal_signal(int signo)
 	}
 	loop_handle_running_jobs();
 	internal_print_errors();
+	jobserver_release(0);
+	/* what make -t did so far sticks */
+	Dir_FlushTouches();
+	Arch_FlushTouches();
 
 	/* die by that signal */
 	sigprocmask(SIG_BLOCK, &sigset, NULL);
@@ -91,6 +91,30 @@ extern void reset_signal_mask(void);
 extern void handle_all_signals(void);
 
 extern void determine_expensive_job(Job *);
+/* does job look like it's running a recursive make ? */
+extern bool expensive_job(Job *);
+
+/* fd = job_output_pipe(job);
+ *	create the pipe the next command of job should write to, and
+ *	return its write side, or -1 if output goes straight to stdout.
+ */
+extern int job_output_pipe(Job *);
+
+/* job_message(job, f, s);
+ *	display line s on f, as part of the output of job.
+ */
+extern void job_message(Job *, FILE *, const char *);
+
+/* job_flush_output(job);
+ *	display what job output so far, before an error message.
+ */
+extern void job_flush_output(Job *);
+
+/* watch_running_job(job);
+ *	tell the job module about a freshly forked job->pid, so that it
+ *	gets woken up when it exits.
+ */
+extern void watch_running_job(Job *);
 extern Job *runningJobs, *errorJobs, *availableJobs;
 extern void debug_job_printf(const char *, ...);
 extern void handle_one_job(Job *);
@@ -100,4 +124,12 @@ extern const char *basedirectory;
 
 extern bool	sequential;	/* True if we are running one single-job */
 
+extern double	max_load;	/* -l: don't start jobs above that load */
+
+extern int	output_sync;	/* -O: how to group output of parallel jobs */
+#define OUTPUT_SYNC_NONE	0
+#define OUTPUT_SYNC_LINE	1	/* by lines */
+#define OUTPUT_SYNC_TARGET	2	/* by target, except for sub-makes */
+#define OUTPUT_SYNC_RECURSE	3	/* by target, including sub-makes */
+
 #endif /* _JOB_H_ */
@@ -0,0 +1,266 @@
+/*	$OpenBSD$ */
+/*
+ * Copyright (c) 2026 Marc Espie.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE OPENBSD PROJECT AND CONTRIBUTORS
+ * ``AS IS'' AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ * LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR
+ * A PARTICULAR PURPOSE ARE DISCLAIMED.  IN NO EVENT SHALL THE OPENBSD
+ * PROJECT OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+ * SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT
+ * LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+ * DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+ * THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+ * OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include <sys/time.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <limits.h>
+#include <poll.h>
+#include <signal.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include "config.h"
+#include "defines.h"
+#include "jobserver.h"
+#include "var.h"
+#include "str.h"
+
+#define JOBSERVER_AUTH	"--jobserver-auth="
+#define JOBSERVER_FDS	"--jobserver-fds="	/* older gnu make */
+#define FIFO_PREFIX	"fifo:"
+
+bool jobserver_active = false;
+
+static int readfd = -1, writefd = -1;
+static bool readfd_private = false;	/* our own non-blocking reader */
+static int tokens_held = 0;	/* tokens we read off the pipe */
+static bool waiting = false;	/* last acquire attempt failed */
+
+static void release_all_tokens(void);
+static bool parse_fds(const char *);
+static bool open_fifo(const char *);
+static void advertise(const char *);
+static void notice_alarm(int);
+static ssize_t read_token(char *);
+
+static void
+advertise(const char *auth)
+{
+	char *s = Str_concat(JOBSERVER_AUTH, auth, 0);
+
+	Var_Append(".MAKEFLAGS", s);
+	free(s);
+}
+
+static bool
+parse_fds(const char *s)
+{
+	const char *errstr;
+	char *comma;
+	char buf[32];
+
+	if (strlcpy(buf, s, sizeof buf) >= sizeof buf)
+		return false;
+	comma = strchr(buf, ',');
+	if (comma == NULL)
+		return false;
+	*comma = '\0';
+	readfd = strtonum(buf, 0, INT_MAX, &errstr);
+	if (errstr != NULL)
+		return false;
+	writefd = strtonum(comma+1, 0, INT_MAX, &errstr);
+	if (errstr != NULL)
+		return false;
+	/* the parent may not have passed them on to us */
+	if (fcntl(readfd, F_GETFD) == -1 || fcntl(writefd, F_GETFD) == -1)
+		return false;
+	return true;
+}
+
+static bool
+open_fifo(const char *path)
+{
+	/* open our own read side, so that O_NONBLOCK doesn't leak */
+	readfd = open(path, O_RDONLY | O_NONBLOCK | O_CLOEXEC);
+	if (readfd == -1)
+		return false;
+	writefd = open(path, O_WRONLY | O_CLOEXEC);
+	if (writefd == -1) {
+		close(readfd);
+		return false;
+	}
+	readfd_private = true;
+	return true;
+}
+
+bool
+Jobserver_ParseArg(const char *word)
+{
+	const char *arg;
+	bool ok;
+
+	if (strncmp(word, JOBSERVER_AUTH, strlen(JOBSERVER_AUTH)) == 0)
+		arg = word + strlen(JOBSERVER_AUTH);
+	else if (strncmp(word, JOBSERVER_FDS, strlen(JOBSERVER_FDS)) == 0)
+		arg = word + strlen(JOBSERVER_FDS);
+	else
+		return false;
+
+	/* we may see the same string again through .MAKEFLAGS */
+	if (jobserver_active)
+		return true;
+
+	if (strncmp(arg, FIFO_PREFIX, strlen(FIFO_PREFIX)) == 0)
+		ok = open_fifo(arg + strlen(FIFO_PREFIX));
+	else
+		ok = parse_fds(arg);
+	if (!ok) {
+		fprintf(stderr,
+		    "make: warning: jobserver %s unavailable, using -j\n",
+		    arg);
+		readfd = writefd = -1;
+		return true;
+	}
+	jobserver_active = true;
+	advertise(arg);
+	atexit(release_all_tokens);
+	return true;
+}
+
+void
+Jobserver_Init(int maxJobs)
+{
+	int fds[2];
+	int i;
+	char buf[32];
+
+	if (jobserver_active || maxJobs <= 1)
+		return;
+	if (pipe(fds) == -1)
+		return;
+	readfd = fds[0];
+	writefd = fds[1];
+	/* our implicit slot is the first job */
+	for (i = 1; i < maxJobs; i++)
+		if (write(writefd, "+", 1) != 1)
+			break;
+	jobserver_active = true;
+	(void)snprintf(buf, sizeof buf, "%d,%d", readfd, writefd);
+	advertise(buf);
+	atexit(release_all_tokens);
+}
+
+static void
+notice_alarm(int sig)
+{
+}
+
+/* A pipe is shared with other makes, which may expect it to block, so we
+ * can't make it non-blocking.  Another make may steal the token poll(2)
+ * showed us, and the next one might only come back once our own jobs
+ * are reaped: don't let read(2) block for more than a moment.  */
+static ssize_t
+read_token(char *c)
+{
+	struct sigaction sa, osa;
+	struct itimerval it;
+	ssize_t r;
+
+	if (readfd_private)
+		return read(readfd, c, 1);
+
+	memset(&sa, 0, sizeof sa);
+	sa.sa_handler = notice_alarm;
+	sigemptyset(&sa.sa_mask);
+	sa.sa_flags = 0;	/* no SA_RESTART: we want the EINTR */
+	(void)sigaction(SIGALRM, &sa, &osa);
+	memset(&it, 0, sizeof it);
+	it.it_value.tv_usec = 10000;
+	(void)setitimer(ITIMER_REAL, &it, NULL);
+	r = read(readfd, c, 1);
+	memset(&it, 0, sizeof it);
+	(void)setitimer(ITIMER_REAL, &it, NULL);
+	(void)sigaction(SIGALRM, &osa, NULL);
+	return r;
+}
+
+bool
+jobserver_acquire(int inuse)
+{
+	struct pollfd pfd;
+	char c;
+	ssize_t r;
+
+	if (!jobserver_active || inuse < 1 + tokens_held)
+		return true;
+	/* look before we read.  If another make steals the token in
+	 * between, we just wait for the next one to come back.  */
+	pfd.fd = readfd;
+	pfd.events = POLLIN;
+	if (poll(&pfd, 1, 0) == 1) {
+		r = read_token(&c);
+		if (r == 1) {
+			tokens_held++;
+			waiting = false;
+			return true;
+		}
+	}
+	waiting = true;
+	return false;
+}
+
+void
+jobserver_release(int inuse)
+{
+	int needed = inuse > 0 ? inuse - 1 : 0;
+	struct pollfd pfd;
+
+	while (tokens_held > needed) {
+		if (write(writefd, "+", 1) == 1)
+			tokens_held--;
+		else if (errno == EAGAIN) {
+			/* someone else made it non-blocking */
+			pfd.fd = writefd;
+			pfd.events = POLLOUT;
+			(void)poll(&pfd, 1, -1);
+		} else if (errno != EINTR) {
+			fprintf(stderr,
+			    "make: warning: can't give back jobserver token: %s\n",
+			    strerror(errno));
+			return;
+		}
+	}
+}
+
+static void
+release_all_tokens(void)
+{
+	jobserver_release(0);
+}
+
+int
+jobserver_wait_fd(void)
+{
+	return waiting ? readfd : -1;
+}
+
+void
+jobserver_stop_waiting(void)
+{
+	waiting = false;
+}
@@ -0,0 +1,66 @@
+#ifndef JOBSERVER_H
+#define JOBSERVER_H
+/*	$OpenBSD$ */
+
+/*
+ * Copyright (c) 2026 Marc Espie.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE OPENBSD PROJECT AND CONTRIBUTORS
+ * ``AS IS'' AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ * LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR
+ * A PARTICULAR PURPOSE ARE DISCLAIMED.  IN NO EVENT SHALL THE OPENBSD
+ * PROJECT OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+ * SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT
+ * LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+ * DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+ * THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+ * OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+/* A GNU-compatible jobserver: a pipe (or fifo) filled with one token per
+ * job slot beyond the first, shared by all makes of a recursive build.
+ * Each make always owns one implicit slot, and must hold a token for
+ * every extra job it runs.
+ */
+
+/* ok = Jobserver_ParseArg(word);
+ *	recognize --jobserver-auth=r,w (or fifo:path) from MAKEFLAGS,
+ *	and record it for sub-makes.  Returns false for other words. */
+extern bool Jobserver_ParseArg(const char *);
+
+/* Jobserver_Init(maxJobs);
+ *	if we didn't inherit a jobserver, create one for maxJobs slots,
+ *	and advertise it in .MAKEFLAGS.  Must be called before MAKEFLAGS
+ *	gets exported. */
+extern void Jobserver_Init(int);
+
+/* ok = jobserver_acquire(inuse);
+ *	check whether we may start one more job, inuse jobs already
+ *	running. May grab a token. */
+extern bool jobserver_acquire(int);
+
+/* jobserver_release(inuse);
+ *	give back tokens we no longer need for inuse jobs. */
+extern void jobserver_release(int);
+
+/* fd = jobserver_wait_fd();
+ *	fd to watch for tokens, if we're waiting for one, or -1. */
+extern int jobserver_wait_fd(void);
+
+/* jobserver_stop_waiting();
+ *	tokens showed up (or not), try again. */
+extern void jobserver_stop_waiting(void);
+
+extern bool jobserver_active;
+
+#endif
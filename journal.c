@@ -0,0 +1,310 @@
+/*	$OpenBSD$ */
+/*
+ * Copyright (c) 2026 Marc Espie.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE OPENBSD PROJECT AND CONTRIBUTORS
+ * ``AS IS'' AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ * LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR
+ * A PARTICULAR PURPOSE ARE DISCLAIMED.  IN NO EVENT SHALL THE OPENBSD
+ * PROJECT OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+ * SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT
+ * LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+ * DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+ * THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+ * OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <ohash.h>
+#include "config.h"
+#include "defines.h"
+#include "journal.h"
+#include "gnode.h"
+#include "timestamp.h"
+#include "buf.h"
+#include "var.h"
+#include "str.h"
+#include "memory.h"
+#include "hash.h"
+
+#define JOURNAL_MAGIC	"make journal 1\n"
+
+struct journal_entry {
+	struct timespec mtime;
+	char name[1];
+};
+
+static struct ohash_info journal_info = {
+	offsetof(struct journal_entry, name), NULL,
+	hash_calloc, hash_free, element_alloc
+};
+
+static struct ohash journal;
+static int journal_fd = -1;
+static char *journal_file = NULL;
+static bool resuming = false;
+
+static char *journal_name(const char *);
+static void forget_entries(void);
+static bool makefiles_header(Buffer);
+static bool read_journal(const char *, const char *);
+static void write_line(const char *, size_t);
+
+/* Sub-makes inherit BUILD_JOURNAL, and must not clobber our journal, nor
+ * each other's: each directory and set of makefiles gets its own.  */
+static char *
+journal_name(const char *file)
+{
+	BUFFER buf;
+	const char *s, *end;
+	char *name;
+	uint32_t hv;
+
+	Buf_Init(&buf, 0);
+	Buf_AddString(&buf, Var_Value(".OBJDIR"));
+	if ((s = Var_Value("MAKEFILE_LIST")) != NULL) {
+		Buf_AddChar(&buf, '\n');
+		Buf_AddString(&buf, s);
+	}
+	s = Buf_Retrieve(&buf);
+	end = NULL;
+	hv = ohash_interval(s, &end);
+	Buf_Destroy(&buf);
+	if (asprintf(&name, "%s.%08x", file, hv) == -1)
+		return NULL;
+	return name;
+}
+
+static void
+forget_entries(void)
+{
+	struct journal_entry *e;
+	unsigned int i;
+
+	for (e = ohash_first(&journal, &i); e != NULL;
+	    e = ohash_next(&journal, &i))
+		free(e);
+	ohash_delete(&journal);
+}
+
+/* What the journal depends on.  (stdin), for instance, can't be
+ * checked, so that journal can't be resumed.  */
+static bool
+makefiles_header(Buffer buf)
+{
+	struct stat st;
+	struct timespec mtime;
+	const char *list, *p, *e;
+	bool ok = true;
+	char *name;
+
+	Buf_AddString(buf, JOURNAL_MAGIC);
+	list = Var_Value("MAKEFILE_LIST");
+	if (list == NULL)
+		list = "";
+	for (e = list; (p = iterate_words(&e)) != NULL;) {
+		name = Str_dupi(p, e);
+		if (stat(name, &st) == -1) {
+			Buf_printf(buf, "m - - %s\n", name);
+			ok = false;
+		} else {
+			ts_set_from_stat(st, mtime);
+			Buf_printf(buf, "m %lld %lld.%09ld %s\n",
+			    (long long)st.st_size, (long long)mtime.tv_sec,
+			    (long)mtime.tv_nsec, name);
+		}
+		free(name);
+	}
+	return ok;
+}
+
+/* the last line may be incomplete, if the make we resume got
+ * interrupted while writing it */
+static bool
+read_journal(const char *file, const char *header)
+{
+	FILE *f;
+	char *line, *copy, *name;
+	size_t len, hlen = strlen(header), seen = 0;
+	struct journal_entry *e;
+	struct timespec mtime;
+	long long sec;
+	long nsec;
+	unsigned int slot;
+	const char *end;
+	char status;
+	int n;
+
+	if ((f = fopen(file, "r")) == NULL)
+		return false;
+	while ((line = fgetln(f, &len)) != NULL) {
+		if (len == 0 || line[len-1] != '\n')
+			break;
+		/* the makefiles must be exactly the same */
+		if (seen < hlen) {
+			if (seen + len > hlen ||
+			    memcmp(header + seen, line, len) != 0)
+				break;
+			seen += len;
+			continue;
+		}
+		copy = emalloc(len);
+		memcpy(copy, line, len-1);
+		copy[len-1] = '\0';
+		n = -1;
+		if (sscanf(copy, "%c %lld.%ld %n", &status, &sec, &nsec,
+		    &n) == 3 && n != -1) {
+			mtime.tv_sec = sec;
+			mtime.tv_nsec = nsec;
+		} else {
+			n = -1;
+			(void)sscanf(copy, "%c - %n", &status, &n);
+			ts_set_out_of_date(mtime);
+		}
+		if (n != -1 && (status == 'r' || status == 'u') &&
+		    copy[n] != '\0') {
+			name = copy + n;
+			end = NULL;
+			slot = hash_qlookupi(&journal, name, &end);
+			e = ohash_find(&journal, slot);
+			if (e == NULL) {
+				e = ohash_create_entry(&journal_info, name,
+				    &end);
+				ohash_insert(&journal, slot, e);
+			}
+			e->mtime = mtime;
+		}
+		free(copy);
+	}
+	fclose(f);
+	return seen == hlen;
+}
+
+static void
+write_line(const char *s, size_t len)
+{
+	ssize_t w;
+
+	while (len > 0) {
+		w = write(journal_fd, s, len);
+		if (w == -1) {
+			if (errno == EINTR)
+				continue;
+			/* no journal is better than a wrong one */
+			(void)close(journal_fd);
+			journal_fd = -1;
+			return;
+		}
+		s += w;
+		len -= w;
+	}
+}
+
+void
+Journal_Init(void)
+{
+	const char *file;
+	BUFFER header;
+	bool ok;
+
+	file = Var_Value("BUILD_JOURNAL");
+	if (file == NULL || *file == '\0' || journal_fd != -1)
+		return;
+	if ((journal_file = journal_name(file)) == NULL)
+		return;
+	file = journal_file;
+	ohash_init(&journal, 8, &journal_info);
+	Buf_Init(&header, 0);
+	ok = makefiles_header(&header);
+	if (ok && Var_Definedi("RESUME", NULL))
+		resuming = read_journal(file, Buf_Retrieve(&header));
+	if (resuming)
+		journal_fd = open(file, O_WRONLY | O_APPEND | O_CLOEXEC);
+	if (journal_fd == -1) {
+		resuming = false;
+		forget_entries();
+		ohash_init(&journal, 8, &journal_info);
+		journal_fd = open(file,
+		    O_WRONLY | O_CREAT | O_TRUNC | O_APPEND | O_CLOEXEC, 0666);
+		if (journal_fd != -1)
+			write_line(Buf_Retrieve(&header), Buf_Size(&header));
+	}
+	Buf_Destroy(&header);
+}
+
+void
+Journal_End(bool complete)
+{
+	if (journal_file == NULL)
+		return;
+	if (journal_fd != -1)
+		(void)close(journal_fd);
+	journal_fd = -1;
+	/* nothing left to resume */
+	if (complete)
+		(void)unlink(journal_file);
+	free(journal_file);
+	journal_file = NULL;
+	resuming = false;
+	forget_entries();
+}
+
+bool
+Journal_Done(GNode *gn)
+{
+	struct journal_entry *e;
+
+	if (!resuming)
+		return false;
+	e = ohash_find(&journal, hash_qlookup(&journal, gn->name));
+	if (e == NULL)
+		return false;
+	gn->mtime = e->mtime;
+	return true;
+}
+
+void
+Journal_Record(GNode *gn)
+{
+	char *line;
+	int len;
+
+	if (journal_fd == -1)
+		return;
+	/* resuming: no need to say it again */
+	if (resuming &&
+	    ohash_find(&journal, hash_qlookup(&journal, gn->name)) != NULL)
+		return;
+	if (is_out_of_date(gn->mtime))
+		len = asprintf(&line, "%c - %s\n",
+		    gn->built_status == REBUILT ? 'r' : 'u', gn->name);
+	else
+		len = asprintf(&line, "%c %lld.%09ld %s\n",
+		    gn->built_status == REBUILT ? 'r' : 'u',
+		    (long long)gn->mtime.tv_sec, (long)gn->mtime.tv_nsec,
+		    gn->name);
+	if (len == -1)
+		return;
+	write_line(line, len);
+	free(line);
+}
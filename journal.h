@@ -0,0 +1,62 @@
+#ifndef JOURNAL_H
+#define JOURNAL_H
+/*	$OpenBSD$ */
+
+/*
+ * Copyright (c) 2026 Marc Espie.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE OPENBSD PROJECT AND CONTRIBUTORS
+ * ``AS IS'' AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ * LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR
+ * A PARTICULAR PURPOSE ARE DISCLAIMED.  IN NO EVENT SHALL THE OPENBSD
+ * PROJECT OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+ * SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT
+ * LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+ * DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+ * THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+ * OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+/* Completion journal: with BUILD_JOURNAL set, make appends one line to
+ * that file, suffixed with a hash of .OBJDIR and MAKEFILE_LIST, for each
+ * target it finds up to date or rebuilds.  The next make with RESUME set
+ * trusts it, as long as the makefiles didn't change: those targets are up
+ * to date, with the time recorded, and nothing below them gets looked at.
+ * Otherwise, the journal starts over.  A build that finishes without
+ * errors removes it.
+ * The file starts with the makefiles:
+ *	make journal 1
+ *	m size sec.nsec name
+ * then has one line per target, r for rebuilt, u for up to date:
+ *	r sec.nsec name
+ * where sec.nsec is - for targets without a file.
+ */
+
+/* Journal_Init();
+ *	open the journal, if BUILD_JOURNAL is set, and read it if we
+ *	resume. */
+extern void Journal_Init(void);
+
+/* Journal_End(complete);
+ *	close the journal, and remove it if the build is complete. */
+extern void Journal_End(bool);
+
+/* done = Journal_Done(gn);
+ *	gn was done already, and gets the time it had then. */
+extern bool Journal_Done(GNode *);
+
+/* Journal_Record(gn);
+ *	gn was just found up to date, or rebuilt. */
+extern void Journal_Record(GNode *);
+
+#endif
@@ -29,12 +29,18 @@
  * OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
  */
 
+#include <sys/types.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
 #include <assert.h>
+#include <limits.h>
 #include <stddef.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <time.h>
 #include <unistd.h>
+#include <ohash.h>
 #include "config.h"
 #include "defines.h"
 #include "buf.h"
@@ -47,6 +53,8 @@
 #include "location.h"
 #endif
 #include "var.h"
+#include "str.h"
+#include "hash.h"
 
 
 #define READ_MAKEFILES "MAKEFILE_LIST"
@@ -54,17 +62,51 @@
 /* Input stream structure: file or string.
  * Files have str == NULL, F != NULL.
  * Strings have F == NULL, str != NULL.
+ * Regular files are mapped whole when possible: map != NULL, and ptr/end
+ * span the file, so that simple lines can be handed out in place.
  */
 struct input_stream {
 	Location origin;	/* Name of file and line number */
 	FILE *F;		/* Open stream, or NULL if pure string. */
 	char *str;		/* Input string, if F == NULL. */
+	char *map;		/* Private mapping of the whole file. */
+	size_t maplen;
 
 	/* Line buffer. */
 	char *ptr;		/* Where we are. */
 	char *end;		/* Don't overdo it. */
+	struct timespec opened;	/* for -dP */
 };
 
+/* -dP: where parsing spends its time.  Files get the time from opening
+ * to closing them, nested includes and loops included, and the time of
+ * their own lines; lines get what it took to read and handle them,
+ * conditionals and .for expansion included.  */
+struct parse_prof {
+	unsigned long count;	/* times read */
+	unsigned long lines;
+	long long self;		/* nanoseconds */
+	long long total;
+	char name[1];
+};
+
+static struct ohash_info parse_prof_info = {
+	offsetof(struct parse_prof, name), NULL,
+	hash_calloc, hash_free, element_alloc
+};
+
+static struct ohash file_profile, line_profile;
+static bool parse_profile_init = false;
+
+#define PARSE_PROFILE_TOP	20
+
+static long long nsec_since(const struct timespec *);
+static struct parse_prof *parse_prof_entry(struct ohash *, const char *,
+    const char *);
+static void show_profile(struct ohash *, const char *, bool);
+static int cmp_parse_prof(const void *, const void *);
+static void Parse_DumpProfile(void);
+
 static struct input_stream *current;	/* the input_stream being parsed. */
 
 static LIST input_stack;	/* Stack of input_stream waiting to be parsed
@@ -84,6 +126,9 @@ static struct input_stream *new_input_string(char *, const Location *);
 /* free_input_stream(obj);
  *	Discard consumed input stream, closing files, freeing memory.  */
 static void free_input_stream(struct input_stream *);
+/* map_input_file(obj);
+ *	Try to read a regular file through mmap(2) instead of fgetln.  */
+static void map_input_file(struct input_stream *);
 
 
 /* Handling basic character reading.
@@ -99,6 +144,11 @@ static int grab_new_line_and_readchar(void);
 /* c = skip_to_end_of_line();
  *	Skips to the end of the current line, returns either '\n' or EOF.  */
 static int skip_to_end_of_line(void);
+/* p = next_special(start, end);
+ *	Finds the next newline or backslash between start and end, or end.
+ *	Everything else can be copied or skipped in one go, and memchr(3)
+ *	is usually much faster than looking at each character. */
+static char *next_special(char *, char *);
 
 
 /* Helper functions to handle basic parsing. */
@@ -129,21 +179,25 @@ startswith(const char *f, const char *s, size_t len)
 	return strncmp(f, s, len) == 0 && f[len] == '/';
 }
 
+/* the name is interned: every command made from this file shares it */
 static const char *
 simplify(const char *filename)
 {
 	if (startswith(filename, curdir, curdir_len))
-		return filename + curdir_len + 1;
+		return Str_Intern(filename + curdir_len + 1);
 	else if (startswith(filename, _PATH_DEFSYSPATH,
 	    sizeof(_PATH_DEFSYSPATH)-1)) {
 	    	size_t sz;
 		char *buf;
+		const char *s;
 		sz = strlen(filename) - sizeof(_PATH_DEFSYSPATH)+3;
 		buf = emalloc(sz);
 		snprintf(buf, sz, "<%s>", filename+sizeof(_PATH_DEFSYSPATH));
-		return buf;
+		s = Str_Intern(buf);
+		free(buf);
+		return s;
 	} else
-		return filename;
+		return Str_Intern(filename);
 }
 
 static struct input_stream *
@@ -159,12 +213,46 @@ new_input_file(const char *name, FILE *stream)
 	istream->origin.lineno = 0;
 	istream->F = stream;
 	istream->ptr = istream->end = NULL;
+	istream->map = NULL;
+	if (stream != NULL)
+		map_input_file(istream);
+	if (DEBUG(PARSEPROF))
+		clock_gettime(CLOCK_MONOTONIC, &istream->opened);
 	return istream;
 }
 
+/* A private writable mapping lets us terminate lines in place: the file
+ * itself is never touched, and nobody else sees our changes.  */
+static void
+map_input_file(struct input_stream *istream)
+{
+	struct stat st;
+	void *m;
+
+	if (fstat(fileno(istream->F), &st) == -1 || !S_ISREG(st.st_mode) ||
+	    st.st_size == 0 || st.st_size > SSIZE_MAX)
+		return;
+	m = mmap(NULL, st.st_size, PROT_READ | PROT_WRITE, MAP_PRIVATE,
+	    fileno(istream->F), 0);
+	if (m == MAP_FAILED)
+		return;
+	istream->map = istream->ptr = m;
+	istream->maplen = st.st_size;
+	istream->end = istream->map + istream->maplen;
+}
+
 static void
 free_input_stream(struct input_stream *istream)
 {
+	if (DEBUG(PARSEPROF) && istream->str == NULL) {
+		struct parse_prof *e = parse_prof_entry(&file_profile,
+		    istream->origin.fname, NULL);
+
+		e->count++;
+		e->total += nsec_since(&istream->opened);
+	}
+	if (istream->map != NULL)
+		(void)munmap(istream->map, istream->maplen);
 	if (istream->F) {
 		if (ferror(istream->F))
 			Parse_Error(PARSE_FATAL, "Read error");
@@ -232,7 +320,7 @@ grab_new_line_and_readchar(void)
 {
 	size_t len;
 
-	if (current->F) {
+	if (current->F && current->map == NULL) {
 		current->ptr = fgetln(current->F, &len);
 		if (current->ptr) {
 			current->end = current->ptr + len;
@@ -244,22 +332,38 @@ grab_new_line_and_readchar(void)
 	return EOF;
 }
 
+static char *
+next_special(char *p, char *end)
+{
+	char *nl, *bs;
+
+	nl = memchr(p, '\n', end - p);
+	if (nl == NULL)
+		nl = end;
+	bs = memchr(p, '\\', nl - p);
+	return bs == NULL ? nl : bs;
+}
+
 static int
 skip_to_end_of_line(void)
 {
-	if (current->F) {
+	if (current->F && current->map == NULL) {
 		if (current->end - current->ptr > 1)
 			current->ptr = current->end - 1;
 		if (*current->ptr == '\n')
 			return *current->ptr++;
 		return EOF;
 	} else {
-		int c;
+		/* strings and mapped files are all there */
+		char *nl;
 
-		do {
-			c = read_char();
-		} while (c != '\n' && c != EOF);
-		return c;
+		nl = memchr(current->ptr, '\n', current->end - current->ptr);
+		if (nl == NULL) {
+			current->ptr = current->end;
+			return EOF;
+		}
+		current->ptr = nl+1;
+		return '\n';
 	}
 }
 
@@ -280,6 +384,7 @@ Parse_ReadNextConditionalLine(Buffer linebuf)
 			if (c == EOF)
 				/* Unclosed conditional, reported by cond.c */
 				return NULL;
+			current->ptr = next_special(current->ptr, current->end);
 		}
 		current->origin.lineno++;
 	}
@@ -299,6 +404,12 @@ read_logical_line(Buffer linebuf, int c)
 		if (c == EOF)
 			break;
 		Buf_AddChar(linebuf, c);
+		if (current->ptr < current->end) {
+			char *p = next_special(current->ptr, current->end);
+
+			Buf_Addi(linebuf, current->ptr, p);
+			current->ptr = p;
+		}
 		c = read_char();
 		while (c == '\\') {
 			c = read_char();
@@ -427,6 +538,37 @@ skip_empty_lines_and_read_char(Buffer linebuf)
 	}
 }
 
+/* line = slice_line(linebuf);
+ *	Mapped files: if the logical line that starts with the character we
+ *	just read is a single physical line without backslashes, terminate
+ *	it in place and return it instead of copying it to linebuf.
+ *	Backslashes are rare enough that read_logical_line can deal with
+ *	the tricky cases.  */
+static char *
+slice_line(Buffer linebuf)
+{
+	char *start, *nl;
+
+	start = current->ptr - 1;
+	if (Buf_Size(linebuf) != 0) {
+		/* a command: we kept the tab, but skipped the blanks after
+		 * it, so we can put the tab back right before start.
+		 * Anything else (backslashes) goes the long way.  */
+		if (Buf_Size(linebuf) != 1 || *Buf_Retrieve(linebuf) != '\t')
+			return NULL;
+		start--;
+	}
+	nl = memchr(current->ptr, '\n', current->end - current->ptr);
+	if (nl == NULL || memchr(start, '\\', nl - start) != NULL)
+		return NULL;
+	if (start != current->ptr - 1)
+		*start = '\t';
+	*nl = '\0';
+	current->ptr = nl+1;
+	current->origin.lineno++;
+	return start;
+}
+
 /* Parse_ReadNormalLine removes beginning and trailing blanks (but keeps
  * the first tab), handles escaped newlines, and skips over uninteresting
  * lines.
@@ -442,11 +584,18 @@ Parse_ReadNormalLine(Buffer linebuf)
 {
 	int c;		/* the current character */
 
+	char *line;
+
 	c = skip_empty_lines_and_read_char(linebuf);
 
 	if (c == EOF)
 		return NULL;
 	else {
+		if (current->map != NULL) {
+			line = slice_line(linebuf);
+			if (line != NULL)
+				return line;
+		}
 		read_logical_line(linebuf, c);
 		return Buf_Retrieve(linebuf);
 	}
@@ -489,3 +638,105 @@ Parse_ReportErrors(void)
 	else
 		assert(current == NULL);
 }
+
+static long long
+nsec_since(const struct timespec *start)
+{
+	struct timespec now;
+
+	clock_gettime(CLOCK_MONOTONIC, &now);
+	return (now.tv_sec - start->tv_sec) * 1000000000LL +
+	    now.tv_nsec - start->tv_nsec;
+}
+
+static struct parse_prof *
+parse_prof_entry(struct ohash *h, const char *name, const char *ename)
+{
+	struct parse_prof *e;
+	unsigned int slot;
+
+	if (!parse_profile_init) {
+		ohash_init(&file_profile, 6, &parse_prof_info);
+		ohash_init(&line_profile, 8, &parse_prof_info);
+		parse_profile_init = true;
+		atexit(Parse_DumpProfile);
+	}
+	slot = hash_qlookupi(h, name, &ename);
+	e = ohash_find(h, slot);
+	if (e == NULL) {
+		e = ohash_create_entry(&parse_prof_info, name, &ename);
+		e->count = 0;
+		e->lines = 0;
+		e->self = 0;
+		e->total = 0;
+		ohash_insert(h, slot, e);
+	}
+	return e;
+}
+
+void
+Parse_ProfileLine(const Location *origin, const struct timespec *start)
+{
+	struct parse_prof *e;
+	char name[PATH_MAX + 32];
+	long long t;
+
+	t = nsec_since(start);
+	e = parse_prof_entry(&file_profile, origin->fname, NULL);
+	e->lines++;
+	e->self += t;
+	(void)snprintf(name, sizeof name, "%s:%lu", origin->fname,
+	    origin->lineno);
+	e = parse_prof_entry(&line_profile, name, NULL);
+	e->count++;
+	e->self += t;
+}
+
+static int
+cmp_parse_prof(const void *a, const void *b)
+{
+	const struct parse_prof *e1 = *(struct parse_prof * const *)a;
+	const struct parse_prof *e2 = *(struct parse_prof * const *)b;
+	long long t1 = e1->total != 0 ? e1->total : e1->self;
+	long long t2 = e2->total != 0 ? e2->total : e2->self;
+
+	if (t1 != t2)
+		return t1 < t2 ? 1 : -1;
+	return strcmp(e1->name, e2->name);
+}
+
+static void
+show_profile(struct ohash *h, const char *what, bool files)
+{
+	struct parse_prof *e, **t;
+	unsigned int i, n = 0;
+
+	t = ereallocarray(NULL, ohash_entries(h), sizeof(*t));
+	for (e = ohash_first(h, &i); e != NULL; e = ohash_next(h, &i))
+		t[n++] = e;
+	qsort(t, n, sizeof(*t), cmp_parse_prof);
+	if (files)
+		printf("#%9s %10s %6s %8s  %s\n", "total ms", "self ms",
+		    "reads", "lines", what);
+	else
+		printf("#%9s %6s  %s\n", "ms", "reads", what);
+	for (i = 0; i < n && i < PARSE_PROFILE_TOP; i++)
+		if (files)
+			printf("%6lld.%03lld %6lld.%03lld %6lu %8lu  %s\n",
+			    t[i]->total / 1000000, t[i]->total / 1000 % 1000,
+			    t[i]->self / 1000000, t[i]->self / 1000 % 1000,
+			    t[i]->count, t[i]->lines, t[i]->name);
+		else
+			printf("%6lld.%03lld %6lu  %s\n",
+			    t[i]->self / 1000000, t[i]->self / 1000 % 1000,
+			    t[i]->count, t[i]->name);
+	free(t);
+}
+
+static void
+Parse_DumpProfile(void)
+{
+	show_profile(&file_profile, "makefile", true);
+	printf("\n");
+	show_profile(&line_profile, "line", false);
+}
@@ -106,5 +106,10 @@ extern char *Parse_ReadUnparsedLine(Buffer, const char *);
  */
 extern void Parse_ReportErrors(void);
 
+/* Parse_ProfileLine(origin, start);
+ *	-dP: the logical line at origin took from start until now to read
+ *	and handle. */
+extern void Parse_ProfileLine(const Location *, const struct timespec *);
+
 extern void Parse_setcurdir(const char *);
 #endif
@@ -0,0 +1,60 @@
+/*	$OpenBSD$ */
+/*
+ * Copyright (c) 2026 Marc Espie.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE OPENBSD PROJECT AND CONTRIBUTORS
+ * ``AS IS'' AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ * LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR
+ * A PARTICULAR PURPOSE ARE DISCLAIMED.  IN NO EVENT SHALL THE OPENBSD
+ * PROJECT OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+ * SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT
+ * LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+ * DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+ * THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+ * OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+
+/*-
+ * lstAlloc.c --
+ *	LstNodes come from chunks, and go back to a freelist
+ */
+
+#include "lstInt.h"
+#include <sys/types.h>
+#include <stddef.h>
+#include "memory.h"
+
+#define NODES_PER_CHUNK	256
+
+LstNode lstFreeNodes = NULL;
+
+/*-
+ *-----------------------------------------------------------------------
+ * LstMoreNodes --
+ *	Refill the freelist with a new chunk of nodes.  Chunks are never
+ *	given back: nodes get reused by the next lists instead.
+ *-----------------------------------------------------------------------
+ */
+void
+LstMoreNodes(void)
+{
+	LstNode chunk;
+	int i;
+
+	chunk = ereallocarray(NULL, NODES_PER_CHUNK, sizeof(*chunk));
+	for (i = 0; i < NODES_PER_CHUNK; i++) {
+		chunk[i].nextPtr = lstFreeNodes;
+		lstFreeNodes = &chunk[i];
+	}
+}
@@ -61,7 +61,7 @@ Lst_Append(Lst l, LstNode after, void *d)
 {
 	LstNode	nLNode;
 
-	PAlloc(nLNode, LstNode);
+	NewNode(nLNode);
 	nLNode->datum = d;
 
 	nLNode->prevPtr = after;
@@ -80,7 +80,7 @@ Lst_AtEnd(Lst l, void *d)
 {
 	LstNode	ln;
 
-	PAlloc(ln, LstNode);
+	NewNode(ln);
 	ln->datum = d;
 
 	ln->prevPtr = l->lastPtr;
@@ -75,7 +75,7 @@ Lst_Concat(Lst l1, Lst l2)
 		 * newly-created node is made the first node of the list.  */
 		for (last = l1->lastPtr, ln = l2->firstPtr; ln != NULL;
 		     ln = ln->nextPtr) {
-			PAlloc(nln, LstNode);
+			NewNode(nln);
 			nln->datum = ln->datum;
 			if (last != NULL)
 				last->nextPtr = nln;
@@ -69,7 +69,7 @@ Lst_DeQueue(Lst l)
 		l->firstPtr->prevPtr = NULL;
 	else
 		l->lastPtr = NULL;
-	free(tln);
+	FreeNode(tln);
 	return rd;
 }
 
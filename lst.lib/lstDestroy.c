@@ -46,7 +46,7 @@
  * Lst_Destroy --
  *	Destroy a list and free all its resources. If the freeProc is
  *	given, it is called with the datum from each node in turn before
- *	the node is freed.
+ *	the node is freed.  The nodes go back to the freelist all at once.
  *
  * Side Effects:
  *	The given list is freed in its entirety.
@@ -57,19 +57,13 @@ void
 Lst_Destroy(Lst l, SimpleProc freeProc)
 {
 	LstNode	ln;
-	LstNode	tln;
 
-	if (freeProc) {
-		for (ln = l->firstPtr; ln != NULL; ln = tln) {
-			 tln = ln->nextPtr;
+	if (l->firstPtr == NULL)
+		return;
+	if (freeProc)
+		for (ln = l->firstPtr; ln != NULL; ln = ln->nextPtr)
 			 (*freeProc)(ln->datum);
-			 free(ln);
-		}
-	} else {
-		for (ln = l->firstPtr; ln != NULL; ln = tln) {
-			 tln = ln->nextPtr;
-			 free(ln);
-		}
-	}
+	l->lastPtr->nextPtr = lstFreeNodes;
+	lstFreeNodes = l->firstPtr;
 }
 
@@ -67,7 +67,7 @@ Lst_Insert(Lst l, LstNode before, void *d)
 	if (before != NULL && Lst_IsEmpty(l))
 		return;
 
-	PAlloc(nLNode, LstNode);
+	NewNode(nLNode);
 
 	nLNode->datum = d;
 
@@ -92,7 +92,7 @@ Lst_AtFront(Lst l, void *d)
 {
 	LstNode	ln;
 
-	PAlloc(ln, LstNode);
+	NewNode(ln);
 	ln->datum = d;
 
 	ln->nextPtr = l->firstPtr;
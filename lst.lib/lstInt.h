@@ -47,9 +47,27 @@
 #include "lst.h"
 
 /*
- * PAlloc(var, ptype) --
- *	Allocate a pointer-typedef structure 'ptype' into the variable 'var'
+ * NewNode(var) --
+ *	Take a node off the freelist into the variable 'var'.
+ * FreeNode(ln) --
+ *	Put node ln back on the freelist, see lstAlloc.c.
+ *
+ * Lists come and go all the time: their nodes are recycled instead of
+ * going through malloc.  Nothing touches lists outside the main thread.
  */
-#define PAlloc(var,ptype)	var = (ptype) emalloc (sizeof (*var))
+extern LstNode lstFreeNodes;
+extern void LstMoreNodes(void);
+#define NewNode(var)						\
+do {								\
+	if (lstFreeNodes == NULL)				\
+		LstMoreNodes();					\
+	(var) = lstFreeNodes;					\
+	lstFreeNodes = (var)->nextPtr;				\
+} while (0)
+#define FreeNode(ln)						\
+do {								\
+	(ln)->nextPtr = lstFreeNodes;				\
+	lstFreeNodes = (ln);					\
+} while (0)
 
 #endif /* _LSTINT_H_ */
@@ -75,6 +75,6 @@ Lst_Remove(Lst l, LstNode ln)
 
 	/* note that the datum is unmolested. The caller must free it as
 	 * necessary and as expected.  */
-	free(ln);
+	FreeNode(ln);
 }
 
@@ -41,6 +41,7 @@
 #include <sys/utsname.h>
 #include <err.h>
 #include <errno.h>
+#include <stdint.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
@@ -63,14 +64,29 @@
 #include "main.h"
 #include "lst.h"
 #include "memory.h"
+#include "hash.h"
 #include "dump.h"
 #include "enginechoice.h"
+#include "jobserver.h"
+#include "history.h"
+#include "digest.h"
+#include "trace.h"
+#include "status.h"
+#include "schedule.h"
+#include "buildcache.h"
+#include "signature.h"
+#include "statcache.h"
+#include "watch.h"
+#include "make.h"
+#include "timestamp.h"
+#include "snapshot.h"
 
 #define MAKEFLAGS	".MAKEFLAGS"
 
 static LIST		to_create; 	/* Targets to be made */
 Lst create = &to_create;
 bool 		allPrecious;	/* .PRECIOUS given on line by itself */
+bool		singleShell;	/* .SINGLESHELL given on line by itself */
 
 static bool	noBuiltins;	/* -r flag */
 static LIST	makefiles;	/* ordered list of makefiles to read */
@@ -78,6 +94,8 @@ static LIST	varstoprint;	/* list of variables to print */
 static int	optj;		/* -j argument */
 static bool 	compatMake;	/* -B argument */
 static bool	forceJobs = false;
+static bool	watchMode = false;	/* -W flag */
+static char	*replayTrace;	/* -R argument */
 int 		debug;		/* -d flag */
 bool 		noExecute;	/* -n flag */
 bool 		keepgoing;	/* -k flag */
@@ -86,6 +104,12 @@ bool 		touchFlag;	/* -t flag */
 bool 		ignoreErrors;	/* -i flag */
 bool 		beSilent;	/* -s flag */
 bool		dumpData;	/* -p flag */
+static int	dumpFormat;	/* -P argument */
+static char	*statusPath;	/* -T argument */
+
+static bool	parsing = false;	/* reading the makefiles */
+static LIST	argLines;	/* .MAKEFLAGS seen while parsing */
+static LstNode	lastGiven;	/* last target given before parsing */
 
 struct dirs {
 	char *current;
@@ -192,7 +216,7 @@ MainParseArgs(int argc, char **argv)
 {
 	int c, optend;
 
-#define OPTFLAGS "BC:D:I:SV:d:ef:ij:km:npqrst"
+#define OPTFLAGS "BC:D:I:O:P:R:ST:V:Wd:ef:ij:kl:m:npqrst"
 #define OPTLETTERS "BSiknpqrst"
 
 	if (pledge("stdio rpath wpath cpath fattr proc exec", NULL) == -1)
@@ -209,6 +233,10 @@ MainParseArgs(int argc, char **argv)
 			    argv[optind][2] == '\0') {
 				optind++;	/* ignore "--" */
 				optend++;	/* "--" denotes end of flags */
+			} else if (argv[optind][1] == '-' &&
+			    Jobserver_ParseArg(argv[optind])) {
+				optind++;	/* passed down by a parent make */
+				continue;
 			}
 		}
 		c = optend ? -1 : getopt(argc, argv, OPTFLAGS);
@@ -223,6 +251,48 @@ MainParseArgs(int argc, char **argv)
 			Parse_AddIncludeDir(optarg);
 			record_option(c, optarg);
 			break;
+		case 'O':
+			if (strcmp(optarg, "none") == 0)
+				output_sync = OUTPUT_SYNC_NONE;
+			else if (strcmp(optarg, "line") == 0)
+				output_sync = OUTPUT_SYNC_LINE;
+			else if (strcmp(optarg, "target") == 0)
+				output_sync = OUTPUT_SYNC_TARGET;
+			else if (strcmp(optarg, "recurse") == 0)
+				output_sync = OUTPUT_SYNC_RECURSE;
+			else {
+				fprintf(stderr,
+				    "make: illegal argument to -O option -- %s\n",
+				    optarg);
+				usage();
+			}
+			record_option(c, optarg);
+			break;
+		case 'P':
+			if (strcmp(optarg, "text") == 0)
+				dumpFormat = DUMP_TEXT;
+			else if (strcmp(optarg, "json") == 0)
+				dumpFormat = DUMP_JSON;
+			else if (strcmp(optarg, "dot") == 0)
+				dumpFormat = DUMP_DOT;
+			else {
+				fprintf(stderr,
+				    "make: illegal argument to -P option -- %s\n",
+				    optarg);
+				usage();
+			}
+			break;
+		case 'R':
+			/* XXX don't pass to submakes, there won't be any */
+			replayTrace = optarg;
+			break;
+		case 'T':
+			/* sub-makes report to the same place */
+			free(statusPath);
+			statusPath = optarg[0] == '/' ? estrdup(optarg) :
+			    Str_concat(Var_Value(".CURDIR"), optarg, '/');
+			record_option(c, statusPath);
+			break;
 		case 'V':
 			Lst_AtEnd(&varstoprint, optarg);
 			record_option(c, optarg);
@@ -241,6 +311,9 @@ MainParseArgs(int argc, char **argv)
 				case 'c':
 					debug |= DEBUG_COND;
 					break;
+				case 'C':
+					debug |= DEBUG_TRACE;
+					break;
 				case 'd':
 					debug |= DEBUG_DIR;
 					break;
@@ -266,6 +339,12 @@ MainParseArgs(int argc, char **argv)
 				case 'h':
 					debug |= DEBUG_HELDJOBS;
 					break;
+				case 'H':
+					debug |= DEBUG_HASH;
+					break;
+				case 'I':
+					debug |= DEBUG_IDLE;
+					break;
 				case 'j':
 					debug |= DEBUG_JOB | DEBUG_KILL;
 					break;
@@ -281,12 +360,18 @@ MainParseArgs(int argc, char **argv)
 				case 'm':
 					debug |= DEBUG_MAKE;
 					break;
+				case 'M':
+					debug |= DEBUG_MEMORY;
+					break;
 				case 'n':
 					debug |= DEBUG_NAME_MATCHING;
 					break;
 				case 'p':
 					debug |= DEBUG_PARALLEL;
 					break;
+				case 'P':
+					debug |= DEBUG_PARSEPROF;
+					break;
 				case 'q':
 					debug |= DEBUG_QUICKDEATH;
 					break;
@@ -302,6 +387,9 @@ MainParseArgs(int argc, char **argv)
 				case 'v':
 					debug |= DEBUG_VAR;
 					break;
+				case 'x':
+					debug |= DEBUG_VARPROF;
+					break;
 				default:
 					(void)fprintf(stderr,
 				"make: illegal argument to -d option -- %c\n",
@@ -328,10 +416,28 @@ MainParseArgs(int argc, char **argv)
 			record_option(c, optarg);
 			break;
 		}
+		case 'l': {
+			char *end;
+
+			max_load = strtod(optarg, &end);
+			if (*end != '\0' || end == optarg || max_load < 0) {
+				fprintf(stderr,
+				    "make: illegal argument to -l option"
+				    " -- %s\n", optarg);
+				usage();
+			}
+			record_option(c, optarg);
+			break;
+		}
 		case 'm':
 			Dir_AddDir(systemIncludePath, optarg);
 			record_option(c, optarg);
 			break;
+		case 'W':
+			/* XXX don't pass to submakes. */
+			watchMode = true;
+			keepgoing = true;
+			break;
 		case -1:
 			/* Check for variable assignments and targets. */
 			if (argv[optind] != NULL &&
@@ -401,7 +507,6 @@ Main_ParseArgLine(const char *line) 	/* Line to fracture */
 {
 	char **argv;			/* Manufactured argument vector */
 	int argc;			/* Number of arguments in argv */
-	char *args;			/* Space used by the args */
 	char *buf;
 	char *argv0;
 	const char *s;
@@ -414,6 +519,8 @@ Main_ParseArgLine(const char *line) 	/* Line to fracture */
 		continue;
 	if (!*line)
 		return;
+	if (parsing)
+		Lst_AtEnd(&argLines, estrdup(line));
 
 	/* POSIX rule: MAKEFLAGS can hold a set of option letters without
 	 * any blanks or dashes. */
@@ -431,14 +538,79 @@ Main_ParseArgLine(const char *line) 	/* Line to fracture */
 	buf = emalloc(len);
 	(void)snprintf(buf, len, "%s %s", argv0, line);
 
-	argv = brk_string(buf, &argc, &args);
+	argv = brk_string(buf, &argc);
 	free(buf);
 	MainParseArgs(argc, argv);
 
-	free(args);
 	free(argv);
 }
 
+#define SAVED_COMPAT		1
+#define SAVED_PRECIOUS		2
+#define SAVED_IGNORE		4
+#define SAVED_SILENT		8
+#define SAVED_SINGLESHELL	16
+
+/* Flags the makefiles may have set, and .MAIN targets.  We replay
+ * .MAKEFLAGS lines, which is simpler than saving every option.  */
+void
+Main_Save(Snapshot *s)
+{
+	LstNode ln;
+	unsigned long n;
+
+	snap_put_int(s,
+	    (compatMake ? SAVED_COMPAT : 0) |
+	    (allPrecious ? SAVED_PRECIOUS : 0) |
+	    (ignoreErrors ? SAVED_IGNORE : 0) |
+	    (beSilent ? SAVED_SILENT : 0) |
+	    (singleShell ? SAVED_SINGLESHELL : 0));
+
+	n = 0;
+	for (ln = Lst_First(&argLines); ln != NULL; ln = Lst_Adv(ln))
+		n++;
+	snap_put_int(s, n);
+	for (ln = Lst_First(&argLines); ln != NULL; ln = Lst_Adv(ln))
+		snap_put_string(s, Lst_Datum(ln));
+
+	n = 0;
+	for (ln = lastGiven == NULL ? Lst_First(create) : Lst_Adv(lastGiven);
+	    ln != NULL; ln = Lst_Adv(ln))
+		n++;
+	snap_put_int(s, n);
+	for (ln = lastGiven == NULL ? Lst_First(create) : Lst_Adv(lastGiven);
+	    ln != NULL; ln = Lst_Adv(ln))
+		snap_put_string(s, Lst_Datum(ln));
+}
+
+void
+Main_Restore(Snapshot *s)
+{
+	unsigned long flags, n;
+	const char *line;
+
+	flags = snap_get_int(s);
+	for (n = snap_get_int(s); n > 0; n--)
+		if ((line = snap_get_string(s)) != NULL)
+			Main_ParseArgLine(line);
+	/* these may have added targets, which we saved as well */
+	while (Lst_Last(create) != lastGiven)
+		Lst_Remove(create, Lst_Last(create));
+	for (n = snap_get_int(s); n > 0; n--)
+		if ((line = snap_get_string(s)) != NULL)
+			Lst_AtEnd(create, (void *)line);
+	if (flags & SAVED_COMPAT)
+		compatMake = true;
+	if (flags & SAVED_PRECIOUS)
+		allPrecious = true;
+	if (flags & SAVED_IGNORE)
+		ignoreErrors = true;
+	if (flags & SAVED_SILENT)
+		beSilent = true;
+	if (flags & SAVED_SINGLESHELL)
+		singleShell = true;
+}
+
 /* Add a :-separated path to a Lst of directories.  */
 static void
 add_dirpath(Lst l, const char *n)
@@ -626,6 +798,8 @@ read_all_make_rules(bool noBuiltins, bool read_depend,
 	if (read_depend)
 		(void)ReadMakefile(".depend", d);
 	Parse_End();
+	/* jobs reap any child, so don't leave shells behind */
+	Var_FinishPending();
 }
 
 static void
@@ -666,12 +840,14 @@ main(int argc, char **argv)
 	Static_Lst_Init(&varstoprint);
 	Static_Lst_Init(&targs);
 	Static_Lst_Init(&special);
+	Static_Lst_Init(&argLines);
 
 	beSilent = false;		/* Print commands as executed */
 	ignoreErrors = false;		/* Pay attention to non-zero returns */
 	noExecute = false;		/* Execute all commands */
 	keepgoing = false;		/* Stop on error */
 	allPrecious = false;		/* Remove targets when interrupted */
+	singleShell = false;		/* One shell per command */
 	queryFlag = false;		/* This is not just a check-run */
 	noBuiltins = false;		/* Read the built-in rules */
 	touchFlag = false;		/* Actually update targets */
@@ -714,16 +890,46 @@ main(int argc, char **argv)
 	
 	basedirectory = getenv("MAKEBASEDIRECTORY");
 	if (basedirectory == NULL)
-		setenv("MAKEBASEDIRECTORY", d.current, 0);
+		Var_Setenv("MAKEBASEDIRECTORY", d.current);
 
 	MainParseArgs(argc, argv);
 
+	if (DEBUG(HASH))
+		atexit(hash_report);
+	if (DEBUG(MEMORY))
+		memory_accounting();
+
+	/*
+	 * Watch mode runs the same graph several times, which the
+	 * compat engine can't do
+	 */
+	if (watchMode) {
+		if (!forceJobs)
+			optj = 1;
+		forceJobs = true;
+		compatMake = false;
+		Watch_Supervise();
+	}
+
+	/* Replay goes through the parallel engine, even for -j1, and so
+	 * does -q, which runs nothing: that way the prefetch looks at the
+	 * whole graph, and stops early */
+	if (replayTrace != NULL || queryFlag) {
+		if (!forceJobs)
+			optj = 1;
+		forceJobs = true;
+		compatMake = false;
+	}
+
 	/*
 	 * Be compatible if user did not specify -j
 	 */
 	if (!forceJobs)
 		compatMake = true;
 
+	Trace_Init();
+	Status_Init(statusPath);
+
 	/* And set up everything for sub-makes */
 	Var_AddCmdline(MAKEFLAGS);
 
@@ -756,16 +962,29 @@ main(int argc, char **argv)
 	if (Lst_IsEmpty(systemIncludePath))
 	    add_dirpath(systemIncludePath, syspath);
 
-	read_all_make_rules(noBuiltins, read_depend, &makefiles, &d);
+	lastGiven = Lst_Last(create);
+	if (!Snapshot_Load(argc, argv)) {
+		parsing = true;
+		read_all_make_rules(noBuiltins, read_depend, &makefiles, &d);
+		parsing = false;
+		Snapshot_Save();
+	}
 
 	if (compatMake)
 		optj = 1;
+	else if (replayTrace == NULL)
+		Jobserver_Init(optj);
+	if (replayTrace != NULL) {
+		/* .NOTPARALLEL only means -j1 */
+		compatMake = false;
+		Schedule_Replay(replayTrace);
+	}
 
 	Var_Append("MFLAGS", Var_Value(MAKEFLAGS));
 
 	/* Install all the flags into the MAKEFLAGS env variable. */
 	if (((p = Var_Value(MAKEFLAGS)) != NULL) && *p)
-		esetenv("MAKEFLAGS", p);
+		Var_Setenv("MAKEFLAGS", p);
 
 	setup_VPATH();
 
@@ -776,6 +995,11 @@ main(int argc, char **argv)
 		exit(0);
 	}
 
+	if (dumpFormat != 0) {
+		dump_graph(dumpFormat, create);
+		exit(0);
+	}
+
 	/* Print the initial graph, if the user requested it.  */
 	if (DEBUG(GRAPH1))
 		dump_data();
@@ -800,16 +1024,37 @@ main(int argc, char **argv)
 		else
 			Targ_FindList(&targs, create);
 
+		/* the usual case for a developer: nothing changed */
+		if (!queryFlag && !touchFlag && !noExecute && !watchMode &&
+		    replayTrace == NULL && !node_is_real(begin_node) &&
+		    !node_is_real(end_node) && Make_NullBuild(&targs))
+			return 0;
+
 		choose_engine(compatMake);
 		Job_Init(optj);
-		if (!queryFlag && node_is_real(begin_node))
-			run_node(begin_node, &errored, &outOfDate);
-
-		if (!errored)
-			engine_run_list(&targs, &errored, &outOfDate);
-
-		if (!queryFlag && !errored && node_is_real(end_node))
-			run_node(end_node, &errored, &outOfDate);
+		History_Init();
+		Schedule_Init();
+		Digest_Init();
+		BuildCache_Init();
+		Signature_Init();
+		StatCache_Init();
+		for (;;) {
+			if (!queryFlag && node_is_real(begin_node))
+				run_node(begin_node, &errored, &outOfDate);
+
+			if (!errored)
+				engine_run_list(&targs, &errored, &outOfDate);
+
+			if (!queryFlag && !errored && node_is_real(end_node))
+				run_node(end_node, &errored, &outOfDate);
+			if (!watchMode)
+				break;
+			/* only comes back if the makefiles didn't change */
+			Watch_Wait();
+			Make_Reset();
+			Init_Timestamp();
+			errored = outOfDate = false;
+		}
 	}
 
 	/* print the graph now it's been processed if the user requested it */
@@ -846,6 +1091,7 @@ ReadMakefile(void *p, void *q)
 	char *name;
 
 	if (!strcmp(fname, "-")) {
+		Snapshot_Volatile();
 		Var_Set("MAKEFILE", "");
 		Parse_File(estrdup("(stdin)"), stdin);
 	} else {
@@ -867,8 +1113,10 @@ ReadMakefile(void *p, void *q)
 		name = Dir_FindFile(fname, userIncludePath);
 		if (!name)
 			name = Dir_FindFile(fname, systemIncludePath);
-		if (!name || !(stream = fopen(name, "r")))
+		if (!name || !(stream = fopen(name, "r"))) {
+			Snapshot_Probe(fname, NULL, false);
 			return false;
+		}
 		fname = name;
 		/*
 		 * set the MAKEFILE variable desired by System V fans -- the
@@ -890,8 +1138,9 @@ static void
 usage()
 {
 	(void)fprintf(stderr,
-"usage: make [-BeiknpqrSst] [-C directory] [-D variable] [-d flags] [-f mk]\n\
-	    [-I directory] [-j max_processes] [-m directory] [-V variable]\n\
+"usage: make [-BeiknpqrSstW] [-C directory] [-D variable] [-d flags] [-f mk]\n\
+	    [-I directory] [-j max_processes] [-l max_load] [-m directory]\n\
+	    [-O mode] [-P format] [-R trace] [-T path] [-V variable]\n\
 	    [NAME=value] [target ...]\n");
 	exit(2);
 }
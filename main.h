@@ -41,4 +41,11 @@ extern Lst	create;
 /* set_notparallel(): used to influence running mode from parse.c */
 extern void set_notparallel(void);
 
+/* Main_Save(snapshot):
+ *	save what reading the makefiles changed in main's state */
+extern void Main_Save(Snapshot *);
+/* Main_Restore(snapshot):
+ *	and set it again */
+extern void Main_Restore(Snapshot *);
+
 #endif
@@ -56,6 +56,7 @@
  *
  */
 
+#include <errno.h>
 #include <limits.h>
 #include <signal.h>
 #include <stddef.h>
@@ -82,6 +83,16 @@
 #include "targequiv.h"
 #include "garray.h"
 #include "memory.h"
+#include "hash.h"
+#include "history.h"
+#include "trace.h"
+#include "status.h"
+#include "schedule.h"
+#include "snapshot.h"
+#include "pool.h"
+#include "statcache.h"
+#include "readahead.h"
+#include "journal.h"
 
 /* what gets added each time. Kept as one static array so that it doesn't
  * get resized every time.
@@ -89,33 +100,87 @@
 static struct growableArray examine;
 /* The current fringe of the graph. These are nodes which await examination by
  * MakeOODate. It is added to by Make_Update and subtracted from by
- * MakeStartJobs */
+ * MakeStartJobs.
+ * Unless DISCOVERY_ORDER is defined, it is kept as a binary heap ordered
+ * by gn->priority, so that nodes with the longest chain of ancestors
+ * still to build start first: otherwise a long link chain that got
+ * discovered late may end up running alone at the end of the build.
+ */
 static struct growableArray to_build;	
-
-/* Hold back on nodes where equivalent stuff is already building... */
-static struct growableArray heldBack;
+static bool use_priority;	/* to_build is a heap */
+static bool priorities_known;	/* the heap property holds */
+static bool priorities_stale;	/* the graph grew since */
+
+/* Hold back on nodes where equivalent stuff is already building:
+ * they wait on the watched node's waiters list. */
+static unsigned int heldBack;
+static unsigned int ordered;	/* nodes waiting on .ORDER, for -dI */
+static unsigned int nodes_done;	/* went through Make_Update, for -T */
+static bool ran_commands;	/* otherwise, it was a null build */
+static bool skip_restat;	/* SKIP_RESTAT: commands always update */
+static unsigned int look_ahead;	/* LOOK_AHEAD: nodes to prepare */
+#define LOOK_AHEAD_DEFAULT	16
+static FILE *query_report;	/* QUERY_REPORT: -q lists everything */
+static bool query_found;	/* ...and found that much out of date */
+static struct growableArray ahead;	/* prepared, to put back */
 
 static struct ohash targets;	/* stuff we must build */
 
-static void MakeAddChild(void *, void *);
+/* cycle detection: bitmaps indexed by gn->id */
+#define BIT_ISSET(b, i)	((b)[(i) / CHAR_BIT] & (1 << ((i) % CHAR_BIT)))
+#define BIT_SET(b, i)	((b)[(i) / CHAR_BIT] |= 1 << ((i) % CHAR_BIT))
+#define BIT_CLR(b, i)	((b)[(i) / CHAR_BIT] &= ~(1 << ((i) % CHAR_BIT)))
+
 static void MakeHandleUse(void *, void *);
 static bool MakeStartJobs(void);
 static void MakePrintStatus(void *);
 
 /* Cycle detection functions */
 static bool targets_contain_cycles(void);
-static void print_unlink_cycle(struct growableArray *, GNode *);
-static void break_and_print_cycles(Lst);
-static GNode *find_cycle(Lst, struct growableArray *);
-
-static bool try_to_make_node(GNode *);
+static bool in_cycle_search(GNode *);
+static void print_cycle(struct growableArray *, GNode *);
+static void print_component(struct growableArray *, unsigned int);
+static bool report_cycles(Lst);
+
+static bool try_to_make_node(GNode *, bool);
+static void start_node(GNode *);
+static void prepare_ahead(void);
 static void add_targets_to_make(Lst);
+static void probe_examine(GNode *);
+static void add_children_to_make(GNode *);
 
 static bool has_predecessor_left_to_build(GNode *);
+static GNode *group_building(GNode *);
+static void hold_back(GNode *, GNode *, const char *);
 static void requeue_successors(GNode *);
 static void random_setup(void);
 
+static long node_weight(GNode *);
+static long node_priority(GNode *);
+static bool more_urgent(GNode *, GNode *);
+static void prefetch_mtimes(bool);
+static void compute_priorities(void);
+static void save_null_build(Lst);
+static void heap_up(struct growableArray *, unsigned int);
+static void heap_down(struct growableArray *, unsigned int);
+static void queue_node(GNode *);
+static void queue_new_node(GNode *);
+static GNode *next_node(void);
+
 static bool randomize_queue;
+
+/* critical path report, indexed by gn->id */
+struct path_times {
+	long finish;		/* earliest, with infinitely many jobs */
+	long latest;		/* latest finish that doesn't delay the end */
+	GNode *slowest;		/* child that finishes last */
+	bool busy;		/* on the stack, for cycles */
+};
+static struct path_times *path_times;
+static long path_finish(GNode *, struct growableArray *);
+static long path_latest(GNode *, long, struct growableArray *);
+static int cmp_slack(const void *, const void *);
+static void report_critical_path(const struct timespec *);
 long random_delay = 0;
 
 bool
@@ -157,25 +222,260 @@ randomize_garray(struct growableArray *g)
 	}
 }
 
-static bool
-has_predecessor_left_to_build(GNode *gn)
+/* The priority of a node is the length of the longest chain of ancestors we
+ * must still build on top of it, including itself.  .ORDER successors wait
+ * for it as well, so their chains count too.  Without a build
+ * history, each node weighs one, so this is an edge count.  Otherwise it
+ * weighs what it took to build last time, and new targets get the mean.
+ * Replaying a trace, the trace knows best.
+ */
+static long
+node_weight(GNode *gn)
+{
+	long w = Schedule_Duration(gn);
+
+	if (w < 0)
+		w = History_Duration(gn);
+
+	if (w < 0)
+		w = History_Mean();
+	return w + 1;
+}
+
+/* A .PRIORITY hint overrides all that: nodes with the best rank go first,
+ * and a node without a hint of its own ranks with its best parent, so a
+ * boosted code generator brings its tools along.
+ */
+static long
+node_priority(GNode *gn)
 {
 	LstNode ln;
+	long best = 0;
+	int rank = INT_MIN;
+
+	if (gn->priority != PRIORITY_UNKNOWN)
+		return gn->priority;
+	/* cycles are reported later, we just need to terminate */
+	gn->priority = 0;
+	gn->rank = gn->hint == HINT_NONE ? 0 : gn->hint;
+	for (ln = Lst_First(&gn->parents); ln != NULL; ln = Lst_Adv(ln)) {
+		GNode *pgn = Lst_Datum(ln);
+		long p;
+
+		if (!pgn->must_make)
+			continue;
+		p = node_priority(pgn);
+		if (p > best)
+			best = p;
+		if (pgn->rank > rank)
+			rank = pgn->rank;
+	}
+	for (ln = Lst_First(&gn->successors); ln != NULL; ln = Lst_Adv(ln)) {
+		GNode *sgn = Lst_Datum(ln);
+		long p;
+
+		if (!sgn->must_make)
+			continue;
+		p = node_priority(sgn);
+		if (p > best)
+			best = p;
+	}
+	if (gn->hint == HINT_NONE && rank != INT_MIN)
+		gn->rank = rank;
+	gn->priority = best + node_weight(gn);
+	return gn->priority;
+}
+
+static bool
+more_urgent(GNode *gn, GNode *gn2)
+{
+	if (gn->rank != gn2->rank)
+		return gn->rank > gn2->rank;
+	if (gn->priority != gn2->priority)
+		return gn->priority > gn2->priority;
+	/* LOOK_AHEAD already spent time on it */
+	return gn->prepared && !gn2->prepared;
+}
+
+/* All nodes we must make are known: ask for their mtimes in one go.
+ * With PREFETCH_BACKGROUND, that goes on in the background, most urgent
+ * nodes first, so that the first jobs start before we know about the
+ * rest.
+ */
+static void
+prefetch_mtimes(bool background)
+{
+	GNode *gn, **nodes;
+	unsigned int i, n = 0;
 
-	if (Lst_IsEmpty(&gn->predecessors))
+	nodes = ereallocarray(NULL, ohash_entries(&targets), sizeof(GNode *));
+	for (gn = ohash_first(&targets, &i); gn != NULL;
+	    gn = ohash_next(&targets, &i))
+		nodes[n++] = gn;
+	if (background)
+		Dir_StartPrefetch(nodes, n);
+	else
+		Dir_PrefetchMTimes(nodes, n);
+	free(nodes);
+}
+
+/* Nothing had to run: that stays true as long as none of the nodes we
+ * examined and directories we read changes */
+static void
+save_null_build(Lst targs)
+{
+	GNode *gn, **nodes;
+	unsigned int i, n = 0;
+
+	nodes = ereallocarray(NULL, ohash_entries(&targets), sizeof(GNode *));
+	for (gn = ohash_first(&targets, &i); gn != NULL;
+	    gn = ohash_next(&targets, &i))
+		nodes[n++] = gn;
+	Snapshot_SaveNullBuild(targs, nodes, n);
+	free(nodes);
+}
+
+bool
+Make_NullBuild(Lst targs)
+{
+	if (!Snapshot_NullBuild(targs))
 		return false;
+	Lst_Every(targs, MakePrintStatus);
+	return true;
+}
+
+/* Once the initial traversal has marked all nodes we must make, every
+ * ancestor chain is known: compute all priorities in one go, then turn
+ * to_build into a heap.  Nodes discovered later on get their priority
+ * computed when they are queued, but they may also sit on top of nodes
+ * we already know about (sources found by Suff_FindDeps, say): then
+ * everything gets computed again, before the next node leaves the heap.
+ */
+static void
+compute_priorities(void)
+{
+	GNode *gn;
+	unsigned int i;
+
+	if (priorities_known)
+		for (gn = ohash_first(&targets, &i); gn != NULL;
+		    gn = ohash_next(&targets, &i))
+			gn->priority = PRIORITY_UNKNOWN;
+	for (gn = ohash_first(&targets, &i); gn != NULL;
+	    gn = ohash_next(&targets, &i))
+		(void)node_priority(gn);
+	for (i = to_build.n / 2; i > 0; i--)
+		heap_down(&to_build, i-1);
+	priorities_known = true;
+	priorities_stale = false;
+}
+
+static void
+heap_up(struct growableArray *h, unsigned int i)
+{
+	GNode *gn = h->a[i];
+
+	while (i > 0) {
+		unsigned int parent = (i-1)/2;
+
+		if (!more_urgent(gn, h->a[parent]))
+			break;
+		h->a[i] = h->a[parent];
+		i = parent;
+	}
+	h->a[i] = gn;
+}
+
+static void
+heap_down(struct growableArray *h, unsigned int i)
+{
+	GNode *gn = h->a[i];
 
+	while (2*i+1 < h->n) {
+		unsigned int child = 2*i+1;
 
-	for (ln = Lst_First(&gn->predecessors); ln != NULL; ln = Lst_Adv(ln)) {
+		if (child+1 < h->n && more_urgent(h->a[child+1], h->a[child]))
+			child++;
+		if (!more_urgent(h->a[child], gn))
+			break;
+		h->a[i] = h->a[child];
+		i = child;
+	}
+	h->a[i] = gn;
+}
+
+static void
+queue_node(GNode *gn)
+{
+	Array_Push(&to_build, gn);
+	gn->queued = true;
+	if (gn->ordered) {
+		gn->ordered = false;
+		ordered--;
+	}
+	if (use_priority && priorities_known) {
+		(void)node_priority(gn);
+		heap_up(&to_build, to_build.n-1);
+	}
+	status_count(STATUS_TO_BUILD, to_build.n);
+	Readahead_Node(gn);
+}
+
+static void
+queue_new_node(GNode *gn)
+{
+	if (!gn->queued)
+		queue_node(gn);
+}
+
+static GNode *
+next_node(void)
+{
+	GNode *gn;
+
+	if (priorities_stale)
+		compute_priorities();
+	if (!use_priority || !priorities_known || to_build.n <= 1)
+		gn = Array_Pop(&to_build);
+	else {
+		gn = to_build.a[0];
+		to_build.a[0] = to_build.a[--to_build.n];
+		heap_down(&to_build, 0);
+	}
+	if (gn != NULL)
+		gn->queued = false;
+	status_count(STATUS_TO_BUILD, to_build.n);
+	return gn;
+}
+
+static bool
+has_predecessor_left_to_build(GNode *gn)
+{
+	LstNode ln;
+	bool settled = true;
+
+	/* Predecessors that got started stay out of the way, so the next
+	 * look can start after them.  Those that are not part of the build
+	 * or held back may still change their mind.  */
+	for (ln = gn->next_pred; ln != NULL; ln = Lst_Adv(ln)) {
 		GNode	*pgn = Lst_Datum(ln);
 
 		if (pgn->must_make && pgn->built_status == UNKNOWN) {
+			if (settled)
+				gn->next_pred = ln;
 			if (DEBUG(MAKE))
 				printf("predecessor %s not made yet.\n",
 				    pgn->name);
 			return true;
 		}
+		if (settled &&
+		    (!pgn->must_make || pgn->built_status == HELDBACK)) {
+			gn->next_pred = ln;
+			settled = false;
+		}
 	}
+	if (settled)
+		gn->next_pred = NULL;
 	return false;
 }
 
@@ -192,29 +492,81 @@ requeue_successors(GNode *gn)
 
 		if (succ->must_make && succ->children_left == 0
 		    && succ->built_status == UNKNOWN)
-			Array_PushNew(&to_build, succ);
+			queue_new_node(succ);
 	}
 }
 
 static void
 requeue(GNode *gn)
 {
-	/* this is where we go inside the array and move things around */
-	unsigned int i, j;
-
-	for (i = 0, j = 0; i < heldBack.n; i++, j++) {
-		if (heldBack.a[i]->watched == gn) {
-			j--;
-			heldBack.a[i]->built_status = UNKNOWN;
-			if (DEBUG(HELDJOBS))
-				printf("%s finished, releasing: %s\n",
-				    gn->name, heldBack.a[i]->name);
-			Array_Push(&to_build, heldBack.a[i]);
-			continue;
-		}
-		heldBack.a[j] = heldBack.a[i];
+	GNode *w, *next, *list = NULL;
+
+	if (gn->waiters == NULL)
+		return;
+	/* waiters got pushed in front: release them in the order
+	 * they got held back */
+	for (w = gn->waiters; w != NULL; w = next) {
+		next = w->next_waiter;
+		w->next_waiter = list;
+		list = w;
+	}
+	gn->waiters = NULL;
+	for (w = list; w != NULL; w = next) {
+		next = w->next_waiter;
+		w->next_waiter = NULL;
+		w->watched = NULL;
+		w->built_status = UNKNOWN;
+		heldBack--;
+		if (DEBUG(HELDJOBS))
+			printf("%s finished, releasing: %s\n",
+			    gn->name, w->name);
+		trace_instant("release", w->name, gn->name);
+		queue_node(w);
 	}
-	heldBack.n = j;
+	trace_counter("held back nodes", heldBack);
+	status_count(STATUS_HELD_BACK, heldBack);
+}
+
+/* The whole groupling list shares one node to keep track of which member
+ * is building: try_to_make_node is the only place that starts them, so
+ * it can tell.  */
+static GNode *
+group_building(GNode *gn)
+{
+	GNode *gn2, *b;
+
+	if (gn->group == NULL) {
+		gn->group = gn;
+		for (gn2 = gn->groupling; gn2 != gn; gn2 = gn2->groupling)
+			gn2->group = gn;
+	}
+	b = gn->group->group_building;
+	if (b != NULL && b->built_status != BUILDING)
+		b = gn->group->group_building = NULL;
+	return b == gn ? NULL : b;
+}
+
+static void
+hold_back(GNode *gn, GNode *gn2, const char *why)
+{
+	gn->watched = gn2;
+	gn->built_status = HELDBACK;
+	gn->next_waiter = gn2->waiters;
+	gn2->waiters = gn;
+	heldBack++;
+	Schedule_Note(gn, 'h');
+	if (DEBUG(HELDJOBS))
+		printf("Holding back job %s, %s to %s\n", gn->name, why,
+		    gn2->name);
+	trace_instant(why, gn->name, gn2->name);
+	trace_counter("held back nodes", heldBack);
+	status_count(STATUS_HELD_BACK, heldBack);
+}
+
+void
+Make_Failed(GNode *gn)
+{
+	requeue(gn);
 }
 
 /*-
@@ -239,7 +591,8 @@ void
 Make_Update(GNode *cgn)	/* the child node */
 {
 	GNode	*pgn;	/* the parent node */
-	LstNode	ln;	/* Element in parents list */
+	GNode	**parents;
+	unsigned int i, n;
 
 	/*
 	 * If the child was actually made, see what its modification time is
@@ -260,18 +613,31 @@ Make_Update(GNode *cgn)	/* the child node */
 		 * the Dir_MTime occurs, thus leading us to believe that the
 		 * file is unchanged, wreaking havoc with files that depend
 		 * on this one.
+		 *
+		 * With SKIP_RESTAT, we trust the commands to have updated
+		 * the file, and don't stop to look.
 		 */
-		if (noExecute || is_out_of_date(Dir_MTime(cgn)))
+		if (noExecute || query_report != NULL || skip_restat ||
+		    is_out_of_date(Dir_MTime(cgn)))
 			clock_gettime(CLOCK_REALTIME, &cgn->mtime);
+		/* sub-makes would otherwise see the old time.  Ours is a
+		 * guess, so they'll have to look for themselves.  */
+		if (skip_restat && !noExecute && query_report == NULL &&
+		    (cgn->type & OP_PHONY) == 0)
+			StatCache_Forget(cgn->path != NULL ? cgn->path :
+			    cgn->name);
 		if (DEBUG(MAKE))
 			printf("update time: %s\n",
 			    time_to_string(&cgn->mtime));
 	}
 
+	Journal_Record(cgn);
 	requeue(cgn);
+	status_progress(++nodes_done, ohash_entries(&targets));
 	/* SIB: this is where I should mark the build as finished */
-	for (ln = Lst_First(&cgn->parents); ln != NULL; ln = Lst_Adv(ln)) {
-		pgn = Lst_Datum(ln);
+	parents = Targ_Parents(cgn, &n);
+	for (i = 0; i < n; i++) {
+		pgn = parents[i];
 		/* SIB: there should be a siblings loop there */
 		pgn->children_left--;
 		if (pgn->must_make) {
@@ -292,7 +658,7 @@ Make_Update(GNode *cgn)	/* the child node */
 				 */
 				if (DEBUG(MAKE))
 					printf("QUEUING ");
-				Array_Push(&to_build, pgn);
+				queue_node(pgn);
 			} else if (pgn->children_left < 0) {
 				Error("Child %s discovered graph cycles through %s", cgn->name, pgn->name);
 			}
@@ -303,11 +669,34 @@ Make_Update(GNode *cgn)	/* the child node */
 	requeue_successors(cgn);
 }
 
+int
+Make_IdleReason(void)
+{
+	if (heldBack > 0)
+		return IDLE_HELDBACK;
+	if (ordered > 0)
+		return IDLE_ORDER;
+	return IDLE_WAITING;
+}
+
 static bool
-try_to_make_node(GNode *gn)
+try_to_make_node(GNode *gn, bool ahead)
 {
+	if (gn->prepared) {
+		start_node(gn);
+		return false;
+	}
 	if (DEBUG(MAKE))
 		printf("Examining %s...", gn->name);
+	if (Journal_Done(gn)) {
+		if (DEBUG(MAKE))
+			printf(" done before, per the journal\n");
+		if (!has_been_built(gn)) {
+			gn->built_status = UPTODATE;
+			Make_Update(gn);
+		}
+		return false;
+	}
 		
 	if (gn->built_status == HELDBACK) {
 		if (DEBUG(HELDJOBS))
@@ -315,11 +704,11 @@ try_to_make_node(GNode *gn)
 		return false;
 	}
 
+	/* Make_Update will queue it again once the last child is done */
 	if (gn->children_left != 0) {
 		if (DEBUG(MAKE))
-			printf(" Requeuing (%d)\n", gn->children_left);
-		add_targets_to_make(&gn->children);
-		Array_Push(&to_build, gn);
+			printf(" Waiting (%d)\n", gn->children_left);
+		add_children_to_make(gn);
 		return false;
 	}
 	if (has_been_built(gn)) {
@@ -330,60 +719,61 @@ try_to_make_node(GNode *gn)
 	if (has_predecessor_left_to_build(gn)) {
 		if (DEBUG(MAKE))
 			printf(" Dropping for now\n");
+		if (!gn->ordered) {
+			gn->ordered = true;
+			ordered++;
+		}
 		return false;
 	}
 
 	/* SIB: this is where there should be a siblings loop */
 	if (gn->children_left != 0) {
 		if (DEBUG(MAKE))
-			printf(" Requeuing (after deps: %d)\n", 
+			printf(" Waiting (after deps: %d)\n",
 			    gn->children_left);
-		add_targets_to_make(&gn->children);
+		add_children_to_make(gn);
 		return false;
 	}
 	/* this is where we hold back nodes */
 	if (gn->groupling != NULL) {
-		GNode *gn2;
-		for (gn2 = gn->groupling; gn2 != gn; gn2 = gn2->groupling)
-			if (gn2->built_status == BUILDING) {
-				gn->watched = gn2;
-				gn->built_status = HELDBACK;
-				if (DEBUG(HELDJOBS))
-					printf("Holding back job %s, "
-					    "groupling to %s\n",
-					    gn->name, gn2->name);
-				Array_Push(&heldBack, gn);
-				return false;
-			}
+		GNode *gn2 = group_building(gn);
+		if (gn2 != NULL) {
+			hold_back(gn, gn2, "groupling");
+			return false;
+		}
 	}
+	/* sibling lists are short, and they may still grow while we
+	 * expand the graph, so there's nothing to cache */
 	if (gn->sibling != gn) {
 		GNode *gn2;
 		for (gn2 = gn->sibling; gn2 != gn; gn2 = gn2->sibling)
 			if (gn2->built_status == BUILDING) {
-				gn->watched = gn2;
-				gn->built_status = HELDBACK;
-				if (DEBUG(HELDJOBS))
-					printf("Holding back job %s, "
-					    "sibling to %s\n",
-					    gn->name, gn2->name);
-				Array_Push(&heldBack, gn);
+				hold_back(gn, gn2, "sibling");
 				return false;
 			}
 	}
-	if (Make_OODate(gn)) {
+	if (simulate ? Schedule_OODate(gn) : Make_OODate(gn)) {
 		if (DEBUG(MAKE))
 			printf("out-of-date\n");
-		if (queryFlag)
+		if (queryFlag && query_report == NULL)
 			return true;
+		/* go on as if it got rebuilt, to find what depends on it */
+		if (queryFlag) {
+			fprintf(query_report, "%s\n", gn->name);
+			query_found = true;
+			gn->built_status = REBUILT;
+			Make_Update(gn);
+			return false;
+		}
 		/* SIB: this is where commands should get prepared */
 		Make_DoAllVar(gn);
-		if (node_find_valid_commands(gn)) {
-			if (touchFlag)
-				Job_Touch(gn);
-			else 
-				Job_Make(gn);
-		} else
+		if (!node_find_valid_commands(gn))
 			node_failure(gn);
+		else if (ahead) {
+			job_prepare_node(gn);
+			gn->prepared = true;
+		} else
+			start_node(gn);
 	} else {
 		if (DEBUG(MAKE))
 			printf("up-to-date\n");
@@ -394,6 +784,58 @@ try_to_make_node(GNode *gn)
 	return false;
 }
 
+/* What's left once a node is known to be out-of-date: a job slot, and room
+ * in its pools.  */
+static void
+start_node(GNode *gn)
+{
+	if (gn->pools != NULL && !touchFlag) {
+		GNode *gn2 = Pool_Busy(gn);
+		if (gn2 != NULL) {
+			hold_back(gn, gn2, "pool");
+			return;
+		}
+	}
+	gn->prepared = false;
+	if (!Lst_IsEmpty(&gn->commands))
+		ran_commands = true;
+	if (touchFlag) {
+		Job_Touch(gn);
+		Make_Update(gn);
+	} else
+		Job_Make(gn);
+	if (gn->groupling != NULL && gn->built_status == BUILDING)
+		gn->group->group_building = gn;
+}
+
+/* With LOOK_AHEAD, once all job slots are busy, examine the next nodes
+ * in to_build anyway: those that turn out to be up-to-date don't need a
+ * slot, and those that don't get their first command expanded, to start
+ * as soon as a job finishes.  Nodes that may get held back by other
+ * nodes building are left for later, since that can change whether
+ * they're out-of-date.
+ */
+static void
+prepare_ahead(void)
+{
+	GNode *gn;
+	unsigned int i;
+
+	for (i = 0; i < look_ahead && errorJobs == NULL &&
+	    (gn = next_node()) != NULL; i++) {
+		if (gn->prepared || gn->groupling != NULL ||
+		    gn->sibling != gn) {
+			Array_Push(&ahead, gn);
+			continue;
+		}
+		(void)try_to_make_node(gn, true);
+		if (gn->prepared)
+			Array_Push(&ahead, gn);
+	}
+	while ((gn = Array_Pop(&ahead)) != NULL)
+		queue_new_node(gn);
+}
+
 /*
  *-----------------------------------------------------------------------
  * MakeStartJobs --
@@ -414,8 +856,11 @@ MakeStartJobs(void)
 {
 	GNode	*gn;
 
-	while (can_start_job() && (gn = Array_Pop(&to_build)) != NULL) {
-		if (try_to_make_node(gn))
+	/* check to_build first, so we don't grab jobserver tokens for
+	 * nothing */
+	while (!Array_IsEmpty(&to_build) && can_start_job() &&
+	    (gn = next_node()) != NULL) {
+		if (try_to_make_node(gn, false))
 			return true;
 	}
 	return false;
@@ -432,16 +877,6 @@ MakePrintStatus(void *gnp)
 	}
 }
 
-static void
-MakeAddChild(void *to_addp, void *ap)
-{
-	GNode *gn = to_addp;
-	struct growableArray *a = ap;
-
-	if (!gn->must_make && !(gn->type & OP_USE))
-		Array_Push(a, gn);
-}
-
 static void
 MakeHandleUse(void *cgnp, void *pgnp)
 {
@@ -459,7 +894,8 @@ MakeHandleUse(void *cgnp, void *pgnp)
 static void
 add_targets_to_make(Lst todo)
 {
-	GNode *gn;
+	GNode *gn, **v;
+	unsigned int i, n;
 
 	unsigned int slot;
 
@@ -468,50 +904,145 @@ add_targets_to_make(Lst todo)
 	while ((gn = Array_Pop(&examine)) != NULL) {
 		if (gn->must_make) 	/* already known */
 			continue;
+		if (!gn->probed && (gn->type & OP_EXPANDED) == 0)
+			probe_examine(gn);
 		gn->must_make = true;
+		priorities_stale = priorities_known;
+		gn->next_pred = Lst_First(&gn->predecessors);
 
-		slot = ohash_qlookup(&targets, gn->name);
+		slot = hash_qlookup(&targets, gn->name);
 		if (!ohash_find(&targets, slot))
 			ohash_insert(&targets, slot, gn);
 
+		/* what's below doesn't matter */
+		if (Journal_Done(gn)) {
+			queue_node(gn);
+			continue;
+		}
 
-		look_harder_for_target(gn);
-		kludge_look_harder_for_target(gn);
-		/*
-		 * Apply any .USE rules before looking for implicit
-		 * dependencies to make sure everything that should have
-		 * commands has commands ...
-		 */
-		Lst_ForEach(&gn->children, MakeHandleUse, gn);
-		Suff_FindDeps(gn);
-		expand_all_children(gn);
+		if ((gn->type & OP_EXPANDED) == 0) {
+			look_harder_for_target(gn);
+			kludge_look_harder_for_target(gn);
+			/*
+			 * Apply any .USE rules before looking for implicit
+			 * dependencies to make sure everything that should
+			 * have commands has commands ...
+			 */
+			Lst_ForEach(&gn->children, MakeHandleUse, gn);
+			Suff_FindDeps(gn);
+			expand_all_children(gn);
+			gn->type |= OP_EXPANDED;
+		}
 
 		if (gn->children_left != 0) {
 			if (DEBUG(MAKE))
 				printf("%s: not queuing (%d children left to build)\n",
 				    gn->name, gn->children_left);
-			Lst_ForEach(&gn->children, MakeAddChild,
-			    &examine);
+			v = Targ_Children(gn, &n);
+			for (i = 0; i < n; i++)
+				if (!v[i]->must_make &&
+				    !(v[i]->type & OP_USE))
+					Array_Push(&examine, v[i]);
+			gn->children_queued = true;
 		} else {
 			if (DEBUG(MAKE))
 				printf("%s: queuing\n", gn->name);
-			Array_Push(&to_build, gn);
+			queue_node(gn);
 		}
 	}
 	if (randomize_queue)
 		randomize_garray(&to_build);
 }
 
+/* Everything waiting in examine gets marked and expanded before anything
+ * runs: look for the implied sources of all of those at once.  */
+static void
+probe_examine(GNode *gn)
+{
+	GNode **v, *gn2;
+	unsigned int i, n = 0;
+
+	v = ereallocarray(NULL, examine.n + 1, sizeof(GNode *));
+	gn->probed = true;
+	v[n++] = gn;
+	for (i = 0; i < examine.n; i++) {
+		gn2 = examine.a[i];
+		if (!gn2->must_make && !gn2->probed &&
+		    (gn2->type & OP_EXPANDED) == 0) {
+			gn2->probed = true;
+			v[n++] = gn2;
+		}
+	}
+	Suff_ProbeDeps(v, n);
+	free(v);
+}
+
+/* each edge only needs looking at once, unless more children show up */
+static void
+add_children_to_make(GNode *gn)
+{
+	if (gn->children_queued)
+		return;
+	add_targets_to_make(&gn->children);
+	gn->children_queued = true;
+}
+
 void
 Make_Init()
 {
 	/* wild guess at initial sizes */
 	Array_Init(&to_build, 500);
 	Array_Init(&examine, 150);
-	Array_Init(&heldBack, 100);
+	Array_Init(&ahead, 16);
 	ohash_init(&targets, 10, &gnode_info);
 }
 
+/* Forget everything the last Make_Run found out, but keep the graph
+ * as it was expanded, so that the next run only has to look at time stamps.
+ */
+void
+Make_Reset(void)
+{
+	GNode *gn, **v;
+	unsigned int i, j, n;
+
+	for (gn = ohash_first(&targets, &i); gn != NULL;
+	    gn = ohash_next(&targets, &i)) {
+		gn->must_make = false;
+		gn->child_rebuilt = false;
+		gn->ordered = false;
+		gn->prepared = false;
+		gn->readahead = false;
+		free(gn->first_cmd);
+		gn->first_cmd = NULL;
+		gn->built_status = UNKNOWN;
+		gn->priority = PRIORITY_UNKNOWN;
+		gn->duration = 0;
+		gn->queued = false;
+		gn->children_queued = false;
+		gn->watched = NULL;
+		gn->waiters = NULL;
+		gn->next_waiter = NULL;
+		gn->group_building = NULL;
+		gn->youngest = gn;
+		ts_set_out_of_date(gn->mtime);
+		/* .USE children were applied once and for all */
+		gn->children_left = 0;
+		v = Targ_Children(gn, &n);
+		for (j = 0; j < n; j++)
+			if ((v[j]->type & OP_USE) == 0)
+				gn->children_left++;
+	}
+	ohash_delete(&targets);
+	ohash_init(&targets, 10, &gnode_info);
+	Array_Reset(&to_build);
+	heldBack = 0;
+	ordered = 0;
+	nodes_done = 0;
+	Dir_ForgetTimes();
+	Dir_Changed();
+}
+
 /*-
  *-----------------------------------------------------------------------
  * Make_Run --
@@ -533,18 +1064,76 @@ Make_Init()
 void
 Make_Run(Lst targs, bool *has_errors, bool *out_of_date)
 {
+	struct timespec start;
+	bool background;
+	const char *s;
+
+	clock_gettime(CLOCK_MONOTONIC, &start);
 	if (DEBUG(PARALLEL))
 		random_setup();
+	/* a shuffled queue is not a heap */
+	use_priority = !randomize_queue &&
+	    !Var_Definedi("DISCOVERY_ORDER", NULL);
+	priorities_known = false;
+	priorities_stale = false;
+	ran_commands = false;
+	skip_restat = Var_Definedi("SKIP_RESTAT", NULL);
+	look_ahead = 0;
+	if (!queryFlag && !touchFlag && !simulate) {
+		const char *s = Var_Value("LOOK_AHEAD");
+		const char *errstr;
+
+		if (s != NULL && *s == '\0')
+			look_ahead = LOOK_AHEAD_DEFAULT;
+		else if (s != NULL) {
+			look_ahead = strtonum(s, 1, INT_MAX, &errstr);
+			if (errstr != NULL)
+				Punt("LOOK_AHEAD is %s: %s", errstr, s);
+		}
+	}
 
+	if (!queryFlag && !touchFlag && !noExecute && !simulate) {
+		Readahead_Init();
+		Journal_Init();
+	}
 	add_targets_to_make(targs);
+	if (Var_Definedi("CHECK_CYCLES", NULL) && report_cycles(targs)) {
+		*has_errors = true;
+		Lst_Every(targs, MakePrintStatus);
+		Readahead_End();
+		Journal_End(false);
+		return;
+	}
+	query_report = NULL;
+	query_found = false;
+	if (queryFlag && (s = Var_Value("QUERY_REPORT")) != NULL &&
+	    (query_report = fopen(s, "w")) == NULL)
+		Punt("Can't write QUERY_REPORT %s: %s", s, strerror(errno));
+	/* the background prefetch goes by priority.  -q can stop at the
+	 * first node that's out of date, so it doesn't wait for all of it
+	 * either.  */
+	background = use_priority && !touchFlag &&
+	    (queryFlag || Var_Definedi("PREFETCH_BACKGROUND", NULL));
+	if (!background)
+		prefetch_mtimes(false);
+	if (use_priority)
+		compute_priorities();
+	if (background)
+		prefetch_mtimes(true);
 	if (queryFlag) {
 		/*
 		 * We wouldn't do any work unless we could start some jobs in
 		 * the next loop... (we won't actually start any, of course,
 		 * this is just to see if any of the targets was out of date)
 		 */
-		if (MakeStartJobs())
+		if (MakeStartJobs() || query_found)
 			*out_of_date = true;
+		if (background)
+			Dir_CancelPrefetch();
+		if (query_report != NULL) {
+			fclose(query_report);
+			query_report = NULL;
+		}
 	} else {
 		/*
 		 * Initialization. At the moment, no jobs are running and until
@@ -555,6 +1144,9 @@ Make_Run(Lst targs, bool *has_errors, bool *out_of_date)
 		 */
 		(void)MakeStartJobs();
 	}
+	/* the first jobs run while the rest of the prefetch finishes */
+	if (background)
+		Dir_EndPrefetch();
 
 	/*
 	 * Main Loop: The idea here is that the ending of jobs will take
@@ -567,24 +1159,218 @@ Make_Run(Lst targs, bool *has_errors, bool *out_of_date)
 	 * the keepgoing flag was given.
 	 */
 	while (!Job_Empty()) {
+		if (look_ahead != 0)
+			prepare_ahead();
 		handle_running_jobs();
 		(void)MakeStartJobs();
 	}
+	Readahead_End();
 
 	if (errorJobs != NULL)
 		*has_errors = true;
+	/* -q didn't look any further, like the compat engine */
+	if (queryFlag && *out_of_date)
+		return;
 
 	/*
 	 * Print the final status of each target. E.g. if it wasn't made
 	 * because some inferior reported an error.
 	 */
 	if (targets_contain_cycles()) {
-		break_and_print_cycles(targs);
+		(void)report_cycles(targs);
 		*has_errors = true;
+	} else {
+		if (!queryFlag && Var_Definedi("CRITICAL_PATH", NULL))
+			report_critical_path(&start);
+		if (!*has_errors && !ran_commands && !queryFlag &&
+		    !touchFlag && !noExecute && !simulate)
+			save_null_build(targs);
 	}
+	Journal_End(!*has_errors);
 	Lst_Every(targs, MakePrintStatus);
 }
 
+/* The critical path through the nodes we just built, weighing each with
+ * how long it took, and the slack of the others: how much later they
+ * could have finished without delaying the whole build.
+ * Dependency chains can be very long, so both walks keep their own stack:
+ * a node stays there until everything it depends on is known.  Nodes in
+ * a cycle count as finishing at 0 (or at the end), as the first visit
+ * leaves them.
+ */
+static long
+path_finish(GNode *root, struct growableArray *stack)
+{
+	struct path_times *t;
+	GNode *gn, **v;
+	unsigned int i, n;
+	long best;
+
+	Array_Push(stack, root);
+	while (stack->n > 0) {
+		gn = stack->a[stack->n-1];
+		t = &path_times[gn->id];
+		v = Targ_Children(gn, &n);
+		if (t->finish == -1) {
+			t->finish = 0;
+			t->busy = true;
+			for (i = 0; i < n; i++)
+				if (v[i]->must_make &&
+				    path_times[v[i]->id].finish == -1)
+					Array_Push(stack, v[i]);
+			continue;
+		}
+		stack->n--;
+		if (!t->busy)
+			continue;
+		best = 0;
+		for (i = 0; i < n; i++) {
+			long f;
+
+			if (!v[i]->must_make)
+				continue;
+			f = path_times[v[i]->id].finish;
+			if (f > best || t->slowest == NULL) {
+				best = f;
+				t->slowest = v[i];
+			}
+		}
+		t->finish = best + gn->duration;
+		t->busy = false;
+	}
+	return path_times[root->id].finish;
+}
+
+static long
+path_latest(GNode *root, long end, struct growableArray *stack)
+{
+	struct path_times *t;
+	GNode *gn, **v;
+	unsigned int i, n;
+	long best;
+
+	Array_Push(stack, root);
+	while (stack->n > 0) {
+		gn = stack->a[stack->n-1];
+		t = &path_times[gn->id];
+		v = Targ_Parents(gn, &n);
+		if (t->latest == -1) {
+			t->latest = end;
+			t->busy = true;
+			for (i = 0; i < n; i++)
+				if (v[i]->must_make &&
+				    path_times[v[i]->id].latest == -1)
+					Array_Push(stack, v[i]);
+			continue;
+		}
+		stack->n--;
+		if (!t->busy)
+			continue;
+		best = end;
+		for (i = 0; i < n; i++) {
+			long l;
+
+			if (!v[i]->must_make)
+				continue;
+			l = path_times[v[i]->id].latest - v[i]->duration;
+			if (l < best)
+				best = l;
+		}
+		t->latest = best;
+		t->busy = false;
+	}
+	return path_times[root->id].latest;
+}
+
+static int
+cmp_slack(const void *a, const void *b)
+{
+	const GNode *g1 = *(GNode * const *)a;
+	const GNode *g2 = *(GNode * const *)b;
+	long s1 = path_times[g1->id].latest - path_times[g1->id].finish;
+	long s2 = path_times[g2->id].latest - path_times[g2->id].finish;
+
+	if (s1 != s2)
+		return s1 < s2 ? -1 : 1;
+	if (g1->duration != g2->duration)
+		return g1->duration < g2->duration ? 1 : -1;
+	return strcmp(g1->name, g2->name);
+}
+
+#define CRITICAL_DEFAULT	10
+
+static void
+report_critical_path(const struct timespec *start)
+{
+	GNode *gn, *last = NULL, **v;
+	struct timespec now, d;
+	struct growableArray path;
+	unsigned int i, n = 0, max;
+	long end = 0, wall;
+	const char *s, *errstr;
+
+	s = Var_Value("CRITICAL_PATH");
+	max = strtonum(s, 1, INT_MAX, &errstr);
+	if (errstr != NULL)
+		max = CRITICAL_DEFAULT;
+	clock_gettime(CLOCK_MONOTONIC, &now);
+	timespecsub(&now, start, &d);
+	wall = d.tv_sec * 1000 + d.tv_nsec / 1000000;
+
+	path_times = ereallocarray(NULL, Targ_Count(), sizeof(*path_times));
+	for (i = 0; i < Targ_Count(); i++) {
+		path_times[i].finish = -1;
+		path_times[i].latest = -1;
+		path_times[i].slowest = NULL;
+		path_times[i].busy = false;
+	}
+	Array_Init(&path, 16);
+	v = ereallocarray(NULL, ohash_entries(&targets), sizeof(GNode *));
+	for (gn = ohash_first(&targets, &i); gn != NULL;
+	    gn = ohash_next(&targets, &i)) {
+		if (path_finish(gn, &path) > end || last == NULL) {
+			end = path_times[gn->id].finish;
+			last = gn;
+		}
+		if (gn->duration > 0)
+			v[n++] = gn;
+	}
+	for (gn = ohash_first(&targets, &i); gn != NULL;
+	    gn = ohash_next(&targets, &i))
+		(void)path_latest(gn, end, &path);
+
+	fprintf(stderr, "Critical path: %ld.%03lds with unlimited jobs, "
+	    "%ld.%03lds observed\n",
+	    end / 1000, end % 1000, wall / 1000, wall % 1000);
+	/* walk it down from the end, show it from the start */
+	for (gn = last; gn != NULL; gn = path_times[gn->id].slowest)
+		if (gn->duration > 0)
+			Array_Push(&path, gn);
+	while (path.n > 0) {
+		gn = Array_Pop(&path);
+		fprintf(stderr, "%8ld.%03lds  %s\n", gn->duration / 1000,
+		    gn->duration % 1000, gn->name);
+	}
+	Array_Reset(&path);
+	free(path.a);
+
+	/* then the least slack, which would be next in line */
+	qsort(v, n, sizeof(GNode *), cmp_slack);
+	if (n > 0)
+		fprintf(stderr, "%13s %13s\n", "duration", "slack");
+	for (i = 0; i < n && i < max; i++) {
+		long slack = path_times[v[i]->id].latest -
+		    path_times[v[i]->id].finish;
+
+		fprintf(stderr, "%8ld.%03lds %8ld.%03lds  %s\n",
+		    v[i]->duration / 1000, v[i]->duration % 1000,
+		    slack / 1000, slack % 1000, v[i]->name);
+	}
+	free(v);
+	free(path_times);
+	path_times = NULL;
+}
+
 /* round-about detection: assume make is bug-free, if there are targets
  * that have not been touched, it means they never were reached, so we can
  * look for a cycle
@@ -612,84 +1398,129 @@ targets_contain_cycles(void)
 	return cycle;
 }
 
+/* nodes that still wait on their children are the only ones that can
+ * be part of a cycle */
+static bool
+in_cycle_search(GNode *gn)
+{
+	return gn->built_status != UPTODATE && gn->children_left != 0;
+}
+
+/* path ends with the node that has an edge back to c */
 static void
-print_unlink_cycle(struct growableArray *l, GNode *c)
+print_cycle(struct growableArray *path, GNode *c)
 {
-	LstNode ln;
-	GNode *gn = NULL;
 	unsigned int i;
-	
-	printf("Cycle found: ");
 
-	for (i = 0; i != l->n; i++) {
-		gn = l->a[i];
-		if (gn == c)
+	printf("Cycle found: ");
+	for (i = 0; i != path->n; i++) {
+		if (path->a[i] == c)
 			printf("(");
-		printf("%s -> ", gn->name);
+		printf("%s -> ", path->a[i]->name);
 	}
 	printf("%s)\n", c->name);
-	assert(gn);
-
-	/* So the first element is tied to our node, find and kill the link */
-	for (ln = Lst_First(&gn->children); ln != NULL; ln = Lst_Adv(ln)) {
-		GNode *gn2 = Lst_Datum(ln);
-		if (gn2 == c) {
-			Lst_Remove(&gn->children, ln);
-			return;
-		}
-	}
-	/* this shouldn't happen ever */
-	assert(0);
 }
 
-/* each call to find_cycle records a cycle in cycle, to break at node c.
- * this will stop eventually.
- */
 static void
-break_and_print_cycles(Lst t)
+print_component(struct growableArray *stack, unsigned int first)
 {
-	struct growableArray cycle;
-
-	Array_Init(&cycle, 16); /* cycles are generally shorter */
-	while (1) {
-		GNode *c;
+	unsigned int i;
 
-		Array_Reset(&cycle);
-		c = find_cycle(t, &cycle);
-		if (c)
-			print_unlink_cycle(&cycle, c);
-		else
-			break;
-	}
-	free(cycle.a);
+	printf("Targets depending on each other:");
+	for (i = first; i != stack->n; i++)
+		printf(" %s", stack->a[i]->name);
+	printf("\n");
 }
 
-
-static GNode *
-find_cycle(Lst l, struct growableArray *cycle)
+/* Tarjan's algorithm, walked without recursion, from the nodes in l:
+ * each edge that goes back up the current path closes a cycle and gets
+ * reported.  Cutting all of those would leave no cycle behind.  Each
+ * strongly connected component with more than one node gets listed
+ * once it's complete.  Linear in the size of the graph, but for the
+ * printing.
+ */
+static bool
+report_cycles(Lst l)
 {
+	struct growableArray path, stack;
+	unsigned int *index, *low, *next;
+	unsigned char *on_path, *on_stack;
+	unsigned int count = Targ_Count();
+	size_t sz = (count + CHAR_BIT - 1) / CHAR_BIT;
+	unsigned int n_index = 0;
+	bool found = false;
 	LstNode ln;
 
+	index = ereallocarray(NULL, count, sizeof(unsigned int));
+	memset(index, 0, count * sizeof(unsigned int));
+	low = ereallocarray(NULL, count, sizeof(unsigned int));
+	next = ereallocarray(NULL, count, sizeof(unsigned int));
+	on_path = emalloc(sz);
+	memset(on_path, 0, sz);
+	on_stack = emalloc(sz);
+	memset(on_stack, 0, sz);
+	Array_Init(&path, 16);
+	Array_Init(&stack, 16);
+
 	for (ln = Lst_First(l); ln != NULL; ln = Lst_Adv(ln)) {
 		GNode *gn = Lst_Datum(ln);
-		if (gn->in_cycle) {
-			/* we should print the cycle and not do more */
-			return gn;
-		}
-		
-		if (gn->built_status == UPTODATE)
+
+		if (!in_cycle_search(gn) || index[gn->id] != 0)
 			continue;
-		if (gn->children_left != 0) {
-			GNode *c;
-
-			gn->in_cycle = true;
-			Array_Push(cycle, gn);
-			c = find_cycle(&gn->children, cycle);
-			gn->in_cycle = false;
-			if (c)
-				return c;
-			Array_Pop(cycle);
+		while (gn != NULL) {
+			GNode **v, *c;
+			unsigned int n, first;
+
+			/* first time around: number it and go down */
+			if (index[gn->id] == 0) {
+				index[gn->id] = low[gn->id] = ++n_index;
+				next[gn->id] = 0;
+				Array_Push(&path, gn);
+				BIT_SET(on_path, gn->id);
+				Array_Push(&stack, gn);
+				BIT_SET(on_stack, gn->id);
+			}
+			v = Targ_Children(gn, &n);
+			if (next[gn->id] < n) {
+				c = v[next[gn->id]++];
+				if (!in_cycle_search(c))
+					continue;
+				if (index[c->id] == 0) {
+					gn = c;
+					continue;
+				}
+				if (BIT_ISSET(on_stack, c->id) &&
+				    index[c->id] < low[gn->id])
+					low[gn->id] = index[c->id];
+				if (BIT_ISSET(on_path, c->id)) {
+					print_cycle(&path, c);
+					found = true;
+				}
+				continue;
+			}
+			/* done with gn's children: go back up */
+			Array_Pop(&path);
+			BIT_CLR(on_path, gn->id);
+			if (low[gn->id] == index[gn->id]) {
+				for (first = stack.n; stack.a[--first] != gn;)
+					BIT_CLR(on_stack, stack.a[first]->id);
+				BIT_CLR(on_stack, gn->id);
+				if (stack.n - first > 1)
+					print_component(&stack, first);
+				stack.n = first;
+			}
+			c = gn;
+			gn = Array_IsEmpty(&path) ? NULL : path.a[path.n-1];
+			if (gn != NULL && low[c->id] < low[gn->id])
+				low[gn->id] = low[c->id];
 		}
 	}
-	return NULL;
+	free(path.a);
+	free(stack.a);
+	free(index);
+	free(low);
+	free(next);
+	free(on_path);
+	free(on_stack);
+	return found;
 }
@@ -41,9 +41,34 @@
  */
 
 extern void Make_Update(GNode *);
+/* Make_Failed(node);
+ *	node won't get built after all: let the nodes held back behind it,
+ *	for a pool for instance, try again.
+ */
+extern void Make_Failed(GNode *);
 extern void Make_Run(Lst, bool *, bool *);
 extern void Make_Init(void);
+extern void Make_Reset(void);
+/* nothing = Make_NullBuild(targs);
+ *	with a valid snapshot, the last run for targs had nothing to do,
+ *	and none of what it looked at changed: report the same, without
+ *	even expanding the graph.
+ */
+extern bool Make_NullBuild(Lst);
 extern long random_delay;
 extern bool nothing_left_to_build(void);
 
+/* why = Make_IdleReason();
+ *	-dI: why the scheduler left job slots free, as far as make.c knows.
+ */
+#define IDLE_WAITING	0	/* targets wait for their prerequisites */
+#define IDLE_HELDBACK	1	/* sibling/target groups races */
+#define IDLE_ORDER	2	/* .ORDER or .WAIT predecessors */
+#define IDLE_EXPENSIVE	3	/* an expensive job runs alone */
+#define IDLE_JOBSERVER	4	/* no token */
+#define IDLE_LOAD	5	/* -l, or MIN_FREE_MEMORY */
+#define IDLE_MAIN	6	/* make itself is busy */
+#define IDLE_NUMBER	7
+extern int Make_IdleReason(void);
+
 #endif /* _MAKE_H_ */
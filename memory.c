@@ -35,7 +35,9 @@
  */
 
 #include <sys/types.h>
+#include <sys/resource.h>
 #include <sys/stat.h>
+#include <sys/time.h>
 #include <errno.h>
 #include <stddef.h>
 #include <stdint.h>
@@ -49,13 +51,102 @@
 
 static void enomem(size_t);
 static void enocmem(size_t, size_t);
+static void *xmalloc(size_t);
+static void account(const char *, size_t);
+static int cmp_account(const void *, const void *);
+static void memory_report(void);
 
-/*
- * emalloc --
- *	malloc, but die on error.
- */
-void *
-emalloc(size_t size)
+/* With -dM, we keep track of what each source file allocates.  Since
+ * free doesn't go through us, these are running totals: only the peak
+ * RSS at the end tells how much was in use at once.  */
+struct account {
+	const char *from;
+	unsigned long count;
+	unsigned long long bytes;
+};
+
+#define MAX_ACCOUNTS	128	/* the last one gets whatever's left */
+
+static bool accounting = false;
+static struct account accounts[MAX_ACCOUNTS];
+static unsigned int n_accounts = 0;
+static struct account *last_account = NULL;
+
+#define ACCOUNT(from, size) \
+do {					\
+	if (accounting)			\
+		account(from, size);	\
+} while (0)
+
+static void
+account(const char *from, size_t size)
+{
+	struct account *a = last_account;
+	unsigned int i;
+
+	if (a == NULL || a->from != from) {
+		for (i = 0; i < n_accounts; i++)
+			if (accounts[i].from == from ||
+			    strcmp(accounts[i].from, from) == 0)
+				break;
+		if (i == n_accounts) {
+			if (n_accounts == MAX_ACCOUNTS)
+				accounts[--i].from = "(others)";
+			else {
+				accounts[i].from = from;
+				n_accounts++;
+			}
+		}
+		a = last_account = accounts + i;
+	}
+	a->count++;
+	a->bytes += size;
+}
+
+void
+memory_accounting(void)
+{
+	if (!accounting) {
+		accounting = true;
+		atexit(memory_report);
+	}
+}
+
+static int
+cmp_account(const void *a, const void *b)
+{
+	const struct account *a1 = a;
+	const struct account *a2 = b;
+
+	if (a1->bytes != a2->bytes)
+		return a1->bytes < a2->bytes ? 1 : -1;
+	return strcmp(a1->from, a2->from);
+}
+
+static void
+memory_report(void)
+{
+	struct rusage ru;
+	unsigned long long total = 0;
+	unsigned int i;
+	const char *s;
+
+	qsort(accounts, n_accounts, sizeof(struct account), cmp_account);
+	last_account = NULL;
+	printf("#%9s %14s  %s\n", "allocs", "bytes", "from");
+	for (i = 0; i < n_accounts; i++) {
+		s = strrchr(accounts[i].from, '/');
+		printf("%10lu %14llu  %s\n", accounts[i].count,
+		    accounts[i].bytes, s == NULL ? accounts[i].from : s+1);
+		total += accounts[i].bytes;
+	}
+	printf("%25llu  total\n", total);
+	if (getrusage(RUSAGE_SELF, &ru) == 0)
+		printf("peak RSS %ld KB\n", ru.ru_maxrss);
+}
+
+static void *
+xmalloc(size_t size)
 {
 	void *p;
 
@@ -64,19 +155,31 @@ emalloc(size_t size)
 	return p;
 }
 
+/*
+ * emalloc --
+ *	malloc, but die on error.
+ */
+void *
+emalloc_from(size_t size, const char *from)
+{
+	ACCOUNT(from, size);
+	return xmalloc(size);
+}
+
 /*
  * estrdup --
  *	strdup, but die on error.
  */
 char *
-estrdup(const char *str)
+estrdup_from(const char *str, const char *from)
 {
 	char *p;
 	size_t size;
 
 	size = strlen(str) + 1;
 
-	p = emalloc(size);
+	ACCOUNT(from, size);
+	p = xmalloc(size);
 	memcpy(p, str, size);
 	return p;
 }
@@ -86,16 +189,18 @@ estrdup(const char *str)
  *	realloc, but die on error.
  */
 void *
-erealloc(void *ptr, size_t size)
+erealloc_from(void *ptr, size_t size, const char *from)
 {
+	ACCOUNT(from, size);
 	if ((ptr = realloc(ptr, size)) == NULL)
 		enomem(size);
 	return ptr;
 }
 
 void *
-ereallocarray(void *ptr, size_t s1, size_t s2)
+ereallocarray_from(void *ptr, size_t s1, size_t s2, const char *from)
 {
+	ACCOUNT(from, s1 * s2);
 	if ((ptr = reallocarray(ptr, s1, s2)) == NULL)
 		enocmem(s1, s2);
 	return ptr;
@@ -107,6 +212,7 @@ hash_calloc(size_t n, size_t s, void *u UNUSED)
 {
 	void *p;
 
+	ACCOUNT("(hash tables)", n * s);
 	if ((p = calloc(n, s)) == NULL)
 		enocmem(n, s);
 	return p;
@@ -121,7 +227,91 @@ hash_free(void *p, void *u UNUSED)
 void *
 element_alloc(size_t s, void *u UNUSED)
 {
-	return emalloc(s);
+	ACCOUNT("(hash elements)", s);
+	return xmalloc(s);
+}
+
+/* Objects that live until we exit get carved out of big chunks that are
+ * never freed: no malloc overhead per object, and fewer pages for fork
+ * to copy.  */
+#define REGION_CHUNK	(64 * 1024)
+#define REGION_ALIGN	16	/* enough for anything we allocate */
+
+static char *region_ptr = NULL, *region_end = NULL;
+
+void *
+region_alloc(size_t s)
+{
+	void *p;
+
+	s = (s + REGION_ALIGN - 1) & ~(size_t)(REGION_ALIGN - 1);
+	ACCOUNT("(region)", s);
+	if (s > (size_t)(region_end - region_ptr)) {
+		/* don't waste a whole chunk on big objects */
+		if (s > REGION_CHUNK / 8)
+			return xmalloc(s);
+		region_ptr = xmalloc(REGION_CHUNK);
+		region_end = region_ptr + REGION_CHUNK;
+	}
+	p = region_ptr;
+	region_ptr += s;
+	return p;
+}
+
+void *
+region_element_alloc(size_t s, void *u UNUSED)
+{
+	return region_alloc(s);
+}
+
+/* Pools work the same, but they get thrown away all at once.  Each chunk
+ * starts with a pointer to the previous one.  */
+#define POOL_CHUNK	(16 * 1024)
+
+void *
+pool_alloc(struct pool *pl, size_t s)
+{
+	char *c;
+	void *p;
+
+	s = (s + REGION_ALIGN - 1) & ~(size_t)(REGION_ALIGN - 1);
+	ACCOUNT("(pools)", s);
+	if (s > (size_t)(pl->end - pl->ptr)) {
+		/* big objects get their own chunk, the current one
+		 * stays around */
+		if (s > POOL_CHUNK / 8) {
+			c = xmalloc(REGION_ALIGN + s);
+			*(void **)c = pl->chunks;
+			pl->chunks = c;
+			return c + REGION_ALIGN;
+		}
+		c = xmalloc(POOL_CHUNK);
+		*(void **)c = pl->chunks;
+		pl->chunks = c;
+		pl->ptr = c + REGION_ALIGN;
+		pl->end = c + POOL_CHUNK;
+	}
+	p = pl->ptr;
+	pl->ptr += s;
+	return p;
+}
+
+void
+pool_free_all(struct pool *pl)
+{
+	void *c;
+
+	while ((c = pl->chunks) != NULL) {
+		pl->chunks = *(void **)c;
+		free(c);
+	}
+	pl->ptr = pl->end = NULL;
+}
+
+void *
+pool_element_alloc(size_t s, void *pl)
+{
+	return pool_alloc(pl, s);
 }
 
 
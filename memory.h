@@ -38,10 +38,19 @@
  *
  *	from: @(#)nonints.h	8.3 (Berkeley) 3/19/94
  */
-extern void *emalloc(size_t);
-extern char *estrdup(const char *);
-extern void *erealloc(void *, size_t);
-extern void *ereallocarray(void *, size_t, size_t);
+/* emalloc and friends die on error.  They also tell which file they're
+ * called from, for -dM.  */
+extern void *emalloc_from(size_t, const char *);
+extern char *estrdup_from(const char *, const char *);
+extern void *erealloc_from(void *, size_t, const char *);
+extern void *ereallocarray_from(void *, size_t, size_t, const char *);
+#define emalloc(s)		emalloc_from(s, __FILE__)
+#define estrdup(s)		estrdup_from(s, __FILE__)
+#define erealloc(p, s)		erealloc_from(p, s, __FILE__)
+#define ereallocarray(p, n, s)	ereallocarray_from(p, n, s, __FILE__)
+/* memory_accounting();
+ *	start keeping track of allocations, to show at exit.  */
+extern void memory_accounting(void);
 extern int eunlink(const char *);
 extern void esetenv(const char *, const char *);
 
@@ -49,6 +58,29 @@ extern void *hash_calloc(size_t, size_t, void *);
 extern void hash_free(void *, void *);
 extern void *element_alloc(size_t, void *);
 
+/* p = region_alloc(size);
+ *	allocate memory that will never be freed, such as nodes and
+ *	commands: it's much cheaper than emalloc.  */
+extern void *region_alloc(size_t);
+/* region_element_alloc: the same, for ohash tables whose elements are
+ *	never freed */
+extern void *region_element_alloc(size_t, void *);
+
+/* Elements of a table that all go away at once, such as caches that get
+ * cleared, come from a pool instead.  Start it zeroed out.  */
+struct pool {
+	void *chunks;
+	char *ptr, *end;
+};
+/* p = pool_alloc(pool, size);
+ *	like region_alloc, from pool.  */
+extern void *pool_alloc(struct pool *, size_t);
+/* pool_free_all(pool);
+ *	free everything allocated from pool, which can then be reused.  */
+extern void pool_free_all(struct pool *);
+/* pool_element_alloc: for ohash tables, with the pool as data */
+extern void *pool_element_alloc(size_t, void *);
+
 struct ohash;
 /* free_hash(o): free a ohash structure, where each element can be free'd. */
 extern void free_hash(struct ohash *);
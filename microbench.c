@@ -0,0 +1,343 @@
+/*	$OpenBSD$ */
+/*
+ * Copyright (c) 2026 Marc Espie.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE OPENBSD PROJECT AND CONTRIBUTORS
+ * ``AS IS'' AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ * LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR
+ * A PARTICULAR PURPOSE ARE DISCLAIMED.  IN NO EVENT SHALL THE OPENBSD
+ * PROJECT OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+ * SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT
+ * LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+ * DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+ * THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+ * OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+
+/* Microbenchmarks: time the primitives everything else is built on,
+ * linked against the same objects as make itself.  Each line of output
+ * is a benchmark name and how many operations per second it ran, so that
+ * runs can be compared with diff.
+ *
+ * usage: microbench [-t seconds] [name ...]
+ */
+
+#include <err.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <ohash.h>
+#include "defines.h"
+#include "buf.h"
+#include "cond.h"
+#include "init.h"
+#include "str.h"
+#include "targ.h"
+#include "var.h"
+
+int main(int, char *[]);
+static double now(void);
+static void setup(void);
+static unsigned long bench_match(unsigned long);
+static unsigned long bench_sysv(unsigned long);
+static unsigned long bench_brk_string(unsigned long);
+static unsigned long bench_buf(unsigned long);
+static unsigned long bench_targ(unsigned long);
+static unsigned long bench_var(unsigned long);
+static unsigned long bench_subst(unsigned long);
+static unsigned long bench_cond(unsigned long);
+
+/* each runs n operations, and returns something depending on the
+ * results so that the compiler can't skip the work */
+static struct bench {
+	const char *name;
+	unsigned long (*run)(unsigned long);
+} benches[] = {
+	{ "Str_Matchi", bench_match },
+	{ "Str_SYSVSubst", bench_sysv },
+	{ "brk_string", bench_brk_string },
+	{ "Buf_AddChars", bench_buf },
+	{ "Targ_FindNode", bench_targ },
+	{ "Var_Value", bench_var },
+	{ "Var_Subst", bench_subst },
+	{ "Cond_Eval", bench_cond },
+};
+
+#define NBENCHES	(sizeof(benches) / sizeof(benches[0]))
+
+/* names the way real trees look: long shared prefixes, few suffixes */
+#define NAMES		4096
+static char names[NAMES][40];
+
+static const char *words[] = {
+	"cc -O2 -pipe -c foo.c -o foo.o",
+	"ar cq libfoo.a a.o b.o c.o d.o e.o f.o g.o h.o",
+	"install -c -m 444 'file with spaces' \"${DESTDIR}/usr/share\"",
+	"ln -sf ../lib/libfoo.so.1.0 libfoo.so",
+};
+#define NWORDS		(sizeof(words) / sizeof(words[0]))
+
+static const char *substs[] = {
+	"${CC} ${CFLAGS} ${CPPFLAGS} -c ${SRC} -o ${SRC:.c=.o}",
+	"${SRCS:M*.c:S/^/obj\\//}",
+	"${SRCS:T:R:C/file/lib/}",
+	"${.CURDIR}/${OBJDIR}",
+};
+#define NSUBSTS		(sizeof(substs) / sizeof(substs[0]))
+
+static const char *conds[] = {
+	"if defined(DEBUG) && ${MACHINE} == \"amd64\"",
+	"if !empty(CFLAGS:M-O2)",
+	"ifndef NOMAN",
+	"if make(install) || ${NUM} > 10",
+};
+#define NCONDS		(sizeof(conds) / sizeof(conds[0]))
+
+static double
+now(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+static void
+setup(void)
+{
+	BUFFER buf;
+	unsigned int i;
+
+	Init();
+	Var_Set(".CURDIR", "/usr/src/usr.bin/make");
+	Var_Set("OBJDIR", "obj");
+	Var_Set("MACHINE", "amd64");
+	Var_Set("CC", "cc");
+	Var_Set("CFLAGS", "-O2 -pipe -Wall -W -Wstrict-prototypes");
+	Var_Set("CPPFLAGS", "-I${.CURDIR} -I${.CURDIR}/lst.lib");
+	Var_Set("SRC", "varmodifiers.c");
+	Var_Set("NUM", "12");
+	for (i = 0; i < NAMES; i++) {
+		snprintf(names[i], sizeof names[i], "obj/dir%u/sub%u/file%u.%c",
+		    i % 37, i % 5, i, "cho"[i % 3]);
+		(void)Targ_FindNode(names[i], TARG_CREATE);
+	}
+	/* lots of variables, most with upper case names */
+	for (i = 0; i < NAMES; i++) {
+		char name[32];
+
+		snprintf(name, sizeof name, i % 4 ? "VAR_%u" : "lib%u_SRCS",
+		    i);
+		Var_Set(name, names[i]);
+	}
+	Buf_Init(&buf, 0);
+	for (i = 0; i < 200; i++) {
+		Buf_AddString(&buf, names[i]);
+		Buf_AddSpace(&buf);
+	}
+	Var_Set("SRCS", Buf_Retrieve(&buf));
+	Buf_Destroy(&buf);
+}
+
+static unsigned long
+bench_match(unsigned long n)
+{
+	static const char *patterns[] = {
+		"*.o", "obj/dir1*/*", "*/sub?/file*[0-9].c", "obj/dir3/sub2/*.h"
+	};
+	unsigned long i, r = 0;
+
+	for (i = 0; i < n; i++) {
+		const char *p = patterns[i % 4];
+		const char *s = names[i % NAMES];
+
+		r += Str_Matchi(s, strchr(s, '\0'), p, strchr(p, '\0'));
+	}
+	return r;
+}
+
+static unsigned long
+bench_sysv(unsigned long n)
+{
+	BUFFER buf;
+	unsigned long i, r = 0;
+	size_t len;
+
+	Buf_Init(&buf, 0);
+	for (i = 0; i < n; i++) {
+		const char *m;
+
+		m = Str_SYSVMatch(names[i % NAMES], "obj/%.c", &len);
+		if (m != NULL) {
+			Str_SYSVSubst(&buf, "%.o", m, len);
+			r += Buf_Size(&buf);
+			Buf_Reset(&buf);
+		}
+	}
+	Buf_Destroy(&buf);
+	return r;
+}
+
+static unsigned long
+bench_brk_string(unsigned long n)
+{
+	unsigned long i, r = 0;
+	char **av;
+	int ac;
+
+	for (i = 0; i < n; i++) {
+		av = brk_string(words[i % NWORDS], &ac);
+		r += ac;
+		free(av);
+	}
+	return r;
+}
+
+/* a whole buffer grown from its default size: one operation is one
+ * short string appended */
+#define CHUNKS	4096
+static unsigned long
+bench_buf(unsigned long n)
+{
+	BUFFER buf;
+	unsigned long i, r = 0;
+
+	Buf_Init(&buf, 0);
+	for (i = 0; i < n; i++) {
+		if (i % CHUNKS == 0) {
+			r += Buf_Size(&buf);
+			Buf_Destroy(&buf);
+			Buf_Init(&buf, 0);
+		}
+		Buf_AddChars(&buf, 12, names[i % NAMES]);
+	}
+	Buf_Destroy(&buf);
+	return r;
+}
+
+/* one lookup in eight misses */
+static unsigned long
+bench_targ(unsigned long n)
+{
+	unsigned long i, r = 0;
+
+	for (i = 0; i < n; i++)
+		if (i % 8 == 0)
+			r += Targ_FindNode("obj/dir0/sub0/nosuchfile.o",
+			    TARG_NOCREATE) != NULL;
+		else
+			r += Targ_FindNode(names[(i * 7) % NAMES],
+			    TARG_NOCREATE) != NULL;
+	return r;
+}
+
+static unsigned long
+bench_var(unsigned long n)
+{
+	static const char *common[] = { "CFLAGS", "CC", "SRCS", "NOSUCHVAR" };
+	char name[32];
+	unsigned long i, r = 0;
+
+	for (i = 0; i < n; i++) {
+		const char *v;
+
+		if (i % 2 == 0)
+			v = Var_Value(common[(i / 2) % 4]);
+		else {
+			snprintf(name, sizeof name, "VAR_%lu",
+			    (i * 7) % NAMES | 1);
+			v = Var_Value(name);
+		}
+		r += v != NULL;
+	}
+	return r;
+}
+
+static unsigned long
+bench_subst(unsigned long n)
+{
+	unsigned long i, r = 0;
+	char *s;
+
+	for (i = 0; i < n; i++) {
+		s = Var_Subst(substs[i % NSUBSTS], NULL, false);
+		r += strlen(s);
+		free(s);
+	}
+	return r;
+}
+
+/* one operation is a whole .if/.endif */
+static unsigned long
+bench_cond(unsigned long n)
+{
+	unsigned long i, r = 0;
+
+	for (i = 0; i < n; i++) {
+		r += Cond_Eval(conds[i % NCONDS]);
+		(void)Cond_Eval("endif");
+	}
+	return r;
+}
+
+int
+main(int argc, char *argv[])
+{
+	double mintime = 0.5, start, t;
+	const char *errstr;
+	unsigned long n;
+	unsigned int i;
+	int c, j;
+
+	while ((c = getopt(argc, argv, "t:")) != -1) {
+		switch (c) {
+		case 't':
+			mintime = strtonum(optarg, 1, 60, &errstr);
+			if (errstr != NULL)
+				errx(1, "seconds is %s: %s", errstr, optarg);
+			break;
+		default:
+			fprintf(stderr,
+			    "usage: microbench [-t seconds] [name ...]\n");
+			exit(1);
+		}
+	}
+	argc -= optind;
+	argv += optind;
+
+	setup();
+	for (i = 0; i < NBENCHES; i++) {
+		if (argc != 0) {
+			for (j = 0; j < argc; j++)
+				if (strcmp(argv[j], benches[i].name) == 0)
+					break;
+			if (j == argc)
+				continue;
+		}
+		/* warm up, then double until it takes long enough */
+		(void)benches[i].run(1000);
+		for (n = 1000;; n *= 2) {
+			start = now();
+			(void)benches[i].run(n);
+			t = now() - start;
+			if (t >= mintime)
+				break;
+		}
+		printf("%-20s %14.0f ops/s\n", benches[i].name, n / t);
+	}
+	return 0;
+}
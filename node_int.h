@@ -48,7 +48,9 @@
 #define NODE_PARALLEL	".PARALLEL"
 #define NODE_PATH	".PATH"
 #define NODE_PHONY	".PHONY"
+#define NODE_POOL	".POOL"
 #define NODE_PRECIOUS	".PRECIOUS"
+#define NODE_PRIORITY	".PRIORITY"
 #define NODE_RECURSIVE	".RECURSIVE"
 #define NODE_SILENT	".SILENT"
 #define NODE_SINGLESHELL	".SINGLESHELL"
@@ -61,12 +61,20 @@
  * SUCH DAMAGE.
  */
 
+#include <sys/types.h>
+#include <sys/stat.h>
 #include <assert.h>
 #include <ctype.h>
+#include <fcntl.h>
+#include <limits.h>
+#include <pthread.h>
 #include <stddef.h>
+#include <stdint.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <time.h>
+#include <unistd.h>
 #include <ohash.h>
 #include "config.h"
 #include "defines.h"
@@ -87,6 +95,7 @@
 #include "main.h"
 #include "gnode.h"
 #include "memory.h"
+#include "hash.h"
 #include "extern.h"
 #include "lst.h"
 #include "parsevar.h"
@@ -94,6 +103,9 @@
 #include "garray.h"
 #include "node_int.h"
 #include "nodehashconsts.h"
+#include "trace.h"
+#include "snapshot.h"
+#include "pool.h"
 
 
 /* gsources and gtargets should be local to some functions, but they're
@@ -128,11 +140,16 @@ static int waiting;
  * seen, then set to each successive source on the line.
  */
 static GNode	*predecessor;
+static char	*pool_name;	/* .POOL line we're reading */
+static long long pool_weight;
+static bool	hint_seen;	/* .PRIORITY line we're reading */
+static int	hint;
 
 static void ParseLinkSrc(GNode *, GNode *);
 static int ParseDoOp(GNode **, unsigned int);
 static void ParseDoSpecial(GNode *, unsigned int);
 static int ParseAddDep(GNode *, GNode *);
+static void parse_hint(const char *, const char *);
 static void ParseDoSrc(struct growableArray *, struct growableArray *, int,
     const char *, const char *);
 static int ParseFindMain(void *, void *);
@@ -157,6 +174,12 @@ static bool lookup_bsd_include(const char *);
 static void lookup_sysv_style_include(const char *, const char *, bool);
 static void lookup_sysv_include(const char *, const char *);
 static void lookup_conditional_include(const char *, const char *);
+static char *skip_dep_blanks(char *, const char *);
+static char *parse_dep_line(char *, Location *);
+struct dep_file;
+static bool open_dep_file(const char *, const char *, struct dep_file *);
+static void load_dep_file(struct dep_file *);
+static bool handle_depinclude(const char *);
 static bool parse_as_special_line(Buffer, Buffer, const char *);
 static unsigned int parse_operator(const char **);
 
@@ -204,10 +227,12 @@ static struct {
     { P(NODE_PARALLEL),		SPECIAL_PARALLEL,	0 },
     { P(NODE_PATH),		SPECIAL_PATH,		0 },
     { P(NODE_PHONY),		SPECIAL_PHONY,		OP_PHONY },
+    { P(NODE_POOL),		SPECIAL_POOL,		0 },
     { P(NODE_PRECIOUS),		SPECIAL_PRECIOUS,	OP_PRECIOUS },
+    { P(NODE_PRIORITY),		SPECIAL_PRIORITY,	0 },
     { P(NODE_RECURSIVE),	SPECIAL_MAKE,		OP_MAKE },
     { P(NODE_SILENT),		SPECIAL_SILENT,		OP_SILENT },
-    { P(NODE_SINGLESHELL),	SPECIAL_NOTHING,	0 },
+    { P(NODE_SINGLESHELL),	SPECIAL_SINGLESHELL,	OP_SINGLESHELL },
     { P(NODE_SUFFIXES),		SPECIAL_SUFFIXES,	0 },
     { P(NODE_USE),		SPECIAL_USE,		OP_USE },
     { P(NODE_WAIT),		SPECIAL_WAIT,		0 },
@@ -247,7 +272,7 @@ create_special_nodes()
 static void
 ParseLinkSrc(GNode *pgn, GNode *cgn)
 {
-	if (Lst_AddNew(&pgn->children, cgn)) {
+	if (Targ_AddChild(pgn, cgn)) {
 		if (specType == SPECIAL_NONE)
 			Lst_AtEnd(&cgn->parents, pgn);
 		pgn->children_left++;
@@ -395,6 +420,22 @@ apply_op(struct growableArray *targets, unsigned int op, GNode *gn)
 		Array_ForEach(targets, ParseLinkSrc, gn);
 }
 
+/* .PRIORITY: n target...
+ *	targets with a higher n start first, whatever the critical path
+ *	says, and their children go along, unless they have a hint of
+ *	their own. */
+static void
+parse_hint(const char *src, const char *esrc)
+{
+	char *s = Str_dupi(src, esrc);
+	const char *errstr;
+
+	hint = strtonum(s, -INT_MAX, INT_MAX, &errstr);
+	if (errstr != NULL)
+		Parse_Error(PARSE_FATAL, ".PRIORITY: %s is %s", s, errstr);
+	free(s);
+}
+
 /*-
  *---------------------------------------------------------------------
  * ParseDoSrc  --
@@ -417,7 +458,23 @@ ParseDoSrc(
     const char	*src,	/* name of the source to handle */
     const char *esrc)
 {
-	GNode *gn = Targ_FindNodei(src, esrc, TARG_CREATE);
+	GNode *gn;
+
+	/* .POOL: the first source names the pool, not a node */
+	if (specType == SPECIAL_POOL && pool_name == NULL) {
+		const char *name, *ename;
+
+		Pool_Parse(src, esrc, &name, &ename, &pool_weight);
+		pool_name = Str_dupi(name, ename);
+		return;
+	}
+	/* .PRIORITY: likewise, the first source is the hint */
+	if (specType == SPECIAL_PRIORITY && !hint_seen) {
+		hint_seen = true;
+		parse_hint(src, esrc);
+		return;
+	}
+	gn = Targ_FindNodei(src, esrc, TARG_CREATE);
 	if (gn->special == SPECIAL_DEPRECATED) {
 		Parse_Error(PARSE_FATAL, "Deprecated keyword found %s\n",
 		    gn->name);
@@ -461,6 +518,14 @@ ParseDoSrc(
 		predecessor = gn;
 		break;
 
+	case SPECIAL_POOL:
+		Pool_Add(gn, pool_name, strchr(pool_name, '\0'), pool_weight);
+		return;
+
+	case SPECIAL_PRIORITY:
+		gn->hint = hint;
+		return;
+
 	default:
 		/*
 		 * In the case of a source that was the object of a :: operator,
@@ -558,6 +623,8 @@ add_target_nodes(const char *line, const char *end)
 		LIST emptyPath;
 		LIST curTargs;
 
+		/* we don't know which directories we looked at */
+		Snapshot_Volatile();
 		Lst_Init(&emptyPath);
 		Lst_Init(&curTargs);
 		Dir_Expandi(line, end, &emptyPath, &curTargs);
@@ -756,6 +823,13 @@ handle_special_targets(Lst paths)
 		case SPECIAL_ORDER:
 			predecessor = NULL;
 			break;
+		case SPECIAL_POOL:
+			free(pool_name);
+			pool_name = NULL;
+			break;
+		case SPECIAL_PRIORITY:
+			hint_seen = false;
+			break;
 		default:
 			break;
 		}
@@ -863,7 +937,7 @@ ParseDoDependency(const char *line)	/* the line to parse */
 
 	/* Several special targets have specific semantics with no source:
 	 *	.SUFFIXES 	clears out all old suffixes
-	 *	.PRECIOUS/.IGNORE/.SILENT
+	 *	.PRECIOUS/.IGNORE/.SILENT/.SINGLESHELL
 	 * 			apply to all target
 	 *	.PATH 		clears out all search paths.  */
 	if (!*line) {
@@ -880,6 +954,9 @@ ParseDoDependency(const char *line)	/* the line to parse */
 		case SPECIAL_SILENT:
 			beSilent = true;
 			break;
+		case SPECIAL_SINGLESHELL:
+			singleShell = true;
+			break;
 		case SPECIAL_PATH:
 			Lst_Every(&paths, ParseClearPath);
 			break;
@@ -896,6 +973,8 @@ ParseDoDependency(const char *line)	/* the line to parse */
 	/* NOW GO FOR THE SOURCES */
 	if (specType == SPECIAL_SUFFIXES || specType == SPECIAL_PATH ||
 	    specType == SPECIAL_NOTHING) {
+		if (specType == SPECIAL_PATH)
+			Dir_ReadDirs(line);
 		while (*line) {
 		    /* Some special targets take a list of space-separated
 		     * words.  For each word,
@@ -1049,18 +1128,19 @@ strip_comments(Buffer copy, const char *line)
 	else {
 		Buf_Reset(copy);
 
-		for (p = line; *p != '\0'; p++) {
-			if (*p == '\\') {
-				if (p[1] == '#') {
-					Buf_Addi(copy, line, p);
-					Buf_AddChar(copy, '#');
-					line = p+2;
-				}
-				if (p[1] != '\0')
-					p++;
-			} else if (*p == '#')
+		for (p = line; (p = strpbrk(p, "\\#")) != NULL; p++) {
+			if (*p == '#')
 				break;
+			if (p[1] == '#') {
+				Buf_Addi(copy, line, p);
+				Buf_AddChar(copy, '#');
+				line = p+2;
+			}
+			if (p[1] != '\0')
+				p++;
 		}
+		if (p == NULL)
+			p = strchr(line, '\0');
 		Buf_Addi(copy, line, p);
 		return Buf_Retrieve(copy);
 	}
@@ -1144,6 +1224,8 @@ handle_include_file(const char *file, const char *efile, bool isSystem,
 	if (fullname == NULL && errIfNotFound)
 		Parse_Error(PARSE_FATAL, "Could not find %.*s", 
 		    (int)(efile - file), file);
+	if (fullname == NULL)
+		Snapshot_Probe(file, efile, false);
 
 	if (fullname != NULL) {
 		FILE *f;
@@ -1153,6 +1235,7 @@ handle_include_file(const char *file, const char *efile, bool isSystem,
 			Parse_Error(PARSE_FATAL, "Cannot open %s", fullname);
 		else
 			Parse_FromFile(fullname, f);
+		free(fullname);
 	}
 }
 
@@ -1251,6 +1334,266 @@ lookup_conditional_include(const char *file, const char *directive)
 }
 
 
+/***
+ *** Compiler-generated dependencies
+ ***/
+
+#define READ_MAKEFILES "MAKEFILE_LIST"
+
+/* On simple lines, backslashes can only be continuations */
+static char *
+skip_dep_blanks(char *s, const char *e)
+{
+	while (s < e && (ISSPACE(*s) || *s == '\\'))
+		s++;
+	return s;
+}
+
+/* Handle one logical line of a dependency file, return the next one.
+ * Those are almost always plain "target...: source... \" lines, that
+ * we link directly.  Anything that looks more complicated goes through
+ * the normal parser instead.  */
+static char *
+parse_dep_line(char *p, Location *origin)
+{
+	char *q, *s, *w, *colon = NULL, *next;
+	bool simple = true;
+	bool empty = true;
+	unsigned long lines = 1;
+
+	for (q = p; *q != '\n' && *q != '\0'; q++) {
+		switch (*q) {
+		case '\\':
+			if (q[1] == '\n') {
+				q++;
+				lines++;
+			} else
+				simple = false;
+			continue;
+		case ':':
+			if (colon != NULL || empty)
+				simple = false;
+			colon = q;
+			break;
+		case '.':
+			/* special targets, transforms and directives */
+			if (colon == NULL && (q == p || ISSPACE(q[-1])))
+				simple = false;
+			break;
+		case '$': case '#': case '=': case ';': case '!': case '(':
+		case '*': case '?': case '[': case '{':
+			simple = false;
+			break;
+		default:
+			break;
+		}
+		if (!ISSPACE(*q))
+			empty = false;
+	}
+	next = *q == '\n' ? q+1 : q;
+	origin->lineno++;
+
+	if (empty)
+		;
+	else if (*p == '\t')
+		Parse_Error(PARSE_FATAL, "Commands in dependency file");
+	else if (!simple || colon == NULL ||
+	    (colon+1 != q && !ISSPACE(colon[1]) && colon[1] != '\\')) {
+		static BUFFER buf, copy;
+		bool commands_seen = false;
+		char *line;
+		const char *stripped, *t;
+
+		/* join continuation lines like Parse_ReadNormalLine does */
+		Buf_Reinit(&buf, MAKE_BSIZE);
+		for (s = p; s < q; s++) {
+			if (*s == '\\' && s[1] == '\n') {
+				Buf_AddSpace(&buf);
+				for (s += 2; s < q && ISSPACE(*s) &&
+				    *s != '\n'; s++)
+					continue;
+				s--;
+			} else
+				Buf_AddChar(&buf, *s);
+		}
+		line = Buf_Retrieve(&buf);
+		Buf_Reinit(&copy, MAKE_BSIZE);
+		stripped = strip_comments(&copy, line);
+		for (t = stripped; ISSPACE(*t); t++)
+			continue;
+		if (*t != '\0' && !Parse_As_Var_Assignment(stripped)) {
+			parse_target_line(&gtargets, line, stripped,
+			    &commands_seen);
+			if (commands_seen)
+				finish_commands(&gtargets);
+		}
+	} else {
+		Array_Reset(&gtargets);
+		Array_Reset(&gsources);
+		specType = SPECIAL_NONE;
+		waiting = 0;
+		for (s = skip_dep_blanks(p, colon); s < colon;
+		    s = skip_dep_blanks(w, colon)) {
+			GNode *gn;
+
+			for (w = s; w < colon && !ISSPACE(*w) && *w != '\\';)
+				w++;
+			gn = Targ_FindNodei(s, w, TARG_CREATE);
+			gn->type &= ~OP_DUMMY;
+			Array_AtEnd(&gtargets, gn);
+		}
+		Array_FindP(&gtargets, ParseDoOp, OP_DEPENDS);
+		dedup_targets(&gtargets);
+		for (s = skip_dep_blanks(colon+1, q); s < q;
+		    s = skip_dep_blanks(w, q)) {
+			for (w = s; w < q && !ISSPACE(*w) && *w != '\\';)
+				w++;
+			ParseDoSrc(&gtargets, &gsources, 0, s, w);
+		}
+		if (mainNode == NULL)
+			Array_Find(&gtargets, ParseFindMain, NULL);
+	}
+	origin->lineno += lines - 1;
+	return next;
+}
+
+/* Dependency files are opened DEP_BATCH at a time, and read from threads
+ * while nothing else happens, then parsed in order.  */
+#define DEP_BATCH	32
+#define DEP_THREADS_MIN	4
+
+struct dep_file {
+	char *fullname;
+	int fd;
+	char *buf;		/* contents, NULL if we couldn't read them */
+};
+
+static struct dep_file *deps_todo;
+static unsigned int deps_n, deps_next;
+static pthread_mutex_t deps_lock = PTHREAD_MUTEX_INITIALIZER;
+
+static bool
+open_dep_file(const char *file, const char *efile, struct dep_file *d)
+{
+	d->fullname = resolve_include_filename(file, efile, false);
+	if (d->fullname == NULL) {
+		Snapshot_Probe(file, efile, false);
+		return false;
+	}
+	d->fd = open(d->fullname, O_RDONLY);
+	if (d->fd == -1) {
+		free(d->fullname);
+		return false;
+	}
+	return true;
+}
+
+/* the whole file at once: there's nothing to push on the stack */
+static void
+read_dep_file(struct dep_file *d)
+{
+	struct stat st;
+	ssize_t n;
+
+	d->buf = NULL;
+	if (fstat(d->fd, &st) == 0 && S_ISREG(st.st_mode) &&
+	    st.st_size < SSIZE_MAX &&
+	    (d->buf = malloc(st.st_size + 1)) != NULL) {
+		n = read(d->fd, d->buf, st.st_size);
+		if (n == st.st_size)
+			d->buf[n] = '\0';
+		else {
+			free(d->buf);
+			d->buf = NULL;
+		}
+	}
+	close(d->fd);
+}
+
+static void *
+dep_worker(void *arg UNUSED)
+{
+	unsigned int i;
+
+	for (;;) {
+		pthread_mutex_lock(&deps_lock);
+		i = deps_next++;
+		pthread_mutex_unlock(&deps_lock);
+		if (i >= deps_n)
+			break;
+		read_dep_file(&deps_todo[i]);
+	}
+	return NULL;
+}
+
+static void
+read_dep_files(struct dep_file *batch, unsigned int n)
+{
+	deps_todo = batch;
+	deps_n = n;
+	deps_next = 0;
+	if (n >= DEP_THREADS_MIN)
+		Dir_RunWorkers(dep_worker);
+	else
+		(void)dep_worker(NULL);
+}
+
+static void
+load_dep_file(struct dep_file *d)
+{
+	char *fullname = d->fullname;
+	char *p;
+	Location origin;
+
+	if (d->buf == NULL) {
+		Parse_Error(PARSE_FATAL, "Cannot read %s", fullname);
+		free(fullname);
+		return;
+	}
+	Var_Append(READ_MAKEFILES, fullname);
+
+	origin.fname = Str_Intern(fullname);
+	origin.lineno = 0;
+	Parse_SetLocation(&origin);
+	for (p = d->buf; *p != '\0';)
+		p = parse_dep_line(p, &origin);
+	Parse_SetLocation(NULL);
+	free(d->buf);
+	free(fullname);
+}
+
+/* .depinclude file...
+ *	read dependency files written by the compiler.  Missing files are
+ *	ignored, since they only appear after the first build. */
+static bool
+handle_depinclude(const char *line)
+{
+	char *files, *name, *ename;
+	struct dep_file batch[DEP_BATCH];
+	unsigned int i, n;
+
+	files = Var_Subst(line, NULL, false);
+	name = files;
+	do {
+		for (n = 0; n < DEP_BATCH; name = ename) {
+			while (ISSPACE(*name))
+				name++;
+			if (*name == '\0')
+				break;
+			for (ename = name; *ename != '\0' && !ISSPACE(*ename);)
+				ename++;
+			if (open_dep_file(name, ename, &batch[n]))
+				n++;
+		}
+		read_dep_files(batch, n);
+		for (i = 0; i < n; i++)
+			load_dep_file(&batch[i]);
+	} while (*name != '\0');
+	free(files);
+	return true;
+}
+
+
 /***
  ***   BSD-specific . constructs
  ***   They all follow the same pattern:
@@ -1392,6 +1735,8 @@ handle_bsd_command(Buffer linebuf, Buffer copy, const char *line)
 		return handle_for_loop(linebuf, line + 3);
 	case COND_ISINCLUDE:
 		return lookup_bsd_include(line + 7);
+	case COND_ISDEPINCLUDE:
+		return handle_depinclude(line + 10);
 	case COND_ISPOISON:
 		return handle_poison(line + 6);
 	case COND_ISUNDEF:
@@ -1412,7 +1757,7 @@ register_target(GNode *gn, struct ohash *t)
 	const char *ename = NULL;
 	GNode *gn2;
 
-	hv = ohash_interval(gn->name, &ename);
+	hv = hash_interval(gn->name, &ename);
 
 	slot = ohash_lookup_interval(t, gn->name, ename, hv);
 	gn2 = ohash_find(t, slot);
@@ -1536,9 +1881,11 @@ parse_commands(struct growableArray *targets, const char *line)
 	struct command *cmd;
 	size_t len = strlen(line);
 
-	cmd = emalloc(sizeof(struct command) + len);
+	cmd = region_alloc(sizeof(struct command) + len);
 	memcpy(&cmd->string, line, len+1);
 	Parse_FillLocation(&cmd->location);
+	cmd->compiled = NULL;
+	cmd->cost = COST_UNKNOWN;
 
 	Array_ForEach(targets, ParseAddCmd, cmd);
 }
@@ -1626,6 +1973,8 @@ Parse_File(const char *filename, FILE *stream)
 	char *line;
 	bool expectingCommands = false;
 	bool commands_seen = false;
+	struct timespec start;
+	Location origin;
 
 	/* permanent spaces to shave time */
 	static BUFFER buf;
@@ -1634,9 +1983,15 @@ Parse_File(const char *filename, FILE *stream)
 	Buf_Reinit(&buf, MAKE_BSIZE);
 	Buf_Reinit(&copy, MAKE_BSIZE);
 
+	trace_begin("parse", filename);
 	Parse_FromFile(filename, stream);
 	do {
+		if (DEBUG(PARSEPROF))
+			clock_gettime(CLOCK_MONOTONIC, &start);
 		while ((line = Parse_ReadNormalLine(&buf)) != NULL) {
+			/* handling may switch to an included file */
+			if (DEBUG(PARSEPROF))
+				Parse_FillLocation(&origin);
 			if (*line == '\t') {
 				if (expectingCommands) {
 					commands_seen = true;
@@ -1663,6 +2018,10 @@ Parse_File(const char *filename, FILE *stream)
 					}
 				}
 			}
+			if (DEBUG(PARSEPROF)) {
+				Parse_ProfileLine(&origin, &start);
+				clock_gettime(CLOCK_MONOTONIC, &start);
+			}
 		}
 	} while (Parse_NextFile());
 
@@ -1670,6 +2029,7 @@ Parse_File(const char *filename, FILE *stream)
 		finish_commands(&gtargets);
 	/* Make sure conditionals are clean.  */
 	Cond_End();
+	trace_end();
 
 	Parse_ReportErrors();
 }
@@ -1698,3 +2058,15 @@ Parse_MainName(Lst listmain)	/* result list */
 	else
 		Lst_AtEnd(listmain, mainNode);
 }
+
+void
+Parse_Save(Snapshot *s)
+{
+	snap_put_node(s, mainNode);
+}
+
+void
+Parse_Restore(Snapshot *s)
+{
+	mainNode = snap_get_node(s);
+}
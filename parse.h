@@ -51,4 +51,11 @@ extern void Parse_AddIncludeDir(const char *);
  *	target exists. */
 extern void Parse_MainName(Lst);
 
+/* Parse_Save(snapshot);
+ *	Save what's left of the parser state for Parse_MainName. */
+extern void Parse_Save(Snapshot *);
+/* Parse_Restore(snapshot);
+ *	And get it back. */
+extern void Parse_Restore(Snapshot *);
+
 #endif
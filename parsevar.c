@@ -50,6 +50,8 @@ find_op1(const char *p)
 			break;
 		if (p[strspn(p, "?:!+")] == '=')
 			break;
+		if (p[0] == '!' && p[1] == '&' && p[2] == '=')
+			break;
 		if (p[0] == ':' && p[1] == 's' && p[2] == 'h')
 			break;
 	}
@@ -64,6 +66,8 @@ find_op2(const char *p)
 			break;
 		if (p[strspn(p, "?:!+")] == '=')
 			break;
+		if (p[0] == '!' && p[1] == '&' && p[2] == '=')
+			break;
 	}
 	return p;
 }
@@ -81,6 +85,7 @@ parse_variable_assignment(const char *line, int ctxt)
 #define VAR_OPT		8
 #define VAR_LAZYSHELL	16
 #define VAR_SUNSHELL	32
+#define VAR_ASYNCSHELL	64
 	int type;
 	struct Name name;
 
@@ -95,6 +100,7 @@ parse_variable_assignment(const char *line, int ctxt)
 	/* double operators (except for :) are forbidden */
 	/* OPT and APPEND don't match */
 	/* APPEND and LAZYSHELL can't really work */
+	/* ASYNCSHELL doesn't mix with APPEND or SUBST either */
 	while (*arg != '=') {
 		/* Check operator type.  */
 		switch (*arg++) {
@@ -133,12 +139,21 @@ parse_variable_assignment(const char *line, int ctxt)
 					type = VAR_INVALID;
 				else
 					type = VAR_LAZYSHELL;
-			} else if (type & (VAR_LAZYSHELL|VAR_SUNSHELL))
+			} else if (type &
+			    (VAR_LAZYSHELL|VAR_SUNSHELL|VAR_ASYNCSHELL))
 				type = VAR_INVALID;
 			else
 				type |= VAR_SHELL;
 			break;
 
+		case '&':
+			if ((type & VAR_SHELL) && *arg == '=' &&
+			    (type & (VAR_APPEND|VAR_SUBST)) == 0)
+				type = (type & ~VAR_SHELL) | VAR_ASYNCSHELL;
+			else
+				type = VAR_INVALID;
+			break;
+
 		default:
 			type = VAR_INVALID;
 			break;
@@ -174,11 +189,11 @@ parse_variable_assignment(const char *line, int ctxt)
 			Parse_Error(PARSE_WARNING, err, arg);
 		arg = res1;
 	}
-	if (type & VAR_LAZYSHELL) {
+	if (type & (VAR_LAZYSHELL|VAR_ASYNCSHELL)) {
 		if (strchr(arg, '$') != NULL) {
 			/* There's a dollar sign in the command, so perform
 			 * variable expansion on the whole thing. */
-			arg = Var_Subst(arg, NULL, true);
+			arg = res1 = Var_Subst(arg, NULL, true);
 		}
 	}
 	if (type & VAR_SUBST) {
@@ -214,6 +229,8 @@ parse_variable_assignment(const char *line, int ctxt)
 		Var_Seti_with_ctxt(name.s, name.e, arg, ctxt);
 	if (type & VAR_LAZYSHELL)
 		Var_Mark(name.s, name.e, VAR_EXEC_LATER);
+	if (type & VAR_ASYNCSHELL)
+		Var_Mark(name.s, name.e, VAR_EXEC_PENDING);
 
 	VarName_Free(&name);
 	free(res2);
@@ -0,0 +1,230 @@
+/*	$OpenBSD$ */
+/*
+ * Copyright (c) 2026 Marc Espie.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE OPENBSD PROJECT AND CONTRIBUTORS
+ * ``AS IS'' AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ * LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR
+ * A PARTICULAR PURPOSE ARE DISCLAIMED.  IN NO EVENT SHALL THE OPENBSD
+ * PROJECT OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+ * SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT
+ * LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+ * DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+ * THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+ * OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include <ctype.h>
+#include <limits.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <ohash.h>
+#include "config.h"
+#include "defines.h"
+#include "pool.h"
+#include "gnode.h"
+#include "error.h"
+#include "garray.h"
+#include "memory.h"
+#include "hash.h"
+#include "str.h"
+#include "var.h"
+
+struct resource_pool {
+	long long capacity;	/* -1 until we ask POOL.name */
+	long long used;
+	struct growableArray running;	/* the nodes using it */
+	char name[1];
+};
+
+static struct ohash_info pool_info = {
+	offsetof(struct resource_pool, name), NULL, hash_calloc, hash_free,
+	element_alloc
+};
+
+static struct ohash pools;
+static bool pools_init = false;
+
+static long long parse_amount(const char *, const char *, const char *);
+static long long capacity(struct resource_pool *);
+static bool fits(struct pool_use *);
+
+/* a number, with a K, M, G or T suffix */
+static long long
+parse_amount(const char *s, const char *e, const char *what)
+{
+	long long n = 0;
+	const char *p;
+	int shift = 0;
+
+	for (p = s; p != e && isdigit((unsigned char)*p); p++) {
+		if (n > (LLONG_MAX - 9) / 10)
+			Fatal("%s: %.*s is too large", what, (int)(e - s), s);
+		n = n * 10 + (*p - '0');
+	}
+	if (p != s && p != e) {
+		switch (toupper((unsigned char)*p++)) {
+		case 'K':
+			shift = 10;
+			break;
+		case 'M':
+			shift = 20;
+			break;
+		case 'G':
+			shift = 30;
+			break;
+		case 'T':
+			shift = 40;
+			break;
+		default:
+			p = s;
+			break;
+		}
+		/* 64G or 64GB */
+		if (p != s && p != e && toupper((unsigned char)*p) == 'B')
+			p++;
+	}
+	if (p == s || p != e)
+		Fatal("%s: bad amount %.*s", what, (int)(e - s), s);
+	if (n > LLONG_MAX >> shift)
+		Fatal("%s: %.*s is too large", what, (int)(e - s), s);
+	return n << shift;
+}
+
+void
+Pool_Parse(const char *spec, const char *espec, const char **name,
+    const char **ename, long long *weight)
+{
+	const char *at;
+
+	*name = spec;
+	at = memchr(spec, '@', espec - spec);
+	if (at == NULL) {
+		*ename = espec;
+		*weight = 1;
+	} else {
+		*ename = at;
+		*weight = parse_amount(at+1, espec, ".POOL");
+	}
+	if (*ename == *name)
+		Fatal(".POOL: no pool name in %.*s", (int)(espec - spec), spec);
+}
+
+void
+Pool_Add(GNode *gn, const char *name, const char *ename, long long weight)
+{
+	struct resource_pool *p;
+	struct pool_use *u;
+	unsigned int slot;
+
+	if (!pools_init) {
+		ohash_init(&pools, 4, &pool_info);
+		pools_init = true;
+	}
+	slot = hash_qlookupi(&pools, name, &ename);
+	p = ohash_find(&pools, slot);
+	if (p == NULL) {
+		p = ohash_create_entry(&pool_info, name, &ename);
+		p->capacity = -1;
+		p->used = 0;
+		Array_Init(&p->running, 4);
+		ohash_insert(&pools, slot, p);
+	}
+	/* the last .POOL line wins */
+	for (u = gn->pools; u != NULL; u = u->next)
+		if (u->pool == p) {
+			u->weight = weight;
+			return;
+		}
+	u = emalloc(sizeof(struct pool_use));
+	u->pool = p;
+	u->weight = weight;
+	u->next = gn->pools;
+	gn->pools = u;
+}
+
+const char *
+Pool_Name(struct resource_pool *p)
+{
+	return p->name;
+}
+
+static long long
+capacity(struct resource_pool *p)
+{
+	char *var;
+	const char *v;
+
+	if (p->capacity == -1) {
+		var = Str_concat("POOL", p->name, '.');
+		v = Var_Value(var);
+		if (v == NULL)
+			Fatal("pool %s: %s is not set", p->name, var);
+		p->capacity = parse_amount(v, strchr(v, '\0'), var);
+		free(var);
+	}
+	return p->capacity;
+}
+
+/* nothing else running in the pool: anything goes, so that a target
+ * heavier than the whole pool still builds */
+static bool
+fits(struct pool_use *u)
+{
+	long long c = capacity(u->pool);
+
+	return u->pool->used == 0 || u->pool->used + u->weight <= c;
+}
+
+GNode *
+Pool_Busy(GNode *gn)
+{
+	struct pool_use *u;
+
+	for (u = gn->pools; u != NULL; u = u->next)
+		if (!fits(u))
+			return u->pool->running.a[0];
+	return NULL;
+}
+
+void
+Pool_Take(GNode *gn)
+{
+	struct pool_use *u;
+
+	for (u = gn->pools; u != NULL; u = u->next) {
+		u->pool->used += u->weight;
+		Array_Push(&u->pool->running, gn);
+	}
+}
+
+void
+Pool_Release(GNode *gn)
+{
+	struct pool_use *u;
+	struct growableArray *r;
+	unsigned int i;
+
+	for (u = gn->pools; u != NULL; u = u->next) {
+		r = &u->pool->running;
+		for (i = 0; i < r->n; i++)
+			if (r->a[i] == gn) {
+				r->a[i] = r->a[--r->n];
+				u->pool->used -= u->weight;
+				break;
+			}
+	}
+}
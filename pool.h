@@ -0,0 +1,70 @@
+#ifndef POOL_H
+#define POOL_H
+/*	$OpenBSD$ */
+
+/*
+ * Copyright (c) 2026 Marc Espie.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE OPENBSD PROJECT AND CONTRIBUTORS
+ * ``AS IS'' AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ * LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR
+ * A PARTICULAR PURPOSE ARE DISCLAIMED.  IN NO EVENT SHALL THE OPENBSD
+ * PROJECT OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+ * SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT
+ * LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+ * DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+ * THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+ * OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+/* Resource pools: POOL.name sets the capacity of pool name, a number
+ * with an optional K, M, G or T suffix, and
+ *	.POOL: name[@weight] target...
+ * makes each target take weight (1 by default) from that pool while it
+ * builds.  A target only starts if all its pools have room for it, or
+ * if nothing else is using them.
+ */
+
+struct resource_pool;
+struct pool_use {
+	struct resource_pool *pool;
+	long long weight;
+	struct pool_use *next;
+};
+
+/* Pool_Parse(spec, espec, &name, &ename, &weight);
+ *	split a .POOL spec, to be used for the following targets. */
+extern void Pool_Parse(const char *, const char *, const char **,
+    const char **, long long *);
+
+/* Pool_Add(gn, name, ename, weight);
+ *	gn takes weight from pool name. */
+extern void Pool_Add(GNode *, const char *, const char *, long long);
+
+/* name = Pool_Name(p); */
+extern const char *Pool_Name(struct resource_pool *);
+
+/* gn2 = Pool_Busy(gn);
+ *	a node using a pool gn doesn't fit in, so that gn can wait for it,
+ *	or NULL if gn can start. */
+extern GNode *Pool_Busy(GNode *);
+
+/* Pool_Take(gn);
+ *	gn starts: take its share of its pools. */
+extern void Pool_Take(GNode *);
+
+/* Pool_Release(gn);
+ *	gn is done: give it back. */
+extern void Pool_Release(GNode *);
+
+#endif
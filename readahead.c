@@ -0,0 +1,183 @@
+/*	$OpenBSD$ */
+/*
+ * Copyright (c) 2026 Marc Espie.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE OPENBSD PROJECT AND CONTRIBUTORS
+ * ``AS IS'' AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ * LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR
+ * A PARTICULAR PURPOSE ARE DISCLAIMED.  IN NO EVENT SHALL THE OPENBSD
+ * PROJECT OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+ * SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT
+ * LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+ * DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+ * THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+ * OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <limits.h>
+#include <pthread.h>
+#include <signal.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include "config.h"
+#include "defines.h"
+#include "readahead.h"
+#include "gnode.h"
+#include "lst.h"
+#include "var.h"
+#include "memory.h"
+
+#define READAHEAD_DEFAULT	256	/* megabytes, if it's not a number */
+
+/* the names still to read: queue[next..n-1], under lock */
+static char **queue;
+static unsigned int next, n, size;
+static bool stopping;
+static bool exhausted;		/* no budget left, set by the reader */
+static off_t budget;		/* only for the reader */
+static pthread_mutex_t lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t more = PTHREAD_COND_INITIALIZER;
+static pthread_t reader;
+static bool running = false;
+
+static void *readahead_worker(void *);
+static void warm(const char *);
+
+static void
+warm(const char *name)
+{
+	struct stat st;
+	off_t len;
+	int fd;
+
+	/* O_NONBLOCK: a fifo must not hang us */
+	fd = open(name, O_RDONLY | O_NONBLOCK | O_CLOEXEC);
+	if (fd == -1)
+		return;
+	if (fstat(fd, &st) == 0 && S_ISREG(st.st_mode)) {
+		len = st.st_size < budget ? st.st_size : budget;
+#ifdef POSIX_FADV_WILLNEED
+		(void)posix_fadvise(fd, 0, len, POSIX_FADV_WILLNEED);
+#endif
+		budget -= len;
+	}
+	close(fd);
+}
+
+static void *
+readahead_worker(void *arg UNUSED)
+{
+	char *name;
+
+	pthread_mutex_lock(&lock);
+	for (;;) {
+		while (next == n && !stopping)
+			pthread_cond_wait(&more, &lock);
+		if (stopping)
+			break;
+		name = queue[next++];
+		pthread_mutex_unlock(&lock);
+		warm(name);
+		free(name);
+		pthread_mutex_lock(&lock);
+		if (budget == 0) {
+			exhausted = true;
+			break;
+		}
+	}
+	pthread_mutex_unlock(&lock);
+	return NULL;
+}
+
+void
+Readahead_Init(void)
+{
+	const char *s = Var_Value("READAHEAD");
+	const char *errstr;
+	sigset_t all, old;
+	long long mb;
+
+	if (s == NULL || running)
+		return;
+	mb = strtonum(s, 1, INT_MAX, &errstr);
+	if (errstr != NULL)
+		mb = READAHEAD_DEFAULT;
+	budget = mb << 20;
+	next = n = 0;
+	stopping = false;
+	exhausted = false;
+	/* signals are for the main thread */
+	sigfillset(&all);
+	pthread_sigmask(SIG_SETMASK, &all, &old);
+	running = pthread_create(&reader, NULL, readahead_worker, NULL) == 0;
+	pthread_sigmask(SIG_SETMASK, &old, NULL);
+}
+
+void
+Readahead_Node(GNode *gn)
+{
+	LstNode ln;
+	bool added = false;
+
+	if (!running)
+		return;
+	pthread_mutex_lock(&lock);
+	if (exhausted) {
+		pthread_mutex_unlock(&lock);
+		return;
+	}
+	/* the reader is done with what's before next */
+	if (next == n)
+		next = n = 0;
+	for (ln = Lst_First(&gn->children); ln != NULL; ln = Lst_Adv(ln)) {
+		GNode *child = Lst_Datum(ln);
+
+		if (child->readahead || !should_have_file(child))
+			continue;
+		child->readahead = true;
+		if (n == size) {
+			size = size == 0 ? 64 : size * 2;
+			queue = ereallocarray(queue, size, sizeof(char *));
+		}
+		queue[n++] = estrdup(child->path != NULL ? child->path :
+		    child->name);
+		added = true;
+	}
+	if (added)
+		pthread_cond_signal(&more);
+	pthread_mutex_unlock(&lock);
+}
+
+void
+Readahead_End(void)
+{
+	if (!running)
+		return;
+	pthread_mutex_lock(&lock);
+	stopping = true;
+	pthread_cond_signal(&more);
+	pthread_mutex_unlock(&lock);
+	pthread_join(reader, NULL);
+	running = false;
+	while (next < n)
+		free(queue[next++]);
+	free(queue);
+	queue = NULL;
+	next = n = size = 0;
+}
@@ -29,11 +29,21 @@
 
 /* regression tests */
 #include <stdio.h>
+#include <stdlib.h>
 #include <string.h>
+#include <time.h>
+#include "config.h"
 #include "defines.h"
+#include "init.h"
 #include "str.h"
+#include "var.h"
+#include "buf.h"
 
 int main(void);
+static bool glob_match(const char *, const char *);
+static unsigned long throughput(const char *, bool);
+static bool subst_is(const char *, const char *);
+static bool globals_are(const char *, const char *);
 #define CHECK(s)		\
 do {				\
     printf("%-65s", #s);	\
@@ -45,10 +55,85 @@ do {				\
     }				\
 } while (0);
 
+static bool
+glob_match(const char *s, const char *p)
+{
+    struct Glob *g;
+    bool r;
+
+    g = Str_CompileGlob(p);
+    r = Str_GlobMatch(g, s);
+    Str_FreeGlob(g);
+    return r;
+}
+
+static bool
+subst_is(const char *s, const char *expected)
+{
+    char *r;
+    bool ok;
+
+    r = Var_Subst(s, NULL, false);
+    ok = strcmp(r, expected) == 0;
+    free(r);
+    return ok;
+}
+
+/* what a command looks like before locals get expanded, NULL if too hard */
+static bool
+globals_are(const char *s, const char *expected)
+{
+    struct SubstTemplate *t = NULL;
+    BUFFER buf;
+    bool ok;
+
+    free(Var_SubstCompiled(s, &t, NULL, false));
+    Buf_Init(&buf, 0);
+    if (Var_SubstGlobals(t, &buf, '#'))
+	ok = expected != NULL && strcmp(Buf_Retrieve(&buf), expected) == 0;
+    else
+	ok = expected == NULL;
+    Buf_Destroy(&buf);
+    return ok;
+}
+
+/* run a pattern over a synthetic file list, and say how fast it went */
+#define WORDS	1000
+#define ROUNDS	1000
+static unsigned long
+throughput(const char *p, bool compiled)
+{
+    static char words[WORDS][32];
+    struct Glob *g;
+    unsigned long n = 0;
+    clock_t start;
+    int i, j;
+
+    for (i = 0; i < WORDS; i++)
+	snprintf(words[i], sizeof words[i], "dir%d/sub/file%d.%c", i % 50, i,
+	    "cho"[i % 3]);
+    g = Str_CompileGlob(p);
+    start = clock();
+    for (j = 0; j < ROUNDS; j++)
+	for (i = 0; i < WORDS; i++)
+	    if (compiled ? Str_GlobMatch(g, words[i]) :
+		Str_Match(words[i], p))
+		n++;
+    printf("%-20s %-12s %8.0f matches/ms\n", p,
+	compiled ? "compiled" : "interpreted",
+	(double)WORDS * ROUNDS /
+	((double)(clock() - start + 1) * 1000 / CLOCKS_PER_SEC));
+    Str_FreeGlob(g);
+    return n;
+}
+
 int
 main(void)
 {
     unsigned int errors = 0;
+    const char *patterns[] = { "*.c", "dir1*", "*/sub/*1?.[ch]" };
+    unsigned long matched, expected;
+    size_t i;
 
     CHECK(Str_Match("string", "string") == true);
     CHECK(Str_Match("string", "string2") == false);
@@ -70,6 +155,68 @@ main(void)
     CHECK(Str_Match("d-0", "d[a\\-z]0") == true);
     CHECK(Str_Match("dz0", "d[a\\]z]0") == true);
 
+    CHECK(glob_match("string", "string") == true);
+    CHECK(glob_match("string", "string2") == false);
+    CHECK(glob_match("string", "string*") == true);
+    CHECK(glob_match("Long string", "Lo*ng") == true);
+    CHECK(glob_match("Long string", "Lo*ng ") == false);
+    CHECK(glob_match("Long string", "Lo*ng *") == true);
+    CHECK(glob_match("string", "stri?g") == true);
+    CHECK(glob_match("str?ng", "str\\?ng") == true);
+    CHECK(glob_match("striiiing", "str?*ng") == true);
+    CHECK(glob_match("Very long string just to see", "******a****") == false);
+    CHECK(glob_match("d[abc?", "d\\[abc\\?") == true);
+    CHECK(glob_match("d[abc!", "d\\[abc\\?") == false);
+    CHECK(glob_match("dwabc?", "d\\[abc\\?") == false);
+    CHECK(glob_match("da0", "d[bcda]0") == true);
+    CHECK(glob_match("da0", "d[z-a]0") == true);
+    CHECK(glob_match("d-0", "d[-a-z]0") == true);
+    CHECK(glob_match("dy0", "d[a\\-z]0") == false);
+    CHECK(glob_match("d-0", "d[a\\-z]0") == true);
+    CHECK(glob_match("dz0", "d[a\\]z]0") == true);
+    CHECK(glob_match("a/b/c.c", "*.c") == true);
+    CHECK(glob_match(".c", "*.c") == true);
+    CHECK(glob_match("c", "*.c") == false);
+    CHECK(glob_match("abcabd", "*ab?") == true);
+    CHECK(glob_match("abcabd", "a*b*c*d") == true);
+    CHECK(glob_match("abcabd", "a*b*c*e") == false);
+    CHECK(glob_match("mississippi", "*sip*") == true);
+    CHECK(glob_match("mississippi", "m*iss*ppi") == true);
+    CHECK(glob_match("db0", "d[!a]0") == true);
+    CHECK(glob_match("da0", "d[^a]0") == false);
+    CHECK(glob_match("string", "string\\") == false);
+    CHECK(glob_match("", "*") == true);
+    CHECK(glob_match("", "?*") == false);
+
+    for (i = 0; i < sizeof(patterns)/sizeof(patterns[0]); i++) {
+	expected = throughput(patterns[i], false);
+	matched = throughput(patterns[i], true);
+	CHECK(matched == expected);
+    }
+
+    Init();
+    Var_Set("A", "ab cd ef");
+    Var_Set("B", "ab ab cd cd ef");
+    if (FEATURES(FEATURE_UNIQ)) {
+	CHECK(subst_is("${B:u}", "ab cd ef"));
+	/* :S and :u share a buffer between words */
+	CHECK(subst_is("${A:S/x/x/:u}", "ab cd ef"));
+	CHECK(subst_is("${B:S/x/x/:u}", "ab cd ef"));
+	Var_Set("C", "ab cd ab ef cd");
+	CHECK(subst_is("${C:ua}", "ab cd ef"));
+	CHECK(subst_is("${C:S/x/x/:ua}", "ab cd ef"));
+    }
+    if (FEATURES(FEATURE_SORT))
+	CHECK(subst_is("${C:Ou}", "ab cd ef"));
+
+    Var_Set("CC", "cc");
+    Var_Set("LINK", "${CC} -o");
+    Var_Set("OUT", "-o $@");
+    CHECK(globals_are("${LINK} $@ $<", "cc -o # #"));
+    CHECK(globals_are("${CC} ${OUT}", NULL));
+    CHECK(globals_are("${CC:S/c/d/} $@", NULL));
+    CHECK(globals_are("${NOPE} $@", NULL));
+
     if (errors != 0)
 	printf("Errors: %d\n", errors);
     return 0;
@@ -0,0 +1,171 @@
+/*	$OpenBSD$ */
+/*
+ * Copyright (c) 2026 Marc Espie.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE OPENBSD PROJECT AND CONTRIBUTORS
+ * ``AS IS'' AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ * LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR
+ * A PARTICULAR PURPOSE ARE DISCLAIMED.  IN NO EVENT SHALL THE OPENBSD
+ * PROJECT OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+ * SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT
+ * LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+ * DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+ * THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+ * OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+
+#include <limits.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include "config.h"
+#include "defines.h"
+#include "engine.h"
+#include "remote.h"
+#include "job.h"
+#include "gnode.h"
+#include "var.h"
+#include "str.h"
+#include "buf.h"
+#include "memory.h"
+#include "error.h"
+
+static char **hosts;
+static int nhosts = 0;
+static int per_host = 1;	/* REMOTE_JOBS */
+static int *load;		/* jobs running on each host */
+static int in_use = 0;		/* on all of them */
+static const char *remote_shell;
+static const char *objdir;
+
+static pid_t remote_start(Job *, const char *, bool, int);
+static const char *remote_kill(Job *, int);
+
+const struct executor remote_executor = {
+	"remote", remote_start, remote_kill
+};
+
+void
+Remote_Init(void)
+{
+	const char *s;
+	int n;
+
+	s = Var_Value("REMOTE_HOSTS");
+	if (s == NULL || *s == '\0')
+		return;
+	hosts = brk_string(s, &n);
+	nhosts = n;
+	if (nhosts == 0)
+		return;
+	if ((s = Var_Value("REMOTE_JOBS")) != NULL) {
+		const char *errstr;
+
+		per_host = strtonum(s, 1, INT_MAX / nhosts, &errstr);
+		if (errstr != NULL)
+			Punt("REMOTE_JOBS is %s: %s", errstr, s);
+	}
+	s = Var_Value("REMOTE_SHELL");
+	remote_shell = estrdup(s == NULL || *s == '\0' ? "ssh" : s);
+	objdir = estrdup(Var_Value(".OBJDIR"));
+	load = ereallocarray(NULL, nhosts, sizeof(int));
+	memset(load, 0, nhosts * sizeof(int));
+}
+
+int
+Remote_Slots(void)
+{
+	return nhosts * per_host;
+}
+
+bool
+Remote_Take(Job *job)
+{
+	int i, best = -1;
+
+	if (job->node->type & (OP_MAKE | OP_EXPENSIVE))
+		return false;
+	/* spread jobs over the hosts */
+	for (i = 0; i < nhosts; i++)
+		if (load[i] < per_host && (best == -1 || load[i] < load[best]))
+			best = i;
+	if (best == -1)
+		return false;
+	load[best]++;
+	in_use++;
+	job->host = best;
+	job->executor = &remote_executor;
+	return true;
+}
+
+void
+Remote_Release(Job *job)
+{
+	if (job->executor != &remote_executor)
+		return;
+	load[job->host]--;
+	in_use--;
+	job->executor = &local_executor;
+}
+
+int
+Remote_InUse(void)
+{
+	return in_use;
+}
+
+/* REMOTE_SHELL host 'cd objdir && exec sh -ec cmd', with cmd quoted once
+ * for the remote shell and the whole script once for ours */
+static pid_t
+remote_start(Job *job, const char *cmd, bool errCheck, int ofd)
+{
+	BUFFER script, buf;
+	pid_t pid;
+
+	/* expensive commands, found by looking at them, stay here, and
+	 * the host is free for something else */
+	if (expensive_job(job)) {
+		Remote_Release(job);
+		return local_executor.start(job, cmd, errCheck, ofd);
+	}
+	Buf_Init(&script, 0);
+	Buf_AddString(&script, "cd ");
+	add_quoted(&script, objdir);
+	Buf_AddString(&script, errCheck ? " && exec sh -ec " :
+	    " && exec sh -c ");
+	add_quoted(&script, cmd);
+	Buf_Init(&buf, 0);
+	Buf_AddString(&buf, remote_shell);
+	Buf_AddChar(&buf, ' ');
+	Buf_AddString(&buf, hosts[job->host]);
+	Buf_AddChar(&buf, ' ');
+	add_quoted(&buf, Buf_Retrieve(&script));
+	debug_job_printf("Sending %s to %s\n", job->node->name,
+	    hosts[job->host]);
+	pid = local_executor.start(job, Buf_Retrieve(&buf), true, ofd);
+	Buf_Destroy(&script);
+	Buf_Destroy(&buf);
+	/* the caller forks cmd right here instead */
+	if (pid == -1)
+		Remote_Release(job);
+	return pid;
+}
+
+/* the proxy passes it on, or loses the connection */
+static const char *
+remote_kill(Job *job, int signo)
+{
+	return local_executor.kill(job, signo);
+}
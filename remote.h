@@ -0,0 +1,61 @@
+#ifndef REMOTE_H
+#define REMOTE_H
+/*	$OpenBSD$ */
+
+/*
+ * Copyright (c) 2026 Marc Espie.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE OPENBSD PROJECT AND CONTRIBUTORS
+ * ``AS IS'' AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ * LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR
+ * A PARTICULAR PURPOSE ARE DISCLAIMED.  IN NO EVENT SHALL THE OPENBSD
+ * PROJECT OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+ * SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT
+ * LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+ * DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+ * THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+ * OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+/* Remote execution: once all -j local slots are busy, cheap jobs may run
+ * on the hosts listed in REMOTE_HOSTS, REMOTE_JOBS at a time on each,
+ * through REMOTE_SHELL (ssh by default).  Hosts must see the same files
+ * at the same place: commands run in .OBJDIR there, with the remote
+ * user's environment.
+ * Recursive makes and .EXPENSIVE targets always run locally.
+ */
+
+/* Remote_Init();
+ *	read the remote variables. */
+extern void Remote_Init(void);
+
+/* n = Remote_Slots();
+ *	how many jobs may run remotely at once. */
+extern int Remote_Slots(void);
+
+/* ok = Remote_Take(job);
+ *	give job a remote host, if there's one free and job may run
+ *	there. */
+extern bool Remote_Take(Job *);
+
+/* Remote_Release(job);
+ *	job is done with its host, or runs locally after all. */
+extern void Remote_Release(Job *);
+
+/* n = Remote_InUse();
+ *	how many jobs hold a remote host. */
+extern int Remote_InUse(void);
+
+extern const struct executor remote_executor;
+
+#endif
@@ -0,0 +1,290 @@
+/*	$OpenBSD$ */
+/*
+ * Copyright (c) 2026 Marc Espie.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE OPENBSD PROJECT AND CONTRIBUTORS
+ * ``AS IS'' AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ * LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR
+ * A PARTICULAR PURPOSE ARE DISCLAIMED.  IN NO EVENT SHALL THE OPENBSD
+ * PROJECT OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+ * SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT
+ * LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+ * DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+ * THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+ * OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include <stddef.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <ohash.h>
+#include "config.h"
+#include "defines.h"
+#include "schedule.h"
+#include "gnode.h"
+#include "targ.h"
+#include "var.h"
+#include "str.h"
+#include "memory.h"
+#include "hash.h"
+#include "error.h"
+
+#define SCHED_EXPENSIVE	0x1
+#define SCHED_HELDBACK	0x2
+
+struct sched_entry {
+	long wall;
+	unsigned int flags;
+	bool done;		/* recorded, or replayed */
+	GNode *gn;
+	struct sched_entry *next;	/* in the order they finished */
+	char name[1];
+};
+
+static struct ohash_info sched_info = {
+	offsetof(struct sched_entry, name), NULL,
+	hash_calloc, hash_free, element_alloc
+};
+
+bool simulate = false;
+
+/* recording */
+static struct ohash recorded;
+static char *schedule_file = NULL;
+static pid_t schedule_pid;
+static struct sched_entry *first, **last = &first;
+
+/* replaying */
+static struct ohash trace;
+static long now = 0;		/* virtual clock, in ms */
+static long busy = 0;		/* sum of what we started */
+static unsigned int started = 0;
+
+static struct sched_entry *lookup(struct ohash *, const char *, bool);
+static void read_trace(FILE *);
+static void Schedule_End(void);
+static void Replay_End(void);
+
+static struct sched_entry *
+lookup(struct ohash *h, const char *name, bool create)
+{
+	struct sched_entry *e;
+	unsigned int slot;
+	const char *ename = NULL;
+
+	slot = hash_qlookupi(h, name, &ename);
+	e = ohash_find(h, slot);
+	if (e == NULL && create) {
+		e = ohash_create_entry(&sched_info, name, &ename);
+		e->wall = 0;
+		e->flags = 0;
+		e->done = false;
+		e->gn = NULL;
+		e->next = NULL;
+		ohash_insert(h, slot, e);
+	}
+	return e;
+}
+
+void
+Schedule_Init(void)
+{
+	const char *s;
+
+	s = Var_Value("BUILD_SCHEDULE");
+	if (s == NULL || *s == '\0')
+		return;
+	schedule_file = estrdup(s);
+	schedule_pid = getpid();
+	ohash_init(&recorded, 8, &sched_info);
+	atexit(Schedule_End);
+}
+
+void
+Schedule_Note(GNode *gn, int flag)
+{
+	struct sched_entry *e;
+
+	if (schedule_file == NULL)
+		return;
+	e = lookup(&recorded, gn->name, true);
+	e->flags |= flag == 'e' ? SCHED_EXPENSIVE : SCHED_HELDBACK;
+}
+
+void
+Schedule_Record(GNode *gn, long wall)
+{
+	struct sched_entry *e;
+
+	if (schedule_file == NULL)
+		return;
+	e = lookup(&recorded, gn->name, true);
+	e->wall = wall;
+	e->gn = gn;
+	if (!e->done) {
+		e->done = true;
+		*last = e;
+		last = &e->next;
+	}
+}
+
+static void
+Schedule_End(void)
+{
+	struct sched_entry *e;
+	GNode **v;
+	unsigned int i, n;
+	char *tmp;
+	FILE *f;
+
+	/* forked children don't own the trace */
+	if (getpid() != schedule_pid)
+		return;
+	tmp = Str_concat(schedule_file, ".tmp", 0);
+	f = fopen(tmp, "w");
+	if (f == NULL) {
+		free(tmp);
+		return;
+	}
+	for (e = first; e != NULL; e = e->next) {
+		fprintf(f, "%s %ld %s%s%s", e->name, e->wall,
+		    e->flags & SCHED_EXPENSIVE ? "e" : "",
+		    e->flags & SCHED_HELDBACK ? "h" : "",
+		    e->flags == 0 ? "-" : "");
+		v = Targ_Children(e->gn, &n);
+		for (i = 0; i < n; i++)
+			fprintf(f, " %s", v[i]->name);
+		fputc('\n', f);
+	}
+	if (fclose(f) == 0)
+		(void)rename(tmp, schedule_file);
+	else
+		(void)unlink(tmp);
+	free(tmp);
+}
+
+/* the children are for other tools: replay goes by the makefiles' graph,
+ * which knows about .ORDER, .WAIT and groups as well */
+static void
+read_trace(FILE *f)
+{
+	char *line, *copy, *p;
+	char flags[8];
+	size_t len;
+	long wall;
+	int n;
+
+	while ((line = fgetln(f, &len)) != NULL) {
+		struct sched_entry *e;
+
+		copy = emalloc(len+1);
+		memcpy(copy, line, len);
+		if (len > 0 && copy[len-1] == '\n')
+			len--;
+		copy[len] = '\0';
+		p = strchr(copy, ' ');
+		if (p != NULL && p != copy) {
+			*p++ = '\0';
+			if (sscanf(p, "%ld %7s%n", &wall, flags, &n) == 2 &&
+			    wall >= 0) {
+				e = lookup(&trace, copy, true);
+				e->wall = wall;
+				e->flags = 0;
+				if (strchr(flags, 'e') != NULL)
+					e->flags |= SCHED_EXPENSIVE;
+				if (strchr(flags, 'h') != NULL)
+					e->flags |= SCHED_HELDBACK;
+			}
+		}
+		free(copy);
+	}
+}
+
+void
+Schedule_Replay(const char *name)
+{
+	FILE *f;
+
+	f = fopen(name, "r");
+	if (f == NULL)
+		Fatal("Can't read schedule trace %s", name);
+	ohash_init(&trace, 8, &sched_info);
+	read_trace(f);
+	fclose(f);
+	simulate = true;
+	atexit(Replay_End);
+}
+
+bool
+Schedule_OODate(GNode *gn)
+{
+	return lookup(&trace, gn->name, false) != NULL;
+}
+
+long
+Schedule_Duration(GNode *gn)
+{
+	struct sched_entry *e;
+
+	if (!simulate)
+		return -1;
+	e = lookup(&trace, gn->name, false);
+	return e == NULL ? -1 : e->wall;
+}
+
+long
+Schedule_Start(GNode *gn, bool *expensive)
+{
+	struct sched_entry *e;
+
+	e = lookup(&trace, gn->name, true);
+	e->done = true;
+	if (DEBUG(JOB))
+		printf("%ld.%03ld: %s for %ld.%03lds\n", now / 1000, now % 1000,
+		    gn->name, e->wall / 1000, e->wall % 1000);
+	*expensive = (e->flags & SCHED_EXPENSIVE) != 0;
+	busy += e->wall;
+	started++;
+	return now + e->wall;
+}
+
+void
+Schedule_Advance(long t)
+{
+	now = t;
+}
+
+static void
+Replay_End(void)
+{
+	struct sched_entry *e;
+	unsigned int i, missed = 0;
+	long left = 0;
+
+	for (e = ohash_first(&trace, &i); e != NULL;
+	    e = ohash_next(&trace, &i)) {
+		if (!e->done) {
+			missed++;
+			left += e->wall;
+		}
+	}
+	printf("Simulated %u jobs in %ld.%03lds, %ld.%03lds of work, "
+	    "parallelism %.2f\n", started, now / 1000, now % 1000,
+	    busy / 1000, busy % 1000, now == 0 ? 0.0 : (double)busy / now);
+	if (missed != 0)
+		printf("%u of %u targets of the trace not built (%ld.%03lds "
+		    "in the trace)\n", missed, ohash_entries(&trace),
+		    left / 1000, left % 1000);
+}
@@ -0,0 +1,79 @@
+#ifndef SCHEDULE_H
+#define SCHEDULE_H
+/*	$OpenBSD$ */
+
+/*
+ * Copyright (c) 2026 Marc Espie.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE OPENBSD PROJECT AND CONTRIBUTORS
+ * ``AS IS'' AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ * LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR
+ * A PARTICULAR PURPOSE ARE DISCLAIMED.  IN NO EVENT SHALL THE OPENBSD
+ * PROJECT OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+ * SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT
+ * LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+ * DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+ * THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+ * OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+/* Schedule traces: what a build did, in a form that can be replayed.
+ * BUILD_SCHEDULE names a file where make writes, at exit, one line per
+ * target it built, in the order they finished:
+ *	name wall flags child ...
+ * wall is in milliseconds, flags has e for an expensive job, h for a
+ * target that got held back, or is - for neither.
+ *
+ * make -R trace replays such a trace against the graph of the current
+ * makefiles: targets in the trace are out of date and take as long as
+ * they did, the rest is up to date, and the parallel engine schedules
+ * them on a virtual clock, without running any command.
+ */
+
+/* Are we replaying a trace ? */
+extern bool simulate;
+
+/* Schedule_Init();
+ *	start recording, if BUILD_SCHEDULE is set.  The trace is written
+ *	at exit. */
+extern void Schedule_Init(void);
+
+/* Schedule_Note(gn, flag);
+ *	gn was an expensive job ('e') or held back ('h'). */
+extern void Schedule_Note(GNode *, int);
+
+/* Schedule_Record(gn, wall);
+ *	gn was just built, in that many ms. */
+extern void Schedule_Record(GNode *, long);
+
+/* Schedule_Replay(trace);
+ *	read trace for -R, and show the simulated schedule at exit. */
+extern void Schedule_Replay(const char *);
+
+/* Schedule_OODate(gn);
+ *	-R: was gn rebuilt in the trace ? */
+extern bool Schedule_OODate(GNode *);
+
+/* wall = Schedule_Duration(gn);
+ *	-R: how long gn took in the trace, or -1 if it's not there. */
+extern long Schedule_Duration(GNode *);
+
+/* end = Schedule_Start(gn, &expensive);
+ *	-R: start gn on the virtual clock, return when it will be done. */
+extern long Schedule_Start(GNode *, bool *);
+
+/* Schedule_Advance(t);
+ *	-R: the virtual clock is now at t. */
+extern void Schedule_Advance(long);
+
+#endif
@@ -0,0 +1,213 @@
+/*	$OpenBSD$ */
+/*
+ * Copyright (c) 2026 Marc Espie.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE OPENBSD PROJECT AND CONTRIBUTORS
+ * ``AS IS'' AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ * LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR
+ * A PARTICULAR PURPOSE ARE DISCLAIMED.  IN NO EVENT SHALL THE OPENBSD
+ * PROJECT OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+ * SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT
+ * LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+ * DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+ * THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+ * OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+
+#include <sha2.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <ohash.h>
+#include "config.h"
+#include "defines.h"
+#include "signature.h"
+#include "gnode.h"
+#include "lst.h"
+#include "var.h"
+#include "str.h"
+#include "memory.h"
+#include "hash.h"
+#include "extern.h"
+
+/* The signature file has one line per target:
+ *	digest target
+ */
+
+struct signature {
+	char digest[SHA256_DIGEST_STRING_LENGTH];
+	char name[1];
+};
+
+static struct ohash_info sig_info = {
+	offsetof(struct signature, name), NULL,
+	hash_calloc, hash_free, element_alloc
+};
+
+static struct ohash signatures;
+static char *sig_file = NULL;
+static pid_t sig_pid;
+static bool dirty = false;
+
+static struct signature *lookup(const char *);
+static bool commands_digest(GNode *, char *);
+static void read_signatures(FILE *);
+static void Signature_End(void);
+
+static struct signature *
+lookup(const char *name)
+{
+	struct signature *s;
+	unsigned int slot;
+	const char *end = NULL;
+
+	slot = hash_qlookupi(&signatures, name, &end);
+	s = ohash_find(&signatures, slot);
+	if (s == NULL) {
+		s = ohash_create_entry(&sig_info, name, &end);
+		s->digest[0] = '\0';
+		ohash_insert(&signatures, slot, s);
+	}
+	return s;
+}
+
+static bool
+commands_digest(GNode *gn, char *digest)
+{
+	SHA256_CTX ctx;
+	LstNode ln;
+	char *s;
+
+	if (Lst_IsEmpty(&gn->commands))
+		return false;
+	SHA256Init(&ctx);
+	for (ln = Lst_First(&gn->commands); ln != NULL; ln = Lst_Adv(ln)) {
+		struct command *cmd = Lst_Datum(ln);
+
+		/* no context: local variables stay as they are, and
+		 * shell commands wait for the actual build */
+		s = Var_SubstNoExec(cmd->string, NULL, NULL);
+		SHA256Update(&ctx, (const u_int8_t *)s, strlen(s) + 1);
+		free(s);
+	}
+	SHA256End(&ctx, digest);
+	return true;
+}
+
+static void
+read_signatures(FILE *f)
+{
+	char *line, *copy;
+	size_t len;
+	char d[SHA256_DIGEST_STRING_LENGTH];
+	int n;
+
+	while ((line = fgetln(f, &len)) != NULL) {
+		copy = emalloc(len+1);
+		memcpy(copy, line, len);
+		if (len > 0 && copy[len-1] == '\n')
+			len--;
+		copy[len] = '\0';
+		if (sscanf(copy, "%64s %n", d, &n) == 1 && copy[n] != '\0')
+			strlcpy(lookup(copy + n)->digest, d,
+			    SHA256_DIGEST_STRING_LENGTH);
+		free(copy);
+	}
+}
+
+void
+Signature_Init(void)
+{
+	const char *s;
+	FILE *f;
+
+	s = Var_Value("COMMAND_SIGNATURES");
+	if (s == NULL || *s == '\0')
+		return;
+	sig_file = estrdup(s);
+	sig_pid = getpid();
+	ohash_init(&signatures, 8, &sig_info);
+	f = fopen(sig_file, "r");
+	if (f != NULL) {
+		read_signatures(f);
+		fclose(f);
+	}
+	atexit(Signature_End);
+}
+
+bool
+Signature_Changed(GNode *gn)
+{
+	struct signature *s;
+	char d[SHA256_DIGEST_STRING_LENGTH];
+
+	if (sig_file == NULL || !commands_digest(gn, d))
+		return false;
+	s = lookup(gn->name);
+	/* assume whatever is there came from these commands */
+	if (s->digest[0] == '\0') {
+		if (!noExecute) {
+			strlcpy(s->digest, d, sizeof s->digest);
+			dirty = true;
+		}
+		return false;
+	}
+	return strcmp(s->digest, d) != 0;
+}
+
+void
+Signature_Done(GNode *gn)
+{
+	struct signature *s;
+	char d[SHA256_DIGEST_STRING_LENGTH];
+
+	if (sig_file == NULL || noExecute || !commands_digest(gn, d))
+		return;
+	s = lookup(gn->name);
+	if (strcmp(s->digest, d) != 0) {
+		strlcpy(s->digest, d, sizeof s->digest);
+		dirty = true;
+	}
+}
+
+static void
+Signature_End(void)
+{
+	struct signature *s;
+	unsigned int i;
+	char *tmp;
+	FILE *f;
+
+	/* forked children that exit() don't get a say */
+	if (getpid() != sig_pid || !dirty)
+		return;
+	tmp = Str_concat(sig_file, ".tmp", 0);
+	f = fopen(tmp, "w");
+	if (f == NULL) {
+		free(tmp);
+		return;
+	}
+	for (s = ohash_first(&signatures, &i); s != NULL;
+	    s = ohash_next(&signatures, &i))
+		if (s->digest[0] != '\0')
+			fprintf(f, "%s %s\n", s->digest, s->name);
+	if (fclose(f) == 0)
+		(void)rename(tmp, sig_file);
+	else
+		(void)unlink(tmp);
+	free(tmp);
+}
@@ -0,0 +1,52 @@
+#ifndef SIGNATURE_H
+#define SIGNATURE_H
+/*	$OpenBSD$ */
+
+/*
+ * Copyright (c) 2026 Marc Espie.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE OPENBSD PROJECT AND CONTRIBUTORS
+ * ``AS IS'' AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ * LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR
+ * A PARTICULAR PURPOSE ARE DISCLAIMED.  IN NO EVENT SHALL THE OPENBSD
+ * PROJECT OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+ * SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT
+ * LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+ * DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+ * THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+ * OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+/* Command signatures: with COMMAND_SIGNATURES set, make keeps a digest
+ * of the commands of each target it builds in the file it names, and a
+ * target whose commands changed since is out of date, for instance
+ * after changing CFLAGS.
+ * Commands are expanded for the signature, except for local variables
+ * such as $@ or $?, which don't say anything about the recipe.
+ */
+
+/* Signature_Init();
+ *	read the signature file, if COMMAND_SIGNATURES is set.  It will be
+ *	written back at exit. */
+extern void Signature_Init(void);
+
+/* changed = Signature_Changed(gn);
+ *	true if gn was last built with other commands.  A target we know
+ *	nothing about gets its current signature. */
+extern bool Signature_Changed(GNode *);
+
+/* Signature_Done(gn);
+ *	gn was just built with its current commands. */
+extern void Signature_Done(GNode *);
+
+#endif
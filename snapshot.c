@@ -0,0 +1,958 @@
+/*	$OpenBSD$ */
+/*
+ * Copyright (c) 2026 Marc Espie.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE OPENBSD PROJECT AND CONTRIBUTORS
+ * ``AS IS'' AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ * LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR
+ * A PARTICULAR PURPOSE ARE DISCLAIMED.  IN NO EVENT SHALL THE OPENBSD
+ * PROJECT OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+ * SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT
+ * LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+ * DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+ * THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+ * OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <limits.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <ohash.h>
+#include "config.h"
+#include "defines.h"
+#include "snapshot.h"
+#include "buf.h"
+#include "dir.h"
+#include "error.h"
+#include "gnode.h"
+#include "lst.h"
+#include "main.h"
+#include "memory.h"
+#include "hash.h"
+#include "parse.h"
+#include "str.h"
+#include "suff.h"
+#include "targ.h"
+#include "timestamp.h"
+#include "var.h"
+#include "pool.h"
+
+/* The snapshot file is
+ *	magic checksum key dependencies state
+ * where key is checked byte for byte against what we compute before
+ * parsing, dependencies are checked one by one, and state is handed
+ * back to each module.  Numbers are stored 7 bits at a time.
+ * Strings read back stay in memory for the whole run, so that
+ * locations can point right into them.
+ */
+
+#define SNAPSHOT_MAGIC	"make snapshot 3\n"
+
+struct Snapshot_ {
+	BUFFER buf;		/* where we write */
+	const char *p;		/* where we read */
+	const char *end;
+	bool bad;		/* ran off the end, or unknown node */
+};
+
+/* pointers we number while saving: nodes, commands */
+struct ptr_number {
+	const void *ptr;
+	unsigned long n;
+};
+
+static struct ohash_info number_info = {
+	offsetof(struct ptr_number, ptr), NULL, hash_calloc, hash_free,
+	element_alloc
+};
+
+struct probe {
+	bool found;
+	char name[1];
+};
+
+static struct ohash_info probe_info = {
+	offsetof(struct probe, name), NULL, hash_calloc, hash_free,
+	element_alloc
+};
+
+#define NODE_TARGET	0
+#define NODE_TRANSFORM	1
+#define NODE_COHORT	2
+
+static char *snapshot_file = NULL;	/* NULL if not in use */
+static bool recording = false;		/* between Load and Save */
+static bool volatile_parse = false;
+static Snapshot key;			/* computed before parsing */
+static struct ohash probes;
+static bool snapshot_valid = false;	/* the parse is the snapshot's */
+static uint32_t snapshot_sum;		/* which identifies it */
+
+static struct ohash node_numbers;	/* while saving */
+static GNode **nodes;			/* by number */
+static unsigned char *kinds;		/* while saving */
+static unsigned long nnodes;
+
+static struct ptr_number *number(struct ohash *, const void *, bool);
+static void add_node(GNode *, int);
+static void add_nodes(struct ohash *, int);
+static void save_nodes(Snapshot *);
+static void restore_nodes(Snapshot *);
+static void save_node(Snapshot *, GNode *, struct ohash *);
+static void restore_node(Snapshot *, GNode *, struct command **,
+    unsigned long);
+static void save_files(Snapshot *);
+static bool check_files(Snapshot *);
+static void save_probes(Snapshot *);
+static bool check_probes(Snapshot *);
+static void compute_key(int, char **);
+static uint32_t checksum(const char *, const char *);
+static char *read_file(const char *, size_t *);
+static void write_file(const char *, uint32_t, Buffer);
+static char *read_snapshot(const char *, Snapshot *, uint32_t *);
+static char *null_build_file(void);
+static unsigned long list_length(Lst);
+
+void
+snap_put_int(Snapshot *s, unsigned long n)
+{
+	while (n >= 0x80) {
+		Buf_AddChar(&s->buf, (n & 0x7f) | 0x80);
+		n >>= 7;
+	}
+	Buf_AddChar(&s->buf, n);
+}
+
+void
+snap_put_string(Snapshot *s, const char *str)
+{
+	size_t len;
+
+	if (str == NULL) {
+		snap_put_int(s, 0);
+		return;
+	}
+	len = strlen(str);
+	snap_put_int(s, len+1);
+	Buf_AddChars(&s->buf, len+1, str);
+}
+
+void
+snap_put_node(Snapshot *s, GNode *gn)
+{
+	struct ptr_number *e;
+
+	if (gn == NULL) {
+		snap_put_int(s, 0);
+		return;
+	}
+	e = number(&node_numbers, gn, false);
+	if (e == NULL) {
+		s->bad = true;
+		snap_put_int(s, 0);
+	} else
+		snap_put_int(s, e->n+1);
+}
+
+void
+snap_put_list(Snapshot *s, Lst l)
+{
+	LstNode ln;
+	unsigned long n = 0;
+
+	for (ln = Lst_First(l); ln != NULL; ln = Lst_Adv(ln))
+		n++;
+	snap_put_int(s, n);
+	for (ln = Lst_First(l); ln != NULL; ln = Lst_Adv(ln))
+		snap_put_node(s, Lst_Datum(ln));
+}
+
+void
+snap_put_path(Snapshot *s, Lst l)
+{
+	LstNode ln;
+	unsigned long n = 0;
+
+	for (ln = Lst_First(l); ln != NULL; ln = Lst_Adv(ln))
+		n++;
+	snap_put_int(s, n);
+	for (ln = Lst_First(l); ln != NULL; ln = Lst_Adv(ln))
+		snap_put_string(s, PathEntry_name(Lst_Datum(ln)));
+}
+
+unsigned long
+snap_get_int(Snapshot *s)
+{
+	unsigned long n = 0;
+	unsigned int shift = 0;
+	unsigned char c;
+
+	do {
+		if (s->p == s->end || shift >= sizeof(n) * 8) {
+			s->bad = true;
+			return 0;
+		}
+		c = *s->p++;
+		n |= (unsigned long)(c & 0x7f) << shift;
+		shift += 7;
+	} while (c & 0x80);
+	return n;
+}
+
+const char *
+snap_get_string(Snapshot *s)
+{
+	unsigned long len;
+	const char *str;
+
+	len = snap_get_int(s);
+	if (len == 0)
+		return NULL;
+	if ((unsigned long)(s->end - s->p) < len || s->p[len-1] != '\0') {
+		s->bad = true;
+		return "";
+	}
+	str = s->p;
+	s->p += len;
+	return str;
+}
+
+GNode *
+snap_get_node(Snapshot *s)
+{
+	unsigned long n;
+
+	n = snap_get_int(s);
+	if (n == 0)
+		return NULL;
+	if (n > nnodes) {
+		s->bad = true;
+		return NULL;
+	}
+	return nodes[n-1];
+}
+
+void
+snap_get_list(Snapshot *s, Lst l)
+{
+	unsigned long n;
+	GNode *gn;
+
+	for (n = snap_get_int(s); n > 0; n--) {
+		gn = snap_get_node(s);
+		if (gn != NULL)
+			Lst_AtEnd(l, gn);
+	}
+}
+
+void
+snap_get_path(Snapshot *s, Lst l)
+{
+	unsigned long n;
+	const char *name;
+
+	for (n = snap_get_int(s); n > 0; n--) {
+		name = snap_get_string(s);
+		if (name != NULL && *name != '\0')
+			Dir_AddDir(l, name);
+	}
+}
+
+static struct ptr_number *
+number(struct ohash *h, const void *ptr, bool create)
+{
+	struct ptr_number *e;
+	unsigned int slot;
+
+	slot = hash_lookup_memory(h, &ptr, sizeof(ptr));
+	e = ohash_find(h, slot);
+	if (e == NULL && create) {
+		e = emalloc(sizeof(*e));
+		e->ptr = ptr;
+		e->n = ohash_entries(h);
+		ohash_insert(h, slot, e);
+	}
+	return e;
+}
+
+/* Nodes come from three places: the targets hash, the transforms hash,
+ * and the cohorts of :: targets, which live in no hash at all.  */
+static void
+add_node(GNode *gn, int kind)
+{
+	static unsigned long nalloc = 0;
+
+	if (number(&node_numbers, gn, false) != NULL)
+		return;
+	(void)number(&node_numbers, gn, true);
+	if (nnodes == nalloc) {
+		nalloc = nalloc == 0 ? 1024 : nalloc * 2;
+		nodes = ereallocarray(nodes, nalloc, sizeof(*nodes));
+		kinds = ereallocarray(kinds, nalloc, sizeof(*kinds));
+	}
+	kinds[nnodes] = kind;
+	nodes[nnodes++] = gn;
+}
+
+static void
+add_nodes(struct ohash *h, int kind)
+{
+	GNode *gn;
+	unsigned int i;
+
+	for (gn = ohash_first(h, &i); gn != NULL; gn = ohash_next(h, &i))
+		add_node(gn, kind);
+}
+
+static void
+save_node(Snapshot *s, GNode *gn, struct ohash *commands)
+{
+	LstNode ln;
+	struct pool_use *u;
+	unsigned long n = 0;
+
+	snap_put_int(s, gn->type);
+	snap_put_int(s, gn->special);
+	snap_put_int(s, gn->special_op);
+	snap_put_int(s, gn->order);
+	/* most nodes don't have a hint: keep that to one byte */
+	if (gn->hint == HINT_NONE)
+		snap_put_int(s, 0);
+	else {
+		snap_put_int(s, 1);
+		snap_put_int(s, (unsigned int)gn->hint);
+	}
+	snap_put_int(s, gn->children_left);
+	snap_put_string(s, gn->path);
+	snap_put_node(s, gn->groupling);
+	for (ln = Lst_First(&gn->commands); ln != NULL; ln = Lst_Adv(ln))
+		n++;
+	snap_put_int(s, n);
+	for (ln = Lst_First(&gn->commands); ln != NULL; ln = Lst_Adv(ln))
+		snap_put_int(s, number(commands, Lst_Datum(ln), false)->n);
+	n = 0;
+	for (u = gn->pools; u != NULL; u = u->next)
+		n++;
+	snap_put_int(s, n);
+	for (u = gn->pools; u != NULL; u = u->next) {
+		snap_put_string(s, Pool_Name(u->pool));
+		snap_put_int(s, u->weight);
+	}
+	snap_put_list(s, &gn->cohorts);
+	snap_put_list(s, &gn->parents);
+	snap_put_list(s, &gn->children);
+	snap_put_list(s, &gn->predecessors);
+	snap_put_list(s, &gn->successors);
+}
+
+static void
+restore_node(Snapshot *s, GNode *gn, struct command **commands,
+    unsigned long ncommands)
+{
+	const char *path;
+	unsigned long n, i;
+
+	gn->type = snap_get_int(s);
+	gn->special = snap_get_int(s);
+	gn->special_op = snap_get_int(s);
+	gn->order = snap_get_int(s);
+	if (snap_get_int(s) != 0)
+		gn->hint = (int)snap_get_int(s);
+	gn->children_left = snap_get_int(s);
+	path = snap_get_string(s);
+	gn->path = path == NULL ? NULL : estrdup(path);
+	gn->groupling = snap_get_node(s);
+	for (n = snap_get_int(s); n > 0; n--) {
+		i = snap_get_int(s);
+		if (i < ncommands)
+			Lst_AtEnd(&gn->commands, commands[i]);
+		else
+			s->bad = true;
+	}
+	for (n = snap_get_int(s); n > 0; n--) {
+		path = snap_get_string(s);
+		i = snap_get_int(s);
+		if (path != NULL)
+			Pool_Add(gn, path, strchr(path, '\0'), i);
+		else
+			s->bad = true;
+	}
+	snap_get_list(s, &gn->cohorts);
+	snap_get_list(s, &gn->parents);
+	snap_get_list(s, &gn->children);
+	snap_get_list(s, &gn->predecessors);
+	snap_get_list(s, &gn->successors);
+}
+
+static void
+save_nodes(Snapshot *s)
+{
+	struct ohash commands;
+	struct command *cmd;
+	LstNode ln;
+	unsigned long i, n, written = 0;
+
+	ohash_init(&node_numbers, 10, &number_info);
+	ohash_init(&commands, 8, &number_info);
+
+	add_nodes(targets_hash(), NODE_TARGET);
+	add_nodes(transforms_hash(), NODE_TRANSFORM);
+	n = nnodes;
+	for (i = 0; i < n; i++)
+		for (ln = Lst_First(&nodes[i]->cohorts); ln != NULL;
+		    ln = Lst_Adv(ln))
+			add_node(Lst_Datum(ln), NODE_COHORT);
+	snap_put_int(s, nnodes);
+	for (i = 0; i < nnodes; i++) {
+		snap_put_int(s, kinds[i]);
+		snap_put_string(s, nodes[i]->name);
+	}
+
+	/* commands are shared between all the targets of a line */
+	for (i = 0; i < nnodes; i++)
+		for (ln = Lst_First(&nodes[i]->commands); ln != NULL;
+		    ln = Lst_Adv(ln))
+			(void)number(&commands, Lst_Datum(ln), true);
+	snap_put_int(s, ohash_entries(&commands));
+	for (i = 0; i < nnodes; i++)
+		for (ln = Lst_First(&nodes[i]->commands); ln != NULL;
+		    ln = Lst_Adv(ln)) {
+			cmd = Lst_Datum(ln);
+			if (number(&commands, cmd, false)->n != written)
+				continue;
+			snap_put_string(s, cmd->location.fname);
+			snap_put_int(s, cmd->location.lineno);
+			snap_put_string(s, cmd->string);
+			written++;
+		}
+
+	for (i = 0; i < nnodes; i++)
+		save_node(s, nodes[i], &commands);
+	free_hash(&commands);
+}
+
+static void
+restore_nodes(Snapshot *s)
+{
+	struct command **commands;
+	const char *name, *fname, *str;
+	unsigned long i, n, lineno;
+	size_t len;
+	int kind;
+
+	nnodes = snap_get_int(s);
+	nodes = ereallocarray(NULL, nnodes, sizeof(*nodes));
+	for (i = 0; i < nnodes; i++) {
+		kind = snap_get_int(s);
+		name = snap_get_string(s);
+		if (name == NULL || s->bad) {
+			s->bad = true;
+			nnodes = i;
+			return;
+		}
+		switch (kind) {
+		case NODE_TARGET:
+			nodes[i] = Targ_FindNode(name, TARG_CREATE);
+			break;
+		case NODE_TRANSFORM:
+			nodes[i] = ohash_find(transforms_hash(),
+			    hash_qlookup(transforms_hash(), name));
+			break;
+		default:
+			nodes[i] = Targ_NewGN(name);
+			break;
+		}
+		if (nodes[i] == NULL) {
+			s->bad = true;
+			nnodes = i;
+			return;
+		}
+	}
+
+	n = snap_get_int(s);
+	commands = n == 0 ? NULL : ereallocarray(NULL, n, sizeof(*commands));
+	for (i = 0; i < n; i++) {
+		fname = snap_get_string(s);
+		if (fname != NULL)
+			fname = Str_Intern(fname);
+		lineno = snap_get_int(s);
+		str = snap_get_string(s);
+		if (str == NULL)
+			str = "";
+		len = strlen(str);
+		commands[i] = region_alloc(sizeof(struct command) + len);
+		memcpy(commands[i]->string, str, len+1);
+		commands[i]->location.fname = fname;
+		commands[i]->location.lineno = lineno;
+		commands[i]->compiled = NULL;
+		commands[i]->cost = COST_UNKNOWN;
+	}
+
+	for (i = 0; i < nnodes; i++)
+		restore_node(s, nodes[i], commands, n);
+	free(commands);
+}
+
+/* The makefiles we read, by size and modification time.  */
+static void
+save_files(Snapshot *s)
+{
+	struct stat st;
+	struct timespec mtime;
+	const char *list, *p, *e;
+	unsigned long n = 0;
+	char *name;
+
+	list = Var_Value("MAKEFILE_LIST");
+	if (list == NULL)
+		list = "";
+	for (e = list; iterate_words(&e) != NULL;)
+		n++;
+	snap_put_int(s, n);
+	for (e = list; (p = iterate_words(&e)) != NULL;) {
+		name = Str_dupi(p, e);
+		/* (stdin), for instance */
+		if (stat(name, &st) == -1) {
+			s->bad = true;
+			free(name);
+			return;
+		}
+		ts_set_from_stat(st, mtime);
+		snap_put_string(s, name);
+		snap_put_int(s, st.st_size);
+		snap_put_int(s, mtime.tv_sec);
+		snap_put_int(s, mtime.tv_nsec);
+		free(name);
+	}
+}
+
+static bool
+check_files(Snapshot *s)
+{
+	struct stat st;
+	struct timespec mtime;
+	const char *name;
+	unsigned long n, size, sec, nsec;
+
+	for (n = snap_get_int(s); n > 0; n--) {
+		name = snap_get_string(s);
+		size = snap_get_int(s);
+		sec = snap_get_int(s);
+		nsec = snap_get_int(s);
+		if (s->bad || name == NULL || stat(name, &st) == -1)
+			return false;
+		ts_set_from_stat(st, mtime);
+		if ((unsigned long)st.st_size != size ||
+		    (unsigned long)mtime.tv_sec != sec ||
+		    (unsigned long)mtime.tv_nsec != nsec)
+			return false;
+	}
+	return true;
+}
+
+static void
+save_probes(Snapshot *s)
+{
+	struct probe *e;
+	unsigned int i;
+
+	snap_put_int(s, ohash_entries(&probes));
+	for (e = ohash_first(&probes, &i); e != NULL;
+	    e = ohash_next(&probes, &i)) {
+		snap_put_string(s, e->name);
+		snap_put_int(s, e->found);
+	}
+}
+
+static bool
+check_probes(Snapshot *s)
+{
+	struct stat st;
+	const char *name;
+	unsigned long n;
+	bool found;
+
+	for (n = snap_get_int(s); n > 0; n--) {
+		name = snap_get_string(s);
+		found = snap_get_int(s);
+		if (s->bad || name == NULL)
+			return false;
+		if ((stat(name, &st) == 0) != found)
+			return false;
+	}
+	return true;
+}
+
+/* what the parse starts from: the command line, and all variables,
+ * including the environment variables we already looked at */
+static void
+compute_key(int argc, char **argv)
+{
+	int i;
+
+	Buf_Init(&key.buf, MAKE_BSIZE);
+	snap_put_int(&key, argc);
+	for (i = 0; i < argc; i++)
+		snap_put_string(&key, argv[i]);
+	Var_Save(&key);
+}
+
+static uint32_t
+checksum(const char *s, const char *e)
+{
+	return ohash_interval(s, &e);
+}
+
+static char *
+read_file(const char *name, size_t *len)
+{
+	struct stat st;
+	char *data;
+	int fd;
+
+	fd = open(name, O_RDONLY | O_CLOEXEC);
+	if (fd == -1)
+		return NULL;
+	if (fstat(fd, &st) == -1 || !S_ISREG(st.st_mode) ||
+	    st.st_size > SSIZE_MAX) {
+		close(fd);
+		return NULL;
+	}
+	*len = st.st_size;
+	data = emalloc(*len + 1);
+	if (read(fd, data, *len) != (ssize_t)*len) {
+		free(data);
+		data = NULL;
+	}
+	close(fd);
+	return data;
+}
+
+static void
+write_file(const char *name, uint32_t sum, Buffer body)
+{
+	char *tmp;
+	FILE *f;
+
+	tmp = Str_concat(name, ".tmp", 0);
+	f = fopen(tmp, "w");
+	if (f == NULL) {
+		free(tmp);
+		return;
+	}
+	fputs(SNAPSHOT_MAGIC, f);
+	fwrite(&sum, sizeof(sum), 1, f);
+	fwrite(body->buffer, 1, Buf_Size(body), f);
+	if (fclose(f) == 0)
+		(void)rename(tmp, name);
+	else
+		(void)unlink(tmp);
+	free(tmp);
+}
+
+/* data = read_snapshot(name, &s, &sum);
+ *	read a file written by write_file, and check it, ready to be
+ *	parsed with the snap_get functions.  data must be freed.
+ */
+static char *
+read_snapshot(const char *name, Snapshot *s, uint32_t *sum)
+{
+	char *data;
+	size_t len;
+
+	data = read_file(name, &len);
+	if (data == NULL)
+		return NULL;
+	if (len < strlen(SNAPSHOT_MAGIC) + sizeof(*sum) ||
+	    memcmp(data, SNAPSHOT_MAGIC, strlen(SNAPSHOT_MAGIC)) != 0) {
+		free(data);
+		return NULL;
+	}
+	s->p = data + strlen(SNAPSHOT_MAGIC);
+	memcpy(sum, s->p, sizeof(*sum));
+	s->p += sizeof(*sum);
+	s->end = data + len;
+	s->bad = false;
+	if (checksum(s->p, s->end) != *sum) {
+		free(data);
+		return NULL;
+	}
+	return data;
+}
+
+bool
+Snapshot_Load(int argc, char **argv)
+{
+	Snapshot s;
+	char *data;
+	const char *v;
+	size_t keylen;
+	uint32_t sum;
+
+	v = Var_Value("MAKESNAPSHOT");
+	if (v == NULL || *v == '\0')
+		return false;
+	snapshot_file = estrdup(v);
+	compute_key(argc, argv);
+	ohash_init(&probes, 4, &probe_info);
+	recording = true;
+
+	data = read_snapshot(snapshot_file, &s, &sum);
+	if (data == NULL)
+		return false;
+	keylen = Buf_Size(&key.buf);
+	if (snap_get_int(&s) != keylen || s.bad ||
+	    (size_t)(s.end - s.p) < keylen ||
+	    memcmp(s.p, key.buf.buffer, keylen) != 0)
+		goto stale;
+	s.p += keylen;
+	if (!Var_CheckEnv(&s) || !check_files(&s) || !check_probes(&s))
+		goto stale;
+
+	/* from now on, data stays around for good */
+	Main_Restore(&s);
+	Suff_Restore(&s);
+	restore_nodes(&s);
+	Var_Restore(&s);
+	Parse_Restore(&s);
+	Lst_Destroy(defaultPath, Dir_Destroy);
+	Lst_Init(defaultPath);
+	snap_get_path(&s, defaultPath);
+	if (s.bad || s.p != s.end)
+		Fatal("make: snapshot %s is corrupt", snapshot_file);
+	recording = false;
+	snapshot_valid = true;
+	snapshot_sum = sum;
+	return true;
+stale:
+	free(data);
+	return false;
+}
+
+void
+Snapshot_Save(void)
+{
+	Snapshot s;
+
+	if (!recording)
+		return;
+	recording = false;
+	if (volatile_parse)
+		return;
+
+	Buf_Init(&s.buf, MAKE_BSIZE);
+	s.bad = false;
+	snap_put_int(&s, Buf_Size(&key.buf));
+	Buf_AddChars(&s.buf, Buf_Size(&key.buf), key.buf.buffer);
+	Var_SaveEnv(&s);
+	save_files(&s);
+	save_probes(&s);
+
+	Main_Save(&s);
+	Suff_Save(&s);
+	save_nodes(&s);
+	Var_Save(&s);
+	Parse_Save(&s);
+	snap_put_path(&s, defaultPath);
+
+	if (!s.bad) {
+		snapshot_sum = checksum(s.buf.buffer,
+		    s.buf.buffer + Buf_Size(&s.buf));
+		snapshot_valid = true;
+		write_file(snapshot_file, snapshot_sum, &s.buf);
+	}
+	Buf_Destroy(&s.buf);
+}
+
+static unsigned long
+list_length(Lst l)
+{
+	LstNode ln;
+	unsigned long n = 0;
+
+	for (ln = Lst_First(l); ln != NULL; ln = Lst_Adv(ln))
+		n++;
+	return n;
+}
+
+static char *
+null_build_file(void)
+{
+	return Str_concat(snapshot_file, ".null", 0);
+}
+
+/* the file says which snapshot it goes with, which targets were asked
+ * for and which were up to date, and then what the run looked at: the
+ * time of each file, or that it was missing, and the directories.
+ */
+void
+Snapshot_SaveNullBuild(Lst targs, GNode **nodes, unsigned int n)
+{
+	Snapshot s;
+	LstNode ln;
+	GNode *gn;
+	unsigned int i;
+	char *name;
+	FILE *f;
+	uint32_t sum;
+
+	if (!snapshot_valid)
+		return;
+	/* the file may well live in one of the directories we check: so
+	 * we write it in place, and the first time we create it, the
+	 * directory changes under us, and we will save it next time. */
+	name = null_build_file();
+	f = fopen(name, "a");
+	if (f == NULL) {
+		free(name);
+		return;
+	}
+	Buf_Init(&s.buf, MAKE_BSIZE);
+	s.bad = false;
+	snap_put_int(&s, snapshot_sum);
+	snap_put_int(&s, list_length(targs));
+	for (ln = Lst_First(targs); ln != NULL; ln = Lst_Adv(ln)) {
+		gn = Lst_Datum(ln);
+		snap_put_string(&s, gn->name);
+		snap_put_int(&s, gn->built_status == UPTODATE);
+	}
+	snap_put_int(&s, n);
+	for (i = 0; i < n; i++) {
+		gn = nodes[i];
+		/* archive members don't have a time of their own */
+		if (gn->type & (OP_ARCHV | OP_MEMBER))
+			s.bad = true;
+		if (gn->type & (OP_PHONY | OP_USE)) {
+			snap_put_string(&s, NULL);
+			continue;
+		}
+		snap_put_string(&s, gn->path != NULL ? gn->path : gn->name);
+		if (is_out_of_date(gn->mtime))
+			snap_put_int(&s, 0);
+		else {
+			snap_put_int(&s, 1);
+			snap_put_int(&s, gn->mtime.tv_sec);
+			snap_put_int(&s, gn->mtime.tv_nsec);
+		}
+	}
+	if (!Dir_SaveLookups(&s))
+		s.bad = true;
+	/* a bad file will never match */
+	if (ftruncate(fileno(f), 0) == 0 && !s.bad) {
+		sum = checksum(s.buf.buffer, s.buf.buffer + Buf_Size(&s.buf));
+		fputs(SNAPSHOT_MAGIC, f);
+		fwrite(&sum, sizeof(sum), 1, f);
+		fwrite(s.buf.buffer, 1, Buf_Size(&s.buf), f);
+	}
+	fclose(f);
+	free(name);
+	Buf_Destroy(&s.buf);
+}
+
+bool
+Snapshot_NullBuild(Lst targs)
+{
+	Snapshot s;
+	LstNode ln;
+	GNode *gn;
+	struct stat st;
+	struct timespec mtime;
+	const char *name;
+	char *file, *data;
+	uint32_t sum;
+	unsigned long n, sec, nsec;
+	bool ok = false;
+
+	if (!snapshot_valid)
+		return false;
+	file = null_build_file();
+	data = read_snapshot(file, &s, &sum);
+	free(file);
+	if (data == NULL)
+		return false;
+	if (snap_get_int(&s) != snapshot_sum ||
+	    snap_get_int(&s) != list_length(targs))
+		goto done;
+	for (ln = Lst_First(targs); ln != NULL; ln = Lst_Adv(ln)) {
+		gn = Lst_Datum(ln);
+		name = snap_get_string(&s);
+		(void)snap_get_int(&s);
+		if (name == NULL || strcmp(name, gn->name) != 0)
+			goto done;
+	}
+	for (n = snap_get_int(&s); n > 0; n--) {
+		if ((name = snap_get_string(&s)) == NULL)
+			continue;
+		if (snap_get_int(&s) == 0) {
+			if (stat(name, &st) == 0)
+				goto done;
+			continue;
+		}
+		sec = snap_get_int(&s);
+		nsec = snap_get_int(&s);
+		if (stat(name, &st) == -1)
+			goto done;
+		ts_set_from_stat(st, mtime);
+		if ((unsigned long)mtime.tv_sec != sec ||
+		    (unsigned long)mtime.tv_nsec != nsec)
+			goto done;
+	}
+	if (!Dir_CheckLookups(&s) || s.bad || s.p != s.end)
+		goto done;
+
+	/* still nothing to do: say so the way Make_Run would */
+	s.p = data + strlen(SNAPSHOT_MAGIC) + sizeof(sum);
+	(void)snap_get_int(&s);
+	(void)snap_get_int(&s);
+	for (ln = Lst_First(targs); ln != NULL; ln = Lst_Adv(ln)) {
+		gn = Lst_Datum(ln);
+		(void)snap_get_string(&s);
+		if (snap_get_int(&s))
+			gn->built_status = UPTODATE;
+	}
+	ok = true;
+done:
+	free(data);
+	return ok;
+}
+
+void
+Snapshot_Probe(const char *name, const char *ename, bool found)
+{
+	struct probe *e;
+	unsigned int slot;
+
+	if (!recording)
+		return;
+	slot = hash_qlookupi(&probes, name, &ename);
+	if (ohash_find(&probes, slot) != NULL)
+		return;
+	e = ohash_create_entry(&probe_info, name, &ename);
+	e->found = found;
+	ohash_insert(&probes, slot, e);
+}
+
+void
+Snapshot_Volatile(void)
+{
+	if (recording)
+		volatile_parse = true;
+}
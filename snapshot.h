@@ -0,0 +1,90 @@
+#ifndef SNAPSHOT_H
+#define SNAPSHOT_H
+/*	$OpenBSD$ */
+
+/*
+ * Copyright (c) 2026 Marc Espie.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE OPENBSD PROJECT AND CONTRIBUTORS
+ * ``AS IS'' AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ * LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR
+ * A PARTICULAR PURPOSE ARE DISCLAIMED.  IN NO EVENT SHALL THE OPENBSD
+ * PROJECT OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+ * SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT
+ * LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+ * DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+ * THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+ * OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+
+/* Parse snapshots: with MAKESNAPSHOT set, the state left by reading the
+ * makefiles (global variables, targets, suffixes, transforms and search
+ * paths) is written to that file, and read back instead of parsing on
+ * the next run, as long as nothing it depends on changed: the command
+ * line, the variables set before parsing, the environment variables the
+ * makefiles looked at, the makefiles themselves, and the files tested
+ * with exists() or optional includes.
+ */
+
+/* found = Snapshot_Load(argc, argv);
+ *	restore the state from the snapshot if it is still valid.
+ *	Otherwise, start recording what the parse depends on. */
+extern bool Snapshot_Load(int, char **);
+
+/* Snapshot_Save();
+ *	write the snapshot after parsing, unless the parse depended on
+ *	things we can't check. */
+extern void Snapshot_Save(void);
+
+/* Snapshot_SaveNullBuild(targs, nodes, n);
+ *	a run on top of a valid snapshot had nothing to do for targs: save
+ *	what it looked at, that is the n nodes it examined, and the
+ *	directory lookups. */
+extern void Snapshot_SaveNullBuild(Lst, GNode **, unsigned int);
+
+/* nothing = Snapshot_NullBuild(targs);
+ *	the last run for targs had nothing to do, and none of the files it
+ *	looked at changed since: record which targets were up to date, so
+ *	that the graph doesn't even have to be expanded. */
+extern bool Snapshot_NullBuild(Lst);
+
+/* Snapshot_Probe(name, ename, found);
+ *	the parse looked for file name, and found it or not. */
+extern void Snapshot_Probe(const char *, const char *, bool);
+
+/* Snapshot_Volatile();
+ *	the parse depends on something we can't check (shell commands,
+ *	wildcards), so don't write a snapshot. */
+extern void Snapshot_Volatile(void);
+
+/* Helpers for modules that save their own state, in the same order they
+ * will read it back. */
+extern void snap_put_int(Snapshot *, unsigned long);
+/* str may be NULL */
+extern void snap_put_string(Snapshot *, const char *);
+extern void snap_put_node(Snapshot *, GNode *);
+/* list of nodes */
+extern void snap_put_list(Snapshot *, Lst);
+/* list of directories */
+extern void snap_put_path(Snapshot *, Lst);
+
+extern unsigned long snap_get_int(Snapshot *);
+/* the string stays valid for the whole run */
+extern const char *snap_get_string(Snapshot *);
+extern GNode *snap_get_node(Snapshot *);
+/* append to the list */
+extern void snap_get_list(Snapshot *, Lst);
+extern void snap_get_path(Snapshot *, Lst);
+
+#endif
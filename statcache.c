@@ -0,0 +1,271 @@
+/*	$OpenBSD$ */
+/*
+ * Copyright (c) 2026 Marc Espie.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE OPENBSD PROJECT AND CONTRIBUTORS
+ * ``AS IS'' AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ * LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR
+ * A PARTICULAR PURPOSE ARE DISCLAIMED.  IN NO EVENT SHALL THE OPENBSD
+ * PROJECT OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+ * SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT
+ * LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+ * DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+ * THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+ * OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include <sys/types.h>
+#include <sys/mman.h>
+#include <fcntl.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <ohash.h>
+#include "config.h"
+#include "defines.h"
+#include "statcache.h"
+#include "var.h"
+#include "memory.h"
+
+#define STAT_CACHE_ENV	"MAKESTATCACHE"
+
+/* The file is a fixed open-addressing table, filled concurrently by
+ * every make of the build without locking: an entry is only believed
+ * if its check matches, so a torn write reads as a miss.
+ * Any make that ran commands bumps the generation in front of the table,
+ * and only entries from the current generation are believed.  Two makes
+ * bumping at the same time may lose an increment, but the generation
+ * still moves on, which is all that matters.
+ */
+#define STATCACHE_SLOTS	16384
+#define STATCACHE_PROBE	8
+#define STATCACHE_NAME	232
+
+struct stat_slot {
+	uint32_t hv;			/* 0: empty */
+	uint32_t check;
+	uint32_t generation;
+	uint32_t unused;
+	int64_t sec;
+	int64_t nsec;
+	char name[STATCACHE_NAME];
+};
+
+struct stat_cache {
+	volatile uint32_t generation;
+	uint32_t unused;
+	struct stat_slot slot[STATCACHE_SLOTS];
+};
+
+static struct stat_cache *cache = NULL;
+static struct stat_slot *table = NULL;
+static uint32_t generation;	/* what we saw before our last stat(2) */
+static const char *objdir;		/* relative names start there */
+static char *cache_file = NULL;
+static pid_t cache_pid;
+
+static void remove_cache_file(void);
+static uint32_t slot_check(const struct stat_slot *);
+static bool map_cache(const char *);
+static bool cache_key(const char *, char *);
+static struct stat_slot *find_slot(const char *, uint32_t);
+
+static void
+remove_cache_file(void)
+{
+	/* forked children that exit() have no business here */
+	if (getpid() != cache_pid)
+		return;
+	(void)unlink(cache_file);
+}
+
+/* covers the name itself, so that a name torn by a concurrent writer
+ * doesn't pass for another one */
+static uint32_t
+slot_check(const struct stat_slot *e)
+{
+	const char *end;
+	uint64_t k = (uint64_t)e->sec * 1000000007ULL ^ (uint64_t)e->nsec;
+
+	end = memchr(e->name, '\0', sizeof e->name);
+	if (end == NULL)
+		return 0;
+	return ohash_interval(e->name, &end) ^ e->hv ^
+	    e->generation * 0x85ebca6bU ^ (uint32_t)k ^ (uint32_t)(k >> 32) ^
+	    0x9e3779b9;
+}
+
+static bool
+map_cache(const char *name)
+{
+	int fd;
+	void *p;
+	size_t len = sizeof(struct stat_cache);
+
+	fd = open(name, O_RDWR);
+	if (fd == -1)
+		return false;
+	p = mmap(NULL, len, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+	close(fd);
+	if (p == MAP_FAILED)
+		return false;
+	cache = p;
+	table = cache->slot;
+	generation = cache->generation;
+	return true;
+}
+
+/* sub-makes run from other directories: names must be absolute */
+static bool
+cache_key(const char *name, char *key)
+{
+	int n;
+
+	while (name[0] == '.' && name[1] == '/')
+		name += 2;
+	if (*name == '/')
+		n = snprintf(key, STATCACHE_NAME, "%s", name);
+	else
+		n = snprintf(key, STATCACHE_NAME, "%s/%s", objdir, name);
+	return n > 0 && n < STATCACHE_NAME;
+}
+
+void
+StatCache_Init(void)
+{
+	const char *s;
+	char tmpl[] = "/tmp/make-statcache.XXXXXXXXXX";
+	int fd;
+
+	objdir = Var_Value(".OBJDIR");
+	s = getenv(STAT_CACHE_ENV);
+	if (s != NULL && *s != '\0') {
+		if (!map_cache(s))
+			fprintf(stderr, "make: can't map stat cache %s\n", s);
+		return;
+	}
+	if (Var_Value("STAT_CACHE") == NULL)
+		return;
+	if ((fd = mkstemp(tmpl)) == -1)
+		return;
+	if (ftruncate(fd, sizeof(struct stat_cache)) == -1) {
+		close(fd);
+		(void)unlink(tmpl);
+		return;
+	}
+	close(fd);
+	cache_file = estrdup(tmpl);
+	cache_pid = getpid();
+	atexit(remove_cache_file);
+	if (map_cache(cache_file))
+		Var_Setenv(STAT_CACHE_ENV, cache_file);
+}
+
+/* slot holding key, or the empty one it would go in, or NULL */
+static struct stat_slot *
+find_slot(const char *key, uint32_t hv)
+{
+	unsigned int i, j;
+	struct stat_slot *e;
+
+	for (i = hv % STATCACHE_SLOTS, j = 0; j < STATCACHE_PROBE;
+	    i = (i + 1) % STATCACHE_SLOTS, j++) {
+		e = table + i;
+		if (e->hv == 0 ||
+		    (e->hv == hv && strcmp(e->name, key) == 0))
+			return e;
+	}
+	return NULL;
+}
+
+bool
+StatCache_Lookup(const char *name, struct timespec *mtime)
+{
+	char key[STATCACHE_NAME];
+	const char *end = NULL;
+	uint32_t hv;
+	struct stat_slot *e;
+
+	if (table == NULL)
+		return false;
+	/* a miss is followed by stat(2), whose answer is only as good as
+	 * this generation */
+	generation = cache->generation;
+	if (!cache_key(name, key))
+		return false;
+	hv = ohash_interval(key, &end) | 1;
+	e = find_slot(key, hv);
+	if (e == NULL || e->hv == 0)
+		return false;
+	if (e->generation != generation || e->check != slot_check(e))
+		return false;
+	mtime->tv_sec = e->sec;
+	mtime->tv_nsec = e->nsec;
+	return true;
+}
+
+void
+StatCache_Enter(const char *name, const struct timespec *mtime)
+{
+	char key[STATCACHE_NAME];
+	const char *end = NULL;
+	uint32_t hv;
+	struct stat_slot *e;
+
+	if (table == NULL)
+		return;
+	if (!cache_key(name, key))
+		return;
+	hv = ohash_interval(key, &end) | 1;
+	e = find_slot(key, hv);
+	/* table full around there: just steal the home slot */
+	if (e == NULL)
+		e = table + hv % STATCACHE_SLOTS;
+	e->check = 0;
+	memcpy(e->name, key, end - key + 1);
+	e->sec = mtime->tv_sec;
+	e->nsec = mtime->tv_nsec;
+	e->generation = generation;
+	e->hv = hv;
+	e->check = slot_check(e);
+}
+
+void
+StatCache_Forget(const char *name)
+{
+	char key[STATCACHE_NAME];
+	const char *end = NULL;
+	uint32_t hv;
+	struct stat_slot *e;
+
+	if (table == NULL)
+		return;
+	if (!cache_key(name, key))
+		return;
+	hv = ohash_interval(key, &end) | 1;
+	e = find_slot(key, hv);
+	/* keep hv, so that the names after it can still be found */
+	if (e != NULL && e->hv != 0)
+		e->check = 0;
+}
+
+void
+StatCache_Changed(void)
+{
+	if (cache == NULL)
+		return;
+	cache->generation++;
+	generation = cache->generation;
+}
@@ -0,0 +1,60 @@
+#ifndef STATCACHE_H
+#define STATCACHE_H
+/*	$OpenBSD$ */
+
+/*
+ * Copyright (c) 2026 Marc Espie.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE OPENBSD PROJECT AND CONTRIBUTORS
+ * ``AS IS'' AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ * LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR
+ * A PARTICULAR PURPOSE ARE DISCLAIMED.  IN NO EVENT SHALL THE OPENBSD
+ * PROJECT OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+ * SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT
+ * LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+ * DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+ * THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+ * OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+/* Shared stat cache: with STAT_CACHE set, the top-level make maps a file
+ * of modification times, and advertises it to sub-makes through
+ * MAKESTATCACHE.  Every make of the build then consults it before
+ * stat(2)ing a target, and records what it finds.
+ * A target that was just rebuilt always goes to the file system, and
+ * its new time replaces the old one for everybody.
+ * Times seen before any make of the build last ran commands are no longer
+ * believed.
+ */
+
+/* StatCache_Init();
+ *	look at MAKESTATCACHE and STAT_CACHE. */
+extern void StatCache_Init(void);
+
+/* found = StatCache_Lookup(name, &mtime);
+ *	time some make of this build already saw for name. */
+extern bool StatCache_Lookup(const char *, struct timespec *);
+
+/* StatCache_Enter(name, &mtime);
+ *	name exists and has that time, as stat(2) just told us. */
+extern void StatCache_Enter(const char *, const struct timespec *);
+
+/* StatCache_Forget(name);
+ *	name was just rebuilt: nobody should believe its old time. */
+extern void StatCache_Forget(const char *);
+
+/* StatCache_Changed();
+ *	commands ran: forget every time seen so far, for all makes. */
+extern void StatCache_Changed(void);
+
+#endif
@@ -32,24 +32,27 @@
 
 /* collection across make invocations is done with an mmap shared file,
    to allow for concurrent adjustment to variables.
+   The always present counters are just appended to a file instead.
  */
 
+#include <sys/types.h>
+#include <sys/time.h>
+#include <sys/resource.h>
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+#include <unistd.h>
 #include "config.h"
 #include "defines.h"
 #include "stats.h"
 
 #ifdef HAS_STATS
-#include <fcntl.h>
-#include <stdio.h>
-#include <stdlib.h>
-#include <sys/time.h>
 #include <sys/mman.h>
-#include <sys/types.h>
-#include <sys/resource.h>
 #include "memory.h"
 
 static void print_stats(void);
-void Init_Stats(void);
+static void init_statarray(void);
 static float average_runs(unsigned long val);
 unsigned long *statarray;
 
@@ -134,8 +137,8 @@ print_stats(void)
 		munmap(statarray, STAT_NUMBER * sizeof(unsigned long));
 }
 
-void
-Init_Stats(void)
+static void
+init_statarray(void)
 {
 	char *name;
 	int fd;
@@ -174,3 +177,106 @@ Init_Stats(void)
 }
 
 #endif
+
+unsigned long counters[COUNT_NUMBER];
+
+static const char *counter_names[COUNT_NUMBER] = {
+	"stat",
+	"dir_hit",
+	"dir_miss",
+	"var_hit",
+	"var_miss",
+	"fork",
+	"noshell",
+	"builtin",
+};
+
+static const char *statfile;
+static pid_t stats_pid;
+static struct timespec stats_start, idle_start, idle;
+
+static double
+seconds(const struct timespec *ts)
+{
+	return ts->tv_sec + ts->tv_nsec / 1e9;
+}
+
+static void
+add_elapsed(struct timespec *total, const struct timespec *since)
+{
+	struct timespec now, d;
+
+	clock_gettime(CLOCK_MONOTONIC, &now);
+	timespecsub(&now, since, &d);
+	timespecadd(total, &d, total);
+}
+
+void
+Stats_IdleBegin(void)
+{
+	if (statfile != NULL)
+		clock_gettime(CLOCK_MONOTONIC, &idle_start);
+}
+
+void
+Stats_IdleEnd(void)
+{
+	if (statfile != NULL)
+		add_elapsed(&idle, &idle_start);
+}
+
+/* one line per make, written at once so that concurrent makes
+ * appending to the same file don't mix up their output */
+static void
+export_counters(void)
+{
+	char line[1024];
+	struct rusage ru;
+	struct timespec real;
+	size_t len;
+	int i, fd;
+
+	/* children that didn't exec don't get to report */
+	if (getpid() != stats_pid)
+		return;
+	timespecclear(&real);
+	add_elapsed(&real, &stats_start);
+	if (getrusage(RUSAGE_SELF, &ru) == -1)
+		return;
+	len = snprintf(line, sizeof line,
+	    "{\"pid\": %ld, \"ppid\": %ld, \"real\": %.6f, "
+	    "\"user\": %ld.%06ld, \"sys\": %ld.%06ld, \"maxrss\": %ld, "
+	    "\"idle\": %.6f",
+	    (long)stats_pid, (long)getppid(), seconds(&real),
+	    (long)ru.ru_utime.tv_sec, (long)ru.ru_utime.tv_usec,
+	    (long)ru.ru_stime.tv_sec, (long)ru.ru_stime.tv_usec,
+	    (long)ru.ru_maxrss, seconds(&idle));
+	for (i = 0; i < COUNT_NUMBER && len < sizeof line; i++)
+		len += snprintf(line + len, sizeof line - len, ", \"%s\": %lu",
+		    counter_names[i], counters[i]);
+	if (len + 2 >= sizeof line)
+		return;
+	line[len++] = '}';
+	line[len++] = '\n';
+	fd = open(statfile, O_WRONLY | O_APPEND | O_CREAT | O_CLOEXEC, 0666);
+	if (fd == -1)
+		return;
+	(void)write(fd, line, len);
+	close(fd);
+}
+
+void
+Init_Stats(void)
+{
+#ifdef HAS_STATS
+	init_statarray();
+#endif
+	statfile = getenv("MAKESTATFILE");
+	if (statfile == NULL || *statfile == '\0') {
+		statfile = NULL;
+		return;
+	}
+	stats_pid = getpid();
+	clock_gettime(CLOCK_MONOTONIC, &stats_start);
+	atexit(export_counters);
+}
@@ -78,8 +78,35 @@ extern unsigned long *statarray;
 
 #define STAT_NUMBER		32
 
-#else
-#define Init_Stats()
 #endif
 
+/* Init_Stats();
+ *	Set up statistics gathering, and their reporting at exit.
+ */
+extern void Init_Stats(void);
+
+/* Cheap counters, always compiled in.  If MAKESTATFILE is set, each make
+ * appends a single line of json with them to that file at exit.
+ */
+enum {
+	COUNT_STAT,		/* stat(2) and friends on files */
+	COUNT_DIR_HIT,		/* file lookups answered from the dir cache */
+	COUNT_DIR_MISS,		/* ... that had to go to the file system */
+	COUNT_VAR_HIT,		/* global variables expanded from cache */
+	COUNT_VAR_MISS,		/* ... that had to be substituted */
+	COUNT_FORK,		/* processes started, by fork or spawn */
+	COUNT_NOSHELL,		/* commands run without a shell */
+	COUNT_BUILTIN,		/* commands run without a process */
+	COUNT_NUMBER
+};
+extern unsigned long counters[COUNT_NUMBER];
+#define COUNT(c)	(counters[COUNT_##c]++)
+#define COUNT_N(c, n)	(counters[COUNT_##c] += (n))
+
+/* Stats_IdleBegin(); Stats_IdleEnd();
+ *	Bracket time spent waiting for jobs with nothing else to do.
+ */
+extern void Stats_IdleBegin(void);
+extern void Stats_IdleEnd(void);
+
 #endif
@@ -0,0 +1,182 @@
+/*	$OpenBSD$ */
+/*
+ * Copyright (c) 2026 Marc Espie.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE OPENBSD PROJECT AND CONTRIBUTORS
+ * ``AS IS'' AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ * LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR
+ * A PARTICULAR PURPOSE ARE DISCLAIMED.  IN NO EVENT SHALL THE OPENBSD
+ * PROJECT OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+ * SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT
+ * LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+ * DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+ * THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+ * OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+
+#include <sys/types.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/un.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <limits.h>
+#include <signal.h>
+#include <stdarg.h>
+#include <stdio.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include "config.h"
+#include "defines.h"
+#include "status.h"
+#include "gnode.h"
+
+static int status_fd = -1;
+static bool is_socket;
+static long counts[STATUS_COUNTS];
+static bool counts_changed = false;
+static unsigned int last_built = 0;
+
+static void put_line(const char *, ...);
+static void show_counts(void);
+static void ignore_sigpipe(int);
+
+/* a reader going away shouldn't kill us.  Unlike SIG_IGN, handlers
+ * don't survive exec, so commands still get the default. */
+static void
+ignore_sigpipe(int signo UNUSED)
+{
+}
+
+void
+Status_Init(const char *path)
+{
+	struct sockaddr_un sun;
+	struct stat st;
+
+	if (path == NULL || status_fd != -1)
+		return;
+	if (stat(path, &st) == 0 && S_ISSOCK(st.st_mode)) {
+		memset(&sun, 0, sizeof sun);
+		sun.sun_family = AF_UNIX;
+		if (strlcpy(sun.sun_path, path, sizeof sun.sun_path) >=
+		    sizeof sun.sun_path) {
+			fprintf(stderr, "make: status socket name too long: "
+			    "%s\n", path);
+			return;
+		}
+		status_fd = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+		if (status_fd != -1 &&
+		    connect(status_fd, (struct sockaddr *)&sun, sizeof sun)
+		    == -1) {
+			close(status_fd);
+			status_fd = -1;
+		}
+		is_socket = true;
+	} else
+		/* a fifo nobody reads fails with ENXIO, instead of
+		 * waiting */
+		status_fd = open(path, O_WRONLY | O_APPEND | O_CREAT |
+		    O_NONBLOCK | O_CLOEXEC, 0666);
+	if (status_fd == -1) {
+		fprintf(stderr, "make: can't open status channel %s: %s\n",
+		    path, strerror(errno));
+		return;
+	}
+	(void)fcntl(status_fd, F_SETFL,
+	    fcntl(status_fd, F_GETFL) | O_NONBLOCK);
+	if (!is_socket) {
+		struct sigaction sa;
+
+		memset(&sa, 0, sizeof sa);
+		sa.sa_handler = ignore_sigpipe;
+		sigemptyset(&sa.sa_mask);
+		sigaction(SIGPIPE, &sa, NULL);
+	}
+}
+
+/* one write per line, so that lines from several makes don't mix */
+static void
+put_line(const char *fmt, ...)
+{
+	char line[PIPE_BUF];
+	struct timespec now;
+	va_list va;
+	int n, m;
+	ssize_t r;
+
+	clock_gettime(CLOCK_REALTIME, &now);
+	n = snprintf(line, sizeof line, "%lld.%03ld %ld ",
+	    (long long)now.tv_sec, now.tv_nsec / 1000000, (long)getpid());
+	va_start(va, fmt);
+	m = vsnprintf(line + n, sizeof line - n, fmt, va);
+	va_end(va);
+	if (m < 0)
+		return;
+	/* long target names get truncated */
+	n += m;
+	if (n >= (int)sizeof line)
+		n = sizeof line - 1;
+	line[n++] = '\n';
+	r = is_socket ? send(status_fd, line, n, MSG_NOSIGNAL) :
+	    write(status_fd, line, n);
+	/* dropping lines is fine, losing the reader for good is not */
+	if (r == -1 && errno != EAGAIN && errno != EINTR) {
+		close(status_fd);
+		status_fd = -1;
+	}
+}
+
+static void
+show_counts(void)
+{
+	if (!counts_changed)
+		return;
+	counts_changed = false;
+	put_line("queue %ld %ld %ld %ld", counts[STATUS_TO_BUILD],
+	    counts[STATUS_HELD_BACK], counts[STATUS_HELD_JOBS],
+	    counts[STATUS_RUNNING]);
+}
+
+void
+status_job(const char *event, GNode *gn, int code)
+{
+	if (status_fd == -1)
+		return;
+	if (strcmp(event, "fail") == 0)
+		put_line("fail %d %s", code, gn->name);
+	else
+		put_line("%s %s", event, gn->name);
+	if (status_fd != -1)
+		show_counts();
+}
+
+void
+status_count(int which, long value)
+{
+	if (counts[which] != value) {
+		counts[which] = value;
+		counts_changed = true;
+	}
+}
+
+void
+status_progress(unsigned int built, unsigned int total)
+{
+	if (status_fd == -1 || built == last_built)
+		return;
+	last_built = built;
+	put_line("progress %u %u", built, total);
+}
@@ -0,0 +1,66 @@
+#ifndef STATUS_H
+#define STATUS_H
+/*	$OpenBSD$ */
+/*
+ * Copyright (c) 2026 Marc Espie.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE OPENBSD PROJECT AND CONTRIBUTORS
+ * ``AS IS'' AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ * LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR
+ * A PARTICULAR PURPOSE ARE DISCLAIMED.  IN NO EVENT SHALL THE OPENBSD
+ * PROJECT OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+ * SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT
+ * LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+ * DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+ * THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+ * OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+
+/* -T path: live status of the build, one line per event, written to a
+ * unix socket, a fifo or a plain file:
+ *	seconds pid event args...
+ * seconds is the time of day, pid tells apart the makes sharing the
+ * same channel.  Events are
+ *	start target
+ *	done target
+ *	fail code target
+ *	queue to_build held_back held_jobs running
+ *	progress built total
+ * Lines are never longer than PIPE_BUF, and are dropped rather than
+ * holding up the build if the reader can't keep up.
+ * All functions do nothing unless -T is active.
+ */
+
+/* Status_Init(path);
+ *	connect to the status channel. */
+extern void Status_Init(const char *);
+
+/* status_job(event, gn, code);
+ *	a job for gn started, was done or failed with code. */
+extern void status_job(const char *, GNode *, int);
+
+/* status_count(which, value);
+ *	note the new length of a queue, shown with the next event. */
+#define STATUS_TO_BUILD		0
+#define STATUS_HELD_BACK	1
+#define STATUS_HELD_JOBS	2
+#define STATUS_RUNNING		3
+#define STATUS_COUNTS		4
+extern void status_count(int, long);
+
+/* status_progress(built, total);
+ *	built nodes out of total we know we must look at. */
+extern void status_progress(unsigned int, unsigned int);
+
+#endif
@@ -36,11 +36,17 @@
  */
 
 #include <ctype.h>
+#include <limits.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <stdlib.h>
 #include <string.h>
+#include <ohash.h>
 #include "config.h"
 #include "defines.h"
 #include "str.h"
 #include "memory.h"
+#include "hash.h"
 #include "buf.h"
 
 /* helpers for Str_Matchi */
@@ -76,98 +82,79 @@ Str_concati(const char *s1, const char *e1, const char *s2, const char *e2,
 	return result;
 }
 
-/*-
- * brk_string --
- *	Fracture a string into an array of words (as delineated by tabs or
- *	spaces) taking quotation marks into account.  Leading tabs/spaces
- *	are ignored.
- *
- * returns --
- *	Pointer to the array of pointers to the words.	Fills up
- *	store_args with its size.
- *	The returned parameters are allocated in a single buffer,
- *	return as *buffer, to be freed later.
- */
-char **
-brk_string(const char *str, int *store_argc, char **buffer)
+const char *
+iterate_args(const char **end, bool *escaped)
 {
-	int argc;
-	char ch;
-	char inquote;
-	const char *p;
-	char *start, *t;
-	size_t len;
-	int argmax = 50;	/* start at 50 */
-	size_t curlen = 0;
-	char **argv = ereallocarray(NULL, argmax + 1, sizeof(char *));
-
-	/* skip leading space chars. */
-	for (; *str == ' ' || *str == '\t'; ++str)
-		continue;
+	const char *start, *p;
+	char inquote = '\0';
 
-	/* allocate room for a copy of the string */
-	if ((len = strlen(str) + 1) > curlen)
-		*buffer = emalloc(curlen = len);
-
-	/*
-	 * copy the string; at the same time, parse backslashes,
-	 * quotes and build the argument list.
-	 */
-	argc = 0;
-	inquote = '\0';
-	for (p = str, start = t = *buffer;; ++p) {
-		switch (ch = *p) {
+	*escaped = false;
+	/* a newline right after a word ends the string */
+	if (**end == '\n')
+		return NULL;
+	for (start = *end;; start++)
+		if (*start != ' ' && *start != '\t' && *start != '\n')
+			break;
+	if (*start == '\0')
+		return NULL;
+	for (p = start;; p++) {
+		switch (*p) {
 		case '"':
 		case '\'':
-			if (inquote) {
-				if (inquote == ch)
-					inquote = '\0';
-				else
-					break;
-			} else {
-				inquote = ch;
-				/* Don't miss "" or '' */
-				if (start == NULL && p[1] == inquote) {
-					start = t + 1;
-					break;
-				}
-			}
+			*escaped = true;
+			if (inquote == *p)
+				inquote = '\0';
+			else if (inquote == '\0')
+				inquote = *p;
+			continue;
+		case '\\':
+			*escaped = true;
+			if (p[1] != '\0' && p[1] != '\n')
+				p++;
 			continue;
 		case ' ':
 		case '\t':
 		case '\n':
 			if (inquote)
-				break;
-			if (!start)
 				continue;
-			/* FALLTHROUGH */
+			break;
 		case '\0':
-			/*
-			 * end of a token -- make sure there's enough argv
-			 * space and save off a pointer.
-			 */
-			if (!start)
-				goto done;
+			break;
+		default:
+			continue;
+		}
+		break;
+	}
+	/* an opening quote all by itself at the end is not a word */
+	if (p - start == 1 && inquote != '\0')
+		return NULL;
+	*end = p;
+	return start;
+}
 
-			*t++ = '\0';
-			if (argc == argmax) {
-				argmax *= 2;	/* ramp up fast */
-				argv = ereallocarray(argv,
-				    (argmax + 1), sizeof(char *));
-			}
-			argv[argc++] = start;
-			start = NULL;
-			if (ch == '\n' || ch == '\0')
-				goto done;
+/* copy the word start/end into t, handling quotes and backslashes */
+static char *
+copy_arg(const char *p, const char *end, char *t)
+{
+	char ch;
+	char inquote = '\0';
+
+	for (; p != end; p++) {
+		switch (ch = *p) {
+		case '"':
+		case '\'':
+			if (inquote == '\0')
+				inquote = ch;
+			else if (inquote == ch)
+				inquote = '\0';
+			else
+				break;
 			continue;
 		case '\\':
-			switch (ch = *++p) {
-			case '\0':
-			case '\n':
-				/* hmmm; fix it up as best we can */
-				ch = '\\';
-				--p;
+			/* hmmm; fix it up as best we can */
+			if (p + 1 == end || p[1] == '\n')
 				break;
+			switch (ch = *++p) {
 			case 'b':
 				ch = '\b';
 				break;
@@ -184,16 +171,67 @@ brk_string(const char *str, int *store_argc, char **buffer)
 				ch = '\t';
 				break;
 			}
-			    break;
+			break;
 		}
-		if (!start)
-			start = t;
 		*t++ = ch;
 	}
-    done:
-	    argv[argc] = NULL;
-	    *store_argc = argc;
-	    return argv;
+	*t++ = '\0';
+	return t;
+}
+
+/*-
+ * brk_string --
+ *	Fracture a string into an array of words (as delineated by tabs or
+ *	spaces) taking quotation marks into account.  Leading tabs/spaces
+ *	are ignored.
+ *
+ * returns --
+ *	Pointer to the array of pointers to the words.	Fills up
+ *	store_args with its size.
+ *	The words are allocated along with the array, to be freed later.
+ */
+char **
+brk_string(const char *str, int *store_argc)
+{
+	const char *end, *start;
+	char **argv;
+	char *t;
+	size_t len = 0;
+	int argc = 0;
+	bool escaped;
+
+	/* skip leading space chars. */
+	for (; *str == ' ' || *str == '\t'; ++str)
+		continue;
+	/* words never grow when copied, so one pass tells how much room
+	 * we need */
+	for (end = str; (start = iterate_args(&end, &escaped)) != NULL;) {
+		argc++;
+		len += end - start + 1;
+	}
+	/* there's always a first word, even if empty */
+	if (argc == 0)
+		len = 1;
+	argv = emalloc((argc + 2) * sizeof(char *) + len);
+	t = (char *)(argv + argc + 2);
+	argv[0] = t;
+	*t = '\0';
+	argc = 0;
+	for (end = str; (start = iterate_args(&end, &escaped)) != NULL;) {
+		argv[argc++] = t;
+		if (escaped)
+			t = copy_arg(start, end, t);
+		else {
+			memcpy(t, start, end - start);
+			t += end - start;
+			*t++ = '\0';
+		}
+	}
+	if (argc == 0)
+		argc++;
+	argv[argc] = NULL;
+	*store_argc = argc;
+	return argv;
 }
 
 
@@ -357,6 +395,219 @@ Str_Matchi(const char *string, const char *estring,
 }
 
 
+/* Compiled patterns, for matching lots of words against the same pattern.
+ * Each element matches exactly one character, stars aside.  The elements
+ * before the first star and after the last star are anchored, which gives
+ * memcmp fast paths for the usual foo* and *.c, and what's left in the
+ * middle is matched without recursion: on mismatch, we go back to the
+ * last star and let it eat one more character.
+ * Classes are expanded to bitmaps by asking range_match() about every
+ * character, so they mean exactly the same thing as in Str_Matchi.  */
+#define GLOB_CHAR	0
+#define GLOB_ANY	1
+#define GLOB_CLASS	2
+#define GLOB_STAR	3
+
+struct glob_elem {
+	unsigned char type;
+	unsigned char bits[UCHAR_MAX/8+1];	/* for GLOB_CLASS */
+};
+
+struct Glob {
+	struct glob_elem *elems;
+	char *plain;		/* parallel to elems, the GLOB_CHAR values */
+	size_t n;
+	size_t prefix;		/* number of elements before the first star */
+	size_t suffix;		/* and after the last one */
+	bool star;
+	bool plain_prefix;	/* only GLOB_CHAR there */
+	bool plain_suffix;
+	bool never;		/* can't match anything */
+	char *pattern;		/* odd patterns are left to Str_Matchi */
+	char *epattern;
+};
+
+#define IN_CLASS(e, c)	\
+	((e)->bits[(unsigned char)(c)/8] & (1 << ((unsigned char)(c)%8)))
+
+static bool
+compile_class(struct glob_elem *elem, const char **ppat, const char *epattern,
+    bool *never)
+{
+	const char *end = NULL, *p;
+	int c;
+
+	elem->type = GLOB_CLASS;
+	memset(elem->bits, 0, sizeof elem->bits);
+	for (c = 0; c <= UCHAR_MAX; c++) {
+		p = *ppat;
+		if (!range_match(c, &p, epattern))
+			continue;
+		/* where the class stops depends on the character in
+		 * some weird cases: don't try to second-guess those */
+		if (p == epattern || (end != NULL && p != end))
+			return false;
+		end = p;
+		elem->bits[c/8] |= 1 << (c%8);
+	}
+	/* nothing matches, so we don't care where it ends */
+	if (end == NULL) {
+		*never = true;
+		return false;
+	}
+	*ppat = end+1;
+	return true;
+}
+
+struct Glob *
+Str_CompileGlobi(const char *pattern, const char *epattern)
+{
+	struct Glob *g;
+	struct glob_elem *elem;
+	const char *p;
+	size_t i, first = 0, last = 0;
+
+	g = emalloc(sizeof(*g));
+	g->elems = ereallocarray(NULL, epattern - pattern + 1,
+	    sizeof(*g->elems));
+	g->plain = emalloc(epattern - pattern + 1);
+	g->n = 0;
+	g->star = false;
+	g->never = false;
+	g->pattern = NULL;
+	for (p = pattern; p != epattern;) {
+		elem = &g->elems[g->n];
+		switch (*p) {
+		case '*':
+			p++;
+			if (g->star && last == g->n-1)
+				continue;
+			if (!g->star)
+				first = g->n;
+			last = g->n;
+			g->star = true;
+			elem->type = GLOB_STAR;
+			break;
+		case '?':
+			p++;
+			elem->type = GLOB_ANY;
+			break;
+		case '[':
+			p++;
+			if (!compile_class(elem, &p, epattern, &g->never)) {
+				if (!g->never)
+					g->pattern = Str_dupi(pattern,
+					    epattern);
+				return g;
+			}
+			break;
+		case '\\':
+			if (++p == epattern) {
+				g->never = true;
+				return g;
+			}
+			/* FALLTHROUGH */
+		default:
+			elem->type = GLOB_CHAR;
+			g->plain[g->n] = *p++;
+			break;
+		}
+		g->n++;
+	}
+	if (g->star) {
+		g->prefix = first;
+		g->suffix = g->n - last - 1;
+	} else {
+		g->prefix = g->n;
+		g->suffix = 0;
+	}
+	g->plain_prefix = true;
+	for (i = 0; i < g->prefix; i++)
+		if (g->elems[i].type != GLOB_CHAR)
+			g->plain_prefix = false;
+	g->plain_suffix = true;
+	for (i = g->n - g->suffix; g->star && i < g->n; i++)
+		if (g->elems[i].type != GLOB_CHAR)
+			g->plain_suffix = false;
+	return g;
+}
+
+void
+Str_FreeGlob(struct Glob *g)
+{
+	free(g->elems);
+	free(g->plain);
+	free(g->pattern);
+	free(g);
+}
+
+static bool
+elem_match(const struct Glob *g, size_t i, char c)
+{
+	const struct glob_elem *elem = &g->elems[i];
+
+	switch (elem->type) {
+	case GLOB_CHAR:
+		return g->plain[i] == c;
+	case GLOB_CLASS:
+		return IN_CLASS(elem, c);
+	default:
+		return true;
+	}
+}
+
+static bool
+anchored_match(const struct Glob *g, size_t i, size_t n, bool plain,
+    const char *s)
+{
+	if (plain)
+		return memcmp(s, g->plain + i, n) == 0;
+	for (; n != 0; n--, i++, s++)
+		if (!elem_match(g, i, *s))
+			return false;
+	return true;
+}
+
+bool
+Str_GlobMatchi(const struct Glob *g, const char *s, const char *e)
+{
+	size_t i, end, star;
+	const char *backtrack = NULL;
+
+	if (g->never)
+		return false;
+	if (g->pattern != NULL)
+		return Str_Matchi(s, e, g->pattern, strchr(g->pattern, '\0'));
+	if (!g->star)
+		return (size_t)(e - s) == g->n &&
+		    anchored_match(g, 0, g->n, g->plain_prefix, s);
+	if ((size_t)(e - s) < g->prefix + g->suffix ||
+	    !anchored_match(g, 0, g->prefix, g->plain_prefix, s) ||
+	    !anchored_match(g, g->n - g->suffix, g->suffix, g->plain_suffix,
+	    e - g->suffix))
+		return false;
+	s += g->prefix;
+	e -= g->suffix;
+	/* between the first star and the last one */
+	i = star = g->prefix;
+	end = g->n - g->suffix;
+	while (s != e) {
+		if (i != end && g->elems[i].type == GLOB_STAR) {
+			star = i++;
+			backtrack = s;
+		} else if (i != end && elem_match(g, i, *s)) {
+			i++;
+			s++;
+		} else {
+			i = star+1;
+			s = ++backtrack;
+		}
+	}
+	while (i != end && g->elems[i].type == GLOB_STAR)
+		i++;
+	return i == end;
+}
+
 /*-
  *-----------------------------------------------------------------------
  * Str_SYSVMatch --
@@ -482,3 +733,35 @@ Str_rchri(const char *begin, const char *end, int c)
 		} while (end != begin);
 	return NULL;
 }
+
+/* interned strings live forever, so they come from the region */
+struct interned {
+	char s[1];
+};
+
+static struct ohash_info interned_info = {
+	offsetof(struct interned, s), NULL,
+	hash_calloc, hash_free, region_element_alloc
+};
+
+static struct ohash interned;
+static bool interned_init = false;
+
+const char *
+Str_Interni(const char *begin, const char *end)
+{
+	struct interned *i;
+	unsigned int slot;
+
+	if (!interned_init) {
+		ohash_init(&interned, 8, &interned_info);
+		interned_init = true;
+	}
+	slot = hash_qlookupi(&interned, begin, &end);
+	i = ohash_find(&interned, slot);
+	if (i == NULL) {
+		i = ohash_create_entry(&interned_info, begin, &end);
+		ohash_insert(&interned, slot, i);
+	}
+	return i->s;
+}
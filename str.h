@@ -39,13 +39,30 @@ extern char *Str_concati(const char *, const char *, const char *, const char *,
  *	strdup on intervals.  */
 extern char *Str_dupi(const char *, const char *);
 
+/* s = Str_Interni(str, end);
+ *	return the one shared copy of str/end (end may be NULL).  Interned
+ *	strings are never freed, and equal strings compare equal as
+ *	pointers.  */
+extern const char *Str_Interni(const char *, const char *);
+#define Str_Intern(s)	Str_Interni(s, NULL)
+
 /* copy = escape_dupi(str, end, set);
  *	copy string str/end. All escape sequences such as \c with c in set
  *	are handled as well.  */
 extern char *escape_dupi(const char *, const char *, const char *);
 
 
-extern char **brk_string(const char *, int *, char **);
+/* argv = brk_string(str, &argc);
+ *	split str into words the way a shell would for simple commands,
+ *	handling quotes and backslashes.  argv is a single allocation,
+ *	the caller frees it.  */
+extern char **brk_string(const char *, int *);
+
+/* begin = iterate_args(&position, &escaped);
+ *	Same words as brk_string, as intervals into the string: nothing
+ *	is copied.  escaped tells whether the word holds quotes or
+ *	backslashes, in which case brk_string would rewrite it.  */
+extern const char *iterate_args(const char **, bool *);
 
 
 /* Iterate through a string word by word,
@@ -65,6 +82,24 @@ extern bool Str_Matchi(const char *, const char *, const char *, const char *);
 #define Str_Match(string, pattern) \
 	Str_Matchi(string, strchr(string, '\0'), pattern, strchr(pattern, '\0'))
 
+/* glob = Str_CompileGlobi(pat, end);
+ *	compile pattern pat/end once, for matching lots of strings against
+ *	it.  */
+struct Glob;
+extern struct Glob *Str_CompileGlobi(const char *, const char *);
+#define Str_CompileGlob(pattern) \
+	Str_CompileGlobi(pattern, strchr(pattern, '\0'))
+
+/* match = Str_GlobMatchi(glob, str, estr);
+ *	same as Str_Matchi(str, estr, pat, end), only faster.  */
+extern bool Str_GlobMatchi(const struct Glob *, const char *, const char *);
+#define Str_GlobMatch(glob, string) \
+	Str_GlobMatchi(glob, string, strchr(string, '\0'))
+
+/* Str_FreeGlob(glob);
+ *	free what Str_CompileGlobi built.  */
+extern void Str_FreeGlob(struct Glob *);
+
 extern const char *Str_SYSVMatch(const char *, const char *, size_t *);
 extern void Str_SYSVSubst(Buffer, const char *, const char *, size_t);
 #endif
@@ -58,11 +58,15 @@
 #include "error.h"
 #include "str.h"
 #include "lst.h"
+#include "buf.h"
 #include "memory.h"
+#include "hash.h"
 #include "gnode.h"
 #include "stats.h"
 #include "dump.h"
 #include "expandchildren.h"
+#include "trace.h"
+#include "snapshot.h"
 
 /* XXX the suffixes hash is stored using a specific hash function, suitable
  * for looking up suffixes in reverse.
@@ -101,15 +105,38 @@ struct Suff_ {
 #define SUFF_ACTIVE	  0x08	/* We never destroy suffixes and rules, */
 				/* we just deactivate them. */
 #define SUFF_PATH	  0x10	/* False suffix: actually, the path keyword */
+#define SUFF_FULLPATH	  0x20	/* searchPath has defaultPath at the end */
 	LIST searchPath;	/* The path along which files of this suffix
 			     	 * may be found */
 	int order;		/* order of declaration for conflict
 				 * resolution. */
 	LIST parents;		/* List of Suff we have a transformation to */
 	LIST children;		/* List of Suff we have a transformation from */
+	struct chain *chain;	/* every way to get to this suffix, see
+				 * suff_chain */
 	char name[1];
 };
 
+/*
+ * All the transformation paths that lead to a suffix, in the order
+ * SuffFindThem tries them: breadth-first, then by suffix order.
+ * The suffixes graph is complete before we look for any implied source,
+ * so we compute those once, and only build Src structures for the path
+ * we end up using.
+ */
+struct chain_step {
+	Suff *suff;
+	int parent;		/* index of the step we transform to,
+				 * -1 for the suffix itself */
+};
+
+struct chain {
+	struct chain_step *steps;
+	unsigned int nsteps, maxsteps;
+	unsigned int *levels;	/* level i is [levels[i], levels[i+1]) */
+	unsigned int nlevels;
+};
+
 static struct ohash_info suff_info = {
 	offsetof(struct Suff_, name), NULL,
 	hash_calloc, hash_free, element_alloc
@@ -131,18 +158,22 @@ typedef struct Src_ {
 #endif
 } Src;
 
-/*
- * A structure for passing more than one argument to the Lst-library-invoked
- * function...
- */
-typedef struct {
-	Lst l;
-	Src *s;
-} LstSrc;
-
 static Suff *emptySuff; /* The empty suffix required for POSIX
 			 * single-suffix transformation rules */
 
+/* What Suff_ProbeDeps hands over to Dir_ProbeFiles: one group of names
+ * per target, each ending with NULL */
+struct probes {
+	char **names;
+	Lst *paths;
+	unsigned int n, size;
+	struct {
+		Suff *suff;
+		size_t prefixLen;
+	} *srcs;		/* like SuffFindNormalDeps' srcs */
+	unsigned int nsrcs;
+};
+
 
 #define parse_transform(s, p, q) parse_transformi(s, s + strlen(s), p, q)
 static bool parse_transformi(const char *, const char *, Suff **, Suff **);
@@ -157,13 +188,19 @@ static Suff *find_suffix_as_suffix(Lst, const char *, const char *);
 static Suff *add_suffixi(const char *, const char *);
 
 static void SuffInsert(Lst, Suff *);
-static void SuffAddSrc(void *, void *);
+static Src *new_src(Src *, Suff *);
 static bool SuffRemoveSrc(Lst);
-static void SuffAddLevel(Lst, Src *);
+static bool on_path(struct chain_step *, int, Suff *);
+static void add_steps(struct chain *, Suff *, Suff *, int);
+static struct chain *suff_chain(Suff *);
+static Src *src_for_step(Src *, struct chain *, int, Lst);
 static Src *SuffFindThem(Lst, Lst);
 static Src *SuffFindCmds(Src *, Lst);
 static bool SuffApplyTransform(GNode *, GNode *, Suff *, Suff *);
 static void SuffFindDeps(GNode *, Lst);
+static bool probe_chains(struct probes *, const char *);
+static void probe_name(struct probes *, char *, Lst);
+static void probe_candidates(struct probes *, GNode *);
 static void SuffFindArchiveDeps(GNode *, Lst);
 static void SuffFindNormalDeps(GNode *, Lst);
 static void SuffPrintName(void *);
@@ -175,7 +212,7 @@ static Suff *find_suffi(const char *, const char *);
 static Suff *find_best_suffix(const char *, const char *);
 static GNode *find_transform(const char *);
 static GNode *find_or_create_transformi(const char *, const char *);
-static void setup_paths(void);
+static Lst suffix_path(Suff *);
 static void build_suffixes_graph(void);
 static void special_path_hack(void);
 
@@ -261,7 +298,7 @@ find_transform(const char *name)
 #ifdef STATS_SUFF
 	STAT_TRANSFORM_LOOKUP_NAME++;
 #endif
-	slot = ohash_qlookup(&transforms, name);
+	slot = hash_qlookup(&transforms, name);
 
 	return ohash_find(&transforms, slot);
 }
@@ -275,7 +312,7 @@ find_or_create_transformi(const char *name, const char *end)
 #ifdef STATS_SUFF
 	STAT_TRANSFORM_LOOKUP_NAME++;
 #endif
-	slot = ohash_qlookupi(&transforms, name, &end);
+	slot = hash_qlookupi(&transforms, name, &end);
 
 	r = ohash_find(&transforms, slot);
 
@@ -457,7 +494,7 @@ find_best_path(const char *name)
 	if (s != NULL) {
 		if (DEBUG(SUFF))
 			printf("suffix is \"%s\"...", s->name);
-		return &s->searchPath;
+		return suffix_path(s);
 	} else
 		return defaultPath;
 }
@@ -493,6 +530,7 @@ Suff_ParseAsTransform(const char *line, const char *end)
 	if (!Lst_IsEmpty(&gn->children)) {
 		Lst_Destroy(&gn->children, NOFREE);
 		Lst_Init(&gn->children);
+		Targ_ForgetChildren(gn);
 	}
 
 	gn->type = OP_TRANSFORM;
@@ -528,6 +566,7 @@ new_suffixi(const char *str, const char *eptr)
 	Lst_Init(&s->searchPath);
 	Lst_Init(&s->children);
 	Lst_Init(&s->parents);
+	s->chain = NULL;
 	s->flags = 0;
 	return s;
 }
@@ -570,11 +609,19 @@ Lst
 find_suffix_path(GNode *gn)
 {
 	if (gn->suffix != NULL && gn->suffix != emptySuff)
-		return &(gn->suffix->searchPath);
+		return suffix_path(gn->suffix);
 	else
 		return defaultPath;
 }
 
+/* Most makefiles only ever use a few of the suffixes and transforms
+ * sys.mk declares, so the rest of the setup waits until it's needed:
+ * the graph until we first look for implied sources, and each suffix's
+ * path until we first look for a file with it.  A snapshot holds the
+ * transforms, the graph gets built from them the same way.  */
+static bool parse_done = false;
+static bool graph_built = false;
+
 static void
 build_suffixes_graph(void)
 {
@@ -582,6 +629,9 @@ build_suffixes_graph(void)
 	GNode *gn;
 	unsigned int i;
 
+	if (graph_built || !parse_done)
+		return;
+	graph_built = true;
 	for (gn = ohash_first(&transforms, &i); gn != NULL;
 	    gn = ohash_next(&transforms, &i)) {
 	    	if (Lst_IsEmpty(&gn->commands) && Lst_IsEmpty(&gn->children))
@@ -595,66 +645,44 @@ build_suffixes_graph(void)
 	}
 }
 
-/*-
- *-----------------------------------------------------------------------
- * setup_paths
- *	Extend the search paths for all suffixes to include the default
- *	search path.
- *
- * Side Effects:
- *	The searchPath field of all the suffixes is extended by the
- *	directories in defaultPath. 
- *-----------------------------------------------------------------------
- */
-static void
-setup_paths(void)
+/* The search path for files with suffix s: once the makefile is read,
+ * it gets extended with the directories in defaultPath.  */
+static Lst
+suffix_path(Suff *s)
 {
-	unsigned int i;
-	Suff *s;
-
-	for (s = ohash_first(&suffixes, &i); s != NULL;
-	    s = ohash_next(&suffixes, &i)) {
+	if (parse_done && !(s->flags & SUFF_FULLPATH)) {
 		if (!Lst_IsEmpty(&s->searchPath))
 			Dir_Concat(&s->searchPath, defaultPath);
 		else
 			Lst_Clone(&s->searchPath, defaultPath, Dir_CopyDir);
+		s->flags |= SUFF_FULLPATH;
 	}
+	return &s->searchPath;
 }
 
 void
 process_suffixes_after_makefile_is_read(void)
 {
-	/* once the Makefile is finish reading, we can set up the default PATH
-	 * stuff, and build the final suffixes graph
-	 */
-	setup_paths();
-	/* and we link all transforms to active suffixes at this point. */
-	build_suffixes_graph();
+	/* once the Makefile is finish reading, the default PATH stuff and
+	 * the transforms are final */
+	parse_done = true;
 }
 	  /********** Implicit Source Search Functions *********/
 
 /*-
  *-----------------------------------------------------------------------
- * SuffAddSrc  --
- *	Add a suffix as a Src structure to the given list with its parent
- *	being the given Src structure. If the suffix is the null suffix,
- *	the prefix is used unaltered as the file name in the Src structure.
- *
- * Side Effects:
- *	A Src structure is created and tacked onto the end of the list
+ * new_src  --
+ *	Create a Src structure for a suffix, with its parent being the
+ *	given Src structure. If the suffix is the null suffix, the prefix
+ *	is used unaltered as the file name in the Src structure.
  *-----------------------------------------------------------------------
  */
-static void
-SuffAddSrc(
-    void *sp,		/* suffix for which to create a Src structure */
-    void *lsp)		/* list and parent for the new Src */
+static Src *
+new_src(
+    Src *targ,		/* parent for the new Src */
+    Suff *s)		/* suffix for which to create a Src structure */
 {
-	Suff *s = sp;
-	LstSrc *ls = lsp;
 	Src *s2;	/* new Src structure */
-	Src *targ;	/* Target structure */
-
-	targ = ls->s;
 
 	s2 = emalloc(sizeof(Src));
 	s2->file = Str_concat(targ->prefix, s->name, 0);
@@ -664,37 +692,80 @@ SuffAddSrc(
 	s2->suff = s;
 	s2->children = 0;
 	targ->children++;
-	Lst_AtEnd(ls->l, s2);
 #ifdef DEBUG_SRC
 	Lst_Init(&s2->cp);
 	Lst_AtEnd(&targ->cp, s2);
-	printf("2 add %x %x to %x:", targ, s2, ls->l);
-	Lst_Every(ls->l, PrintAddr);
-	printf("\n");
+	printf("2 add %x %x\n", targ, s2);
 #endif
+	return s2;
+}
 
+/* A suffix that already occurs on the path would give us a file we
+ * already looked for, or the target itself: going there again can only
+ * send us around in circles.  */
+static bool
+on_path(struct chain_step *steps, int i, Suff *s)
+{
+	for (; i != -1; i = steps[i].parent)
+		if (steps[i].suff == s)
+			return true;
+	return false;
 }
 
-/*-
- *-----------------------------------------------------------------------
- * SuffAddLevel  --
- *	Add all the children of targ as Src structures to the given list
- *
- * Side Effects:
- *	Lots of structures are created and added to the list
- *-----------------------------------------------------------------------
- */
 static void
-SuffAddLevel(
-    Lst l,	/* list to which to add the new level */
-    Src *targ)	/* Src structure to use as the parent */
+add_steps(struct chain *c, Suff *s, Suff *from, int parent)
 {
-	LstSrc	   ls;
+	LstNode ln;
+
+	for (ln = Lst_First(&from->children); ln != NULL; ln = Lst_Adv(ln)) {
+		Suff *s2 = Lst_Datum(ln);
 
-	ls.s = targ;
-	ls.l = l;
+		if (s2 == s || on_path(c->steps, parent, s2))
+			continue;
+		if (c->nsteps == c->maxsteps) {
+			c->maxsteps *= 2;
+			c->steps = ereallocarray(c->steps, c->maxsteps,
+			    sizeof(struct chain_step));
+		}
+		c->steps[c->nsteps].suff = s2;
+		c->steps[c->nsteps].parent = parent;
+		c->nsteps++;
+	}
+}
 
-	Lst_ForEach(&targ->suff->children, SuffAddSrc, &ls);
+static struct chain *
+suff_chain(Suff *s)
+{
+	struct chain *c;
+	unsigned int first, last, i, maxlevels = 4;
+
+	if (s->chain != NULL)
+		return s->chain;
+
+	c = emalloc(sizeof(struct chain));
+	c->maxsteps = 8;
+	c->nsteps = 0;
+	c->steps = ereallocarray(NULL, c->maxsteps, sizeof(struct chain_step));
+	c->levels = ereallocarray(NULL, maxlevels, sizeof(unsigned int));
+	c->nlevels = 0;
+	c->levels[0] = 0;
+
+	/* each level comes from the previous one, the first one straight
+	 * from s */
+	add_steps(c, s, s, -1);
+	for (first = 0; c->nsteps != first; first = last) {
+		last = c->nsteps;
+		if (c->nlevels + 2 > maxlevels) {
+			maxlevels *= 2;
+			c->levels = ereallocarray(c->levels, maxlevels,
+			    sizeof(unsigned int));
+		}
+		c->levels[++c->nlevels] = last;
+		for (i = first; i < last; i++)
+			add_steps(c, s, c->steps[i].suff, i);
+	}
+	s->chain = c;
+	return c;
 }
 
 /*-
@@ -752,10 +823,26 @@ SuffRemoveSrc(Lst l)
 	return false;
 }
 
+/* Build the Src structures for the path from the target to step i.
+ * The ones in between get recorded in slst, so that they get freed.  */
+static Src *
+src_for_step(Src *targ, struct chain *c, int i, Lst slst)
+{
+	Src *parent;
+
+	if (i == -1)
+		return targ;
+	parent = src_for_step(targ, c, c->steps[i].parent, slst);
+	if (parent != targ)
+		Lst_AtEnd(slst, parent);
+	return new_src(parent, c->steps[i].suff);
+}
+
 /*-
  *-----------------------------------------------------------------------
  * SuffFindThem --
- *	Find the first existing file/target in the list srcs
+ *	Find the first existing file/target that can be transformed into
+ *	one of the targets in the list srcs, level by level.  Empties srcs.
  *
  * Results:
  *	The lowest structure in the chain of transformations
@@ -763,47 +850,67 @@ SuffRemoveSrc(Lst l)
  */
 static Src *
 SuffFindThem(
-    Lst srcs,	/* list of Src structures to search through */
+    Lst srcs,	/* list of Src structures to search from */
     Lst slst)
 {
-	Src *s;		/* current Src */
+	Src *targ;	/* current target */
 	Src *rs; 	/* returned Src */
-	char *ptr;
+	struct chain *c;
+	LstNode ln;
+	BUFFER file;
+	char space[MAKE_BSIZE];
+	unsigned int level, i;
+	bool more;
+	char *name, *ptr;
 
 	rs = NULL;
+	Buf_InitLocal(&file, space, sizeof(space));
+
+	for (level = 0, more = true; more && rs == NULL; level++) {
+		more = false;
+		for (ln = Lst_First(srcs); ln != NULL && rs == NULL;
+		    ln = Lst_Adv(ln)) {
+			targ = Lst_Datum(ln);
+			c = suff_chain(targ->suff);
+			if (level >= c->nlevels)
+				continue;
+			more = true;
+			for (i = c->levels[level]; i < c->levels[level+1];
+			    i++) {
+				Suff *s = c->steps[i].suff;
+
+				Buf_Reset(&file);
+				Buf_AddString(&file, targ->prefix);
+				Buf_AddChars(&file, s->nameLen, s->name);
+				name = Buf_Retrieve(&file);
+				if (DEBUG(SUFF))
+					printf("\ttrying %s...", name);
+
+				/*
+				 * A file is considered to exist if either a
+				 * node exists in the graph for it or the file
+				 * actually exists.
+				 */
+				if (Targ_FindNode(name, TARG_NOCREATE) != NULL) {
+					rs = src_for_step(targ, c, i, slst);
+					break;
+				}
 
-	while ((s = Lst_DeQueue(srcs)) != NULL) {
-		if (DEBUG(SUFF))
-			printf("\ttrying %s...", s->file);
-
-		/*
-		 * A file is considered to exist if either a node exists in the
-		 * graph for it or the file actually exists.
-		 */
-		if (Targ_FindNode(s->file, TARG_NOCREATE) != NULL) {
-#ifdef DEBUG_SRC
-			printf("remove %x from %x\n", s, srcs);
-#endif
-			rs = s;
-			break;
-		}
+				ptr = Dir_FindFile(name, suffix_path(s));
+				if (ptr != NULL) {
+					rs = src_for_step(targ, c, i, slst);
+					free(ptr);
+					break;
+				}
 
-		if ((ptr = Dir_FindFile(s->file, &s->suff->searchPath))
-		    != NULL) {
-			rs = s;
-#ifdef DEBUG_SRC
-			printf("remove %x from %x\n", s, srcs);
-#endif
-			free(ptr);
-			break;
+				if (DEBUG(SUFF))
+				    printf("not there\n");
+			}
 		}
-
-		if (DEBUG(SUFF))
-		    printf("not there\n");
-
-		SuffAddLevel(srcs, s);
-		Lst_AtEnd(slst, s);
 	}
+	Buf_Destroy(&file);
+	while (Lst_DeQueue(srcs) != NULL)
+		continue;
 
 	if (DEBUG(SUFF) && rs)
 	    printf("got it\n");
@@ -910,7 +1017,7 @@ SuffApplyTransform(
 	char	*tname; /* Name of transformation rule */
 	GNode	*gn;	/* Node for same */
 
-	if (Lst_AddNew(&tGn->children, sGn)) {
+	if (Targ_AddChild(tGn, sGn)) {
 		/* Not already linked, so form the proper links between the
 		 * target and source.  */
 		LinkParent(sGn, tGn);
@@ -924,7 +1031,7 @@ SuffApplyTransform(
 		for (ln=Lst_First(&sGn->cohorts); ln != NULL; ln=Lst_Adv(ln)) {
 			gn = Lst_Datum(ln);
 
-			if (Lst_AddNew(&tGn->children, gn)) {
+			if (Targ_AddChild(tGn, gn)) {
 				/* Not already linked, so form the proper links
 				 * between the target and source.  */
 				LinkParent(gn, tGn);
@@ -1019,7 +1126,7 @@ SuffFindArchiveDeps(
 	SuffFindDeps(mem, slst);
 
 	/* Create the link between the two nodes right off. */
-	if (Lst_AddNew(&gn->children, mem))
+	if (Targ_AddChild(gn, mem))
 		LinkParent(mem, gn);
 
 	/* Copy variables from member node to this one.  */
@@ -1038,7 +1145,9 @@ SuffFindArchiveDeps(
 
 	/* Set the other two local variables required for this target.  */
 	Var(MEMBER_INDEX, gn) = mem->name;
-	Var(ARCHIVE_INDEX, gn) = gn->name;
+	/* only set here, so anything there is ours from last time */
+	free(Var(ARCHIVE_INDEX, gn));
+	Var(ARCHIVE_INDEX, gn) = Str_dupi(gn->name, eoarch);
 
 	if (ms != NULL) {
 		/*
@@ -1096,8 +1205,9 @@ record_possible_suffix(Suff *s, GNode *gn, char *eoname, Lst srcs, Lst targs)
 	memcpy(targ->prefix, gn->name, prefixLen);
 	targ->prefix[prefixLen] = '\0';
 
-	/* Add nodes from which the target can be made.  */
-	SuffAddLevel(srcs, targ);
+	/* Look for nodes from which the target can be made.  */
+	if (!Lst_IsEmpty(&s->children))
+		Lst_AtEnd(srcs, targ);
 
 	/* Record the target so we can nuke it.  */
 	Lst_AtEnd(targs, targ);
@@ -1196,7 +1306,7 @@ SuffFindNormalDeps(
 		/* Only use the default suffix rules if we don't have commands
 		 * or dependencies defined for this gnode.  */
 		if (Lst_IsEmpty(&gn->commands) && Lst_IsEmpty(&gn->children))
-			SuffAddLevel(&srcs, targ);
+			Lst_AtEnd(&srcs, targ);
 		else {
 			if (DEBUG(SUFF))
 				printf("not ");
@@ -1252,7 +1362,7 @@ sfnd_abort:
 		    Lst_IsEmpty(&gn->commands))) {
 			gn->path = Dir_FindFile(gn->name,
 			    (targ == NULL ? defaultPath :
-			    &targ->suff->searchPath));
+			    suffix_path(targ->suff)));
 			if (gn->path != NULL) {
 				char *ptr;
 				Var(TARGET_INDEX, gn) = estrdup(gn->path);
@@ -1407,18 +1517,156 @@ sfnd_return:
  *	the .c and .l files don't, the search will branch out in
  *	all directions from .o and again from all the nodes on the
  *	next level until the .l,v node is encountered.
+ *
+ *	This runs in the main thread only: looking for a file may add
+ *	directories to search paths and fills the directory caches.
+ *	Suff_ProbeDeps does the slow part ahead of time from threads.
  *-----------------------------------------------------------------------
  */
 
 void
 Suff_FindDeps(GNode *gn)
 {
-
+	/* done already: no need for the graph */
+	if (gn->type & OP_DEPS_FOUND)
+		return;
+	build_suffixes_graph();
+	trace_begin("suff", gn->name);
 	SuffFindDeps(gn, &srclist);
 	while (SuffRemoveSrc(&srclist))
 		continue;
+	trace_end();
+}
+
+
+static void
+probe_name(struct probes *pr, char *name, Lst path)
+{
+	if (pr->n == pr->size) {
+		pr->size = pr->size == 0 ? 256 : pr->size * 2;
+		pr->names = ereallocarray(pr->names, pr->size, sizeof(char *));
+		pr->paths = ereallocarray(pr->paths, pr->size, sizeof(Lst));
+	}
+	pr->names[pr->n] = name;
+	pr->paths[pr->n++] = path;
+}
+
+/* the names SuffFindThem will look for, in the same order: false if it
+ * stops at an existing node */
+static bool
+probe_chains(struct probes *pr, const char *name)
+{
+	unsigned int level, i, j;
+	bool more;
+	char *file;
+
+	for (level = 0, more = true; more; level++) {
+		more = false;
+		for (j = 0; j < pr->nsrcs; j++) {
+			Suff *s = pr->srcs[j].suff;
+			size_t len = pr->srcs[j].prefixLen;
+			struct chain *c = suff_chain(s);
+
+			if (level >= c->nlevels)
+				continue;
+			more = true;
+			for (i = c->levels[level]; i < c->levels[level+1];
+			    i++) {
+				Suff *s2 = c->steps[i].suff;
+
+				file = emalloc(len + s2->nameLen + 1);
+				memcpy(file, name, len);
+				memcpy(file + len, s2->name, s2->nameLen + 1);
+				if (Targ_FindNode(file, TARG_NOCREATE) != NULL) {
+					free(file);
+					return false;
+				}
+				probe_name(pr, file, suffix_path(s2));
+			}
+		}
+	}
+	return true;
+}
+
+/* same suffixes as record_possible_suffixes, same lookups as
+ * SuffFindNormalDeps */
+static void
+probe_candidates(struct probes *pr, GNode *gn)
+{
+	const char *s = gn->name;
+	const char *e = s + strlen(s);
+	const char *p;
+	uint32_t hv;
+	unsigned int slot;
+	Suff *suff, *first = NULL;
+
+	pr->nsrcs = 0;
+	p = e;
+	hv = *--p;
+	while (p != s) {
+		slot = ohash_lookup_interval(&suffixes, p, e, hv);
+		suff = ohash_find(&suffixes, slot);
+		if (suff != NULL && (suff->flags & SUFF_ACTIVE)) {
+			if (first == NULL)
+				first = suff;
+			if (!Lst_IsEmpty(&suff->children)) {
+				pr->srcs[pr->nsrcs].suff = suff;
+				pr->srcs[pr->nsrcs++].prefixLen = p - s;
+			}
+		}
+		if (e - p >= (ptrdiff_t)maxLen)
+			break;
+		reverse_hash_add_char(&hv, --p);
+	}
+	if (pr->nsrcs == 0 && Lst_IsEmpty(&gn->commands) &&
+	    Lst_IsEmpty(&gn->children)) {
+		pr->srcs[0].suff = emptySuff;
+		pr->srcs[pr->nsrcs++].prefixLen = e - s;
+	}
+	/* if nothing turns up, a source gets looked for by itself */
+	if (probe_chains(pr, s) && (OP_NOP(gn->type) ||
+	    (Lst_IsEmpty(&gn->children) && Lst_IsEmpty(&gn->commands))))
+		probe_name(pr, estrdup(s),
+		    first == NULL ? defaultPath : suffix_path(first));
+	probe_name(pr, NULL, NULL);
 }
 
+void
+Suff_ProbeDeps(GNode **nodes, unsigned int n)
+{
+	struct probes pr;
+	GNode *gn;
+	unsigned int i;
+
+	pr.names = NULL;
+	pr.paths = NULL;
+	pr.n = pr.size = 0;
+	pr.srcs = NULL;
+	for (i = 0; i < n; i++) {
+		gn = nodes[i];
+		if (gn->type & (OP_DEPS_FOUND | OP_ARCHV | OP_MEMBER | OP_USE))
+			continue;
+		/* without a slash, Dir_FindFile is just lookups */
+		if (strchr(gn->name, '/') == NULL)
+			continue;
+		/* only set up the graph if something is going to use it */
+		if (pr.srcs == NULL) {
+			build_suffixes_graph();
+			/* each suffix has a different length */
+			pr.srcs = ereallocarray(NULL, maxLen + 1,
+			    sizeof(*pr.srcs));
+		}
+		probe_candidates(&pr, gn);
+	}
+	if (pr.srcs == NULL)
+		return;
+	Dir_ProbeFiles(pr.names, pr.paths, pr.n);
+	for (i = 0; i < pr.n; i++)
+		free(pr.names[i]);
+	free(pr.names);
+	free(pr.paths);
+	free(pr.srcs);
+}
 
 static void
 SuffFindDeps(GNode *gn, Lst slst)
@@ -1461,7 +1709,7 @@ Suff_Init(void)
 	/* Create null suffix for single-suffix rules (POSIX). The thing doesn't
 	 * actually go on the suffix list as it matches everything.  */
 	emptySuff = new_suffix("");
-	emptySuff->flags = SUFF_ACTIVE;
+	emptySuff->flags = SUFF_ACTIVE | SUFF_FULLPATH;
 	emptySuff->order = 0;
 	Dir_Concat(&emptySuff->searchPath, defaultPath);
 	ohash_init(&suffixes, 4, &suff_info);
@@ -1469,6 +1717,87 @@ Suff_Init(void)
 }
 
 
+struct ohash *
+transforms_hash(void)
+{
+	return &transforms;
+}
+
+/* Snapshots are taken right after parsing, so the suffixes graph and
+ * the full search paths aren't there yet.  The transforms are saved as
+ * nodes by snapshot.c, we just recreate them with their suffix.  */
+void
+Suff_Save(Snapshot *snap)
+{
+	Suff *s;
+	GNode *gn;
+	unsigned int i;
+
+	snap_put_int(snap, order);
+	snap_put_int(snap, maxLen);
+	snap_put_int(snap, ohash_entries(&suffixes));
+	for (s = ohash_first(&suffixes, &i); s != NULL;
+	    s = ohash_next(&suffixes, &i)) {
+		snap_put_string(snap, s->name);
+		snap_put_int(snap, s->flags);
+		snap_put_int(snap, s->order);
+		snap_put_path(snap, &s->searchPath);
+	}
+	snap_put_int(snap, ohash_entries(&transforms));
+	for (gn = ohash_first(&transforms, &i); gn != NULL;
+	    gn = ohash_next(&transforms, &i)) {
+		snap_put_string(snap, gn->name);
+		if (gn->suffix == NULL)
+			snap_put_string(snap, NULL);
+		else
+			snap_put_string(snap, gn->suffix == emptySuff ? "" :
+			    gn->suffix->name);
+	}
+}
+
+void
+Suff_Restore(Snapshot *snap)
+{
+	const char *name, *e;
+	unsigned long n;
+	unsigned int slot;
+	Suff *s;
+	GNode *gn;
+
+	order = snap_get_int(snap);
+	maxLen = snap_get_int(snap);
+	for (n = snap_get_int(snap); n > 0; n--) {
+		name = snap_get_string(snap);
+		if (name == NULL)
+			return;
+		e = NULL;
+		slot = reverse_slot(&suffixes, name, &e);
+		s = ohash_find(&suffixes, slot);
+		if (s == NULL) {
+			s = new_suffixi(name, e);
+			ohash_insert(&suffixes, slot, s);
+		}
+		s->flags = snap_get_int(snap);
+		s->order = snap_get_int(snap);
+		Lst_Destroy(&s->searchPath, Dir_Destroy);
+		Lst_Init(&s->searchPath);
+		snap_get_path(snap, &s->searchPath);
+	}
+	for (n = snap_get_int(snap); n > 0; n--) {
+		name = snap_get_string(snap);
+		e = snap_get_string(snap);
+		if (name == NULL)
+			return;
+		gn = find_or_create_transformi(name, strchr(name, '\0'));
+		if (e == NULL)
+			gn->suffix = NULL;
+		else if (*e == '\0')
+			gn->suffix = emptySuff;
+		else
+			gn->suffix = find_suff(e);
+	}
+}
+
 /********************* DEBUGGING FUNCTIONS **********************/
 
 static void
@@ -1521,7 +1850,7 @@ print_path(Suff *s)
 	LstNode ln1, ln2;
 	bool first = true;
 
-	for (ln1 = Lst_First(&s->searchPath), ln2 = Lst_First(defaultPath);
+	for (ln1 = Lst_First(suffix_path(s)), ln2 = Lst_First(defaultPath);
 	    ln1 != NULL && ln2 != NULL; 
 	    ln1 = Lst_Adv(ln1)) {
 		if (Lst_Datum(ln1) == Lst_Datum(ln2)) {
@@ -1547,6 +1876,7 @@ Suff_PrintAll(void)
 	bool reprint;
 
 
+	build_suffixes_graph();
 	printf("# Suffixes graph\n");
 	t = sort_ohash_by_name(&suffixes);
 	for (i = 0; t[i] != NULL; i++)
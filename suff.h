@@ -44,14 +44,20 @@ extern GNode *Suff_ParseAsTransform(const char *, const char *);
  *	suffix. */
 extern void Suff_AddSuffixi(const char *, const char *);
 /* process_suffixes_after_makefile_is_read():
- *	finish setting up the transformation graph for Suff_FindDep
- *	and the .PATH.sfx paths get the default path appended for
- *	find_suffix_path().  */
+ *	from now on, the transformation graph for Suff_FindDeps gets
+ *	built on first use, and the .PATH.sfx paths get the default path
+ *	appended as find_suffix_path() and friends need them.  */
 extern void process_suffixes_after_makefile_is_read(void);
 /* Suff_FindDeps(gn):
  *	find implicit dependencies for gn and fill out corresponding
  *	fields. */
 extern void Suff_FindDeps(GNode *);
+/* Suff_ProbeDeps(nodes, n):
+ *	Suff_FindDeps is coming for all of those, with nothing running in
+ *	between: look for the implied sources of the ones with a directory
+ *	in their name at once, from threads, so that it doesn't wait for
+ *	stat(2) on each miss. */
+extern void Suff_ProbeDeps(GNode **, unsigned int);
 /* l = find_suffix_path(gn):
  *	returns the path associated with a gn, either because of its
  *	suffix, or the default path.  */
@@ -63,4 +69,13 @@ extern void Suff_PrintAll(void);
  *	find the best path for the name, according to known suffixes.
  */
 extern Lst find_best_path(const char *name);
+/* h = transforms_hash():
+ *	all the transformation rules, as nodes. */
+extern struct ohash *transforms_hash(void);
+/* Suff_Save(snapshot):
+ *	save the suffixes, along with the transforms names. */
+extern void Suff_Save(Snapshot *);
+/* Suff_Restore(snapshot):
+ *	recreate them, the transforms being empty nodes. */
+extern void Suff_Restore(Snapshot *);
 #endif
@@ -109,6 +109,7 @@
 #include "var.h"
 #include "targ.h"
 #include "memory.h"
+#include "hash.h"
 #include "gnode.h"
 #include "extern.h"
 #include "timestamp.h"
@@ -118,8 +119,9 @@
 #include "dump.h"
 
 static struct ohash targets;	/* hash table of targets */
+static unsigned int n_nodes = 0;	/* for GNode id */
 struct ohash_info gnode_info = {
-	offsetof(GNode, name), NULL, hash_calloc, hash_free, element_alloc
+	offsetof(GNode, name), NULL, hash_calloc, hash_free, region_element_alloc
 };
 
 static GNode *Targ_mk_node(const char *, const char *, unsigned int,
@@ -135,6 +137,7 @@ Targ_Init(void)
 {
 	/* A small make file already creates 200 targets.  */
 	ohash_init(&targets, 10, &gnode_info);
+	hash_register(&targets, "targets");
 	begin_node = Targ_mk_constant(NODE_BEGIN, 
 	    OP_DUMMY | OP_NOTMAIN | OP_NODEFAULT);
 	end_node = Targ_mk_constant(NODE_END, 
@@ -153,6 +156,7 @@ Targ_mk_node(const char *name, const char *ename,
 	GNode *gn;
 
 	gn = ohash_create_entry(&gnode_info, name, &ename);
+	gn->id = n_nodes++;
 	gn->path = NULL;
 	gn->type = type;
 	gn->special = special;
@@ -160,15 +164,28 @@ Targ_mk_node(const char *name, const char *ename,
 	gn->children_left = 0;
 	gn->must_make = false;
 	gn->built_status = UNKNOWN;
-	gn->in_cycle = false;
+	gn->queued = false;
+	gn->children_queued = false;
 	gn->child_rebuilt = false;
+	gn->ordered = false;
+	gn->prepared = false;
+	gn->readahead = false;
+	gn->probed = false;
 	gn->order = 0;
+	gn->priority = PRIORITY_UNKNOWN;
+	gn->duration = 0;
 	ts_set_out_of_date(gn->mtime);
 	gn->youngest = gn;
 	Lst_Init(&gn->cohorts);
 	Lst_Init(&gn->parents);
 	Lst_Init(&gn->children);
+	gn->child_index = NULL;
+	gn->childv = NULL;
+	gn->parentv = NULL;
+	gn->nchildv = 0;
+	gn->nparentv = 0;
 	Lst_Init(&gn->predecessors);
+	gn->next_pred = NULL;
 	Lst_Init(&gn->successors);
 	SymTable_Init(&gn->localvars);
 	gn->impliedsrc = NULL;
@@ -176,8 +193,18 @@ Targ_mk_node(const char *name, const char *ename,
 	gn->suffix = NULL;
 	gn->next = NULL;
 	gn->basename = NULL;
+	gn->keys = NULL;
 	gn->sibling = gn;
 	gn->groupling = NULL;
+	gn->watched = NULL;
+	gn->waiters = NULL;
+	gn->next_waiter = NULL;
+	gn->group = NULL;
+	gn->group_building = NULL;
+	gn->pools = NULL;
+	gn->first_cmd = NULL;
+	gn->hint = HINT_NONE;
+	gn->rank = 0;
 
 #ifdef STATS_GN_CREATION
 	STAT_GN_COUNT++;
@@ -199,7 +226,7 @@ Targ_FindNodei(const char *name, const char *ename, int flags)
 	GNode *gn;
 	unsigned int slot;
 
-	hv = ohash_interval(name, &ename);
+	hv = hash_interval(name, &ename);
 
 	slot = ohash_lookup_interval(&targets, name, ename, hv);
 
@@ -231,6 +258,160 @@ Targ_mk_special_node(const char *name, size_t n, uint32_t hv,
 	return gn;
 }
 
+/* Checking for duplicate children is a linear search, which turns
+ * quadratic for targets with thousands of sources.  Past CHILD_INDEX_MIN
+ * children, we keep a hash of the children pointers on the side.
+ */
+#define CHILD_INDEX_MIN	32
+
+struct child_entry {
+	GNode *gn;
+};
+
+static struct ohash_info child_info = {
+	offsetof(struct child_entry, gn), NULL, hash_calloc, hash_free,
+	element_alloc
+};
+
+static unsigned int
+child_slot(struct ohash *h, GNode *cgn)
+{
+	return hash_lookup_memory(h, &cgn, sizeof(cgn));
+}
+
+static void
+index_child(struct ohash *h, GNode *cgn)
+{
+	struct child_entry *e;
+	unsigned int slot;
+
+	slot = child_slot(h, cgn);
+	if (ohash_find(h, slot) == NULL) {
+		e = emalloc(sizeof(*e));
+		e->gn = cgn;
+		ohash_insert(h, slot, e);
+	}
+}
+
+static void
+build_child_index(GNode *pgn)
+{
+	LstNode ln;
+
+	pgn->child_index = emalloc(sizeof(struct ohash));
+	ohash_init(pgn->child_index, 6, &child_info);
+	for (ln = Lst_First(&pgn->children); ln != NULL; ln = Lst_Adv(ln))
+		index_child(pgn->child_index, Lst_Datum(ln));
+}
+
+bool
+Targ_HasChild(GNode *pgn, GNode *cgn)
+{
+	LstNode ln;
+	unsigned int n = 0;
+
+	if (pgn->child_index != NULL)
+		return ohash_find(pgn->child_index,
+		    child_slot(pgn->child_index, cgn)) != NULL;
+	for (ln = Lst_First(&pgn->children); ln != NULL; ln = Lst_Adv(ln), n++)
+		if (Lst_Datum(ln) == cgn)
+			break;
+	/* even if we found it: the next one may be far down the list too */
+	if (n >= CHILD_INDEX_MIN)
+		build_child_index(pgn);
+	return ln != NULL;
+}
+
+void
+Targ_NoteChild(GNode *pgn, GNode *cgn)
+{
+	if (pgn->child_index != NULL)
+		index_child(pgn->child_index, cgn);
+	pgn->children_queued = false;
+	/* cgn is about to get pgn as a parent */
+	free(pgn->childv);
+	pgn->childv = NULL;
+	free(cgn->parentv);
+	cgn->parentv = NULL;
+}
+
+bool
+Targ_AddChild(GNode *pgn, GNode *cgn)
+{
+	if (Targ_HasChild(pgn, cgn))
+		return false;
+	Lst_AtEnd(&pgn->children, cgn);
+	Targ_NoteChild(pgn, cgn);
+	return true;
+}
+
+void
+Targ_ForgetChild(GNode *pgn, GNode *cgn)
+{
+	unsigned int slot;
+
+	if (pgn->child_index != NULL) {
+		slot = child_slot(pgn->child_index, cgn);
+		free(ohash_remove(pgn->child_index, slot));
+	}
+	free(pgn->childv);
+	pgn->childv = NULL;
+}
+
+void
+Targ_ForgetChildren(GNode *pgn)
+{
+	if (pgn->child_index != NULL) {
+		free_hash(pgn->child_index);
+		free(pgn->child_index);
+		pgn->child_index = NULL;
+	}
+	free(pgn->childv);
+	pgn->childv = NULL;
+}
+
+/* Walking the lists means chasing one malloc'ed node per edge all over
+ * the heap.  Once the graph settles down, a vector is much cheaper.  */
+static GNode **
+edge_vector(Lst l, GNode ***pv, unsigned int *pn)
+{
+	LstNode ln;
+	unsigned int n = 0;
+
+	if (*pv != NULL)
+		return *pv;
+	for (ln = Lst_First(l); ln != NULL; ln = Lst_Adv(ln))
+		n++;
+	*pv = ereallocarray(NULL, n == 0 ? 1 : n, sizeof(GNode *));
+	*pn = n;
+	n = 0;
+	for (ln = Lst_First(l); ln != NULL; ln = Lst_Adv(ln))
+		(*pv)[n++] = Lst_Datum(ln);
+	return *pv;
+}
+
+unsigned int
+Targ_Count(void)
+{
+	return n_nodes;
+}
+
+GNode **
+Targ_Children(GNode *gn, unsigned int *n)
+{
+	edge_vector(&gn->children, &gn->childv, &gn->nchildv);
+	*n = gn->nchildv;
+	return gn->childv;
+}
+
+GNode **
+Targ_Parents(GNode *gn, unsigned int *n)
+{
+	edge_vector(&gn->parents, &gn->parentv, &gn->nparentv);
+	*n = gn->nparentv;
+	return gn->parentv;
+}
+
 void
 Targ_FindList(Lst nodes, Lst names)
 {
@@ -313,6 +494,7 @@ Targ_PrintType(int type)
 		PRINTBIT(MAKE);
 		PRINTBIT(INVISIBLE);
 		PRINTBIT(NOTMAIN);
+		PRINTBIT(SINGLESHELL);
 		/*XXX: MEMBER is defined, so CONCAT(OP_,MEMBER) gives OP_"%" */
 		case OP_MEMBER:
 			if (DEBUG(TARG))
@@ -51,6 +51,30 @@ extern GNode *Targ_mk_special_node(const char *, size_t, uint32_t,
     unsigned int, unsigned char, unsigned int);
 
 extern void Targ_FindList(Lst, Lst);
+
+/* added = Targ_AddChild(pgn, cgn);
+ *	append cgn to pgn's children, unless it's already there. */
+extern bool Targ_AddChild(GNode *, GNode *);
+/* Targ_HasChild(pgn, cgn), quick even for thousands of children.
+ * Code that adds children by hand must call Targ_NoteChild(pgn, cgn);
+ * code that removes them must call Targ_ForgetChild(pgn, cgn), or
+ * Targ_ForgetChildren(pgn) after removing several.  */
+extern bool Targ_HasChild(GNode *, GNode *);
+extern void Targ_NoteChild(GNode *, GNode *);
+extern void Targ_ForgetChild(GNode *, GNode *);
+extern void Targ_ForgetChildren(GNode *);
+/* v = Targ_Children(gn, &n);
+ *	gn's children as a vector of n nodes, built from the list the first
+ *	time around.  It stays valid until children get added or removed,
+ *	so the loop walking it must not do that.  */
+extern GNode **Targ_Children(GNode *, unsigned int *);
+/* v = Targ_Parents(gn, &n);
+ *	the same for parents.  */
+extern GNode **Targ_Parents(GNode *, unsigned int *);
+/* n = Targ_Count();
+ *	number of nodes created so far: every gn->id is below that, so
+ *	side tables indexed by id can be sized from it.  */
+extern unsigned int Targ_Count(void);
 extern bool Targ_Ignore(GNode *);
 extern bool Targ_Silent(GNode *);
 extern bool Targ_Precious(GNode *);
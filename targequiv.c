@@ -40,12 +40,14 @@
 #include "config.h"
 #include "defines.h"
 #include "memory.h"
+#include "hash.h"
 #include "gnode.h"
 #include "lst.h"
 #include "suff.h"
 #include "dir.h"
 #include "targ.h"
 #include "targequiv.h"
+#include "str.h"
 
 struct equiv_list {
 	GNode *first, *last;
@@ -60,14 +62,12 @@ static struct ohash_info equiv_info = {
 static void attach_node(GNode *, GNode *);
 static void build_equivalence(void);
 static void add_to_equiv_list(struct ohash *, GNode *);
-static char *names_match(GNode *, GNode *);
-static char *names_match_with_dir(const char *, const char *, char *,
-    char *,  const char *);
-static char *names_match_with_dirs(const char *, const char *, char *,
-    char *,  const char *, const char *);
-static char *relative_reduce(const char *, const char *);
-static char *relative_reduce2(const char *, const char *, const char *);
-static char *absolute_reduce(const char *);
+static bool names_match(GNode *, GNode *);
+static struct equiv_keys *keys_of(GNode *);
+static struct equiv_keys *path_keys(GNode *, Lst);
+static const char *relative_reduce(const char *, const char *);
+static const char *relative_reduce2(const char *, const char *, const char *);
+static const char *absolute_reduce(const char *);
 static size_t parse_reduce(size_t, const char *);
 static void find_siblings(GNode *);
 
@@ -97,7 +97,7 @@ add_to_equiv_list(struct ohash *equiv, GNode *gn)
 		gn->basename = gn->name;
 	else
 		gn->basename++;
-	slot = ohash_qlookupi(equiv, gn->basename, &end);
+	slot = hash_qlookupi(equiv, gn->basename, &end);
 	e = ohash_find(equiv, slot);
 	if (e == NULL) {
 		e = ohash_create_entry(&equiv_info, gn->basename, &end);
@@ -167,7 +167,7 @@ kludge_look_harder_for_target(GNode *gn)
 			    ln = Lst_Adv(ln)) {
 				cgn = Lst_Datum(ln);
 
-				if (Lst_AddNew(&gn->children, cgn)) {
+				if (Targ_AddChild(gn, cgn)) {
 					Lst_AtEnd(&cgn->parents, gn);
 					gn->children_left++;
 				}
@@ -228,7 +228,8 @@ parse_reduce(size_t i, const char *src)
 	return i;
 }
 
-static char *
+/* reduced names are interned, so that matching is a pointer comparison */
+static const char *
 absolute_reduce(const char *src)
 {
 	size_t i = 0;
@@ -238,10 +239,10 @@ absolute_reduce(const char *src)
 
 	buffer[i++] = '/';
 	i = parse_reduce(i, src);
-	return estrdup(buffer);
+	return Str_Intern(buffer);
 }
 
-static char *
+static const char *
 relative_reduce(const char *dir, const char *src)
 {
 	size_t i = 0;
@@ -256,10 +257,10 @@ relative_reduce(const char *dir, const char *src)
 	if (buffer[i-1] != '/')
 		buffer[i++] = '/';
 	i = parse_reduce(i, src);
-	return estrdup(buffer);
+	return Str_Intern(buffer);
 }
 
-static char *
+static const char *
 relative_reduce2(const char *dir1, const char *dir2, const char *src)
 {
 	size_t i = 0;
@@ -279,129 +280,104 @@ relative_reduce2(const char *dir1, const char *dir2, const char *src)
 		buffer[i++] = '/';
 
 	i = parse_reduce(i, src);
-	return estrdup(buffer);
+	return Str_Intern(buffer);
 }
 
-static char *
-names_match_with_dir(const char *a, const char *b, char *ra,
-    char *rb,  const char *dir)
+/* Each node keeps its name reduced against every directory it can be
+ * relative to, so that matching two nodes is just comparing pointers:
+ * an absolute name has a single reduction, a relative name gets one for
+ * objdir, one for curdir, then two for each entry of the search path
+ * (absolute entries only use the first one).
+ * The path ones are only computed when needed.  */
+struct equiv_keys {
+	const char *abs;	/* the reduced name, for an absolute name */
+	Lst path;		/* what the rest was computed for */
+	unsigned int n;
+	const char *k[2];	/* objdir, curdir, then the path */
+};
+
+#define KEY(e, i)	((e)->abs != NULL ? (e)->abs : (e)->k[i])
+
+static struct equiv_keys *
+keys_of(GNode *gn)
 {
-	bool r;
-	bool free_a, free_b;
-
-	if (ra == NULL) {
-		ra = relative_reduce(dir, a);
-		free_a = true;
-	} else {
-		free_a = false;
-	}
+	struct equiv_keys *e = gn->keys;
 
-	if (rb == NULL) {
-		rb = relative_reduce(dir, b);
-		free_b = true;
-	} else {
-		free_b = false;
-	}
-	r = strcmp(ra, rb) == 0;
-	if (free_a)
-		free(ra);
-	if (r)
-		return rb;
-	else {
-		if (free_b)
-			free(rb);
-		return NULL;
+	if (e == NULL) {
+		e = emalloc(sizeof(struct equiv_keys));
+		e->path = NULL;
+		e->n = 2;
+		if (gn->name[0] == '/') {
+			e->abs = absolute_reduce(gn->name);
+			e->k[0] = e->k[1] = NULL;
+		} else {
+			e->abs = NULL;
+			e->k[0] = relative_reduce(objdir, gn->name);
+			e->k[1] = relative_reduce(curdir, gn->name);
+		}
+		gn->keys = e;
 	}
+	return e;
 }
 
-static char *
-names_match_with_dirs(const char *a, const char *b, char *ra,
-    char *rb,  const char *dir1, const char *dir2)
+static struct equiv_keys *
+path_keys(GNode *gn, Lst l)
 {
-	bool r;
-	bool free_a, free_b;
-
-	if (ra == NULL) {
-		ra = relative_reduce2(dir1, dir2, a);
-		free_a = true;
-	} else {
-		free_a = false;
-	}
-
-	if (rb == NULL) {
-		rb = relative_reduce2(dir1, dir2, b);
-		free_b = true;
-	} else {
-		free_b = false;
-	}
-	r = strcmp(ra, rb) == 0;
-	if (free_a)
-		free(ra);
-	if (r)
-		return rb;
-	else {
-		if (free_b)
-			free(rb);
-		return NULL;
+	struct equiv_keys *e = keys_of(gn);
+	LstNode ln;
+	unsigned int n;
+
+	if (e->path == l || e->abs != NULL)
+		return e;
+	for (n = 2, ln = Lst_First(l); ln != NULL; ln = Lst_Adv(ln))
+		n += 2;
+	e = erealloc(e, sizeof(struct equiv_keys) +
+	    (n - 2) * sizeof(e->k[0]));
+	gn->keys = e;
+	e->path = l;
+	e->n = n;
+	for (n = 2, ln = Lst_First(l); ln != NULL; ln = Lst_Adv(ln)) {
+		const char *p = PathEntry_name(Lst_Datum(ln));
+
+		if (p[0] == '/') {
+			e->k[n++] = relative_reduce(p, gn->name);
+			e->k[n++] = NULL;
+		} else {
+			e->k[n++] = relative_reduce2(p, objdir, gn->name);
+			e->k[n++] = relative_reduce2(p, curdir, gn->name);
+		}
 	}
+	return e;
 }
 
-static char *
+static bool
 names_match(GNode *a, GNode *b)
 {
-	char *ra = NULL , *rb = NULL;
-	char *r;
-
-	if (a->name[0] == '/')
-		ra = absolute_reduce(a->name);
-	if (b->name[0] == '/')
-		rb = absolute_reduce(b->name);
-	if (ra && rb) {
-		if (strcmp(ra, rb) == 0)
-			r = rb;
-		else
-			r = NULL;
-	} else {
-		r = names_match_with_dir(a->name, b->name, ra, rb, objdir);
-		if (!r)
-			r = names_match_with_dir(a->name, b->name, ra, rb,
-			    curdir);
-		if (!r) {
-			/* b has necessarily the same one */
-			Lst l = find_suffix_path(a);
-			LstNode ln;
-
-			for (ln = Lst_First(l); ln != NULL; ln = Lst_Adv(ln)) {
-				const char *p = PathEntry_name(Lst_Datum(ln));
-				if (p[0] == '/') {
-					r = names_match_with_dir(a->name,
-					    b->name, ra, rb, p);
-					if (r)
-						break;
-				} else {
-					r = names_match_with_dirs(a->name,
-					    b->name, ra, rb, p, objdir);
-					if (r)
-						break;
-					r = names_match_with_dirs(a->name,
-					    b->name, ra, rb, p, curdir);
-					if (r)
-						break;
-				}
-			}
-		}
-	}
-	free(ra);
-	if (r != rb)
-		free(rb);
-	return r;
+	struct equiv_keys *ka, *kb;
+	unsigned int i, n;
+	Lst l;
+
+	ka = keys_of(a);
+	kb = keys_of(b);
+	if (ka->abs != NULL && kb->abs != NULL)
+		return ka->abs == kb->abs;
+	if (KEY(ka, 0) == KEY(kb, 0) || KEY(ka, 1) == KEY(kb, 1))
+		return true;
+	/* b has necessarily the same one */
+	l = find_suffix_path(a);
+	ka = path_keys(a, l);
+	kb = path_keys(b, l);
+	n = ka->abs != NULL ? kb->n : ka->n;
+	for (i = 2; i < n; i++)
+		if (KEY(ka, i) != NULL && KEY(ka, i) == KEY(kb, i))
+			return true;
+	return false;
 }
 
 static void
 find_siblings(GNode *gn)
 {
 	GNode *gn2;
-	char *fullpath;
 
 	/* not part of an equivalence class: can't alias */
 	if (gn->next == NULL)
@@ -413,8 +389,7 @@ find_siblings(GNode *gn)
 		fprintf(stderr, "Matching for %s:", gn->name);
 	/* look through the aliases */
 	for (gn2 = gn->next; gn2 != gn; gn2 = gn2->next) {
-		fullpath = names_match(gn, gn2);
-		if (fullpath) {
+		if (names_match(gn, gn2)) {
 			attach_node(gn, gn2);
 		} else {
 			if (DEBUG(NAME_MATCHING))
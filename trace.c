@@ -0,0 +1,198 @@
+/*	$OpenBSD$ */
+/*
+ * Copyright (c) 2026 Marc Espie.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE OPENBSD PROJECT AND CONTRIBUTORS
+ * ``AS IS'' AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ * LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR
+ * A PARTICULAR PURPOSE ARE DISCLAIMED.  IN NO EVENT SHALL THE OPENBSD
+ * PROJECT OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+ * SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT
+ * LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+ * DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+ * THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+ * OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include <sys/time.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+#include <unistd.h>
+#include "config.h"
+#include "defines.h"
+#include "trace.h"
+
+static FILE *trace = NULL;
+static pid_t trace_pid;
+static bool first_event = true;
+
+static void Trace_End(void);
+static void put_string(const char *);
+static void put_time(const struct timespec *);
+static void start_event(const char *, const char *, const char *,
+    const struct timespec *);
+
+void
+Trace_Init(void)
+{
+	char name[64];
+
+	if (!DEBUG(TRACE) || trace != NULL)
+		return;
+	trace_pid = getpid();
+	(void)snprintf(name, sizeof name, "make-trace.%ld.json",
+	    (long)trace_pid);
+	trace = fopen(name, "w");
+	if (trace == NULL) {
+		fprintf(stderr, "make: can't write trace to %s\n", name);
+		return;
+	}
+	fputs("[\n", trace);
+	atexit(Trace_End);
+}
+
+static void
+Trace_End(void)
+{
+	/* forked children don't own the file */
+	if (getpid() != trace_pid)
+		return;
+	fputs("\n]\n", trace);
+	fclose(trace);
+	trace = NULL;
+}
+
+/* JSON string, with quotes */
+static void
+put_string(const char *s)
+{
+	putc('"', trace);
+	for (; *s != '\0'; s++) {
+		unsigned char c = *s;
+
+		if (c == '"' || c == '\\')
+			fprintf(trace, "\\%c", c);
+		else if (c == '\n')
+			fputs("\\n", trace);
+		else if (c == '\t')
+			fputs("\\t", trace);
+		else if (c < 0x20)
+			fprintf(trace, "\\u%04x", c);
+		else
+			putc(c, trace);
+	}
+	putc('"', trace);
+}
+
+/* in microseconds */
+static void
+put_time(const struct timespec *ts)
+{
+	fprintf(trace, "%lld.%03ld", (long long)ts->tv_sec * 1000000 +
+	    ts->tv_nsec / 1000, ts->tv_nsec % 1000);
+}
+
+static void
+start_event(const char *ph, const char *cat, const char *name,
+    const struct timespec *ts)
+{
+	struct timespec now;
+
+	if (ts == NULL) {
+		clock_gettime(CLOCK_MONOTONIC, &now);
+		ts = &now;
+	}
+	fputs(first_event ? "" : ",\n", trace);
+	first_event = false;
+	fprintf(trace, "{\"ph\":\"%s\",\"pid\":%ld,\"ts\":", ph,
+	    (long)trace_pid);
+	put_time(ts);
+	if (cat != NULL) {
+		fputs(",\"cat\":", trace);
+		put_string(cat);
+	}
+	fputs(",\"name\":", trace);
+	put_string(name);
+}
+
+void
+trace_begin(const char *cat, const char *name)
+{
+	if (trace == NULL)
+		return;
+	start_event("B", cat, name, NULL);
+	fputs(",\"tid\":0}", trace);
+}
+
+void
+trace_end(void)
+{
+	struct timespec now;
+
+	if (trace == NULL)
+		return;
+	clock_gettime(CLOCK_MONOTONIC, &now);
+	fputs(",\n{\"ph\":\"E\",\"tid\":0,", trace);
+	fprintf(trace, "\"pid\":%ld,\"ts\":", (long)trace_pid);
+	put_time(&now);
+	putc('}', trace);
+}
+
+void
+trace_now(struct timespec *ts)
+{
+	if (trace != NULL)
+		clock_gettime(CLOCK_MONOTONIC, ts);
+}
+
+void
+trace_span(int lane, const struct timespec *start, const char *name,
+    const char *cmd)
+{
+	struct timespec now, d;
+
+	if (trace == NULL)
+		return;
+	clock_gettime(CLOCK_MONOTONIC, &now);
+	timespecsub(&now, start, &d);
+	start_event("X", "job", name, start);
+	fprintf(trace, ",\"tid\":%d,\"dur\":", lane);
+	put_time(&d);
+	if (cmd != NULL) {
+		fputs(",\"args\":{\"cmd\":", trace);
+		put_string(cmd);
+		putc('}', trace);
+	}
+	putc('}', trace);
+}
+
+void
+trace_instant(const char *cat, const char *name, const char *why)
+{
+	if (trace == NULL)
+		return;
+	start_event("i", cat, name, NULL);
+	fputs(",\"tid\":0,\"s\":\"p\",\"args\":{\"why\":", trace);
+	put_string(why);
+	fputs("}}", trace);
+}
+
+void
+trace_counter(const char *name, long value)
+{
+	if (trace == NULL)
+		return;
+	start_event("C", NULL, name, NULL);
+	fprintf(trace, ",\"tid\":0,\"args\":{\"value\":%ld}}", value);
+}
@@ -0,0 +1,65 @@
+#ifndef TRACE_H
+#define TRACE_H
+/*	$OpenBSD$ */
+
+/*
+ * Copyright (c) 2026 Marc Espie.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE OPENBSD PROJECT AND CONTRIBUTORS
+ * ``AS IS'' AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ * LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR
+ * A PARTICULAR PURPOSE ARE DISCLAIMED.  IN NO EVENT SHALL THE OPENBSD
+ * PROJECT OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+ * SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT
+ * LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+ * DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+ * THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+ * OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+/* -dC: timeline of the build, in the trace event format chrome://tracing
+ * and perfetto understand, written to make-trace.<pid>.json.
+ * Timestamps come from the monotonic clock, so the traces of sub-makes
+ * can be loaded alongside.
+ * All functions do nothing unless -dC is active.
+ */
+
+/* Trace_Init();
+ *	open the trace file, if needed. */
+extern void Trace_Init(void);
+
+/* trace_begin(cat, name);
+ *	start a span of work done by make itself. */
+extern void trace_begin(const char *, const char *);
+/* trace_end();
+ *	end the latest span. */
+extern void trace_end(void);
+
+/* trace_now(&ts);
+ *	timestamp for a span that will be reported later. */
+extern void trace_now(struct timespec *);
+/* trace_span(lane, &start, name, cmd);
+ *	report a span that started at start and ends now, on its own lane,
+ *	with the command that ran. */
+extern void trace_span(int, const struct timespec *, const char *,
+    const char *);
+
+/* trace_instant(cat, name, why);
+ *	something happened right now. */
+extern void trace_instant(const char *, const char *, const char *);
+
+/* trace_counter(name, value);
+ *	the value of counter name changed. */
+extern void trace_counter(const char *, long);
+
+#endif
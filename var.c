@@ -67,6 +67,7 @@
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <time.h>
 #include <ohash.h>
 
 #include "config.h"
@@ -82,10 +83,13 @@
 #include "str.h"
 #include "var_int.h"
 #include "memory.h"
+#include "hash.h"
 #include "symtable.h"
 #include "gnode.h"
 #include "dump.h"
 #include "lowparse.h"
+#include "snapshot.h"
+#include "engine.h"
 
 /*
  * This is a harmless return value for Var_Parse that can be used by Var_Subst
@@ -93,6 +97,7 @@
  * a flag, as things outside this module don't give a hoot.
  */
 char	var_Error[] = "";
+char	var_Lazy[] = "";
 
 GNode *current_node = NULL;
 /*
@@ -105,10 +110,62 @@ bool		errorIsOkay;
 static bool	checkEnvFirst;	/* true if environment should be searched for
 				 * variables before the global context */
 
+/* -dx: where expansions spend their time, per global variable name.
+ * Times include nested expansions.  */
+struct var_prof {
+	unsigned long count;
+	unsigned long long bytes;	/* total size of the values produced */
+	unsigned int depth;		/* deepest nesting seen */
+	long long nsec;
+	char name[1];
+};
+
+static struct ohash_info prof_info = {
+	offsetof(struct var_prof, name), NULL,
+	hash_calloc, hash_free, element_alloc
+};
+
+static struct ohash var_profile;
+static bool var_profile_init = false;
+static unsigned int prof_depth = 0;
+
+#define PROFILE_TOP	20
+
+static void prof_start(struct timespec *);
+static void prof_end(int, const char *, const char *, const char *,
+    const struct timespec *);
+static int cmp_prof(const void *, const void *);
+static void Var_DumpProfile(void);
+
+/* Expanded values of global variables are cached, as long as nothing
+ * changes: var_generation is bumped whenever a global variable changes,
+ * volatility whenever an expansion looks at anything else (dynamic
+ * variables, undefined variables, shell commands...).  */
+static unsigned long var_generation = 0;
+
+/* What an expansion changes as it goes lives there.  */
+struct Expansion {
+	unsigned long volatility;
+	bool noexec;		/* for Var_SubstNoExec */
+	unsigned long skipped;	/* ...what it didn't run */
+	unsigned int depth;	/* references being looked at */
+	BUFFER scratch;		/* for Var_Substi */
+};
+static struct Expansion main_expansion;
+static struct Expansion *expansion = &main_expansion;
+
+/* Cached expansions are handed out as is, like raw values.  A nested
+ * expansion may replace a cache while an outer reference still uses it:
+ * old caches wait there until variables get set outside of any
+ * reference.  */
+static char **retired = NULL;
+static size_t n_retired = 0, retired_size = 0;
+
 void
 Var_setCheckEnvFirst(bool yes)
 {
 	checkEnvFirst = yes;
+	var_generation++;
 }
 
 /*
@@ -210,6 +267,22 @@ static bool *tlist = xtlist+1;
 
 static struct ohash global_variables;
 
+/* A copy of the environment, hashed like global_variables, so that
+ * looking for variables that aren't there doesn't scan environ.
+ * Var_Setenv keeps it in sync.  */
+struct env_var {
+	char *value;
+	char name[1];
+};
+
+static struct ohash_info env_info = {
+	offsetof(struct env_var, name), NULL,
+	hash_calloc, hash_free, element_alloc
+};
+
+static struct ohash environment;
+extern char **environ;
+
 
 typedef struct Var_ {
 	BUFFER val;		/* the variable value */
@@ -225,9 +298,19 @@ typedef struct Var_ {
 
 #define POISONS (POISON_NORMAL | POISON_EMPTY | POISON_NOT_DEFINED)
 				/* Defined in var.h */
+	char *cache;		/* fully expanded value... */
+	unsigned long cache_gen;/* ...valid for that var_generation */
 	char name[1];		/* the variable's name */
 }  Var;
 
+/* variables whose !&= command is still running */
+struct pending_var {
+	Var *v;
+	struct pending_cmd *cmd;
+	struct pending_var *next;
+};
+static struct pending_var *pending = NULL;
+
 
 static struct ohash_info var_info = {
 	offsetof(Var, name),
@@ -238,14 +321,18 @@ static struct ohash_info var_info = {
 static int classify_var(const char *, const char **, uint32_t *);
 static Var *find_global_var(const char *, const char *, uint32_t);
 static Var *find_global_var_without_env(const char *, const char *, uint32_t);
-static void fill_from_env(Var *);
+static void fill_from_env(Var *, uint32_t);
+static void snapshot_environ(void);
+static struct env_var *find_env(const char *, const char *, uint32_t, bool);
 static Var *create_var(const char *, const char *);
 static void var_set_initial_value(Var *, const char *);
 static void var_set_value(Var *, const char *);
-#define var_get_value(v)	((v)->flags & VAR_EXEC_LATER ? \
+#define VAR_EXEC_CMD		(VAR_EXEC_LATER|VAR_EXEC_PENDING)
+#define var_get_value(v)	((v)->flags & VAR_EXEC_CMD ? \
 	var_exec_cmd(v) : \
 	Buf_Retrieve(&((v)->val)))
 static char *var_exec_cmd(Var *);
+static struct pending_cmd *take_pending(Var *);
 static void var_append_value(Var *, const char *);
 static void poison_check(Var *);
 static void var_set_append(const char *, const char *, const char *, int, bool);
@@ -261,6 +348,18 @@ typedef const char * (*find_t)(const char *);
 static find_t find_pos(int);
 static void push_used(Var *);
 static void pop_used(Var *);
+static char *compute_lazy(SymTable *, int);
+static char *check_value(char *, int, const char *, const char *, SymTable *,
+    bool, bool *);
+static const char *subst_value(Buffer, const char *, char *, size_t, bool,
+    bool, bool *);
+static void subst_loop(Buffer, const char *, SymTable *, bool, bool *,
+    struct SubstTemplate *);
+static void add_subst_piece(struct SubstTemplate *, const char *,
+    const char *, const char *, const char *);
+static char *expand_global(Var *, const char *, SymTable *, bool, bool *);
+static void retire_cache(Var *);
+static void free_retired(void);
 static char *get_expanded_value(const char *, const char *, int, uint32_t,
     SymTable *, bool, bool *);
 static bool parse_base_variable_name(const char **, struct Name *, SymTable *);
@@ -275,7 +374,7 @@ classify_var(const char *name, const char **enamePtr, uint32_t *pk)
 {
 	size_t len;
 
-	*pk = ohash_interval(name, enamePtr);
+	*pk = hash_interval(name, enamePtr);
 	len = *enamePtr - name;
 	    /* substitute short version for long local name */
 	switch (*pk % MAGICSLOTS1) {	/* MAGICSLOTS should be the    */
@@ -407,7 +506,38 @@ classify_var(const char *name, const char **enamePtr, uint32_t *pk)
 static Var *
 create_var(const char *name, const char *ename)
 {
-	return ohash_create_entry(&var_info, name, &ename);
+	Var *v;
+
+	v = ohash_create_entry(&var_info, name, &ename);
+	v->cache = NULL;
+	return v;
+}
+
+static void
+retire_cache(Var *v)
+{
+	if (v->cache == NULL)
+		return;
+	if (expansion->depth == 0)
+		free(v->cache);
+	else {
+		if (n_retired == retired_size) {
+			retired_size = retired_size == 0 ? 8 : retired_size * 2;
+			retired = ereallocarray(retired, retired_size,
+			    sizeof(char *));
+		}
+		retired[n_retired++] = v->cache;
+	}
+	v->cache = NULL;
+}
+
+static void
+free_retired(void)
+{
+	if (expansion->depth != 0)
+		return;
+	while (n_retired != 0)
+		free(retired[--n_retired]);
 }
 
 /* Initial version of var_set_value(), to be called after create_var().
@@ -417,9 +547,12 @@ var_set_initial_value(Var *v, const char *val)
 {
 	size_t len;
 
+	free_retired();
+
 	len = strlen(val);
 	Buf_Init(&(v->val), len+1);
 	Buf_AddChars(&(v->val), len, val);
+	var_generation++;
 }
 
 /* Normal version of var_set_value(), to be called after variable is fully
@@ -428,9 +561,11 @@ var_set_initial_value(Var *v, const char *val)
 static void
 var_set_value(Var *v, const char *val)
 {
+	free_retired();
 	if ((v->flags & VAR_DUMMY) == 0) {
 		Buf_Reset(&(v->val));
 		Buf_AddString(&(v->val), val);
+		var_generation++;
 	} else {
 		var_set_initial_value(v, val);
 		v->flags &= ~VAR_DUMMY;
@@ -443,9 +578,11 @@ var_set_value(Var *v, const char *val)
 static void
 var_append_value(Var *v, const char *val)
 {
+	free_retired();
 	if ((v->flags & VAR_DUMMY) == 0) {
 		Buf_AddSpace(&(v->val));
 		Buf_AddString(&(v->val), val);
+		var_generation++;
 	} else {
 		var_set_initial_value(v, val);
 		v->flags &= ~VAR_DUMMY;
@@ -458,9 +595,13 @@ var_append_value(Var *v, const char *val)
 static void
 delete_var(Var *v)
 {
+	if (v->flags & VAR_EXEC_PENDING)
+		(void)var_exec_cmd(v);
 	if ((v->flags & VAR_DUMMY) == 0)
 		Buf_Destroy(&(v->val));
+	retire_cache(v);
 	free(v);
+	var_generation++;
 }
 
 
@@ -505,18 +646,70 @@ find_global_var_without_env(const char *name, const char *ename, uint32_t k)
 	return v;
 }
 
+static struct env_var *
+find_env(const char *name, const char *ename, uint32_t k, bool create)
+{
+	struct env_var *e;
+	unsigned int slot;
+
+	slot = ohash_lookup_interval(&environment, name, ename, k);
+	e = ohash_find(&environment, slot);
+	if (e == NULL && create) {
+		e = ohash_create_entry(&env_info, name, &ename);
+		e->value = NULL;
+		ohash_insert(&environment, slot, e);
+	}
+	return e;
+}
+
+static void
+snapshot_environ(void)
+{
+	char **p;
+	const char *eq;
+	struct env_var *e;
+	uint32_t k;
+
+	ohash_init(&environment, 8, &env_info);
+	hash_register(&environment, "environment");
+	for (p = environ; *p != NULL; p++) {
+		eq = strchr(*p, '=');
+		if (eq == NULL)
+			continue;
+		k = hash_interval(*p, &eq);
+		e = find_env(*p, eq, k, true);
+		/* like getenv, the first one wins */
+		if (e->value == NULL)
+			e->value = estrdup(eq+1);
+	}
+}
+
+void
+Var_Setenv(const char *name, const char *value)
+{
+	struct env_var *e;
+	const char *ename = NULL;
+	uint32_t k;
+
+	esetenv(name, value);
+	k = hash_interval(name, &ename);
+	e = find_env(name, ename, k, true);
+	free(e->value);
+	e->value = estrdup(value);
+}
+
 /* Helper for find_global_var(): grab environment value if needed.
  */
 static void
-fill_from_env(Var *v)
+fill_from_env(Var *v, uint32_t k)
 {
-	char	*env;
+	struct env_var *e;
 
-	env = getenv(v->name);
-	if (env == NULL)
+	e = find_env(v->name, strchr(v->name, '\0'), k, false);
+	if (e == NULL || e->value == NULL)
 		v->flags |= VAR_SEEN_ENV;
 	else {
-		var_set_value(v, env);
+		var_set_value(v, e->value);
 		v->flags |= VAR_FROM_ENV | VAR_SEEN_ENV;
 	}
 
@@ -537,7 +730,7 @@ find_global_var(const char *name, const char *ename, uint32_t k)
 	if ((v->flags & VAR_SEEN_ENV) == 0)
 		if ((checkEnvFirst && (v->flags & VAR_FROM_CMD) == 0) ||
 		    (v->flags & VAR_DUMMY) != 0)
-			fill_from_env(v);
+			fill_from_env(v, k);
 
 	return v;
 }
@@ -561,6 +754,15 @@ Var_Mark(const char *name, const char *ename, unsigned int type)
 
 	v = find_global_var(name, ename, k);
 	v->flags |= type;
+	var_generation++;
+	if (type & VAR_EXEC_PENDING) {
+		struct pending_var *p = emalloc(sizeof(struct pending_var));
+
+		p->v = v;
+		p->cmd = Cmd_Start(Buf_Retrieve(&(v->val)));
+		p->next = pending;
+		pending = p;
+	}
 	/* POISON_NORMAL is not lazy: if the variable already exists in
 	 * the Makefile, then it's a mistake.
 	 */
@@ -645,6 +847,9 @@ var_set_append(const char *name, const char *ename, const char *val, int ctxt,
 	}
 
 	v = find_global_var(name, ename, k);
+	/* the old value still has to be reaped */
+	if (v->flags & VAR_EXEC_PENDING)
+		(void)var_exec_cmd(v);
 	if (v->flags & POISON_NORMAL)
 		Parse_Error(PARSE_FATAL, "Trying to %s poisoned variable %s\n",
 		    append ? "append to" : "set", v->name);
@@ -657,7 +862,7 @@ var_set_append(const char *name, const char *ename, const char *val, int ctxt,
 			 * automatically exported to the environment,
 			 * except for SHELL (as per POSIX standard).
 			 */
-			esetenv(v->name, val);
+			Var_Setenv(v->name, val);
 		}
 		if (DEBUG(VAR))
 			printf("command:%s = %s\n", v->name, var_get_value(v));
@@ -687,18 +892,47 @@ Var_Appendi_with_ctxt(const char *name, const char *ename, const char *val,
 static char *
 var_exec_cmd(Var *v)
 {
+	static char nothing[] = "";
 	char *arg = Buf_Retrieve(&(v->val));
 	char *err;
 	char *res1;
-	res1 = Cmd_Exec(arg, &err);
+
+	if (Var_NoExec())
+		return nothing;
+	if (v->flags & VAR_EXEC_PENDING)
+		res1 = Cmd_Finish(take_pending(v), &err);
+	else
+		res1 = Cmd_Exec(arg, &err);
 	if (err)
 		Parse_Error(PARSE_WARNING, err, arg);
 	var_set_value(v, res1);
 	free(res1);
-	v->flags &= ~VAR_EXEC_LATER;
+	v->flags &= ~VAR_EXEC_CMD;
 	return Buf_Retrieve(&(v->val));
 }
 
+static struct pending_cmd *
+take_pending(Var *v)
+{
+	struct pending_var **p, *q;
+	struct pending_cmd *cmd;
+
+	for (p = &pending; (*p)->v != v; p = &(*p)->next)
+		continue;
+	q = *p;
+	*p = q->next;
+	cmd = q->cmd;
+	free(q);
+	return cmd;
+}
+
+void
+Var_FinishPending(void)
+{
+	while (pending != NULL)
+		(void)var_exec_cmd(pending->v);
+}
+
 /* XXX different semantics for Var_Valuei() and Var_Definedi():
  * references to poisoned value variables will error out in Var_Valuei(),
  * but not in Var_Definedi(), so the following construct works:
@@ -763,17 +997,13 @@ Var_Definedi(const char *name, const char *ename)
 static const char *
 find_rparen(const char *p)
 {
-	while (*p != '$' && *p != '\0' && *p != ')' && *p != ':')
-		p++;
-	return p;
+	return p + strcspn(p, "$):");
 }
 
 static const char *
 find_ket(const char *p)
 {
-	while (*p != '$' && *p != '\0' && *p != '}' && *p != ':')
-		p++;
-	return p;
+	return p + strcspn(p, "$}:");
 }
 
 /* Figure out what kind of name we're looking for from a start character.
@@ -907,6 +1137,48 @@ pop_used(Var *v)
 	current_depth--;
 }
 
+/* var_Lazy only ever shows up in a GNode's localvars */
+static char *
+compute_lazy(SymTable *ctxt, int idx)
+{
+	GNode *gn = (GNode *)((char *)ctxt - offsetof(GNode, localvars));
+
+	if (idx >= LOCAL_SIZE)
+		idx = EXTENDED2SIMPLE(idx);
+	ctxt->locals[idx] = Make_ComputeVar(gn, idx);
+	return ctxt->locals[idx];
+}
+
+/* Expand the value of a global variable, and keep the result if it
+ * only depended on global variables that haven't changed since.
+ * Like raw values, the cached value is handed out as is.  */
+static char *
+expand_global(Var *v, const char *val, SymTable *ctxt, bool err,
+    bool *freePtr)
+{
+	unsigned long gen, vol;
+	char *s;
+
+	if (v->cache != NULL && v->cache_gen == var_generation) {
+		COUNT(VAR_HIT);
+		return v->cache;
+	}
+	COUNT(VAR_MISS);
+
+	gen = var_generation;
+	vol = expansion->volatility;
+	push_used(v);
+	s = Var_Subst(val, ctxt, err);
+	pop_used(v);
+	if (gen == var_generation && vol == expansion->volatility) {
+		retire_cache(v);
+		v->cache = s;
+		v->cache_gen = gen;
+	} else
+		*freePtr = true;
+	return s;
+}
+
 static char *
 get_expanded_value(const char *name, const char *ename, int idx, uint32_t k,
     SymTable *ctxt, bool err, bool *freePtr)
@@ -927,24 +1199,25 @@ get_expanded_value(const char *name, const char *ename, int idx, uint32_t k,
 		if (v == NULL)
 			return NULL;
 
-		if ((v->flags & POISONS) != 0)
+		if ((v->flags & POISONS) != 0) {
+			expansion->volatility++;
 			poison_check(v);
+		}
 		if ((v->flags & VAR_DUMMY) != 0)
 			return NULL;
 
 		val = var_get_value(v);
-		if (strchr(val, '$') != NULL) {
-			push_used(v);
-			val = Var_Subst(val, ctxt, err);
-			pop_used(v);
-			*freePtr = true;
-		}
+		if (strchr(val, '$') != NULL)
+			val = expand_global(v, val, ctxt, err, freePtr);
 	} else {
+		expansion->volatility++;
 		if (ctxt != NULL) {
 			if (idx < LOCAL_SIZE)
 				val = ctxt->locals[idx];
 			else
 				val = ctxt->locals[EXTENDED2SIMPLE(idx)];
+			if (val == var_Lazy)
+				val = compute_lazy(ctxt, idx);
 		} else
 			val = NULL;
 		if (val == NULL)
@@ -994,6 +1267,49 @@ bad_dynamic_variable(int idx)
     	}
 }
 
+static void
+prof_start(struct timespec *ts)
+{
+	if (!var_profile_init) {
+		ohash_init(&var_profile, 8, &prof_info);
+		var_profile_init = true;
+		atexit(Var_DumpProfile);
+	}
+	prof_depth++;
+	clock_gettime(CLOCK_MONOTONIC, ts);
+}
+
+static void
+prof_end(int idx, const char *name, const char *ename, const char *val,
+    const struct timespec *start)
+{
+	struct timespec now;
+	struct var_prof *e;
+	unsigned int slot;
+
+	clock_gettime(CLOCK_MONOTONIC, &now);
+	if (idx == GLOBAL_INDEX) {
+		slot = hash_qlookupi(&var_profile, name, &ename);
+		e = ohash_find(&var_profile, slot);
+		if (e == NULL) {
+			e = ohash_create_entry(&prof_info, name, &ename);
+			e->count = 0;
+			e->bytes = 0;
+			e->depth = 0;
+			e->nsec = 0;
+			ohash_insert(&var_profile, slot, e);
+		}
+		e->count++;
+		if (val != NULL)
+			e->bytes += strlen(val);
+		if (prof_depth > e->depth)
+			e->depth = prof_depth;
+		e->nsec += (now.tv_sec - start->tv_sec) * 1000000000LL +
+		    now.tv_nsec - start->tv_nsec;
+	}
+	prof_depth--;
+}
+
 char *
 Var_Parse(const char *str,	/* The string to parse */
     SymTable *ctxt,		/* The context for the variable */
@@ -1007,6 +1323,7 @@ Var_Parse(const char *str,	/* The string to parse */
 	uint32_t k;
 	int idx;
 	bool has_modifier;
+	struct timespec start;
 
 	*freePtr = false;
 
@@ -1015,9 +1332,13 @@ Var_Parse(const char *str,	/* The string to parse */
 	if (str[1] == 0) {
 		*lengthPtr = 1;
 		*freePtr = false;
+		expansion->volatility++;
 		return err ? var_Error : varNoError;
 	}
 
+	if (DEBUG(VARPROF))
+		prof_start(&start);
+	expansion->depth++;
 	has_modifier = parse_base_variable_name(&tstr, &name, ctxt);
 
 	idx = classify_var(name.s, &name.e, &k);
@@ -1026,6 +1347,20 @@ Var_Parse(const char *str,	/* The string to parse */
 		val = VarModifiers_Apply(val, &name, ctxt, err, freePtr,
 		    &tstr, str[1]);
 	}
+	val = check_value(val, idx, str, tstr, ctxt, err, freePtr);
+	expansion->depth--;
+	if (DEBUG(VARPROF))
+		prof_end(idx, name.s, name.e, val, &start);
+	VarName_Free(&name);
+	*lengthPtr = tstr - str;
+	return val;
+}
+
+/* Final touches on the value of the variable reference str/tstr */
+static char *
+check_value(char *val, int idx, const char *str, const char *tstr,
+    SymTable *ctxt, bool err, bool *freePtr)
+{
 	if (val == NULL) {
 		val = err ? var_Error : varNoError;
 		/* If it comes from a dynamic source, and it doesn't have
@@ -1049,22 +1384,94 @@ Var_Parse(const char *str,	/* The string to parse */
 			}
 		}
 	}
-	VarName_Free(&name);
-	*lengthPtr = tstr - str;
+	/* what happens next depends on err and errorIsOkay */
+	if (val == var_Error || val == varNoError)
+		expansion->volatility++;
 	return val;
 }
 
+void
+Var_Volatile(void)
+{
+	expansion->volatility++;
+}
 
-char *
-Var_Subst(const char *str,	/* the string in which to substitute */
-    SymTable *ctxt,		/* the context wherein to find variables */
-    bool undefErr)		/* true if undefineds are an error */
+
+/* Strings that get expanded over and over, like commands, can be cut
+ * into pieces once: literal text, followed by a variable reference.
+ * References without modifiers are looked up directly.  */
+struct SubstPiece {
+	const char *lit;		/* literal text to copy */
+	const char *elit;
+	const char *spec;		/* the reference that follows, or NULL */
+	const char *next;		/* where the string goes on after it */
+	const char *name;		/* simple reference, or NULL */
+	const char *ename;
+	uint32_t k;
+	int idx;
+};
+
+struct SubstTemplate {
+	struct SubstPiece *pieces;
+	size_t n;
+	size_t size;
+	size_t hint;			/* how large expansions get */
+	bool bad;			/* don't use: errors got in the way */
+};
+
+/* Store the value val of the variable reference at str into buf, and
+ * return where the string goes on.  */
+static const char *
+subst_value(Buffer buf, const char *str, char *val, size_t length,
+    bool doFree, bool undefErr, bool *errorReported)
 {
-	BUFFER buf;		/* Buffer for forming things */
-	static bool errorReported;
+	/* When we come down here, val should either point to the
+	 * value of this variable, suitably modified, or be NULL.
+	 * Length should be the total length of the potential
+	 * variable invocation (from $ to end character...) */
+	if (val == var_Error || val == varNoError) {
+		/* If errors are not an issue, skip over the variable
+		 * and continue with the substitution. Otherwise, store
+		 * the dollar sign and advance str so we continue with
+		 * the string...  */
+		if (errorIsOkay)
+			str += length;
+		else if (undefErr) {
+			/* If variable is undefined, complain and
+			 * skip the variable name. The complaint
+			 * will stop us from doing anything when
+			 * the file is parsed.  */
+			if (!*errorReported)
+				Parse_Error(PARSE_FATAL,
+				     "Undefined variable \"%.*s\"",
+				     (int)length, str);
+			str += length;
+			*errorReported = true;
+		} else {
+			Buf_AddChar(buf, *str);
+			str++;
+		}
+	} else {
+		/* We've now got a variable structure to store in.
+		 * But first, advance the string pointer.  */
+		str += length;
 
-	Buf_Init(&buf, MAKE_BSIZE);
-	errorReported = false;
+		/* Copy all the characters from the variable value
+		 * straight into the new string.  */
+		Buf_AddString(buf, val);
+		if (doFree)
+			free(val);
+	}
+	return str;
+}
+
+/* The actual substitution loop.  If t is not NULL, record where the
+ * variable references are, for Var_SubstCompiled.  */
+static void
+subst_loop(Buffer buf, const char *str, SymTable *ctxt, bool undefErr,
+    bool *errorReported, struct SubstTemplate *t)
+{
+	const char *lit = str;
 
 	for (;;) {
 		char *val;	/* Value to substitute for a variable */
@@ -1075,57 +1482,203 @@ Var_Subst(const char *str,	/* the string in which to substitute */
 		/* copy uninteresting stuff */
 		for (cp = str; *str != '\0' && *str != '$'; str++)
 			;
-		Buf_Addi(&buf, cp, str);
+		Buf_Addi(buf, cp, str);
 		if (*str == '\0')
 			break;
 		if (str[1] == '$') {
 			/* A $ may be escaped with another $. */
-			Buf_AddChar(&buf, '$');
+			Buf_AddChar(buf, '$');
+			if (t != NULL)
+				add_subst_piece(t, lit, str+1, NULL, NULL);
 			str += 2;
+			lit = str;
 			continue;
 		}
 		val = Var_Parse(str, ctxt, undefErr, &length, &doFree);
-		/* When we come down here, val should either point to the
-		 * value of this variable, suitably modified, or be NULL.
-		 * Length should be the total length of the potential
-		 * variable invocation (from $ to end character...) */
-		if (val == var_Error || val == varNoError) {
-			/* If errors are not an issue, skip over the variable
-			 * and continue with the substitution. Otherwise, store
-			 * the dollar sign and advance str so we continue with
-			 * the string...  */
-			if (errorIsOkay)
-				str += length;
-			else if (undefErr) {
-				/* If variable is undefined, complain and
-				 * skip the variable name. The complaint
-				 * will stop us from doing anything when
-				 * the file is parsed.  */
-				if (!errorReported)
-					Parse_Error(PARSE_FATAL,
-					     "Undefined variable \"%.*s\"",
-					     (int)length, str);
-				str += length;
-				errorReported = true;
-			} else {
-				Buf_AddChar(&buf, *str);
-				str++;
-			}
-		} else {
-			/* We've now got a variable structure to store in.
-			 * But first, advance the string pointer.  */
-			str += length;
-
-			/* Copy all the characters from the variable value
-			 * straight into the new string.  */
-			Buf_AddString(&buf, val);
-			if (doFree)
-				free(val);
+		cp = str;
+		str = subst_value(buf, str, val, length, doFree, undefErr,
+		    errorReported);
+		if (t != NULL) {
+			/* errors don't always skip the whole reference */
+			if (val == var_Error || val == varNoError)
+				t->bad = true;
+			add_subst_piece(t, lit, cp, cp, str);
 		}
+		lit = str;
 	}
+	if (t != NULL)
+		add_subst_piece(t, lit, str, NULL, NULL);
+}
+
+char *
+Var_Subst(const char *str,	/* the string in which to substitute */
+    SymTable *ctxt,		/* the context wherein to find variables */
+    bool undefErr)		/* true if undefineds are an error */
+{
+	BUFFER buf;		/* Buffer for forming things */
+	bool errorReported = false;
+	static size_t hint = MAKE_BSIZE;
+
+	Buf_Init(&buf, hint);
+	subst_loop(&buf, str, ctxt, undefErr, &errorReported, NULL);
+	Buf_Learn(&buf, &hint);
 	return  Buf_Retrieve(&buf);
 }
 
+static void
+add_subst_piece(struct SubstTemplate *t, const char *lit, const char *elit,
+    const char *spec, const char *next)
+{
+	struct SubstPiece *p;
+
+	if (t->n == t->size) {
+		t->size = t->size == 0 ? 8 : t->size * 2;
+		t->pieces = ereallocarray(t->pieces, t->size,
+		    sizeof(struct SubstPiece));
+	}
+	p = &t->pieces[t->n++];
+	p->lit = lit;
+	p->elit = elit;
+	p->spec = spec;
+	p->next = next;
+	p->name = NULL;
+	if (spec == NULL)
+		return;
+	if (spec[1] != '(' && spec[1] != '{') {
+		p->name = spec+1;
+		p->ename = spec+2;
+	} else if (next[-1] == (spec[1] == '(' ? ')' : '}')) {
+		const char *s;
+
+		for (s = spec+2; s < next-1; s++)
+			if (*s == '$' || *s == ':')
+				return;
+		p->name = spec+2;
+		p->ename = next-1;
+	} else
+		return;
+	p->idx = classify_var(p->name, &p->ename, &p->k);
+}
+
+char *
+Var_SubstCompiled(const char *str, struct SubstTemplate **tp,
+    SymTable *ctxt, bool undefErr)
+{
+	BUFFER buf;
+	bool errorReported = false;
+	struct SubstTemplate *t = *tp;
+	size_t i;
+
+	Buf_Init(&buf, t == NULL ? MAKE_BSIZE : t->hint);
+	if (t == NULL) {
+		t = emalloc(sizeof(*t));
+		t->pieces = NULL;
+		t->n = t->size = 0;
+		t->bad = false;
+		subst_loop(&buf, str, ctxt, undefErr, &errorReported, t);
+		t->hint = 0;
+		Buf_Learn(&buf, &t->hint);
+		*tp = t;
+		return Buf_Retrieve(&buf);
+	}
+	if (t->bad) {
+		subst_loop(&buf, str, ctxt, undefErr, &errorReported, NULL);
+		return Buf_Retrieve(&buf);
+	}
+	for (i = 0; i < t->n; i++) {
+		struct SubstPiece *p = &t->pieces[i];
+		const char *next;
+		size_t length;
+		bool doFree = false;
+		char *val;
+
+		Buf_Addi(&buf, p->lit, p->elit);
+		if (p->spec == NULL)
+			continue;
+		if (p->name != NULL) {
+			struct timespec start;
+
+			if (DEBUG(VARPROF))
+				prof_start(&start);
+			expansion->depth++;
+			val = get_expanded_value(p->name, p->ename, p->idx,
+			    p->k, ctxt, undefErr, &doFree);
+			val = check_value(val, p->idx, p->spec, p->next, ctxt,
+			    undefErr, &doFree);
+			expansion->depth--;
+			if (DEBUG(VARPROF))
+				prof_end(p->idx, p->name, p->ename, val,
+				    &start);
+			length = p->next - p->spec;
+		} else
+			val = Var_Parse(p->spec, ctxt, undefErr, &length,
+			    &doFree);
+		next = subst_value(&buf, p->spec, val, length, doFree,
+		    undefErr, &errorReported);
+		/* this time around, an error stopped short */
+		if (next != p->next) {
+			subst_loop(&buf, next, ctxt, undefErr, &errorReported,
+			    NULL);
+			break;
+		}
+	}
+	Buf_Learn(&buf, &t->hint);
+	return Buf_Retrieve(&buf);
+}
+
+bool
+Var_SubstGlobals(struct SubstTemplate *t, Buffer buf, char local)
+{
+	bool old = expansion->noexec;
+	bool ok = true;
+	size_t i;
+
+	if (t == NULL || t->bad)
+		return false;
+	expansion->noexec = true;
+	for (i = 0; i < t->n; i++) {
+		struct SubstPiece *p = &t->pieces[i];
+		unsigned long vol;
+		bool doFree = false;
+		char *val;
+
+		Buf_Addi(buf, p->lit, p->elit);
+		if (p->spec == NULL)
+			continue;
+		/* modifiers and nested references, too hard */
+		if (p->name == NULL) {
+			ok = false;
+			break;
+		}
+		if (p->idx != GLOBAL_INDEX) {
+			Buf_AddChar(buf, local);
+			continue;
+		}
+		vol = expansion->volatility;
+		expansion->depth++;
+		val = get_expanded_value(p->name, p->ename, p->idx, p->k,
+		    NULL, false, &doFree);
+		expansion->depth--;
+		/* undefined, or the value depends on more than globals */
+		if (val == NULL || vol != expansion->volatility)
+			ok = false;
+		else
+			Buf_AddString(buf, val);
+		if (doFree)
+			free(val);
+		if (!ok)
+			break;
+	}
+	expansion->noexec = old;
+	return ok;
+}
+
+unsigned long
+Var_Generation(void)
+{
+	return var_generation;
+}
+
 /* Very quick version of the variable scanner that just looks for target
  * variables, and never ever errors out
  */
@@ -1171,8 +1724,6 @@ Var_Check_for_target(const char *str)
 	return seen_target;
 }
 
-static BUFFER subst_buffer;
-
 /* we would like to subst on intervals, but it's complicated, so we cheat
  * by storing the interval in a static buffer.
  */
@@ -1183,9 +1734,9 @@ Var_Substi(const char *str, const char *estr, SymTable *ctxt, bool undefErr)
 	if (estr == NULL || *estr == '\0')
 		return Var_Subst(str, ctxt, undefErr);
 
-	Buf_Reset(&subst_buffer);
-	Buf_Addi(&subst_buffer, str, estr);
-	return Var_Subst(Buf_Retrieve(&subst_buffer), ctxt, undefErr);
+	Buf_Reset(&expansion->scratch);
+	Buf_Addi(&expansion->scratch, str, estr);
+	return Var_Subst(Buf_Retrieve(&expansion->scratch), ctxt, undefErr);
 }
 
 /***
@@ -1213,11 +1764,13 @@ Var_NewLoopVar(const char *name, const char *ename)
 	 * value, and make sure the environment cannot touch us.
 	 */
 	/* XXX: should we avoid dynamic variables ? */
-	k = ohash_interval(name, &ename);
+	k = hash_interval(name, &ename);
 
 	l->me = find_global_var_without_env(name, ename, k);
 	l->old = *(l->me);
 	l->me->flags = VAR_SEEN_ENV | VAR_DUMMY;
+	l->me->cache = NULL;
+	var_generation++;
 	return l;
 }
 
@@ -1232,7 +1785,9 @@ Var_DeleteLoopVar(struct LoopVar *l)
 {
 	if ((l->me->flags & VAR_DUMMY) == 0)
 		Buf_Destroy(&(l->me->val));
+	retire_cache(l->me);
 	*(l->me) = l->old;
+	var_generation++;
 	free(l);
 }
 
@@ -1317,6 +1872,168 @@ Var_SubstVar(Buffer buf,	/* To store result */
 	}
 }
 
+/* A loop body, cut into literal text, each followed by a reference to
+ * the loop variable (but the last).  We find out where references with
+ * modifiers end while substituting the first value, so the body is
+ * scanned exactly as Var_SubstVar would.  */
+struct LoopPiece {
+	const char *lit;		/* literal text to copy */
+	const char *elit;
+	const char *mod;		/* modifiers of the reference, or NULL */
+	char paren;
+};
+
+struct LoopTemplate {
+	struct LoopVar *l;
+	const char *text;
+	struct LoopPiece *pieces;
+	size_t n;
+	size_t size;
+	bool compiled;
+};
+
+static void add_piece(struct LoopTemplate *, const char *, const char *,
+    const char *, char);
+static void compile_loop(Buffer, struct LoopTemplate *, const char *);
+static void subst_modifiers(Buffer, struct LoopTemplate *, const char *,
+    const char **, char);
+
+struct LoopTemplate *
+Var_NewLoopTemplate(const char *str, struct LoopVar *l)
+{
+	struct LoopTemplate *t;
+
+	t = emalloc(sizeof(*t));
+	t->l = l;
+	t->text = str;
+	t->pieces = NULL;
+	t->n = t->size = 0;
+	t->compiled = false;
+	return t;
+}
+
+void
+Var_DeleteLoopTemplate(struct LoopTemplate *t)
+{
+	free(t->pieces);
+	free(t);
+}
+
+static void
+add_piece(struct LoopTemplate *t, const char *lit, const char *elit,
+    const char *mod, char paren)
+{
+	if (t->n == t->size) {
+		t->size = t->size == 0 ? 8 : t->size * 2;
+		t->pieces = ereallocarray(t->pieces, t->size,
+		    sizeof(struct LoopPiece));
+	}
+	t->pieces[t->n].lit = lit;
+	t->pieces[t->n].elit = elit;
+	t->pieces[t->n].mod = mod;
+	t->pieces[t->n].paren = paren;
+	t->n++;
+}
+
+static void
+subst_modifiers(Buffer buf, struct LoopTemplate *t, const char *val,
+    const char **p, char paren)
+{
+	bool doFree = false;
+	char *newval;
+	struct Name name;
+
+	name.s = t->l->me->name;
+	name.e = name.s + strlen(name.s);
+	/* see Var_SubstVar */
+	newval = VarModifiers_Apply((char *)val, &name, NULL, false, &doFree,
+	    p, paren);
+	Buf_AddString(buf, newval);
+	if (doFree)
+		free(newval);
+}
+
+/* same scan as Var_SubstVar, keeping track of what we did */
+static void
+compile_loop(Buffer buf, struct LoopTemplate *t, const char *val)
+{
+	const char *var = t->l->me->name;
+	const char *str = t->text;
+	const char *lit = str;
+
+	for (;;) {
+		const char *start;
+
+		for (start = str; *str != '\0' && *str != '$'; str++)
+			;
+		start = str;
+		if (*str++ == '\0')
+			break;
+		str++;
+		if (start[1] == '$')
+			continue;
+		if (start[1] != '(' && start[1] != '{') {
+			if (start[1] != *var || var[1] != '\0')
+				continue;
+			add_piece(t, lit, start, NULL, 0);
+		} else {
+			const char *p;
+			char paren = start[1];
+
+			p = find_pos(paren)(str);
+			if (*p == '$') {
+				str = p;
+				continue;
+			}
+			if (strncmp(var, str, p - str) != 0 ||
+			    var[p - str] != '\0') {
+				str = p;
+				continue;
+			}
+			if (*p == ':') {
+				add_piece(t, lit, start, p, paren);
+				Buf_Addi(buf, lit, start);
+				subst_modifiers(buf, t, val, &p, paren);
+				lit = str = p;
+				continue;
+			}
+			str = p+1;
+			add_piece(t, lit, start, NULL, 0);
+		}
+		Buf_Addi(buf, lit, start);
+		Buf_AddString(buf, val);
+		lit = str;
+	}
+	add_piece(t, lit, str-1, NULL, 0);
+	Buf_Addi(buf, lit, str-1);
+	t->compiled = true;
+}
+
+void
+Var_SubstTemplate(Buffer buf, struct LoopTemplate *t, const char *val)
+{
+	size_t i;
+
+	var_set_value(t->l->me, val);
+	if (!t->compiled) {
+		compile_loop(buf, t, val);
+		return;
+	}
+	for (i = 0; i < t->n; i++) {
+		struct LoopPiece *piece = &t->pieces[i];
+
+		Buf_Addi(buf, piece->lit, piece->elit);
+		if (i == t->n - 1)
+			break;
+		if (piece->mod != NULL) {
+			const char *p = piece->mod;
+
+			subst_modifiers(buf, t, val, &p, piece->paren);
+		} else
+			Buf_AddString(buf, val);
+	}
+}
+
 /***
  ***	Odds and ends
  ***/
@@ -1329,7 +2046,7 @@ set_magic_shell_variable()
 	uint32_t k;
 	Var *v;
 
-	k = ohash_interval(name, &ename);
+	k = hash_interval(name, &ename);
 	v = find_global_var_without_env(name, ename, k);
 	var_set_value(v, _PATH_BSHELL);
 	/* XXX the environment shall never affect it */
@@ -1344,6 +2061,8 @@ void
 Var_Init(void)
 {
 	ohash_init(&global_variables, 10, &var_info);
+	hash_register(&global_variables, "global variables");
+	snapshot_environ();
 	set_magic_shell_variable();
 
 
@@ -1351,7 +2070,33 @@ Var_Init(void)
 	Var_setCheckEnvFirst(false);
 
 	VarModifiers_Init();
-	Buf_Init(&subst_buffer, MAKE_BSIZE);
+	Buf_Init(&main_expansion.scratch, MAKE_BSIZE);
+}
+
+char *
+Var_SubstNoExec(const char *str, SymTable *ctxt, bool *skipped)
+{
+	bool old = expansion->noexec;
+	unsigned long n = expansion->skipped;
+	char *s;
+
+	expansion->noexec = true;
+	s = Var_Subst(str, ctxt, false);
+	expansion->noexec = old;
+	if (skipped != NULL)
+		*skipped = expansion->skipped != n;
+	return s;
+}
+
+bool
+Var_NoExec(void)
+{
+	/* what we skip would be part of the value */
+	if (expansion->noexec) {
+		expansion->volatility++;
+		expansion->skipped++;
+	}
+	return expansion->noexec;
 }
 
 
@@ -1434,6 +2179,38 @@ Var_Dump(void)
 	printf("\n");
 }
 
+static int
+cmp_prof(const void *a, const void *b)
+{
+	const struct var_prof *e1 = *(struct var_prof * const *)a;
+	const struct var_prof *e2 = *(struct var_prof * const *)b;
+
+	if (e1->nsec != e2->nsec)
+		return e1->nsec < e2->nsec ? 1 : -1;
+	return strcmp(e1->name, e2->name);
+}
+
+static void
+Var_DumpProfile(void)
+{
+	struct var_prof *e, **t;
+	unsigned int i, n = 0;
+
+	t = ereallocarray(NULL, ohash_entries(&var_profile), sizeof(*t));
+	for (e = ohash_first(&var_profile, &i); e != NULL;
+	    e = ohash_next(&var_profile, &i))
+		t[n++] = e;
+	qsort(t, n, sizeof(*t), cmp_prof);
+	printf("#%9s %12s %5s %10s  %s\n", "expanded", "bytes", "depth",
+	    "ms", "variable");
+	for (i = 0; i < n && i < PROFILE_TOP; i++)
+		printf("%10lu %12llu %5u %6lld.%03lld  %s\n", t[i]->count,
+		    t[i]->bytes, t[i]->depth, t[i]->nsec / 1000000,
+		    t[i]->nsec / 1000 % 1000, t[i]->name);
+	free(t);
+	VarModifiers_DumpProfile();
+}
+
 static const char *quotable = " \t\n\\'\"";
 
 /* POSIX says that variable assignments passed on the command line should be
@@ -1471,3 +2248,99 @@ Var_AddCmdline(const char *name)
 	Var_Append(name, Buf_Retrieve(&buf));
 	Buf_Destroy(&buf);
 }
+
+/* Snapshots don't bother with variables that are just names, unless
+ * they've been poisoned.  */
+#define saved_var(v) \
+	(((v)->flags & VAR_DUMMY) == 0 || ((v)->flags & POISONS) != 0)
+
+void
+Var_Save(Snapshot *s)
+{
+	Var *v;
+	unsigned int i;
+	unsigned long n = 0;
+
+	for (v = ohash_first(&global_variables, &i); v != NULL;
+	    v = ohash_next(&global_variables, &i))
+		if (saved_var(v))
+			n++;
+	snap_put_int(s, n);
+	for (v = ohash_first(&global_variables, &i); v != NULL;
+	    v = ohash_next(&global_variables, &i)) {
+		if (!saved_var(v))
+			continue;
+		snap_put_string(s, v->name);
+		snap_put_int(s, v->flags & ~VAR_IN_USE);
+		/* not var_get_value: VAR_EXEC_LATER stays that way */
+		snap_put_string(s, v->flags & VAR_DUMMY ? NULL :
+		    Buf_Retrieve(&v->val));
+	}
+}
+
+void
+Var_Restore(Snapshot *s)
+{
+	const char *name, *ename, *val;
+	unsigned long n;
+	unsigned int flags;
+	uint32_t k;
+	Var *v;
+
+	for (n = snap_get_int(s); n > 0; n--) {
+		name = snap_get_string(s);
+		flags = snap_get_int(s);
+		val = snap_get_string(s);
+		if (name == NULL)
+			return;
+		ename = NULL;
+		k = hash_interval(name, &ename);
+		v = find_global_var_without_env(name, ename, k);
+		if (val != NULL)
+			var_set_value(v, val);
+		else if ((v->flags & VAR_DUMMY) == 0)
+			Buf_Destroy(&v->val);
+		v->flags = flags;
+		var_generation++;
+	}
+}
+
+/* The environment variables the parse looked at, and what they were */
+void
+Var_SaveEnv(Snapshot *s)
+{
+	Var *v;
+	unsigned int i;
+	unsigned long n = 0;
+
+	for (v = ohash_first(&global_variables, &i); v != NULL;
+	    v = ohash_next(&global_variables, &i))
+		if ((v->flags & (VAR_SEEN_ENV|VAR_IS_SHELL)) == VAR_SEEN_ENV)
+			n++;
+	snap_put_int(s, n);
+	for (v = ohash_first(&global_variables, &i); v != NULL;
+	    v = ohash_next(&global_variables, &i))
+		if ((v->flags & (VAR_SEEN_ENV|VAR_IS_SHELL)) == VAR_SEEN_ENV) {
+			snap_put_string(s, v->name);
+			snap_put_string(s, getenv(v->name));
+		}
+}
+
+bool
+Var_CheckEnv(Snapshot *s)
+{
+	const char *name, *val, *env;
+	unsigned long n;
+
+	for (n = snap_get_int(s); n > 0; n--) {
+		name = snap_get_string(s);
+		val = snap_get_string(s);
+		if (name == NULL)
+			return false;
+		env = getenv(name);
+		if (env == NULL ? val != NULL :
+		    val == NULL || strcmp(env, val) != 0)
+			return false;
+	}
+	return true;
+}
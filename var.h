@@ -30,6 +30,10 @@ extern GNode *current_node;
 extern void Var_Init(void);
 extern void Var_setCheckEnvFirst(bool);
 
+/* Var_Setenv(name, value);
+ *	setenv(3), in a way that further variable lookups will notice.  */
+extern void Var_Setenv(const char *, const char *);
+
 /* Global variable handling. */
 /* value = Var_Valuei(name, end);
  *	Returns value of global variable name/end, or NULL if inexistent. */
@@ -93,6 +97,9 @@ extern char *Var_Parse(const char *, SymTable *, bool, size_t *,
 /* Note that var_Error is an instance of the empty string "", so that
  * callers who don't care don't need to. */
 extern char	var_Error[];
+/* Dynamic variables that are only computed on demand are set to var_Lazy,
+ * see Make_DoAllVar. */
+extern char	var_Lazy[];
 
 /* ok = Var_ParseSkip(&varspec, ctxt, &ok);
  *	Parses a variable specification and returns true if the varspec
@@ -116,6 +123,39 @@ extern char *Var_Subst(const char *, SymTable *, bool);
  */
 extern char *Var_Substi(const char *, const char *, SymTable *, bool);
 
+/* subst = Var_SubstCompiled(str, &tpl, ctxt, undef_is_bad);
+ *	Same as Var_Subst, for strings that get substituted over and over,
+ *	like commands.  tpl starts out NULL, and remembers where the
+ *	variable references are.  */
+struct SubstTemplate;
+extern char *Var_SubstCompiled(const char *, struct SubstTemplate **,
+    SymTable *, bool);
+
+/* ok = Var_SubstGlobals(tpl, buf, c);
+ *	What Var_SubstCompiled would give for tpl as far as global
+ *	variables go, with each local variable like $@ replaced by c.
+ *	Nothing gets run.  False if that's not enough to tell, because
+ *	of modifiers, or values that depend on more than globals.
+ * gen = Var_Generation();
+ *	Changes whenever some global variable does.  */
+extern bool Var_SubstGlobals(struct SubstTemplate *, Buffer, char);
+extern unsigned long Var_Generation(void);
+
+/* subst = Var_SubstNoExec(str, ctxt, &skipped);
+ *	Same as Var_Subst, except nothing gets run or set along the way:
+ *	shell commands and assignments in modifiers expand to nothing.
+ *	For looking at commands without running them.  skipped, unless
+ *	NULL, tells whether it came to that.
+ * skip = Var_NoExec();
+ *	true if the current expansion should not run or set anything. */
+extern char *Var_SubstNoExec(const char *, SymTable *, bool *);
+extern bool Var_NoExec(void);
+
+/* Var_Volatile();
+ *	the expansion going on depends on more than global variables, and
+ *	must not be cached.  */
+extern void Var_Volatile(void);
+
 /* has_target = Var_Check_for_target(s):
  *	specialized tweak on Var_Subst that reads through a command line
  *	and looks for stuff like $@.
@@ -132,12 +172,23 @@ extern bool Var_Check_for_target(const char *);
  *		Var_SubstVar(buffer, str, handle, val);
  *	// Free handle
  *	Var_DeleteLoopVar(handle);
+ *
+ * When str is always the same, it can be scanned only once:
+ *	tpl = Var_NewLoopTemplate(str, handle);
+ *	for (...)
+ *		Var_SubstTemplate(buffer, tpl, val);
+ *	Var_DeleteLoopTemplate(tpl);
+ * str must stay around until then.
  */
 struct LoopVar;	/* opaque handle */
 struct LoopVar *Var_NewLoopVar(const char *, const char *);
 void Var_DeleteLoopVar(struct LoopVar *);
 extern void Var_SubstVar(Buffer, const char *, struct LoopVar *, const char *);
 char *Var_LoopVarName(struct LoopVar *);
+struct LoopTemplate;	/* opaque handle */
+struct LoopTemplate *Var_NewLoopTemplate(const char *, struct LoopVar *);
+void Var_DeleteLoopTemplate(struct LoopTemplate *);
+extern void Var_SubstTemplate(Buffer, struct LoopTemplate *, const char *);
 
 
 /* Var_Dump();
@@ -149,6 +200,19 @@ extern void Var_Dump(void);
  *	Used to propagate variable values to submakes through MAKEFLAGS.  */
 extern void Var_AddCmdline(const char *);
 
+/* Var_Save(snapshot);
+ *	Save all global variables, with their flags. */
+extern void Var_Save(Snapshot *);
+/* Var_Restore(snapshot);
+ *	Set global variables back to what Var_Save saw. */
+extern void Var_Restore(Snapshot *);
+/* Var_SaveEnv(snapshot);
+ *	Save the environment variables we looked up so far. */
+extern void Var_SaveEnv(Snapshot *);
+/* ok = Var_CheckEnv(snapshot);
+ *	Check they still have the same value. */
+extern bool Var_CheckEnv(Snapshot *);
+
 /* stuff common to var.c and varparse.c */
 extern bool	errorIsOkay;
 
@@ -163,6 +227,11 @@ extern bool	errorIsOkay;
 #define POISON_EMPTY		128
 #define POISON_NOT_DEFINED	256
 #define VAR_EXEC_LATER		512
+#define VAR_EXEC_PENDING	1024
 
 extern void Var_Mark(const char *, const char *, unsigned int);
+/* Var_FinishPending();
+ *	Wait for the commands of all !&= assignments still running.
+ *	Must happen before any job gets started.  */
+extern void Var_FinishPending(void);
 #endif
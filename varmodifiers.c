@@ -69,9 +69,12 @@
 #include <sys/types.h>
 #include <regex.h>
 #include <stddef.h>
+#include <stdint.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <time.h>
+#include <ohash.h>
 #include "config.h"
 #include "defines.h"
 #include "buf.h"
@@ -83,6 +86,7 @@
 #include "str.h"
 #include "cmd_exec.h"
 #include "memory.h"
+#include "hash.h"
 #include "gnode.h"
 
 
@@ -120,7 +124,9 @@ static bool VarSuffix(struct Name *, bool, Buffer, void *);
 static bool VarRoot(struct Name *, bool, Buffer, void *);
 static bool VarMatch(struct Name *, bool, Buffer, void *);
 static bool VarSYSVMatch(struct Name *, bool, Buffer, void *);
+struct uniq_arg;
 static bool VarNoMatch(struct Name *, bool, Buffer, void *);
+static bool seen_before(struct uniq_arg *, const struct Name *);
 static bool VarUniq(struct Name *, bool, Buffer, void *);
 static bool VarLoop(struct Name *, bool, Buffer, void *);
 
@@ -130,28 +136,63 @@ static bool VarRESubstitute(struct Name *, bool, Buffer, void *);
 static char *do_regex(const char *, const struct Name *, void *);
 
 typedef struct {
-	regex_t	  re;
+	regex_t	 *re;
+	const char *literal;	/* or plain string to look for */
+	size_t	  len;
 	int 	  nsub;
 	regmatch_t	 *matches;
 	char	 *replace;
 	int 	  flags;
 } VarREPattern;
 
+/* The same :C patterns come up again and again in commands and loops,
+ * so we keep a few compiled regexps around.  */
+struct re_entry {
+	regex_t re;
+	unsigned long used;	/* last use, oldest gets evicted */
+	char name[1];
+};
+
+#define RE_CACHE_MAX	64
+
+static struct ohash_info re_info = {
+	offsetof(struct re_entry, name), NULL,
+	hash_calloc, hash_free, element_alloc
+};
+
+static struct ohash re_cache;
+static bool re_cache_init = false;
+static unsigned int re_cache_size = 0;
+static unsigned long re_clock = 0;
+
+static regex_t *compile_regex(const char *);
+static void evict_regex(void);
+static int exec_regex(VarREPattern *, const char *);
+
 static bool VarSubstitute(struct Name *, bool, Buffer, void *);
 static char *VarGetPattern(SymTable *, int, const char **, int, int,
     size_t *, VarPattern *);
 static char *VarQuote(const char *, const struct Name *, void *);
 static char *VarModify(char *, bool (*)(struct Name *, bool, Buffer, void *), void *);
+struct fused_stage;
+static void feed_stage(struct fused_stage *, size_t, size_t, struct Name *);
+static char *VarModifyFused(char *, struct fused_stage *, size_t);
+static char *apply_fused(char *, bool *, struct fused_stage *, size_t *);
 
 static void *check_empty(const char **, SymTable *, bool, int);
 static void *check_quote(const char **, SymTable *, bool, int);
+static void *check_sort(const char **, SymTable *, bool, int);
+static void *get_uniqarg(const char **, SymTable *, bool, int);
+static void free_uniqarg(void *);
 static char *do_upper(const char *, const struct Name *, void *);
 static char *do_lower(const char *, const struct Name *, void *);
 static void *check_shcmd(const char **, SymTable *, bool, int);
 static char *do_shcmd(const char *, const struct Name *, void *);
 static char *do_sort(const char *, const struct Name *, void *);
 static char *finish_loop(const char *, const struct Name *, void *);
-static int NameCompare(const void *, const void *);
+static int char_at(const struct Name *, size_t);
+static int compare_from(const struct Name *, const struct Name *, size_t);
+static void sort_names(struct Name *, size_t, size_t);
 static char *do_label(const char *, const struct Name *, void *);
 static char *do_path(const char *, const struct Name *, void *);
 static char *do_def(const char *, const struct Name *, void *);
@@ -163,7 +204,8 @@ static void *assign_get_value(const char **, SymTable *, bool, int);
 static void *get_cmd(const char **, SymTable *, bool, int);
 static void *get_value(const char **, SymTable *, bool, int);
 static void *get_stringarg(const char **, SymTable *, bool, int);
-static void free_stringarg(void *);
+static void *get_globarg(const char **, SymTable *, bool, int);
+static void free_globarg(void *);
 static void *get_patternarg(const char **, SymTable *, bool, int);
 static void *get_spatternarg(const char **, SymTable *, bool, int);
 static void *common_get_patternarg(const char **, SymTable *, bool, int, bool);
@@ -183,8 +225,8 @@ static struct modifier {
 	    bool (*word_apply)(struct Name *, bool, Buffer, void *);
 	    void   (*freearg)(void *);
 } *choose_mod[256],
-	match_mod = {false, get_stringarg, NULL, VarMatch, free_stringarg},
-	nomatch_mod = {false, get_stringarg, NULL, VarNoMatch, free_stringarg},
+	match_mod = {false, get_globarg, NULL, VarMatch, free_globarg},
+	nomatch_mod = {false, get_globarg, NULL, VarNoMatch, free_globarg},
 	subst_mod = {false, get_spatternarg, NULL, VarSubstitute, free_patternarg},
 	resubst_mod = {false, get_patternarg, do_regex, NULL, free_patternarg},
 	quote_mod = {false, check_quote, VarQuote, NULL , free},
@@ -196,8 +238,8 @@ static struct modifier {
 	lower_mod = {false, check_empty, do_lower, NULL, NULL},
 	shcmd_mod = {false, check_shcmd, do_shcmd, NULL, NULL},
 	sysv_mod = {false, get_sysvpattern, NULL, VarSYSVMatch, free_patternarg},
-	uniq_mod = {false, check_empty, NULL, VarUniq, NULL},
-	sort_mod = {false, check_empty, do_sort, NULL, NULL},
+	uniq_mod = {false, get_uniqarg, NULL, VarUniq, free_uniqarg},
+	sort_mod = {false, check_sort, do_sort, NULL, free},
 	loop_mod = {false, get_loop, finish_loop, VarLoop, free_looparg},
 	undef_mod = {true, get_value, do_undef, NULL, NULL},
 	def_mod = {true, get_value, do_def, NULL, NULL},
@@ -207,6 +249,14 @@ static struct modifier {
 	exec_mod = {true, get_cmd, do_exec, NULL, free_patternarg}
 ;
 
+/* -dx: how much each kind of modifier costs, indexed like choose_mod,
+ * with the System V form as '='.  */
+static struct mod_prof {
+	unsigned long count;
+	unsigned long long bytes;
+	long long nsec;
+} mod_profile[256];
+
 void
 VarModifiers_Init()
 {
@@ -348,9 +398,7 @@ static bool
 VarMatch(struct Name *word, bool addSpace, Buffer buf,
     void *pattern) /* Pattern the word must match */
 {
-	const char *pat = pattern;
-
-	if (Str_Matchi(word->s, word->e, pat, strchr(pat, '\0'))) {
+	if (Str_GlobMatchi(pattern, word->s, word->e)) {
 		if (addSpace)
 			Buf_AddSpace(buf);
 		Buf_Addi(buf, word->s, word->e);
@@ -369,9 +417,7 @@ static bool
 VarNoMatch(struct Name *word, bool addSpace, Buffer buf,
     void *pattern) /* Pattern the word must not match */
 {
-	const char *pat = pattern;
-
-	if (!Str_Matchi(word->s, word->e, pat, strchr(pat, '\0'))) {
+	if (!Str_GlobMatchi(pattern, word->s, word->e)) {
 		if (addSpace)
 			Buf_AddSpace(buf);
 		Buf_Addi(buf, word->s, word->e);
@@ -380,21 +426,59 @@ VarNoMatch(struct Name *word, bool addSpace, Buffer buf,
 		return addSpace;
 }
 
+/* :u drops words identical to the previous one, :ua all the words seen
+ * before, which it keeps in an open addressing table.  */
+struct uniq_arg {
+	BUFFER last;		/* a copy: fused stages reuse their buffer */
+	bool has_last;
+	bool all;		/* :ua */
+	struct ohash seen;	/* ...the words so far, with their own copy */
+};
+
+struct seen_word {
+	char name[1];
+};
+
+static struct ohash_info seen_info = {
+	offsetof(struct seen_word, name), NULL,
+	hash_calloc, hash_free, element_alloc
+};
+
+static bool
+seen_before(struct uniq_arg *u, const struct Name *word)
+{
+	const char *e = word->e;
+	unsigned int slot;
+
+	slot = hash_qlookupi(&u->seen, word->s, &e);
+	if (ohash_find(&u->seen, slot) != NULL)
+		return true;
+	ohash_insert(&u->seen, slot,
+	    ohash_create_entry(&seen_info, word->s, &e));
+	return false;
+}
+
 static bool
-VarUniq(struct Name *word, bool addSpace, Buffer buf, void *lastp)
+VarUniq(struct Name *word, bool addSpace, Buffer buf, void *arg)
 {
-	struct Name *last = lastp;
+	struct uniq_arg *u = arg;
+	bool dup;
 
-	/* does not match */
-	if (last->s == NULL || last->e - last->s != word->e - word->s ||
-	    strncmp(word->s, last->s, word->e - word->s) != 0) {
+	if (u->all)
+		dup = seen_before(u, word);
+	else
+		dup = u->has_last &&
+		    Buf_Size(&u->last) == (size_t)(word->e - word->s) &&
+		    memcmp(u->last.buffer, word->s, word->e - word->s) == 0;
+	if (!dup) {
 		if (addSpace)
 			Buf_AddSpace(buf);
 		Buf_Addi(buf, word->s, word->e);
 		addSpace = true;
 	}
-	last->s = word->s;
-	last->e = word->e;
+	Buf_Reset(&u->last);
+	Buf_Addi(&u->last, word->s, word->e);
+	u->has_last = true;
 	return addSpace;
 }
 
@@ -417,39 +501,79 @@ finish_loop(const char *s, const struct Name *n UNUSED , void *p)
 	return Var_Subst(s, NULL,  l->err);
 }
 
+/* :O is a multikey quicksort: words are split three ways on the character
+ * at depth d, and those that share it are only looked at again from d+1.
+ * Short runs go through insertion sort.  The order is the same as
+ * strcmp's, with a word coming before its extensions.  */
+#define SORT_SMALL	10
+
 static int
-NameCompare(const void *ap, const void *bp)
+char_at(const struct Name *w, size_t d)
 {
-	const struct Name *a, *b;
-	size_t n, m;
+	return w->s + d < w->e ? (unsigned char)w->s[d] : -1;
+}
+
+static int
+compare_from(const struct Name *a, const struct Name *b, size_t d)
+{
+	size_t n = a->e - a->s, m = b->e - b->s;
 	int c;
 
-	a = ap;
-	b = bp;
-	n = a->e - a->s;
-	m = b->e - b->s;
-	if (n < m) {
-		c = strncmp(a->s, b->s, n);
-		if (c != 0)
-			return c;
-		else
-			return -1;
-    	} else if (m < n) {
-		c = strncmp(a->s, b->s, m);
-		if (c != 0)
-			return c;
-		else
-			return 1;
-    	} else
-		return strncmp(a->s, b->s, n);
+	c = memcmp(a->s + d, b->s + d, (n < m ? n : m) - d);
+	if (c != 0)
+		return c;
+	return n < m ? -1 : n > m;
+}
+
+static void
+sort_names(struct Name *t, size_t n, size_t d)
+{
+	struct Name tmp;
+	size_t lt, gt, i, j;
+	int pivot, c;
+
+	while (n > SORT_SMALL) {
+		pivot = char_at(&t[n/2], d);
+		/* t[0..lt) < pivot == t[lt..i), t[gt..n) > pivot */
+		lt = i = 0;
+		gt = n;
+		while (i < gt) {
+			c = char_at(&t[i], d);
+			if (c < pivot) {
+				tmp = t[lt];
+				t[lt++] = t[i];
+				t[i++] = tmp;
+			} else if (c > pivot) {
+				tmp = t[--gt];
+				t[gt] = t[i];
+				t[i] = tmp;
+			} else
+				i++;
+		}
+		sort_names(t, lt, d);
+		sort_names(t + gt, n - gt, d);
+		/* all the same word */
+		if (pivot == -1)
+			return;
+		t += lt;
+		n = gt - lt;
+		d++;
+	}
+	for (i = 1; i < n; i++) {
+		tmp = t[i];
+		for (j = i; j > 0 && compare_from(&t[j-1], &tmp, d) > 0; j--)
+			t[j] = t[j-1];
+		t[j] = tmp;
+	}
 }
 
 static char *
-do_sort(const char *s, const struct Name *dummy UNUSED, void *arg UNUSED)
+do_sort(const char *s, const struct Name *dummy UNUSED, void *arg)
 {
 	struct Name *t;
 	unsigned long n, i, j;
 	const char *start, *end;
+	int *unique = arg;
 
 	n = 1024;	/* start at 1024 words */
 	t = ereallocarray(NULL, n, sizeof(struct Name));
@@ -471,9 +595,12 @@ do_sort(const char *s, const struct Name *dummy UNUSED, void *arg UNUSED)
 		BUFFER buf;
 
 		Buf_Init(&buf, end - s);
-		qsort(t, i, sizeof(struct Name), NameCompare);
+		sort_names(t, i, 0);
 		Buf_Addi(&buf, t[0].s, t[0].e);
 		for (j = 1; j < i; j++) {
+			/* :Ou, duplicates are next to each other */
+			if (*unique && compare_from(&t[j-1], &t[j], 0) == 0)
+				continue;
 			Buf_AddSpace(&buf);
 			Buf_Addi(&buf, t[j].s, t[j].e);
 		}
@@ -481,7 +608,7 @@ do_sort(const char *s, const struct Name *dummy UNUSED, void *arg UNUSED)
 		return Buf_Retrieve(&buf);
 	} else {
 		free(t);
-		return "";
+		return estrdup("");
 	}
 }
 
@@ -496,6 +623,8 @@ do_path(const char *s UNUSED, const struct Name *n, void *arg UNUSED)
 {
 	GNode *gn;
 
+	/* the path changes as files get found */
+	Var_Volatile();
 	gn = Targ_FindNodei(n->s, n->e, TARG_NOCREATE);
 	if (gn == NULL)
 		return Str_dupi(n->s, n->e);
@@ -532,6 +661,8 @@ do_assign(const char *s, const struct Name *n, void *arg)
 	char *msg;
 	char *result;
 
+	if (Var_NoExec())
+		return NULL;
 	switch (v->flags) {
 	case VAR_EQUAL:
 		Var_Seti(n->s, n->e, v->lbuffer);
@@ -566,6 +697,8 @@ do_exec(const char *s UNUSED, const struct Name *n UNUSED, void *arg)
 	char *msg;
 	char *result;
 
+	if (Var_NoExec())
+		return estrdup("");
 	result = Cmd_Exec(v->lbuffer, &msg);
 	if (result == NULL)
 		Error(msg, v->lbuffer);
@@ -860,7 +993,7 @@ VarRESubstitute(struct Name *word, bool addSpace, Buffer buf, void *patternp)
 		xrv = REG_NOMATCH;
 	else {
 	tryagain:
-		xrv = regexec(&pat->re, wp, pat->nsub, pat->matches, 0);
+		xrv = exec_regex(pat, wp);
 	}
 
 	switch (xrv) {
@@ -942,7 +1075,7 @@ VarRESubstitute(struct Name *word, bool addSpace, Buffer buf, void *patternp)
 		}
 		break;
 	default:
-		VarREError(xrv, &pat->re, "Unexpected regex error");
+		VarREError(xrv, pat->re, "Unexpected regex error");
 	       /* FALLTHROUGH */
 	case REG_NOMATCH:
 		if (*wp) {
@@ -975,8 +1108,9 @@ VarModify(char *str, 		/* String whose words should be trimmed */
 				     * buffer before adding the trimmed
 				     * word */
 	struct Name	  word;
+	static size_t hint = 0;
 
-	Buf_Init(&buf, 0);
+	Buf_Init(&buf, hint);
 	addSpace = false;
 
 	word.e = str;
@@ -989,9 +1123,124 @@ VarModify(char *str, 		/* String whose words should be trimmed */
 		addSpace = (*modProc)(&word, addSpace, &buf, datum);
 		*((char *)(word.e)) = termc;
 	}
+	Buf_Learn(&buf, &hint);
 	return Buf_Retrieve(&buf);
 }
 
+/* Consecutive word modifiers, as in ${SRCS:M*.c:T:R}, are applied in one
+ * pass: each word goes through the whole chain before we look at the
+ * next one, and only the last stage builds a string.
+ * The outcome of a stage is split into words again for the next one,
+ * which is only safe as long as there are no quotes nor backslashes
+ * around: as soon as a stage produces one, it holds on to the rest of
+ * its output, which gets split as a whole at the end.  */
+#define MAX_FUSED	8
+
+struct fused_stage {
+	struct modifier *mod;
+	void *arg;
+	BUFFER buf;		/* output of that stage */
+	bool addSpace;
+	bool held;		/* keep the output until the end */
+	char space[128];	/* usually enough for one word */
+};
+
+static void
+feed_stage(struct fused_stage *st, size_t i, size_t n, struct Name *word)
+{
+	char *s, *p;
+	struct Name next;
+
+	if (i + 1 == n || st[i].held) {
+		st[i].addSpace = st[i].mod->word_apply(word, st[i].addSpace,
+		    &st[i].buf, st[i].arg);
+		return;
+	}
+	Buf_Reset(&st[i].buf);
+	st[i].addSpace = st[i].mod->word_apply(word, st[i].addSpace,
+	    &st[i].buf, st[i].arg);
+	s = Buf_Retrieve(&st[i].buf);
+	/* same splitting as iterate_words, minus the quotes */
+	for (p = s;;) {
+		while (ISSPACE(*p))
+			p++;
+		if (*p == '\0')
+			return;
+		next.s = p;
+		for (; *p != ' ' && *p != '\t' && *p != '\0'; p++)
+			if (*p == '"' || *p == '\'' || *p == '\\') {
+				size_t len = Buf_Size(&st[i].buf) -
+				    (next.s - s);
+
+				memmove(s, next.s, len);
+				Buf_Truncate(&st[i].buf, len);
+				st[i].held = true;
+				return;
+			}
+		next.e = p;
+		if (*p == '\0') {
+			feed_stage(st, i+1, n, &next);
+			return;
+		}
+		*p = '\0';
+		feed_stage(st, i+1, n, &next);
+		*p++ = ' ';
+	}
+}
+
+static char *
+VarModifyFused(char *str, struct fused_stage *st, size_t n)
+{
+	struct Name word;
+	size_t i;
+
+	/* all stages but the last one usually hold a single word */
+	for (i = 0; i < n; i++) {
+		if (i + 1 == n)
+			Buf_Init(&st[i].buf, 0);
+		else
+			Buf_InitLocal(&st[i].buf, st[i].space,
+			    sizeof(st[i].space));
+		st[i].addSpace = false;
+		st[i].held = false;
+	}
+	for (i = 0; i < n; i++) {
+		word.e = i == 0 ? str : Buf_Retrieve(&st[i-1].buf);
+		if (i != 0 && !st[i-1].held)
+			continue;
+		while ((word.s = iterate_words(&word.e)) != NULL) {
+			char termc;
+
+			termc = *word.e;
+			*((char *)(word.e)) = '\0';
+			feed_stage(st, i, n, &word);
+			*((char *)(word.e)) = termc;
+		}
+	}
+	for (i = 0; i + 1 < n; i++)
+		Buf_Destroy(&st[i].buf);
+	return Buf_Retrieve(&st[n-1].buf);
+}
+
+static char *
+apply_fused(char *str, bool *freePtr, struct fused_stage *st, size_t *n)
+{
+	char *newStr;
+	size_t i;
+
+	if (*n == 0)
+		return str;
+	newStr = VarModifyFused(str, st, *n);
+	for (i = 0; i < *n; i++)
+		if (st[i].mod->freearg != NULL)
+			st[i].mod->freearg(st[i].arg);
+	*n = 0;
+	if (*freePtr)
+		free(str);
+	*freePtr = true;
+	return newStr;
+}
+
 /*-
  *-----------------------------------------------------------------------
  * VarGetPattern --
@@ -1016,8 +1265,9 @@ VarGetPattern(SymTable *ctxt, int err, const char **tstr, int delim1,
 	char	*result;
 	BUFFER	buf;
 	size_t	junk;
+	static size_t hint = 0;
 
-	Buf_Init(&buf, 0);
+	Buf_Init(&buf, hint);
 	if (length == NULL)
 		length = &junk;
 
@@ -1056,6 +1306,7 @@ VarGetPattern(SymTable *ctxt, int err, const char **tstr, int delim1,
 	}
 
 	*length = Buf_Size(&buf);
+	Buf_Learn(&buf, &hint);
 	result = Buf_Retrieve(&buf);
 
 	if (*cp != delim1 && *cp != delim2) {
@@ -1112,6 +1363,61 @@ check_empty(const char **p, SymTable *ctxt UNUSED, bool b UNUSED, int endc)
 		return NULL;
 }
 
+/* :O, or :Ou to also drop duplicates */
+static void *
+check_sort(const char **p, SymTable *ctxt UNUSED, bool b UNUSED, int endc)
+{
+	int *unique;
+	const char *q = *p;
+
+	if (q[1] == 'u')
+		q++;
+	if (q[1] != endc && q[1] != ':')
+		return NULL;
+	unique = emalloc(sizeof(int));
+	*unique = q != *p;
+	*p = q + 1;
+	return unique;
+}
+
+/* :u, or :ua */
+static void *
+get_uniqarg(const char **p, SymTable *ctxt UNUSED, bool b UNUSED, int endc)
+{
+	struct uniq_arg *u;
+	const char *q = *p;
+
+	if (q[1] == 'a')
+		q++;
+	if (q[1] != endc && q[1] != ':')
+		return NULL;
+	u = emalloc(sizeof(struct uniq_arg));
+	Buf_Init(&u->last, 0);
+	u->has_last = false;
+	u->all = q != *p;
+	if (u->all)
+		ohash_init(&u->seen, 6, &seen_info);
+	*p = q + 1;
+	return u;
+}
+
+static void
+free_uniqarg(void *arg)
+{
+	struct uniq_arg *u = arg;
+	struct seen_word *w;
+	unsigned int i;
+
+	if (u->all) {
+		for (w = ohash_first(&u->seen, &i); w != NULL;
+		    w = ohash_next(&u->seen, &i))
+			free(w);
+		ohash_delete(&u->seen);
+	}
+	Buf_Destroy(&u->last);
+	free(u);
+}
+
 static void *
 check_quote(const char **p, SymTable *ctxt UNUSED, bool b UNUSED, int endc)
 {
@@ -1147,6 +1453,8 @@ do_shcmd(const char *s, const struct Name *n UNUSED, void *arg UNUSED)
 	char *err;
 	char *t;
 
+	if (Var_NoExec())
+		return estrdup("");
 	t = Cmd_Exec(s, &err);
 	if (err)
 		Error(err, s);
@@ -1171,10 +1479,25 @@ get_stringarg(const char **p, SymTable *ctxt UNUSED, bool b UNUSED, int endc)
 	return s;
 }
 
+/* :M and :N match every word against the same pattern */
+static void *
+get_globarg(const char **p, SymTable *ctxt, bool b, int endc)
+{
+	char *s;
+	struct Glob *g;
+
+	s = get_stringarg(p, ctxt, b, endc);
+	if (s == NULL)
+		return NULL;
+	g = Str_CompileGlob(s);
+	free(s);
+	return g;
+}
+
 static void
-free_stringarg(void *arg)
+free_globarg(void *arg)
 {
-	free(arg);
+	Str_FreeGlob(arg);
 }
 
 static char *
@@ -1406,20 +1729,90 @@ free_patternarg(void *p)
 	free(vp);
 }
 
+static void
+evict_regex(void)
+{
+	struct re_entry *e, *oldest = NULL;
+	unsigned int i;
+
+	for (e = ohash_first(&re_cache, &i); e != NULL;
+	    e = ohash_next(&re_cache, &i))
+		if (oldest == NULL || e->used < oldest->used)
+			oldest = e;
+	ohash_remove(&re_cache, hash_qlookup(&re_cache, oldest->name));
+	regfree(&oldest->re);
+	free(oldest);
+	re_cache_size--;
+}
+
+static regex_t *
+compile_regex(const char *pattern)
+{
+	struct re_entry *e;
+	unsigned int slot;
+	const char *end = NULL;
+	int error;
+
+	if (!re_cache_init) {
+		ohash_init(&re_cache, 6, &re_info);
+		re_cache_init = true;
+	}
+	slot = hash_qlookupi(&re_cache, pattern, &end);
+	e = ohash_find(&re_cache, slot);
+	if (e == NULL) {
+		e = ohash_create_entry(&re_info, pattern, &end);
+		error = regcomp(&e->re, pattern, REG_EXTENDED);
+		if (error) {
+			VarREError(error, &e->re, "RE substitution error");
+			free(e);
+			return NULL;
+		}
+		if (re_cache_size == RE_CACHE_MAX) {
+			evict_regex();
+			slot = hash_qlookupi(&re_cache, pattern, &end);
+		}
+		ohash_insert(&re_cache, slot, e);
+		re_cache_size++;
+	}
+	e->used = ++re_clock;
+	return &e->re;
+}
+
+static int
+exec_regex(VarREPattern *pat, const char *wp)
+{
+	const char *m;
+
+	if (pat->literal == NULL)
+		return regexec(pat->re, wp, pat->nsub, pat->matches, 0);
+	m = strstr(wp, pat->literal);
+	if (m == NULL)
+		return REG_NOMATCH;
+	pat->matches[0].rm_so = m - wp;
+	pat->matches[0].rm_eo = m - wp + pat->len;
+	return 0;
+}
+
 static char *
 do_regex(const char *s, const struct Name *n UNUSED, void *arg)
 {
 	VarREPattern p2;
 	VarPattern *p = arg;
-	int error;
 	char *result;
 
-	error = regcomp(&p2.re, p->lhs, REG_EXTENDED);
-	if (error) {
-		VarREError(error, &p2.re, "RE substitution error");
-		return var_Error;
+	/* no special characters: it's just a string to look for */
+	if (*p->lhs != '\0' && strpbrk(p->lhs, "^$.[]()|*+?{}\\") == NULL) {
+		p2.re = NULL;
+		p2.literal = p->lhs;
+		p2.len = strlen(p->lhs);
+		p2.nsub = 1;
+	} else {
+		p2.re = compile_regex(p->lhs);
+		if (p2.re == NULL)
+			return var_Error;
+		p2.literal = NULL;
+		p2.nsub = p2.re->re_nsub + 1;
 	}
-	p2.nsub = p2.re.re_nsub + 1;
 	p2.replace = p->rhs;
 	p2.flags = p->flags;
 	if (p2.nsub < 1)
@@ -1428,7 +1821,6 @@ do_regex(const char *s, const struct Name *n UNUSED, void *arg)
 		p2.nsub = 10;
 	p2.matches = ereallocarray(NULL, p2.nsub, sizeof(regmatch_t));
 	result = VarModify((char *)s, VarRESubstitute, &p2);
-	regfree(&p2.re);
 	free(p2.matches);
 	return result;
 }
@@ -1441,6 +1833,8 @@ VarModifiers_Apply(char *str, const struct Name *name, SymTable *ctxt,
 	bool atstart;    /* Some ODE modifiers only make sense at start */
 	char endc = paren == '(' ? ')' : '}';
 	const char *start = *pscan;
+	struct fused_stage chain[MAX_FUSED];
+	size_t nfused = 0;
 
 	tstr = start;
 	/*
@@ -1470,6 +1864,8 @@ VarModifiers_Apply(char *str, const struct Name *name, SymTable *ctxt,
 		struct modifier *mod;
 		void *arg;
 		char *newStr;
+		unsigned char kind;
+		struct timespec begin, now;
 
 		tstr++;
 		if (DEBUG(VAR)) {
@@ -1479,17 +1875,31 @@ VarModifiers_Apply(char *str, const struct Name *name, SymTable *ctxt,
 				printf("Applying :%c\n", *tstr);
 		}
 
-		mod = choose_mod[(unsigned char)*tstr];
+		kind = *tstr;
+		mod = choose_mod[kind];
 		arg = NULL;
 
 		if (mod != NULL && (!mod->atstart || atstart))
 			arg = mod->getarg(&tstr, ctxt, err, endc);
 		if (FEATURES(FEATURE_SYSVVARSUB) && arg == NULL) {
 			mod = &sysv_mod;
+			kind = '=';
 			arg = mod->getarg(&tstr, ctxt, err, endc);
 		}
 		atstart = false;
+		/* debug output wants to see each step */
+		if (arg != NULL && str != NULL && mod->word_apply != NULL &&
+		    mod->apply == NULL && !DEBUG(VAR) && !DEBUG(VARPROF)) {
+			chain[nfused].mod = mod;
+			chain[nfused].arg = arg;
+			if (++nfused == MAX_FUSED)
+				str = apply_fused(str, freePtr, chain, &nfused);
+			continue;
+		}
+		str = apply_fused(str, freePtr, chain, &nfused);
 		if (arg != NULL) {
+			if (DEBUG(VARPROF))
+				clock_gettime(CLOCK_MONOTONIC, &begin);
 			if (str != NULL || (mod->atstart && name != NULL)) {
 				if (mod->word_apply != NULL) {
 					newStr = VarModify(str,
@@ -1512,6 +1922,15 @@ VarModifiers_Apply(char *str, const struct Name *name, SymTable *ctxt,
 				else
 					*freePtr = false;
 			}
+			if (DEBUG(VARPROF)) {
+				clock_gettime(CLOCK_MONOTONIC, &now);
+				mod_profile[kind].count++;
+				if (str != NULL)
+					mod_profile[kind].bytes += strlen(str);
+				mod_profile[kind].nsec +=
+				    (now.tv_sec - begin.tv_sec) * 1000000000LL +
+				    now.tv_nsec - begin.tv_nsec;
+			}
 			if (mod->freearg != NULL)
 				mod->freearg(arg);
 		} else {
@@ -1528,6 +1947,7 @@ VarModifiers_Apply(char *str, const struct Name *name, SymTable *ctxt,
 		if (DEBUG(VAR) && str != NULL)
 			printf("Result is \"%s\"\n", str);
 	}
+	str = apply_fused(str, freePtr, chain, &nfused);
 	if (*tstr == '\0')
 		Parse_Error(PARSE_FATAL, "Unclosed variable specification");
 	else
@@ -1548,3 +1968,17 @@ Var_GetTail(char *s)
 {
 	return VarModify(s, VarTail, NULL);
 }
+
+void
+VarModifiers_DumpProfile(void)
+{
+	int i;
+
+	printf("#%9s %12s %10s  %s\n", "applied", "bytes", "ms", "modifier");
+	for (i = 0; i < 256; i++)
+		if (mod_profile[i].count != 0)
+			printf("%10lu %12llu %6lld.%03lld  :%c\n",
+			    mod_profile[i].count, mod_profile[i].bytes,
+			    mod_profile[i].nsec / 1000000,
+			    mod_profile[i].nsec / 1000 % 1000, i);
+}
@@ -51,6 +51,10 @@ extern void VarModifiers_Init(void);
 extern char *VarModifiers_Apply(char *, const struct Name *, SymTable *,
 	bool, bool *, const char **, int);
 
+/* VarModifiers_DumpProfile();
+ *	Print what each kind of modifier cost, for -dx.  */
+extern void VarModifiers_DumpProfile(void);
+
 /* Direct interface to specific modifiers used under special circumstances. */
 /* tails = Var_GetTail(string);
  *	Returns the tail of list of words in string (needed for SysV locals). */
@@ -0,0 +1,310 @@
+/*	$OpenBSD$ */
+/*
+ * Copyright (c) 2026 Marc Espie.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE OPENBSD PROJECT AND CONTRIBUTORS
+ * ``AS IS'' AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ * LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR
+ * A PARTICULAR PURPOSE ARE DISCLAIMED.  IN NO EVENT SHALL THE OPENBSD
+ * PROJECT OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+ * SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT
+ * LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+ * DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+ * THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+ * OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include <sys/types.h>
+#include <sys/event.h>
+#include <sys/resource.h>
+#include <sys/stat.h>
+#include <sys/wait.h>
+#include <err.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <signal.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <ohash.h>
+#include "config.h"
+#include "defines.h"
+#include "watch.h"
+#include "gnode.h"
+#include "job.h"
+#include "targ.h"
+#include "timestamp.h"
+#include "var.h"
+#include "str.h"
+#include "memory.h"
+
+/* Files are watched through EVFILT_VNODE as long as we have fds to spare,
+ * the rest is polled.
+ */
+
+#define WATCH_REPARSE	3	/* child exit status: makefiles changed */
+#define WATCH_POLL	1	/* seconds between polls */
+#define WATCH_SETTLE	100	/* ms, editors write files in several steps */
+#define WATCH_FD_MAX	1024
+
+struct watched {
+	char *name;
+	bool makefile;
+	bool exists;
+	bool changed;
+	struct timespec mtime;
+	off_t size;
+	int fd;
+};
+
+static struct watched *files;
+static unsigned int nfiles, maxfiles;
+
+static void add_file(const char *, const char *, bool);
+static void collect_files(void);
+static void snapshot(struct watched *);
+static bool has_changed(struct watched *);
+static void watch_files(int);
+static void wait_for_change(int);
+static bool report_changes(void);
+static void forget_files(void);
+
+void
+Watch_Supervise(void)
+{
+	pid_t pid;
+	int status;
+
+	for (;;) {
+		pid = fork();
+		if (pid == -1)
+			err(2, "fork");
+		if (pid == 0)
+			return;
+		/* ^C is for the child, we just follow */
+		(void)signal(SIGINT, SIG_IGN);
+		(void)signal(SIGQUIT, SIG_IGN);
+		while (waitpid(pid, &status, 0) == -1)
+			if (errno != EINTR)
+				err(2, "waitpid");
+		if (WIFEXITED(status) && WEXITSTATUS(status) == WATCH_REPARSE) {
+			(void)signal(SIGINT, SIG_DFL);
+			(void)signal(SIGQUIT, SIG_DFL);
+			continue;
+		}
+		if (WIFSIGNALED(status)) {
+			(void)signal(WTERMSIG(status), SIG_DFL);
+			(void)kill(getpid(), WTERMSIG(status));
+		}
+		exit(WIFEXITED(status) ? WEXITSTATUS(status) : 2);
+	}
+}
+
+static void
+add_file(const char *name, const char *ename, bool makefile)
+{
+	struct watched *w;
+
+	if (nfiles == maxfiles) {
+		maxfiles = maxfiles == 0 ? 64 : 2 * maxfiles;
+		files = ereallocarray(files, maxfiles, sizeof(*files));
+	}
+	w = &files[nfiles++];
+	w->name = Str_dupi(name, ename);
+	w->makefile = makefile;
+	w->fd = -1;
+	w->changed = false;
+	snapshot(w);
+}
+
+/* every file the last build looked at, plus the makefiles */
+static void
+collect_files(void)
+{
+	GNode *gn;
+	unsigned int i;
+	const char *s, *p, *e;
+
+	s = Var_Value("MAKEFILE_LIST");
+	if (s != NULL) {
+		e = s;
+		while ((p = iterate_words(&e)) != NULL)
+			add_file(p, e, true);
+	}
+	for (gn = ohash_first(targets_hash(), &i); gn != NULL;
+	    gn = ohash_next(targets_hash(), &i)) {
+		if (!gn->must_make || gn->special != SPECIAL_NONE)
+			continue;
+		if (gn->type & (OP_PHONY|OP_USE|OP_TRANSFORM|OP_ARCHV|
+		    OP_MEMBER))
+			continue;
+		s = gn->path != NULL ? gn->path : gn->name;
+		add_file(s, strchr(s, '\0'), false);
+	}
+}
+
+static void
+snapshot(struct watched *w)
+{
+	struct stat st;
+
+	w->exists = stat(w->name, &st) == 0;
+	if (w->exists) {
+		ts_set_from_stat(st, w->mtime);
+		w->size = st.st_size;
+	}
+}
+
+static bool
+has_changed(struct watched *w)
+{
+	struct watched old = *w;
+
+	snapshot(w);
+	if (old.exists != w->exists || (w->exists && (w->size != old.size ||
+	    timespeccmp(&w->mtime, &old.mtime, !=))))
+		w->changed = true;
+	return w->changed;
+}
+
+/* use kqueue for as many files as we can, leaving most fds for jobs */
+static void
+watch_files(int kq)
+{
+	struct kevent kev;
+	struct rlimit rl;
+	unsigned int i, budget = 0;
+
+	if (getrlimit(RLIMIT_NOFILE, &rl) == 0)
+		budget = rl.rlim_cur / 4 < WATCH_FD_MAX ?
+		    rl.rlim_cur / 4 : WATCH_FD_MAX;
+	/* the makefiles first, they're the expensive ones */
+	for (i = 0; i < nfiles && budget > 0; i++) {
+		struct watched *w = &files[i];
+
+		if (!w->exists)
+			continue;
+		w->fd = open(w->name, O_RDONLY | O_CLOEXEC);
+		if (w->fd == -1)
+			continue;
+		EV_SET(&kev, w->fd, EVFILT_VNODE, EV_ADD | EV_CLEAR,
+		    NOTE_WRITE | NOTE_EXTEND | NOTE_ATTRIB | NOTE_DELETE |
+		    NOTE_RENAME, 0, w);
+		if (kevent(kq, &kev, 1, NULL, 0, NULL) == -1) {
+			close(w->fd);
+			w->fd = -1;
+			/* no point trying the others */
+			if (errno == EINVAL)
+				break;
+			continue;
+		}
+		budget--;
+	}
+}
+
+static void
+wait_for_change(int kq)
+{
+	struct kevent ev;
+	struct timespec poll, *timeout = NULL;
+	unsigned int i;
+	int n;
+
+	poll.tv_sec = WATCH_POLL;
+	poll.tv_nsec = 0;
+	for (i = 0; i < nfiles; i++)
+		if (files[i].fd == -1)
+			timeout = &poll;
+
+	for (;;) {
+		n = kevent(kq, NULL, 0, &ev, 1, timeout);
+		if (n == -1) {
+			if (errno != EINTR)
+				err(2, "kevent");
+			handle_all_signals();
+			continue;
+		}
+		if (n == 1 && ev.filter == EVFILT_VNODE) {
+			struct watched *w = ev.udata;
+
+			if (ev.fflags & (NOTE_DELETE|NOTE_RENAME))
+				w->changed = true;
+			if (has_changed(w))
+				return;
+			continue;
+		}
+		for (i = 0; i < nfiles; i++)
+			if (files[i].fd == -1 && has_changed(&files[i]))
+				return;
+	}
+}
+
+/* tell the user what we're going to rebuild for */
+static bool
+report_changes(void)
+{
+	struct watched *w;
+	struct timespec settle;
+	bool makefile = false;
+	unsigned int i;
+
+	settle.tv_sec = 0;
+	settle.tv_nsec = WATCH_SETTLE * 1000000L;
+	(void)nanosleep(&settle, NULL);
+	for (i = 0; i < nfiles; i++) {
+		w = &files[i];
+		if (has_changed(w)) {
+			printf("make: %s changed\n", w->name);
+			if (w->makefile)
+				makefile = true;
+		}
+	}
+	fflush(stdout);
+	return makefile;
+}
+
+static void
+forget_files(void)
+{
+	unsigned int i;
+
+	for (i = 0; i < nfiles; i++) {
+		if (files[i].fd >= 0)
+			close(files[i].fd);
+		free(files[i].name);
+	}
+	nfiles = 0;
+}
+
+void
+Watch_Wait(void)
+{
+	int kq;
+	bool makefile;
+
+	collect_files();
+	kq = kqueue();
+	if (kq == -1)
+		err(2, "kqueue");
+	watch_files(kq);
+	printf("make: watching %u files for changes\n", nfiles);
+	fflush(stdout);
+	wait_for_change(kq);
+	makefile = report_changes();
+	forget_files();
+	close(kq);
+	if (makefile)
+		exit(WATCH_REPARSE);
+}